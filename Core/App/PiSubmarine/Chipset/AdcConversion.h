@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstdint>
+
+/// ADC code to engineering unit kernels.
+/// Cortex-M0+ has no hardware divider, so every division by a constant is replaced by a multiplication
+/// with a precomputed reciprocal in Q24 format. The divisor that depends on factory calibration is
+/// turned into a reciprocal once, when TemperatureCalibration is constructed.
+/// The static_asserts below compare the kernels against the plain division formulas for all 4096 codes.
+namespace PiSubmarine::Chipset::AdcConversion
+{
+	constexpr uint32_t AdcMax = (1UL << 12) - 1;
+	constexpr uint64_t AdcRefMicroVolts = 3300000;
+	constexpr uint32_t RailDividerRatio = 2;
+
+	constexpr int64_t TsCal1Celsius = 30;
+	constexpr int64_t TsCal2Celsius = 130;
+	constexpr int64_t ZeroCelsiusMicroKelvins = 273150000;
+
+	/// floor(n / d) == (n * ceil(2^Q / d)) >> Q holds for every n * d < 2^Q. With 12-bit codes and
+	/// 12-bit divisors 2^24 covers all inputs.
+	constexpr uint32_t ReciprocalShift = 24;
+
+	constexpr uint64_t CeilReciprocal(uint64_t numerator, uint64_t divisor)
+	{
+		return ((numerator << ReciprocalShift) + divisor - 1) / divisor;
+	}
+
+	/// Rail voltage behind the 1:2 divider, in microvolts
+	constexpr uint32_t RailMicroVolts(uint16_t code)
+	{
+		constexpr uint64_t multiplier = CeilReciprocal(AdcRefMicroVolts, AdcMax);
+		return static_cast<uint32_t>((code * multiplier) >> ReciprocalShift) * RailDividerRatio;
+	}
+
+	/// Lowest code that RailMicroVolts() converts to at least microVolts, AdcMax if none does. Turns a
+	/// rail threshold into the ADC's own units at compile time, for the analog watchdogs.
+	constexpr uint16_t RailCode(uint32_t microVolts)
+	{
+		uint32_t low = 0;
+		uint32_t high = AdcMax;
+		while (low < high)
+		{
+			uint32_t middle = (low + high) / 2;
+			if (RailMicroVolts(static_cast<uint16_t>(middle)) < microVolts)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+		return static_cast<uint16_t>(low);
+	}
+
+	/// Reference formula, kept for the compile-time cross-check
+	constexpr uint64_t RailMicroVoltsByDivision(uint16_t code)
+	{
+		return AdcRefMicroVolts * code / AdcMax * RailDividerRatio;
+	}
+
+	/// Reference formula, evaluated in 64 bits
+	constexpr int64_t TemperatureMicroKelvinsByDivision(uint16_t code, uint16_t tsCal1, uint16_t tsCal2)
+	{
+		int64_t tsCalTempDelta = TsCal2Celsius - TsCal1Celsius;
+		int64_t tsCalDelta = static_cast<int64_t>(tsCal2) - tsCal1;
+		int64_t tsDataDelta = static_cast<int64_t>(code) - tsCal1;
+		int64_t celsius = tsCalTempDelta * tsDataDelta * 1000000 / tsCalDelta + TsCal1Celsius * 1000000;
+		return celsius + ZeroCelsiusMicroKelvins;
+	}
+
+	/// Internal temperature sensor calibration, with the division by (TS_CAL2 - TS_CAL1) precomputed
+	class TemperatureCalibration
+	{
+	public:
+		/// Calibration codes must already be scaled to the ADC reference voltage in use
+		constexpr TemperatureCalibration(uint16_t tsCal1, uint16_t tsCal2) :
+				m_TsCal1(tsCal1),
+				m_Multiplier(tsCal2 > tsCal1 ? CeilReciprocal((TsCal2Celsius - TsCal1Celsius) * 1000000, tsCal2 - tsCal1) : 0)
+		{
+
+		}
+
+		[[nodiscard]] constexpr bool IsValid() const
+		{
+			return m_Multiplier != 0;
+		}
+
+		[[nodiscard]] constexpr int64_t ToMicroKelvins(uint16_t code) const
+		{
+			// C division truncates toward zero, so the reciprocal is applied to the magnitude
+			bool negative = code < m_TsCal1;
+			uint64_t magnitude = negative ? m_TsCal1 - code : code - m_TsCal1;
+			int64_t delta = static_cast<int64_t>((magnitude * m_Multiplier) >> ReciprocalShift);
+			int64_t celsius = (negative ? -delta : delta) + TsCal1Celsius * 1000000;
+			return celsius + ZeroCelsiusMicroKelvins;
+		}
+
+	private:
+		uint16_t m_TsCal1;
+		uint64_t m_Multiplier;
+	};
+
+	namespace Detail
+	{
+		constexpr bool RailKernelMatches()
+		{
+			for (uint32_t code = 0; code <= AdcMax; code++)
+			{
+				if (RailMicroVolts(static_cast<uint16_t>(code)) != RailMicroVoltsByDivision(static_cast<uint16_t>(code)))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/// RailCode() of every voltage the kernel produces, and of one microvolt more, is the lowest code reaching it
+		constexpr bool RailCodeInvertsKernel()
+		{
+			for (uint32_t code = 0; code < AdcMax; code++)
+			{
+				for (uint32_t extra = 0; extra <= 1; extra++)
+				{
+					uint32_t microVolts = RailMicroVolts(static_cast<uint16_t>(code)) + extra;
+					uint16_t found = RailCode(microVolts);
+					if (RailMicroVolts(found) < microVolts || (found > 0 && RailMicroVolts(static_cast<uint16_t>(found - 1)) >= microVolts))
+					{
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+
+		constexpr bool TemperatureKernelMatches(uint16_t tsCal1, uint16_t tsCal2)
+		{
+			TemperatureCalibration calibration(tsCal1, tsCal2);
+			for (uint32_t code = 0; code <= AdcMax; code++)
+			{
+				auto expected = TemperatureMicroKelvinsByDivision(static_cast<uint16_t>(code), tsCal1, tsCal2);
+				if (calibration.ToMicroKelvins(static_cast<uint16_t>(code)) != expected)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+	}
+
+	static_assert(Detail::RailKernelMatches(), "RailMicroVolts deviates from the division formula");
+	static_assert(Detail::RailCodeInvertsKernel(), "RailCode is not the inverse of RailMicroVolts");
+	// Typical factory values scaled to 3.3 V, plus the extreme divisors
+	static_assert(Detail::TemperatureKernelMatches(1034, 1368), "Temperature kernel deviates from the division formula");
+	static_assert(Detail::TemperatureKernelMatches(0, 1), "Temperature kernel deviates from the division formula");
+	static_assert(Detail::TemperatureKernelMatches(0, AdcMax), "Temperature kernel deviates from the division formula");
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include "main.h"
+#include "adc.h"
+
+// Oversampling is configured in adc.c (ratio 16, shift 4). A build may override it, but the
+// ratio/shift pair must keep 12-bit results, since the conversion code assumes 12-bit codes.
+#if defined(CHIPSET_ADC_OVERSAMPLING_RATIO) != defined(CHIPSET_ADC_OVERSAMPLING_SHIFT)
+#error "CHIPSET_ADC_OVERSAMPLING_RATIO and CHIPSET_ADC_OVERSAMPLING_SHIFT must be defined together"
+#endif
+
+#ifndef CHIPSET_ADC_SAMPLE_PERIOD_MS
+#define CHIPSET_ADC_SAMPLE_PERIOD_MS 50
+#endif
+
+/// Scan period in telemetry mode, a divisor of the sample period. The scans between two samples
+/// only feed the analog watchdogs.
+#ifndef CHIPSET_ADC_SCAN_PERIOD_MS
+#define CHIPSET_ADC_SCAN_PERIOD_MS 5
+#endif
+
+/// Scan period in watchdog mode. One scan of four channels at 16x oversampling and 160.5 cycles
+/// sampling takes about 2.8 ms of the 4 MHz ADC clock.
+#ifndef CHIPSET_ADC_WATCHDOG_PERIOD_MS
+#define CHIPSET_ADC_WATCHDOG_PERIOD_MS 4
+#endif
+
+namespace PiSubmarine::Chipset
+{
+	/// Continuous 4-channel ADC acquisition. TIM6 TRGO triggers one oversampled scan per scan period
+	/// and circular DMA fills a buffer of two sample periods. The CPU only sees the half- and
+	/// full-transfer interrupts, once per sample period, and latches the last scan of the half.
+	/// STM32U031 cannot trigger the ADC from LPTIM, so the basic timer TIM6 is used as the trigger.
+	/// In watchdog mode the DMA interrupts are off: the CPU sleeps through the scans and only the ADC
+	/// analog watchdogs, configured by the owner of the stream, wake it.
+	class AdcStream
+	{
+	public:
+		constexpr static size_t ChannelCount = 4;
+		constexpr static std::chrono::milliseconds SamplePeriod{CHIPSET_ADC_SAMPLE_PERIOD_MS};
+		constexpr static std::chrono::milliseconds ScanPeriod{CHIPSET_ADC_SCAN_PERIOD_MS};
+		constexpr static size_t ScansPerSample = static_cast<size_t>(SamplePeriod / ScanPeriod);
+		static_assert(ScansPerSample > 0 && SamplePeriod % ScanPeriod == std::chrono::milliseconds(0),
+				"The scan period must divide the sample period");
+		constexpr static std::chrono::milliseconds WatchdogSamplePeriod{CHIPSET_ADC_WATCHDOG_PERIOD_MS};
+
+		enum class Mode : uint8_t
+		{
+			/// A scan is latched every sample period
+			Telemetry,
+			/// Scans only feed the analog watchdogs
+			Watchdog
+		};
+
+		AdcStream(ADC_HandleTypeDef &adcHandle, TIM_TypeDef *triggerTimer) : m_AdcHandle(adcHandle), m_TriggerTimer(triggerTimer)
+		{
+
+		}
+
+		bool Start(Mode mode = Mode::Telemetry)
+		{
+			if (m_Running)
+			{
+				return true;
+			}
+
+			if (!m_Calibrated)
+			{
+#if defined(CHIPSET_ADC_OVERSAMPLING_RATIO)
+				m_AdcHandle.Init.Oversampling.Ratio = CHIPSET_ADC_OVERSAMPLING_RATIO;
+				m_AdcHandle.Init.Oversampling.RightBitShift = CHIPSET_ADC_OVERSAMPLING_SHIFT;
+				if (HAL_ADC_Init(&m_AdcHandle) != HAL_OK)
+				{
+					return false;
+				}
+#endif
+				// Calibration survives until the ADC is powered down, so it is done once
+				if (HAL_ADCEx_Calibration_Start(&m_AdcHandle) != HAL_OK)
+				{
+					return false;
+				}
+				m_Calibrated = true;
+			}
+
+			if (HAL_ADC_Start_DMA(&m_AdcHandle, reinterpret_cast<uint32_t*>(m_DmaBuffer.data()), m_DmaBuffer.size()) != HAL_OK)
+			{
+				return false;
+			}
+			if (mode == Mode::Watchdog)
+			{
+				// HAL_ADC_Start_DMA() enables the transfer interrupts. Nothing was transferred before the
+				// first trigger, so the channel may be disabled for the change.
+				DMA_HandleTypeDef *dma = m_AdcHandle.DMA_Handle;
+				__HAL_DMA_DISABLE(dma);
+				__HAL_DMA_DISABLE_IT(dma, DMA_IT_HT | DMA_IT_TC);
+				__HAL_DMA_ENABLE(dma);
+			}
+
+			m_Mode = mode;
+			StartTriggerTimer(mode == Mode::Watchdog ? WatchdogSamplePeriod : ScanPeriod);
+			m_Running = true;
+			return true;
+		}
+
+		void Stop()
+		{
+			Halt();
+			// Stop() precedes STOP mode, which may drop the calibration
+			m_Calibrated = false;
+		}
+
+		/// Stops the scans but keeps the calibration. The analog watchdogs can be reconfigured until
+		/// Start(). Watchdog mode latches the last complete scan, so samples are available before the
+		/// first telemetry period has passed.
+		void Pause()
+		{
+			if (!m_Running)
+			{
+				return;
+			}
+			StopTriggerTimer();
+			if (m_Mode == Mode::Watchdog)
+			{
+				// The DMA counts down the transfers left until the buffer wraps
+				size_t written = m_DmaBuffer.size() - __HAL_DMA_GET_COUNTER(m_AdcHandle.DMA_Handle);
+				size_t scans = written / ChannelCount;
+				Latch(&m_AdcHandle, (scans > 0 ? scans - 1 : BufferScans - 1) * ChannelCount);
+			}
+			Halt();
+		}
+
+		/// ISR side: the first half of the DMA buffer is complete
+		void OnHalfTransfer(ADC_HandleTypeDef *hadc)
+		{
+			m_HalfStart = 0;
+			Latch(hadc, (ScansPerSample - 1) * ChannelCount);
+		}
+
+		/// ISR side: the second half of the DMA buffer is complete
+		void OnTransferComplete(ADC_HandleTypeDef *hadc)
+		{
+			m_HalfStart = ScansPerSample * ChannelCount;
+			Latch(hadc, (BufferScans - 1) * ChannelCount);
+		}
+
+		/// ISR side, after OnHalfTransfer() or OnTransferComplete(): the lowest code of a channel over
+		/// all scans of the completed half, and how many of them were below the threshold
+		uint16_t ScanHalf(size_t channel, uint16_t threshold, size_t &below) const
+		{
+			uint16_t minimum = UINT16_MAX;
+			below = 0;
+			for (size_t offset = m_HalfStart + channel; offset < m_HalfStart + ScansPerSample * ChannelCount; offset += ChannelCount)
+			{
+				uint16_t code = m_DmaBuffer[offset];
+				minimum = std::min(minimum, code);
+				below += code < threshold ? 1 : 0;
+			}
+			return minimum;
+		}
+
+		[[nodiscard]] const std::array<uint16_t, ChannelCount>& GetSamples() const
+		{
+			return m_Samples;
+		}
+
+	private:
+		constexpr static size_t BufferScans = ScansPerSample * 2;
+
+		ADC_HandleTypeDef &m_AdcHandle;
+		TIM_TypeDef *m_TriggerTimer;
+		std::array<uint16_t, ChannelCount * BufferScans> m_DmaBuffer{0};
+		std::array<uint16_t, ChannelCount> m_Samples{0};
+		/// First DMA buffer entry of the half latched last
+		size_t m_HalfStart = 0;
+		bool m_Calibrated = false;
+		bool m_Running = false;
+		Mode m_Mode = Mode::Telemetry;
+
+		void Halt()
+		{
+			StopTriggerTimer();
+			HAL_ADC_Stop_DMA(&m_AdcHandle);
+			m_Running = false;
+		}
+
+		void Latch(ADC_HandleTypeDef *hadc, size_t offset)
+		{
+			if (&m_AdcHandle != hadc)
+			{
+				return;
+			}
+
+			// Copied in the ISR: the DMA rewrites this scan one sample period later
+			for (size_t i = 0; i < ChannelCount; i++)
+			{
+				m_Samples[i] = m_DmaBuffer[offset + i];
+			}
+		}
+
+		void StartTriggerTimer(std::chrono::milliseconds period)
+		{
+			// TIM HAL is not part of this project, the basic timer is simple enough to drive directly
+			__HAL_RCC_TIM6_CLK_ENABLE();
+			uint32_t timerClock = HAL_RCC_GetPCLK1Freq();
+			m_TriggerTimer->CR1 = 0;
+			m_TriggerTimer->PSC = timerClock / 1000 - 1;
+			m_TriggerTimer->ARR = static_cast<uint32_t>(period.count()) - 1;
+			m_TriggerTimer->CR2 = TIM_CR2_MMS_1; // TRGO on update
+			m_TriggerTimer->EGR = TIM_EGR_UG;
+			m_TriggerTimer->SR = 0;
+			m_TriggerTimer->CR1 = TIM_CR1_CEN;
+		}
+
+		void StopTriggerTimer()
+		{
+			m_TriggerTimer->CR1 = 0;
+			__HAL_RCC_TIM6_CLK_DISABLE();
+		}
+	};
+}
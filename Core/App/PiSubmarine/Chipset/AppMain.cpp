@@ -9,23 +9,45 @@
 #include "PiSubmarine/Chipset/Api/Command.h"
 #include "PiSubmarine/Chipset/Api/PacketShutdown.h"
 #include "PiSubmarine/Chipset/Api/PacketSetTime.h"
+#include "PiSubmarine/Chipset/LocalCommand.h"
+#include "PiSubmarine/Chipset/LittleEndian.h"
+#include "PiSubmarine/Chipset/CivilTime.h"
 #include "usart.h"
 #include "i2c.h"
 #include "lptim.h"
+#include <algorithm>
 #include <vector>
-#include <stdio.h>
 #include "adc.h"
 #include "crc.h"
 
 using namespace std::chrono_literals;
-using namespace PiSubmarine::Bq25792;
-using namespace PiSubmarine::RegUtils;
 
 namespace PiSubmarine::Chipset
 {
+	namespace
+	{
+#if CHIPSET_PERSIST_MIRROR
+		/// Placed where the startup code does not zero it, it keeps its value through resets
+		__attribute__((section(".noinit"))) PersistentState::Words PersistentMirror;
+
+		PersistentState::Words* GetPersistentMirror()
+		{
+			return &PersistentMirror;
+		}
+#else
+		PersistentState::Words* GetPersistentMirror()
+		{
+			return nullptr;
+		}
+#endif
+	}
+
 	AppMain *AppMain::Instance = nullptr;
 
-	AppMain::AppMain()
+	// Members are never smaller on a 64-bit host than on the target, so the simulation build checks this too
+	static_assert(sizeof(AppMain) <= CHIPSET_APP_RAM_BYTES, "AppMain exceeds CHIPSET_APP_RAM_BYTES, shrink CHIPSET_HISTORY_BYTES or CHIPSET_LOG_BYTES");
+
+	AppMain::AppMain() : m_Persistent(hrtc, GetPersistentMirror()), m_TemperatureCalibration(ReadTemperatureCalibration())
 	{
 		Instance = this;
 	}
@@ -37,6 +59,11 @@ namespace PiSubmarine::Chipset
 
 	void AppMain::Run()
 	{
+		m_Profiler.Start();
+		m_Clock.Start();
+		StartPersistentState();
+		LogClock();
+		m_WakeupTimer.Start();
 		HAL_LPTIM_PWM_Start(&hlptim2, LPTIM_CHANNEL_1);
 
 		// RPI_SDA_GPIO_Port->PUPDR |= (0b11ULL << (7 * 2));
@@ -69,24 +96,45 @@ namespace PiSubmarine::Chipset
 				TickFullReset();
 				break;
 			case PowerState::WaitForReg12:
+			{
+				ProfileScope scope(m_Profiler, ProfileSlot::TickWaitForReg12);
 				TickWaitForReg12();
 				break;
+			}
 			case PowerState::WaitForReg5:
+			{
+				ProfileScope scope(m_Profiler, ProfileSlot::TickWaitForReg5);
 				TickWaitForReg5();
 				break;
+			}
 			case PowerState::WaitForRegPi:
+			{
+				ProfileScope scope(m_Profiler, ProfileSlot::TickWaitForRegPi);
 				TickWaitForRegPi();
 				break;
+			}
 			case PowerState::Running:
+			{
+				ProfileScope scope(m_Profiler, ProfileSlot::TickRunning);
 				TickRunning();
 				break;
+			}
 			case PowerState::Standby:
+			{
+				ProfileScope scope(m_Profiler, ProfileSlot::TickStandby);
 				TickStandby();
 				break;
 			}
+			}
+
+			DrainEvents();
+			m_Clock.Poll();
+			UpdateUptime();
 
 			if (m_PowerState != powerStateOld)
 			{
+				// Recorded first, EnterStandby() waits out the shutdown delay of the Pi
+				m_Persistent.SetPowerState(static_cast<uint8_t>(m_PowerState));
 				switch (m_PowerState)
 				{
 				case PowerState::FullReset:
@@ -112,20 +160,161 @@ namespace PiSubmarine::Chipset
 		}
 	}
 
-	void AppMain::LpTimCallback(LPTIM_HandleTypeDef *hlptim)
+	void AppMain::LpTimAutoReloadCallback(LPTIM_HandleTypeDef *hlptim)
+	{
+		ProfileScope scope(m_Profiler, ProfileSlot::LptimAutoReload);
+		m_WakeupTimer.OnAutoReloadMatch(hlptim);
+	}
+
+	void AppMain::GpioRisingCallback(uint16_t pin)
+	{
+		ProfileScope scope(m_Profiler, ProfileSlot::GpioRising);
+		switch (pin)
+		{
+		case REG12_PG_Pin:
+			m_Scheduler.Post(Event::Reg12PowerGood);
+			break;
+		case BATCHG_INT_Pin:
+			m_Scheduler.Post(Event::BatchgInt);
+			break;
+		case BUTTON_PWR_Pin:
+			m_Scheduler.Post(Event::ButtonEdge);
+			break;
+		default:
+			break;
+		}
+	}
+
+	void AppMain::GpioFallingCallback(uint16_t pin)
+	{
+		ProfileScope scope(m_Profiler, ProfileSlot::GpioFalling);
+		// Only the button interrupts on both edges. The level is read once it has settled.
+		if (pin == BUTTON_PWR_Pin)
+		{
+			m_Scheduler.Post(Event::ButtonEdge);
+		}
+	}
+
+	void AppMain::RtcAlarmCallback(uint32_t alarm)
+	{
+		ProfileScope scope(m_Profiler, ProfileSlot::RtcAlarm);
+		m_Scheduler.Post(alarm == WakeAlarm ? Event::WakeAlarm : Event::WindowEnd);
+	}
+
+	void AppMain::I2CMasterCompleteCallback(I2C_HandleTypeDef *hi2c)
+	{
+		(void) hi2c;
+		m_Scheduler.Post(Event::I2CComplete);
+	}
+
+	void AppMain::UartTxCompleteCallback(UART_HandleTypeDef *huart)
 	{
-		if (hlptim == &hlptim1)
+		m_Log.OnTransmitComplete(huart);
+		if (huart == &huart1 && m_Log.IsEmpty())
 		{
-			m_Lptim1Expired = true;
-			HAL_LPTIM_TimeOut_Stop_IT(&hlptim1);
+			m_Scheduler.Post(Event::LogDrained);
 		}
 	}
 
+	void AppMain::AdcHalfConvertionCompletedCallback(ADC_HandleTypeDef *hadc)
+	{
+		ProfileScope scope(m_Profiler, ProfileSlot::AdcHalfComplete);
+		m_AdcStream.OnHalfTransfer(hadc);
+		ScanMaskedRails();
+		PushEvent(AppEventType::AdcComplete, Event::AdcComplete);
+	}
+
 	void AppMain::AdcConvertionCompletedCallback(ADC_HandleTypeDef *hadc)
 	{
-		(void) hadc;
-		m_AdcComplete = true;
+		ProfileScope scope(m_Profiler, ProfileSlot::AdcComplete);
+		m_AdcStream.OnTransferComplete(hadc);
+		ScanMaskedRails();
+		PushEvent(AppEventType::AdcComplete, Event::AdcComplete);
+	}
+
+	void AppMain::AdcLevelOutOfWindowCallback(ADC_HandleTypeDef *hadc, uint32_t watchdog)
+	{
+		ProfileScope scope(m_Profiler, ProfileSlot::AdcWatchdog);
+		if (m_RailGuard.IsArmed())
+		{
+			// A sag while running. The result is still in DR: the next channel of the scan takes
+			// about 0.7 ms to convert. The watchdog would fire at every scan of a lasting sag, so it
+			// is masked and ScanMaskedRails() counts the later scans from the DMA buffer.
+			Rail rail = watchdog == Reg5Watchdog ? Rail::Reg5 : Rail::RegPi;
+			uint16_t code = static_cast<uint16_t>(hadc->Instance->DR);
+			__HAL_ADC_DISABLE_IT(hadc, watchdog == Reg5Watchdog ? ADC_IT_AWD2 : ADC_IT_AWD3);
+			if (m_RailGuard.OnSag(rail, code, m_Clock.Now()))
+			{
+				// Past the coalescing window, the Pi may have little time left
+				m_Notifier.Raise(Notify::Fault);
+				m_Notifier.Assert();
+				m_Scheduler.Post(Event::RailFault);
+			}
+			return;
+		}
+
+		// The flag is raised by every scan outside the window, one interrupt per power-up is enough
+		if (watchdog == Reg5Watchdog)
+		{
+			__HAL_ADC_DISABLE_IT(hadc, ADC_IT_AWD2);
+			m_Scheduler.Post(Event::Reg5Good);
+		}
+		else if (watchdog == RegPiWatchdog)
+		{
+			__HAL_ADC_DISABLE_IT(hadc, ADC_IT_AWD3);
+			m_Scheduler.Post(Event::RegPiGood);
+		}
+	}
+
+	void AppMain::PushEvent(AppEventType type, EventMask wakeEvents, uint8_t arg)
+	{
+		// All peripheral IRQs share NVIC priority 0 and never preempt each other,
+		// so the ISRs together form the single producer of m_Events.
+		m_Events.Push(AppEvent { type, arg });
+		m_Scheduler.Post(wakeEvents);
+	}
+
+	void AppMain::DrainEvents()
+	{
+		ProfileScope scope(m_Profiler, ProfileSlot::DrainEvents);
+		AppEvent event;
+		while (m_Events.Pop(event))
+		{
+			switch (event.Type)
+			{
+			case AppEventType::AdcComplete:
+				OnAdcComplete();
+				break;
+			case AppEventType::RpiCommand:
+				OnRpiCommand();
+				break;
+			case AppEventType::RpiListenComplete:
+				CHIPSET_LOG("L");
+				break;
+			case AppEventType::RpiTransmitComplete:
+				CHIPSET_LOG("T");
+				if (event.Arg == TransmitPacketOut)
+				{
+					// Status flags report what happened since the previous read. The charger
+					// state only changes on BATCHG_INT, so it is carried over.
+					m_PacketOut.Status = m_ChargerStatus;
+					PublishPacketOut();
+				}
+				break;
+			case AppEventType::RpiError:
+				CHIPSET_LOG("E");
+				break;
+			}
+		}
+
+		if (m_PacketOutBuffer.IsDeferred() || m_RegisterImage.IsDeferred())
+		{
+			PublishPacketOut();
+		}
+	}
 
+	void AppMain::OnAdcComplete()
+	{
 		uint16_t ballastAdc = GetAdcBallast();
 		m_PacketOut.BallastAdc = Api::Percentage<12>(ballastAdc);
 
@@ -139,10 +328,105 @@ namespace PiSubmarine::Chipset
 		m_PacketOut.ChipsetTemperature = GetTemperature(tempAdc);
 
 		m_PacketOut.Status = m_PacketOut.Status | Api::StatusFlags::AdcValid;
+
+		if (m_PowerState == PowerState::Running)
+		{
+			SampleHistory();
+			PublishPacketOut();
+			PostNotification(Notify::AdcSample);
+		}
+	}
+
+	void AppMain::SampleHistory()
+	{
+		const auto &samples = m_AdcStream.GetSamples();
+		Api::StatusFlags status = m_ChargerStatus | Api::StatusFlags::AdcValid;
+		auto now = m_Scheduler.Now();
+
+		bool record = m_History.IsEmpty() || now - m_LastHistoryTime >= HistoryPeriod || status != m_HistoryStatus;
+		for (size_t i = 0; i < samples.size() && !record; i++)
+		{
+			uint16_t delta = samples[i] > m_HistoryAdc[i] ? samples[i] - m_HistoryAdc[i] : m_HistoryAdc[i] - samples[i];
+			record = delta >= HistoryThresholds[i];
+		}
+		if (!record)
+		{
+			return;
+		}
+
+		TelemetrySample sample;
+		sample.TimestampMs = static_cast<uint64_t>(GetTimestamp().count());
+		sample.BallastAdc = samples[0];
+		sample.Reg5MilliVolts = static_cast<uint16_t>(GetVoltageReg5(samples[1]).Get() / 1000);
+		sample.RegPiMilliVolts = static_cast<uint16_t>(GetVoltageRegPi(samples[2]).Get() / 1000);
+		sample.TemperatureCentiKelvins = static_cast<uint16_t>(GetTemperature(samples[3]).Get() / 10000);
+		sample.Status = static_cast<uint8_t>(status);
+		m_History.Append(sample);
+
+		m_LastHistoryTime = now;
+		m_HistoryAdc = samples;
+		m_HistoryStatus = status;
+	}
+
+	void AppMain::PublishPacketOut()
+	{
+		m_PacketOut.ChipsetTime = GetTimestamp();
+		PublishRegisters();
+
+		uint8_t *buffer = m_PacketOutBuffer.BeginWrite();
+		if (buffer == nullptr)
+		{
+			// The Pi is reading the back copy, DrainEvents() retries once it is released
+			return;
+		}
+
+		PiSubmarine::Chipset::Api::Crc32Func crcFunc = [this](const uint8_t *data, size_t size)
+		{	return Crc32(data, size);};
+		m_PacketOut.Serialize(buffer, m_PacketOutBuffer.GetSize(), crcFunc);
+		m_PacketOutBuffer.Commit();
+	}
+
+	void AppMain::PublishRegisters()
+	{
+		uint8_t *image = m_RegisterImage.BeginWrite();
+		if (image == nullptr)
+		{
+			return;
+		}
+
+		RegisterMap::Values values;
+		values.Status = static_cast<uint8_t>(m_PacketOut.Status);
+		values.PowerState = static_cast<uint8_t>(m_PowerState);
+		values.BallastAdc = GetAdcBallast();
+		values.Reg5MicroVolts = static_cast<uint32_t>(m_PacketOut.Reg5Voltage.Get());
+		values.RegPiMicroVolts = static_cast<uint32_t>(m_PacketOut.RegPiVoltage.Get());
+		values.TemperatureMicroKelvins = static_cast<uint32_t>(m_PacketOut.ChipsetTemperature.Get());
+		values.TimeMs = static_cast<uint64_t>(m_PacketOut.ChipsetTime.count());
+		const PersistentRecord &record = m_Persistent.GetRecord();
+		values.BootCount = record.BootCount;
+		values.ResetCause = static_cast<uint8_t>(m_ResetCause);
+		values.PreviousPowerState = m_Persistent.GetPrevious().PowerState;
+		values.ShutdownReason = static_cast<uint8_t>(record.Shutdown);
+		values.BootFlags = m_BootFlags;
+		values.UptimeSeconds = record.UptimeSeconds;
+		values.SessionSeconds = GetSessionSeconds();
+		values.PreviousSessionSeconds = m_Persistent.GetPrevious().SessionSeconds;
+		values.ResetCounts = record.ResetCounts;
+		RailFault fault = m_RailGuard.GetFault();
+		values.FaultRails = fault.Rails;
+		values.FaultScans = fault.Scans;
+		values.FaultReg5MicroVolts = GetFaultMicroVolts(fault, Rail::Reg5);
+		values.FaultRegPiMicroVolts = GetFaultMicroVolts(fault, Rail::RegPi);
+		values.FaultTimeMs = static_cast<uint64_t>(ToTimestamp(fault.Time).count());
+		values.PendingEvents = m_Notifier.GetPending();
+		values.EventMask = m_Notifier.GetEnabled();
+		RegisterMap::Build(image, values);
+		m_RegisterImage.Commit();
 	}
 
 	void AppMain::I2CAddressCallback(I2C_HandleTypeDef *hi2c, uint8_t TransferDirection, uint16_t AddrMatchCode)
 	{
+		ProfileScope scope(m_Profiler, ProfileSlot::I2CAddress);
 		(void) AddrMatchCode;
 		if (m_PowerState != PowerState::Running)
 		{
@@ -154,30 +438,77 @@ namespace PiSubmarine::Chipset
 			return;
 		}
 
-		HAL_I2C_DisableListen_IT(&hi2c1);
-
 		if (TransferDirection == I2C_DIRECTION_TRANSMIT)
 		{
-			HAL_I2C_Slave_Receive_IT(hi2c, m_RpiReceiveBuffer.data(), m_RpiReceiveBuffer.size());
+			// Sequential reception keeps listen mode, so a STOP before the buffer is full ends the
+			// write through I2CErrorCallback() instead of stretching the master
+			m_RpiReceiving = true;
+			HAL_I2C_Slave_Seq_Receive_IT(hi2c, m_RpiReceiveBuffer.data(), m_RpiReceiveBuffer.size(), I2C_FIRST_AND_LAST_FRAME);
 		}
 		else
 		{
-			PiSubmarine::Chipset::Api::Crc32Func crcFunc = [this](const uint8_t *data, size_t size)
-			{	return Crc32(data, size);};
-			m_PacketOut.ChipsetTime = GetTimestamp();
-			m_PacketOut.Serialize(m_PacketOutSerialized.data(), m_PacketOutSerialized.size(), crcFunc);
+			if (m_RpiReceiving)
+			{
+				// A repeated START ended the write. The handle is still receiving in listen mode, which
+				// only the sequential transmit can take over, so this read is always a register read.
+				OnRpiWriteComplete(static_cast<size_t>(hi2c->pBuffPtr - m_RpiReceiveBuffer.data()));
+				m_RegisterReadPending = true;
+			}
+			if (m_RegisterReadPending)
+			{
+				StartRegisterRead(hi2c);
+				return;
+			}
 
-			// Clear packet data
-			m_PacketOut.ChipsetTime = std::chrono::milliseconds(0);
-			m_PacketOut.Status = Api::StatusFlags { 0 };
+			HAL_I2C_DisableListen_IT(&hi2c1);
+			if (m_ResponseFramePending)
+			{
+				// One-shot answer to a local command
+				m_ResponseFramePending = false;
+				m_ResponseFrameSending = true;
+				HAL_I2C_Slave_Transmit_DMA(&hi2c1, m_ResponseFrame.data(), m_ResponseFrame.size());
+				return;
+			}
 
-			HAL_I2C_Slave_Transmit_DMA(&hi2c1, m_PacketOutSerialized.data(), m_PacketOutSerialized.size());
+			// The packet was serialized and sealed by the main loop, the master is only stretched for the DMA setup
+			const uint8_t *packet = m_PacketOutBuffer.Acquire();
+			if (packet == nullptr)
+			{
+				HAL_I2C_EnableListen_IT(hi2c);
+				return;
+			}
+			HAL_I2C_Slave_Transmit_DMA(&hi2c1, const_cast<uint8_t*>(packet), m_PacketOutBuffer.GetSize());
 		}
 
 	}
 
+	void AppMain::StartRegisterRead(I2C_HandleTypeDef *hi2c)
+	{
+		m_RegisterReadPending = false;
+		const uint8_t *image = m_RegisterImage.Acquire();
+		size_t pointer = m_RegisterPointer;
+		m_RegisterReading = true;
+
+		// Sequential transmit in listen mode: the master NACKs whenever it has read enough, which ends
+		// the read in I2CErrorCallback(), and the address auto-increments up to the end of the map
+		if (pointer == static_cast<size_t>(Register::Events))
+		{
+			// Served live: the mask read is the mask cleared
+			RegisterMap::BuildEvents(m_EventRegister.data(), m_Notifier.Take());
+			HAL_I2C_Slave_Seq_Transmit_DMA(hi2c, m_EventRegister.data(), m_EventRegister.size(), I2C_LAST_FRAME);
+			return;
+		}
+		if (image == nullptr || pointer >= RegisterMap::Size)
+		{
+			HAL_I2C_Slave_Seq_Transmit_DMA(hi2c, m_UnmappedRegister.data(), m_UnmappedRegister.size(), I2C_LAST_FRAME);
+			return;
+		}
+		HAL_I2C_Slave_Seq_Transmit_DMA(hi2c, const_cast<uint8_t*>(image + pointer), RegisterMap::Size - pointer, I2C_LAST_FRAME);
+	}
+
 	void AppMain::I2CListenCompleteCallback(I2C_HandleTypeDef *hi2c)
 	{
+		ProfileScope scope(m_Profiler, ProfileSlot::I2CListenComplete);
 		if (m_PowerState != PowerState::Running)
 		{
 			return;
@@ -188,12 +519,14 @@ namespace PiSubmarine::Chipset
 			return;
 		}
 
+		ReleaseRpiTransmit();
 		HAL_I2C_EnableListen_IT(hi2c);
-		printf("L\n");
+		PushEvent(AppEventType::RpiListenComplete, Event::None);
 	}
 
 	void AppMain::I2CSlaveRxCompleteCallback(I2C_HandleTypeDef *hi2c)
 	{
+		ProfileScope scope(m_Profiler, ProfileSlot::I2CSlaveRxComplete);
 		if (m_PowerState != PowerState::Running)
 		{
 			return;
@@ -204,26 +537,203 @@ namespace PiSubmarine::Chipset
 			return;
 		}
 
-		printf("C: 0x%X\n", m_RpiReceiveBuffer[0]);
-		Api::Command command = static_cast<Api::Command>(m_RpiReceiveBuffer[0]);
-		switch (command)
+		// The buffer is full. Listen mode is still on, the STOP ends in I2CListenCompleteCallback().
+		OnRpiWriteComplete(m_RpiReceiveBuffer.size());
+	}
+
+	void AppMain::OnRpiWriteComplete(size_t size)
+	{
+		m_RpiReceiving = false;
+
+		// A single byte is never a command but an SMBus style register address for the next read
+		if (size == 1)
 		{
-		case Api::Command::SetTime:
-			OnSetTimeCommand();
-			break;
-		case Api::Command::Shutdown:
-			OnShutdownCommand();
-			break;
-		default:
-			break;
+			m_RegisterPointer = m_RpiReceiveBuffer[0];
+			m_RegisterReadPending = true;
+			return;
 		}
 
-		HAL_I2C_EnableListen_IT(hi2c);
+		// Parsing, CRC checking and RTC access happen in the main loop. The copy frees
+		// m_RpiReceiveBuffer for the next write; a command arriving before the previous
+		// one was handled is dropped.
+		if (!m_RpiCommandPending && size > 0)
+		{
+			std::copy_n(m_RpiReceiveBuffer.begin(), size, m_RpiCommandBuffer.begin());
+			m_RpiCommandSize = size;
+			m_RpiCommandPending = true;
+			PushEvent(AppEventType::RpiCommand, Event::RpiCommand);
+		}
+	}
+
+	void AppMain::OnRpiCommand()
+	{
+		CHIPSET_LOG("C: 0x%X", m_RpiCommandBuffer[0]);
+		if (m_RpiCommandBuffer[0] == static_cast<uint8_t>(LocalCommand::Batch))
+		{
+			OnBatchCommand(m_RpiCommandSize);
+		}
+		else
+		{
+			OnSingleCommand(m_RpiCommandSize);
+		}
+		m_RpiCommandPending = false;
+		PostNotification(Notify::CommandComplete);
+	}
+
+	void AppMain::OnSingleCommand(size_t size)
+	{
+		uint8_t command = m_RpiCommandBuffer[0];
+		size_t requestSize = GetRequestSize(command);
+		if (requestSize == 0)
+		{
+			return;
+		}
+
+		// Api packets check their own CRC, local commands are followed by one
+		bool local = command >= FirstLocalCommand;
+		if (size < requestSize + (local ? sizeof(uint32_t) : 0))
+		{
+			CHIPSET_LOG("Cs %lu", static_cast<uint32_t>(size));
+			return;
+		}
+		if (local && !CheckRequestCrc(requestSize))
+		{
+			return;
+		}
+
+		// Local commands answer with a response frame
+		bool respond = local && BeginResponse();
+		size_t responseSize = 0;
+		ExecuteCommand(m_RpiCommandBuffer.data(), requestSize, respond ? m_ResponseFrame.data() : nullptr,
+				ResponseFrameSize - sizeof(uint32_t), responseSize);
+		if (respond)
+		{
+			SealResponse();
+		}
+	}
+
+	void AppMain::OnBatchCommand(size_t size)
+	{
+		if (size < BatchHeaderSize + sizeof(uint32_t))
+		{
+			CHIPSET_LOG("Cs %lu", static_cast<uint32_t>(size));
+			return;
+		}
+		size_t requestSize = BatchHeaderSize + m_RpiCommandBuffer[1];
+		if (size < requestSize + sizeof(uint32_t))
+		{
+			CHIPSET_LOG("Cs %lu", static_cast<uint32_t>(size));
+			return;
+		}
+		if (!CheckRequestCrc(requestSize))
+		{
+			return;
+		}
+
+		// The commands run even if the previous response frame is still being read, only their answers are lost
+		bool respond = BeginResponse();
+		constexpr size_t frameEnd = ResponseFrameSize - sizeof(uint32_t);
+		size_t offset = BatchHeaderSize;
+		uint8_t count = 0;
+
+		uint8_t *entry = &m_RpiCommandBuffer[BatchHeaderSize];
+		uint8_t *end = &m_RpiCommandBuffer[requestSize];
+		while (entry < end)
+		{
+			size_t length = entry[0];
+			uint8_t *request = entry + 1;
+			if (length == 0 || request + length > end)
+			{
+				CHIPSET_LOG("Cs %lu", static_cast<uint32_t>(length));
+				break;
+			}
+			entry = request + length;
+
+			// u8 command, u8 status, u16 length, response
+			bool fits = respond && offset + BatchEntryHeaderSize <= frameEnd;
+			uint8_t *response = fits ? &m_ResponseFrame[offset + BatchEntryHeaderSize] : nullptr;
+			size_t capacity = fits ? frameEnd - offset - BatchEntryHeaderSize : 0;
+			size_t responseSize = 0;
+			CommandStatus status = ExecuteCommand(request, length, response, capacity, responseSize);
+			if (fits)
+			{
+				m_ResponseFrame[offset] = request[0];
+				m_ResponseFrame[offset + 1] = static_cast<uint8_t>(status);
+				LittleEndian::Write16(&m_ResponseFrame[offset + 2], static_cast<uint16_t>(responseSize));
+				offset += BatchEntryHeaderSize + responseSize;
+				count++;
+			}
+		}
+
+		if (respond)
+		{
+			m_ResponseFrame[0] = static_cast<uint8_t>(LocalCommand::Batch);
+			m_ResponseFrame[1] = count;
+			SealResponse();
+		}
+	}
+
+	CommandStatus AppMain::ExecuteCommand(uint8_t *request, size_t size, uint8_t *response, size_t capacity, size_t &responseSize)
+	{
+		responseSize = 0;
+		size_t requestSize = GetRequestSize(request[0]);
+		if (requestSize == 0)
+		{
+			return CommandStatus::Unknown;
+		}
+		if (size != requestSize)
+		{
+			return CommandStatus::Rejected;
+		}
+
+		switch (request[0])
+		{
+		case static_cast<uint8_t>(Api::Command::SetTime):
+			return OnSetTimeCommand(request) ? CommandStatus::Ok : CommandStatus::Rejected;
+		case static_cast<uint8_t>(Api::Command::Shutdown):
+			return OnShutdownCommand(request) ? CommandStatus::Ok : CommandStatus::Rejected;
+		case static_cast<uint8_t>(LocalCommand::ReadHistory):
+			return OnReadHistoryCommand(request, response, capacity, responseSize);
+		case static_cast<uint8_t>(LocalCommand::ReadProfile):
+			return OnReadProfileCommand(request, response, capacity, responseSize);
+		case static_cast<uint8_t>(LocalCommand::ClearRailFault):
+			return OnClearRailFaultCommand(response, capacity, responseSize);
+		case static_cast<uint8_t>(LocalCommand::SetSchedule):
+			return OnSetScheduleCommand(request, response, capacity, responseSize);
+		case static_cast<uint8_t>(LocalCommand::SetEventMask):
+			OnSetEventMaskCommand(request);
+			return CommandStatus::Ok;
+		default:
+			return CommandStatus::Unknown;
+		}
+	}
 
+	size_t AppMain::GetRequestSize(uint8_t command)
+	{
+		switch (command)
+		{
+		case static_cast<uint8_t>(Api::Command::SetTime):
+			return Api::PacketSetTime::Size;
+		case static_cast<uint8_t>(Api::Command::Shutdown):
+			return Api::PacketShutdown::Size;
+		case static_cast<uint8_t>(LocalCommand::ReadHistory):
+			return 1 + 4 + 2;
+		case static_cast<uint8_t>(LocalCommand::ReadProfile):
+			return 1 + 1 + 1;
+		case static_cast<uint8_t>(LocalCommand::ClearRailFault):
+			return 1;
+		case static_cast<uint8_t>(LocalCommand::SetSchedule):
+			return 1 + 1 + WakeSchedule::MaxEntries * WakeSchedule::EntrySize;
+		case static_cast<uint8_t>(LocalCommand::SetEventMask):
+			return 1 + 1;
+		default:
+			return 0;
+		}
 	}
 
 	void AppMain::I2CSlaveTxCompleteCallback(I2C_HandleTypeDef *hi2c)
 	{
+		ProfileScope scope(m_Profiler, ProfileSlot::I2CSlaveTxComplete);
 		if (m_PowerState != PowerState::Running)
 		{
 			return;
@@ -233,12 +743,15 @@ namespace PiSubmarine::Chipset
 		{
 			return;
 		}
+		uint8_t source = m_RegisterReading ? TransmitRegisters : m_ResponseFrameSending ? TransmitResponse : TransmitPacketOut;
+		ReleaseRpiTransmit();
 		HAL_I2C_EnableListen_IT(hi2c);
-		printf("T\n");
+		PushEvent(AppEventType::RpiTransmitComplete, Event::None, source);
 	}
 
 	void AppMain::I2CErrorCallback(I2C_HandleTypeDef *hi2c)
 	{
+		ProfileScope scope(m_Profiler, ProfileSlot::I2CError);
 		if (m_PowerState != PowerState::Running)
 		{
 			return;
@@ -248,8 +761,34 @@ namespace PiSubmarine::Chipset
 		{
 			return;
 		}
+
+		if (m_RpiReceiving && hi2c->ErrorCode == HAL_I2C_ERROR_AF)
+		{
+			// A STOP before the buffer was full, the normal end of a write. HAL follows up with
+			// I2CListenCompleteCallback(), which restarts listening.
+			OnRpiWriteComplete(static_cast<size_t>(hi2c->pBuffPtr - m_RpiReceiveBuffer.data()));
+			return;
+		}
+		if (m_RegisterReading && hi2c->ErrorCode == HAL_I2C_ERROR_AF)
+		{
+			// The master NACKed the last byte it wanted before the end of the map
+			ReleaseRpiTransmit();
+			PushEvent(AppEventType::RpiTransmitComplete, Event::None, TransmitRegisters);
+			return;
+		}
+
+		m_RpiReceiving = false;
+		ReleaseRpiTransmit();
 		HAL_I2C_EnableListen_IT(hi2c);
-		printf("E\n");
+		PushEvent(AppEventType::RpiError, Event::None);
+	}
+
+	void AppMain::ReleaseRpiTransmit()
+	{
+		m_PacketOutBuffer.Release();
+		m_RegisterImage.Release();
+		m_ResponseFrameSending = false;
+		m_RegisterReading = false;
 	}
 
 	I2CDriver& AppMain::GetRpiDriver()
@@ -267,73 +806,113 @@ namespace PiSubmarine::Chipset
 		return m_BatchgI2CDriver;
 	}
 
-	bool AppMain::InitBatteryManagers()
+	CycleProfiler& AppMain::GetProfiler()
 	{
-		// Force-disable regulators
-		HAL_GPIO_WritePin(REG12_EN_GPIO_Port, REG12_EN_Pin, GPIO_PIN_RESET);
-		HAL_GPIO_WritePin(REG5_EN_GPIO_Port, REG5_EN_Pin, GPIO_PIN_RESET);
+		return m_Profiler;
+	}
+
+	UartLog<CHIPSET_LOG_BYTES>& AppMain::GetLog()
+	{
+		return m_Log;
+	}
 
-		WaitFunc delayFunc = [this](std::chrono::milliseconds delay)
-		{	SleepWait(delay);};
+	void AppMain::StartPersistentState()
+	{
+		m_ResetCause = PersistentState::ToResetCause(HAL_RCC_GetResetSource());
+		m_Persistent.Start(m_ResetCause);
+		m_BootTime = m_Clock.Monotonic();
 
-		// Init BATCHG
-		if (!m_Batchg.ReadAndWait(delayFunc))
+		const PersistentRecord &previous = m_Persistent.GetPrevious();
+		switch (m_Persistent.GetSource())
 		{
-			return false;
+		case PersistentState::Source::BackupRegisters:
+			m_BootFlags = BootFlags::StateRestored;
+			break;
+		case PersistentState::Source::Mirror:
+			m_BootFlags = BootFlags::StateRestored | BootFlags::RestoredFromMirror;
+			break;
+		case PersistentState::Source::None:
+			m_BootFlags = 0;
+			break;
+		}
+		if (m_Persistent.GetRecord().Flags & PersistentRecord::ChargerConfiguredFlag)
+		{
+			m_BootFlags |= BootFlags::WarmBoot;
 		}
+		CHIPSET_LOG("B: boot %lu cause %lu flags 0x%lX, was in state %lu for %lu s", m_Persistent.GetRecord().BootCount,
+				static_cast<uint32_t>(m_ResetCause), static_cast<uint32_t>(m_BootFlags), static_cast<uint32_t>(previous.PowerState),
+				previous.SessionSeconds);
+	}
+
+	void AppMain::UpdateUptime()
+	{
+		m_Persistent.SetSessionSeconds(GetSessionSeconds());
+	}
+
+	uint32_t AppMain::GetSessionSeconds() const
+	{
+		// The RTC keeps counting in STOP, where the LPTIM based scheduler clock is suspended
+		return static_cast<uint32_t>(std::chrono::floor<std::chrono::seconds>(m_Clock.Monotonic() - m_BootTime).count());
+	}
+
+	bool AppMain::InitBatteryManagers()
+	{
+		// Force-disable regulators
+		HAL_GPIO_WritePin(REG12_EN_GPIO_Port, REG12_EN_Pin, GPIO_PIN_RESET);
+		HAL_GPIO_WritePin(REG5_EN_GPIO_Port, REG5_EN_Pin, GPIO_PIN_RESET);
 
-		m_Batchg.SetChargeCurrentLimit(PiSubmarine::Bq25792::MilliAmperes(3000));
-		m_Batchg.SetTsIgnore(true);
-		m_Batchg.SetWatchdog(PiSubmarine::Bq25792::Watchdog::Disable);
-		// m_Batchg.SetAdcEnabled(true);
-		m_Batchg.SetDischargeOcpEnabled(true);
-		// m_Batchg.SetDischargeCurrentSensingEnabled(true);
-		m_Batchg.SetIlimHizCurrentLimitEnabled(false);
-		m_Batchg.SetAutomaticDpDmDetectionEnabled(false);
-		if (!m_Batchg.WriteDirty())
+		if (m_BootFlags & BootFlags::WarmBoot)
 		{
-			return false;
+			// Only the MCU was reset. The charger kept the configuration of an earlier boot if it answers
+			// and its registers still hold the settings, the brownout that reset the MCU may have reset it too.
+			m_Scheduler.Clear(Event::ChargerStatus);
+			if (m_ChargerMonitor.RequestRefresh(AllVolatilityClasses) && WaitForCharger() && m_ChargerMonitor.IsValid())
+			{
+				if (m_ChargerMonitor.HoldsConfiguration())
+				{
+					return true;
+				}
+				CHIPSET_LOG("B: charger lost its configuration, configuring it again");
+			}
+			else
+			{
+				CHIPSET_LOG("B: charger did not answer, configuring it again");
+			}
+			m_BootFlags = static_cast<uint8_t>(m_BootFlags & ~BootFlags::WarmBoot);
+			m_Persistent.SetFlags(static_cast<uint8_t>(m_Persistent.GetRecord().Flags & ~PersistentRecord::ChargerConfiguredFlag));
 		}
 
-		if (!m_Batchg.WaitForTransaction(delayFunc))
+		// Init BATCHG. The configuration is read into the charger cache and only the registers
+		// the settings change are written back.
+		m_Scheduler.Clear(Event::ChargerStatus);
+		if (!m_ChargerMonitor.RequestConfigure() || !WaitForCharger() || !m_ChargerMonitor.IsConfigured())
 		{
 			return false;
 		}
 
+		// The only full read of the register map until the slow background refresh
+		RefreshCharger(AllVolatilityClasses);
+		m_Persistent.SetFlags(static_cast<uint8_t>(m_Persistent.GetRecord().Flags | PersistentRecord::ChargerConfiguredFlag));
 		return true;
 	}
 
-	void AppMain::SleepWait(std::chrono::milliseconds delay, bool interruptable)
+	void AppMain::SleepWait(std::chrono::milliseconds delay)
 	{
-		if (delay.count() == 0)
-		{
-			return;
-		}
-
-		HAL_SuspendTick();
-
-		// One LPTIM tick is exactly 1ms
-		uint32_t timeoutTicks = static_cast<uint32_t>(delay.count());
-
-		m_Lptim1Expired = false;
-		HAL_LPTIM_TimeOut_Start_IT(&hlptim1, timeoutTicks);
-		__HAL_LPTIM_CLEAR_FLAG(&hlptim1, LPTIM_FLAG_ARRM);
+		m_Scheduler.Sleep(delay);
+	}
 
-		if (interruptable)
-		{
-			HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
-			HAL_LPTIM_TimeOut_Stop_IT(&hlptim1);
-		}
-		else
+	bool AppMain::WaitForCharger()
+	{
+		for (uint32_t poll = 0; poll < ChargerWaitPolls; poll++)
 		{
-			while (!m_Lptim1Expired)
+			// Returns as soon as the cache is done instead of sleeping the whole poll
+			if (m_Scheduler.WaitFor(Event::ChargerStatus, ChargerWaitPoll) != Event::None)
 			{
-				HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
+				return true;
 			}
-			m_Lptim1Expired = false;
+			m_BatchgI2CDriver.CheckTimeouts();
 		}
-
-		HAL_ResumeTick();
+		return false;
 	}
 
 	void AppMain::TickFullReset()
@@ -349,9 +928,19 @@ namespace PiSubmarine::Chipset
 		HAL_I2C_MspDeInit(&hi2c3);
 
 		HAL_I2C_DisableListen_IT(&hi2c1);
-		HAL_ADC_Stop_DMA(&hadc1);
+		m_RailGuard.Disarm();
+		m_AdcStream.Stop();
+		m_Scheduler.StopTimer(ChargerRefreshTimer);
+		m_Scheduler.StopTimer(ProfileDumpTimer);
+		m_Scheduler.StopTimer(NotifyTimer);
+		m_Scheduler.StopTimer(WindowGraceTimer);
+		m_Clock.ClearAlarm(WindowEndAlarm);
+		m_Scheduler.Clear(Event::WindowEnd | Event::WindowGrace);
+		m_WindowEnd = RtcClock::Duration(0);
 
 		SleepWait(m_ShutdownDelay);
+		// Presses until now are stale, a button still held from a long press is released first
+		ResetButton();
 
 		HAL_LPTIM_PWM_Stop(&hlptim2, LPTIM_CHANNEL_1);
 		HAL_LPTIM_PWM_Start(&hlptim2, LPTIM_CHANNEL_1);
@@ -359,31 +948,85 @@ namespace PiSubmarine::Chipset
 
 		HAL_GPIO_WritePin(REG5_EN_GPIO_Port, REG5_EN_Pin, GPIO_PIN_RESET);
 		HAL_GPIO_WritePin(REG12_EN_GPIO_Port, REG12_EN_Pin, GPIO_PIN_RESET);
+	}
+
+	void AppMain::TickStandby()
+	{
+		if (!m_Scheduler.IsTimerActive(ButtonDebounceTimer))
+		{
+			bool scheduled = ArmWakeAlarm();
+			EnterStop();
+			EventMask wake = m_Scheduler.Poll(Event::ButtonEdge | Event::WakeAlarm);
+			if ((wake & Event::ButtonEdge) == 0)
+			{
+				// Without a window ahead any other wake-up, such as the charger's interrupt, boots as
+				// well. With one only the alarm does, the rails stay off until the window.
+				if ((wake & Event::WakeAlarm) ? StartWindow() : !scheduled)
+				{
+					LeaveStandby();
+				}
+				return;
+			}
+			m_Scheduler.StartTimer(ButtonDebounceTimer, ButtonDebounceTime, Event::ButtonSettled);
+		}
+
+		// The core sleeps with LPTIM1 running until the contacts settle. A press boots at once,
+		// a bounce or a release goes back to STOP at the next tick.
+		EventMask events = m_Scheduler.Wait(Event::ButtonEdge | Event::ButtonSettled);
+		if (events & Event::ButtonEdge)
+		{
+			m_Scheduler.StartTimer(ButtonDebounceTimer, ButtonDebounceTime, Event::ButtonSettled);
+		}
+		else if (IsButtonDown())
+		{
+			CHIPSET_LOG("Button: boot");
+			LeaveStandby();
+		}
+	}
 
+	void AppMain::EnterStop()
+	{
+		// STOP halts the USART1 clock in the middle of a line otherwise. The completion interrupts
+		// keep the transfer going while the core sleeps, the last one posts LogDrained. A UART that
+		// stopped sending must not keep the core out of STOP, so the wait is bounded.
+		m_Scheduler.Clear(Event::LogDrained);
+		if (!m_Log.IsEmpty())
+		{
+			m_Scheduler.WaitFor(Event::LogDrained, LogDrainTimeout);
+		}
+
+		// The LPTIM1 auto-reload interrupt would wake the core from STOP once per minute. The button
+		// and charger EXTI lines and the RTC alarm still wake it.
+		m_WakeupTimer.Suspend();
 		HAL_SuspendTick();
 		HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_SLEEPENTRY_WFI);
 		HAL_ResumeTick();
+		m_WakeupTimer.Resume();
+	}
 
+	void AppMain::LeaveStandby()
+	{
 		HAL_LPTIM_PWM_Stop(&hlptim2, LPTIM_CHANNEL_1);
+		// Set again on the way back to STOP
+		m_Clock.ClearAlarm(WakeAlarm);
+		m_Scheduler.Clear(Event::WakeAlarm);
 
 		MX_I2C1_Init();
 		MX_I2C2_Init();
 		MX_I2C3_Init();
-	}
-
-	void AppMain::TickStandby()
-	{
 		m_PowerState = PowerState::WaitForReg12;
 	}
 
 	void AppMain::EnterWaitForReg12(PowerState oldState)
 	{
 		(void) oldState;
-		HAL_GPIO_WritePin(CHIPSET_INT_GPIO_Port, CHIPSET_INT_Pin, GPIO_PIN_RESET);
+		// The Pi is unpowered, the line must not feed it. Pending events are kept.
+		m_Notifier.Release();
 		HAL_GPIO_WritePin(LED_REG5_GPIO_Port, LED_REG5_Pin, GPIO_PIN_SET);
 		HAL_GPIO_WritePin(LED_REG12_GPIO_Port, LED_REG12_Pin, GPIO_PIN_SET);
 		HAL_GPIO_WritePin(LED_REGPI_GPIO_Port, LED_REGPI_Pin, GPIO_PIN_SET);
 
+		m_Scheduler.Clear(Event::Reg12PowerGood);
 		HAL_GPIO_WritePin(REG12_EN_GPIO_Port, REG12_EN_Pin, GPIO_PIN_SET);
 	}
 
@@ -392,7 +1035,7 @@ namespace PiSubmarine::Chipset
 		auto reg12Pg = HAL_GPIO_ReadPin(REG12_PG_GPIO_Port, REG12_PG_Pin);
 		if (reg12Pg != GPIO_PIN_SET)
 		{
-			SleepWait(1ms);
+			m_Scheduler.Wait(Event::Reg12PowerGood);
 			return;
 		}
 		HAL_GPIO_WritePin(LED_REG12_GPIO_Port, LED_REG12_Pin, GPIO_PIN_RESET);
@@ -404,22 +1047,15 @@ namespace PiSubmarine::Chipset
 		(void) oldState;
 		HAL_GPIO_WritePin(REG5_EN_GPIO_Port, REG5_EN_Pin, GPIO_PIN_SET);
 
-		StartAdcOneShot();
+		StartAdcStream();
 	}
 
 	void AppMain::TickWaitForReg5()
 	{
-		if (!m_AdcComplete)
-		{
-			SleepWait(10ms);
-			return;
-		}
-
-		if (m_PacketOut.Reg5Voltage.Get() < Api::MicroVolts(4900000).Get())
-		{
-			StartAdcOneShot();
-			return;
-		}
+		// The analog watchdog interrupts at the first scan with REG5 at the threshold, the scans
+		// before that do not wake the core
+		m_Scheduler.Wait(Event::Reg5Good);
+		CHIPSET_LOG("REG5 good after %lu ms", static_cast<uint32_t>((m_Scheduler.Now() - m_RailWaitStart).count()));
 
 		HAL_GPIO_WritePin(LED_REG5_GPIO_Port, LED_REG5_Pin, GPIO_PIN_RESET);
 		m_PowerState = PowerState::WaitForRegPi;
@@ -428,225 +1064,839 @@ namespace PiSubmarine::Chipset
 	void AppMain::EnterWaitForRegPi(PowerState oldState)
 	{
 		(void) oldState;
-		StartAdcOneShot();
+		// REGPI may have crossed its threshold already, its watchdog event is still pending then
 	}
 
 	void AppMain::TickWaitForRegPi()
 	{
-		if (!m_AdcComplete)
+		m_Scheduler.Wait(Event::RegPiGood);
+		CHIPSET_LOG("REGPI good after %lu ms", static_cast<uint32_t>((m_Scheduler.Now() - m_RailWaitStart).count()));
+
+		HAL_GPIO_WritePin(LED_REGPI_GPIO_Port, LED_REGPI_Pin, GPIO_PIN_RESET);
+		m_PowerState = PowerState::Running;
+	}
+
+	void AppMain::EnterRunning(PowerState oldState)
+	{
+		(void) oldState;
+		ReleaseRpiTransmit();
+		// Telemetry scans from now on. The last watchdog scan is latched and published right away.
+		m_AdcStream.Pause();
+		StartRailGuard();
+		OnAdcComplete();
+		HAL_I2C_EnableListen_IT(&hi2c1);
+
+		// Edges from before Running are stale, the status read below covers them
+		m_Scheduler.Clear(Event::BatchgInt | Event::ChargerStatus);
+		RefreshCharger(static_cast<uint8_t>(Volatility::FastStatus));
+		m_Scheduler.StartTimer(ChargerRefreshTimer, ChargerRefreshPeriod, Event::ChargerRefresh, true);
+		if (ProfileDumpPeriod.count() > 0)
 		{
-			SleepWait(10ms);
+			m_Scheduler.StartTimer(ProfileDumpTimer, ProfileDumpPeriod, Event::ProfileDump, true);
+		}
+		// Events from before a rail recovery are still pending
+		m_Notifier.Assert();
+		// The press that booted may still be held, it does not count as a gesture
+		ResetButton();
+		ArmWindowEnd();
+	}
+
+	void AppMain::TickRunning()
+	{
+		// AdcComplete only has to end the wait: DrainEvents() publishes the new samples after every tick
+		EventMask events = m_Scheduler.Wait(Event::AdcComplete | Event::BatchgInt | Event::ChargerStatus | Event::ChargerRefresh | Event::RpiCommand
+				| Event::ProfileDump | Event::RailFault | Event::NotifyFlush | ButtonEvents | Event::WindowEnd | Event::WindowGrace);
+
+		// A transfer that never completes would hold its bus queue forever. The ADC scans wake the loop
+		// far more often than the transfer deadlines, so no wake-up of its own is needed.
+		m_ChipsetI2CDriver.CheckTimeouts();
+		m_BatchgI2CDriver.CheckTimeouts();
+
+		if (events & Event::RailFault)
+		{
+			OnRailFault();
+			if (m_PowerState != PowerState::Running)
+			{
+				return;
+			}
+		}
+
+		if (events & ButtonEvents)
+		{
+			OnButtonEvents(events);
+			if (m_PowerState != PowerState::Running)
+			{
+				return;
+			}
+		}
+
+		if (events & Event::WindowGrace)
+		{
+			// The Pi did not send the Shutdown command in time
+			CHIPSET_LOG("W: forced off");
+			m_ShutdownDelay = 0ms;
+			m_PowerState = PowerState::Standby;
+			m_Persistent.SetShutdownReason(ShutdownReason::Schedule);
 			return;
 		}
 
-		Api::MicroVolts regPiVoltage = m_PacketOut.RegPiVoltage;
-		printf("RegPi Voltage: %lu\n", static_cast<uint32_t>(regPiVoltage.Get() / 1000));
+		if (events & Event::WindowEnd)
+		{
+			OnWindowEnd();
+		}
+
+		if (events & Event::BatchgInt)
+		{
+			// Only the status and fault registers can have changed
+			RefreshCharger(static_cast<uint8_t>(Volatility::FastStatus));
+		}
 
-		if (regPiVoltage.Get() < Api::MicroVolts(3200000).Get())
+		if (events & Event::ChargerRefresh)
 		{
-			StartAdcOneShot();
+			// Slow fallback for a missed interrupt. Now and then the measurements and the configuration,
+			// which a charger reset would have changed, are read along.
+			m_ChargerRefreshTicks++;
+			bool full = m_ChargerRefreshTicks % ChargerFullRefreshTicks == 0;
+			RefreshCharger(full ? AllVolatilityClasses : static_cast<uint8_t>(Volatility::FastStatus));
+		}
+
+		if (events & Event::ChargerStatus)
+		{
+			OnChargerStatus();
+		}
+
+		if (events & Event::ProfileDump)
+		{
+			DumpProfile();
+		}
+
+		if (events & Event::NotifyFlush)
+		{
+			m_Notifier.Assert();
+		}
+	}
+
+	void AppMain::OnRailFault()
+	{
+		// Detection and CHIPSET_INT are done by the watchdog interrupt, this only reports
+		RailFault fault = m_RailGuard.GetFault();
+		CHIPSET_LOG("R: sag 0x%lX, REG5 %lu uV, REGPI %lu uV", static_cast<uint32_t>(fault.Rails), GetFaultMicroVolts(fault, Rail::Reg5),
+				GetFaultMicroVolts(fault, Rail::RegPi));
+		PublishRegisters();
+#if CHIPSET_BROWNOUT_RECOVERY
+		RecoverRails();
+#endif
+	}
+
+	void AppMain::RecoverRails()
+	{
+		// Like a shutdown without STOP: REG12 and the charger stay up, REG5 and the Pi regulator
+		// behind it restart. The fault record and event stay pending for the rebooted Pi.
+		m_Persistent.SetShutdownReason(ShutdownReason::Brownout);
+		HAL_I2C_DisableListen_IT(&hi2c1);
+		m_RailGuard.Disarm();
+		m_AdcStream.Pause();
+		m_Scheduler.StopTimer(ChargerRefreshTimer);
+		m_Scheduler.StopTimer(ProfileDumpTimer);
+		m_Scheduler.StopTimer(NotifyTimer);
+		m_Notifier.Release();
+
+		HAL_GPIO_WritePin(REG5_EN_GPIO_Port, REG5_EN_Pin, GPIO_PIN_RESET);
+		HAL_GPIO_WritePin(LED_REG5_GPIO_Port, LED_REG5_Pin, GPIO_PIN_SET);
+		HAL_GPIO_WritePin(LED_REGPI_GPIO_Port, LED_REGPI_Pin, GPIO_PIN_SET);
+		SleepWait(BrownoutOffTime);
+		m_PowerState = PowerState::WaitForReg5;
+	}
+
+	void AppMain::PostNotification(uint8_t events)
+	{
+		m_Notifier.Raise(events);
+		if ((events & m_Notifier.GetEnabled()) == 0)
+		{
+			// Latched for the next read only, no edge and no coalescing timer
 			return;
 		}
+		if (NotifyCoalescePeriod.count() == 0)
+		{
+			m_Notifier.Assert();
+			return;
+		}
+		// The first event opens the window, the ones raised until it closes share its edge
+		if (!m_Notifier.IsAsserted() && !m_Scheduler.IsTimerActive(NotifyTimer))
+		{
+			m_Scheduler.StartTimer(NotifyTimer, NotifyCoalescePeriod, Event::NotifyFlush);
+		}
+	}
 
-		HAL_GPIO_WritePin(LED_REGPI_GPIO_Port, LED_REGPI_Pin, GPIO_PIN_RESET);
-		m_PowerState = PowerState::Running;
+	void AppMain::OnButtonEvents(EventMask events)
+	{
+		bool changed = false;
+		// A gap that ran out together with the next press still ends the gesture before it
+		if (events & Event::ButtonTimeout)
+		{
+			OnButtonGesture(m_Button.OnTimeout());
+			changed = true;
+		}
+		if (events & Event::ButtonEdge)
+		{
+			// Every edge restarts the debounce, so bouncing contacts cost a few wake-ups and no polling
+			m_Scheduler.StartTimer(ButtonDebounceTimer, ButtonDebounceTime, Event::ButtonSettled);
+		}
+		if ((events & Event::ButtonSettled) && IsButtonDown() != m_Button.IsPressed())
+		{
+			OnButtonGesture(m_Button.OnLevel(IsButtonDown()));
+			changed = true;
+		}
+		if (!changed)
+		{
+			return;
+		}
+
+		std::chrono::milliseconds timeout = m_Button.GetTimeout();
+		if (timeout.count() > 0)
+		{
+			m_Scheduler.StartTimer(ButtonGestureTimer, timeout, Event::ButtonTimeout);
+		}
+		else
+		{
+			m_Scheduler.StopTimer(ButtonGestureTimer);
+		}
 	}
 
-	void AppMain::EnterRunning(PowerState oldState)
+	void AppMain::OnButtonGesture(ButtonGesture gesture)
 	{
-		(void) oldState;
-		StartAdcOneShot();
-		HAL_I2C_EnableListen_IT(&hi2c1);
+		switch (gesture)
+		{
+		case ButtonGesture::Short:
+			// Like the power button of a PC: the Pi shuts down and then sends the Shutdown command
+			CHIPSET_LOG("Button: shutdown request");
+			PostNotification(Notify::ShutdownRequest);
+			break;
+		case ButtonGesture::Double:
+			CHIPSET_LOG("Button: double press");
+			PostNotification(Notify::ButtonDouble);
+			break;
+		case ButtonGesture::Long:
+			// For a Pi that does not respond: the rails go off without a shutdown delay
+			CHIPSET_LOG("Button: forced off");
+			m_ShutdownDelay = 0ms;
+			m_PowerState = PowerState::Standby;
+			m_Persistent.SetShutdownReason(ShutdownReason::Button);
+			break;
+		case ButtonGesture::None:
+			break;
+		}
 	}
 
-	void AppMain::TickRunning()
+	bool AppMain::ArmWakeAlarm()
 	{
-		WaitFunc delayFunc = [this](std::chrono::milliseconds delay)
-		{	SleepWait(delay);};
+		WakeWindow window;
+		if (!m_Clock.IsSet() || !m_WakeSchedule.FindNext(m_Clock.Now(), window))
+		{
+			// Nothing due, but RtcClock::Poll() has to see every counter wrap. StartWindow() finds
+			// no window for this alarm and the core goes back to STOP after the poll in Run().
+			m_Clock.SetAlarm(WakeAlarm, m_Clock.Now() + RtcClock::MaxAlarmDelay);
+			return false;
+		}
+		m_Clock.SetAlarm(WakeAlarm, window.Start);
+		return true;
+	}
+
+	bool AppMain::StartWindow()
+	{
+		WakeWindow window;
+		RtcClock::Duration now = m_Clock.Now();
+		if (!m_Clock.IsSet() || !m_WakeSchedule.FindNext(now, window) || window.Start > now)
+		{
+			// An alarm capped at RtcClock::MaxAlarmDelay, it is set again on the way back to STOP
+			return false;
+		}
+		// An end of 0 leaves it to the Pi
+		CHIPSET_LOG("W: window until %lu", static_cast<uint32_t>(ToTimestamp(window.End).count() / 1000));
+		m_WakeSchedule.MarkStarted(window);
+		m_WindowEnd = window.End;
+		return true;
+	}
 
-		if (m_AdcComplete)
+	void AppMain::ArmWindowEnd()
+	{
+		if (m_WindowEnd.count() != 0)
 		{
-			StartAdcOneShot();
+			m_Clock.SetAlarm(WindowEndAlarm, m_WindowEnd);
 		}
+	}
+
+	void AppMain::OnWindowEnd()
+	{
+		if (m_WindowEnd.count() == 0)
+		{
+			return;
+		}
+		if (m_Clock.Now() < m_WindowEnd)
+		{
+			// Capped like the wake alarm
+			ArmWindowEnd();
+			return;
+		}
+		// Ends like a short press of the button, the rails go off with the Shutdown command or the grace time
+		CHIPSET_LOG("W: window ended");
+		m_WindowEnd = RtcClock::Duration(0);
+		PostNotification(Notify::ShutdownRequest);
+		m_Scheduler.StartTimer(WindowGraceTimer, WindowGraceTime, Event::WindowGrace);
+	}
+
+	void AppMain::ResetButton()
+	{
+		m_Scheduler.StopTimer(ButtonDebounceTimer);
+		m_Scheduler.StopTimer(ButtonGestureTimer);
+		m_Scheduler.Clear(ButtonEvents);
+		m_Button.Reset(IsButtonDown());
+	}
+
+	bool AppMain::IsButtonDown()
+	{
+		// The button pulls the line low against the internal pull-up
+		return HAL_GPIO_ReadPin(BUTTON_PWR_GPIO_Port, BUTTON_PWR_Pin) == GPIO_PIN_RESET;
+	}
 
-		bool batchgOk = m_Batchg.Read();
-		batchgOk &= m_Batchg.WaitForTransaction(delayFunc);
+	void AppMain::RefreshCharger(uint8_t classMask)
+	{
+		// The monitor keeps the classes for the next request, at the latest the next refresh tick
+		uint32_t merged = m_ChargerMonitor.GetMergedCount();
+		if (!m_ChargerMonitor.RequestRefresh(classMask))
+		{
+			CHIPSET_LOG("Charger: refresh 0x%X not queued", classMask);
+		}
+		else if (m_ChargerMonitor.GetMergedCount() != merged)
+		{
+			CHIPSET_LOG("Charger: refresh 0x%X merged, %lu so far", classMask, m_ChargerMonitor.GetMergedCount());
+		}
+	}
 
-		if (batchgOk)
+	void AppMain::OnChargerStatus()
+	{
+		if (m_ChargerMonitor.IsConfigurationLost())
 		{
-			m_PacketOut.Status = m_PacketOut.Status | Api::StatusFlags::BatchgValid;
-			auto status0 = m_Batchg.GetChargerStatus0();
-			auto chargeStatus = m_Batchg.GetChargeStatus();
-			bool vbusPresent = RegUtils::HasAnyFlag(status0, ChargerStatus0Flags::VbusPresentStat);
-			bool isCharging = chargeStatus != ChargeStatus::NotCharging && chargeStatus != ChargeStatus::ChargingTerminationDone;
+			// The charger reset itself and runs at its defaults. Its completion posts this event again,
+			// a configuration that cannot start yet is retried after the next refresh.
+			if (m_ChargerMonitor.RequestConfigure())
+			{
+				CHIPSET_LOG("Charger: configuration lost, writing it again");
+			}
+		}
 
-			if (vbusPresent)
+		Api::StatusFlags previous = m_ChargerStatus;
+		m_ChargerStatus = Api::StatusFlags { 0 };
+		if (m_ChargerMonitor.IsValid())
+		{
+			m_ChargerStatus = Api::StatusFlags::BatchgValid;
+			if (m_ChargerMonitor.IsVbusPresent())
 			{
-				m_PacketOut.Status = m_PacketOut.Status | Api::StatusFlags::VbusConnected;
+				m_ChargerStatus = m_ChargerStatus | Api::StatusFlags::VbusConnected;
 			}
-			if (isCharging)
+			if (m_ChargerMonitor.IsCharging())
 			{
-				m_PacketOut.Status = m_PacketOut.Status | Api::StatusFlags::ChargingInProgress;
+				m_ChargerStatus = m_ChargerStatus | Api::StatusFlags::ChargingInProgress;
 			}
 		}
-
-		SleepWait(100ms, true);
+		m_PacketOut.Status = m_PacketOut.Status | m_ChargerStatus;
+		SampleHistory();
+		PublishPacketOut();
+		if (m_ChargerStatus != previous)
+		{
+			PostNotification(Notify::ChargerStatus);
+		}
 	}
 
 	uint16_t AppMain::GetAdcBallast() const
 	{
-		return m_AdcBuffer[0];
+		return m_AdcStream.GetSamples()[0];
 	}
 
 	uint16_t AppMain::GetAdcReg5() const
 	{
-		return m_AdcBuffer[1];
+		return m_AdcStream.GetSamples()[Reg5Sample];
 	}
 
 	uint16_t AppMain::GetAdcRegPi() const
 	{
-		return m_AdcBuffer[2];
+		return m_AdcStream.GetSamples()[RegPiSample];
 	}
 
 	uint16_t AppMain::GetAdcTemp() const
 	{
-		return m_AdcBuffer[3];
+		return m_AdcStream.GetSamples()[3];
 	}
 
 	Api::MicroVolts AppMain::GetVoltageReg5(uint16_t reg5Adc) const
 	{
-		constexpr auto adcRef = Api::MicroVolts(3300000);
-
-		auto adcScaled = adcRef * reg5Adc / ((1ULL << 12) - 1) * 2;
-		return adcScaled;
+		return Api::MicroVolts(AdcConversion::RailMicroVolts(reg5Adc));
 	}
 
 	Api::MicroVolts AppMain::GetVoltageRegPi(uint16_t regPiAdc) const
 	{
-		constexpr auto adcRef = Api::MicroVolts(3300000);
-		auto adcScaled = adcRef * regPiAdc / ((1ULL << 12) - 1) * 2;
-		return adcScaled;
+		return Api::MicroVolts(AdcConversion::RailMicroVolts(regPiAdc));
 	}
 
 	Api::MicroKelvins AppMain::GetTemperature(uint16_t tempAdc) const
 	{
-		constexpr uint16_t tsCal1Temp = 30;
-		constexpr uint16_t tsCal2Temp = 130;
-		uint16_t tsCal1 = *(reinterpret_cast<uint16_t*>(0x1FFF6E68)) * 33 / 30;
-		uint16_t tsCal2 = *(reinterpret_cast<uint16_t*>(0x1FFF6E8A)) * 33 / 30;
-		int32_t tsData = tempAdc;
-		int32_t tsCalTempDelta = tsCal2Temp - tsCal1Temp;
-		int32_t tsCalDelta = tsCal2 - tsCal1;
-		int32_t tsDataDelta = tsData - (int32_t) tsCal1;
-		int64_t celcius = tsCalTempDelta * tsDataDelta * 1000000 / tsCalDelta + tsCal1Temp * 1000000;
-		uint64_t kelvin = celcius + 273150000;
+		uint64_t kelvin = m_TemperatureCalibration.ToMicroKelvins(tempAdc);
 		return Api::MicroKelvins(kelvin);
 	}
 
+	AdcConversion::TemperatureCalibration AppMain::ReadTemperatureCalibration()
+	{
+		// Factory values are taken at 3.0 V and scaled to the 3.3 V reference, once at boot
+		uint16_t tsCal1 = *TEMPSENSOR_CAL1_ADDR * 33 / 30;
+		uint16_t tsCal2 = *TEMPSENSOR_CAL2_ADDR * 33 / 30;
+		return {tsCal1, tsCal2};
+	}
+
 	std::chrono::milliseconds AppMain::GetTimestamp() const
 	{
-		if (!IsRtcCorrect())
+		return ToTimestamp(m_Clock.Now());
+	}
+
+	std::chrono::milliseconds AppMain::ToTimestamp(RtcClock::Duration time) const
+	{
+		if (!m_Clock.IsSet())
 		{
 			return std::chrono::milliseconds(0);
 		}
+		return std::chrono::floor<std::chrono::milliseconds>(time);
+	}
 
-		RTC_TimeTypeDef currentTime;
-		RTC_DateTypeDef currentDate;
-		time_t timestamp;
-		tm currTime;
-
-		HAL_RTC_GetTime(&hrtc, &currentTime, RTC_FORMAT_BCD);
-		HAL_RTC_GetDate(&hrtc, &currentDate, RTC_FORMAT_BCD);
-
-		currTime.tm_year = RTC_Bcd2ToByte(currentDate.Year) + 100;  // In fact: 2000 + 18 - 1900
-		currTime.tm_mday = RTC_Bcd2ToByte(currentDate.Date);
-		currTime.tm_mon = RTC_Bcd2ToByte(currentDate.Month) - 1;
-
-		currTime.tm_hour = RTC_Bcd2ToByte(currentTime.Hours);
-		currTime.tm_min = RTC_Bcd2ToByte(currentTime.Minutes);
-		currTime.tm_sec = RTC_Bcd2ToByte(currentTime.Seconds);
-
-		timestamp = mktime(&currTime) * 1000;
-		return std::chrono::milliseconds(timestamp);
+	uint32_t AppMain::Crc32(const uint8_t *data, size_t size)
+	{
+		return m_Crc.Calculate(data, size);
 	}
 
-	void AppMain::ToRtc(std::chrono::milliseconds Timestamp, RTC_TimeTypeDef &OutTime, RTC_DateTypeDef &OutDate) const
+	void AppMain::StartAdcStream()
 	{
-		time_t RawTime = Timestamp.count() / 1000;
-		// uint32_t Milliseconds = Timestamp % 1000;
-		tm ptm;
-		gmtime_r(&RawTime, &ptm);
+		m_Scheduler.Clear(Event::AdcComplete | Event::Reg5Good | Event::RegPiGood);
+		// Channels and thresholds of the watchdogs can only change while the ADC is not converting
+		// A watchdog flags conversions outside its window. The window ends below the good code, so
+		// the first conversion at or above it interrupts.
+		bool armed = ArmRailWatchdog(Reg5Watchdog, Reg5Channel, 0, Reg5GoodCode - 1U) && ArmRailWatchdog(RegPiWatchdog, RegPiChannel, 0, RegPiGoodCode - 1U);
+		if (!armed || !m_AdcStream.Start(AdcStream::Mode::Watchdog))
+		{
+			Error_Handler();
+		}
+		m_RailWaitStart = m_Scheduler.Now();
+	}
 
-		OutDate.Year = RTC_ByteToBcd2(ptm.tm_year - 100);
-		OutDate.Date = RTC_ByteToBcd2(ptm.tm_mday);
-		OutDate.Month = RTC_ByteToBcd2(ptm.tm_mon + 1);
-		OutDate.WeekDay = RTC_WEEKDAY_MONDAY;
+	void AppMain::StartRailGuard()
+	{
+		// Same watchdogs, now with the window above the fault codes. Arming also clears the flags,
+		// which the last watchdog scans left set.
+		bool armed = ArmRailWatchdog(Reg5Watchdog, Reg5Channel, Reg5FaultCode, AdcConversion::AdcMax)
+				&& ArmRailWatchdog(RegPiWatchdog, RegPiChannel, RegPiFaultCode, AdcConversion::AdcMax);
+		m_RailGuard.Arm();
+		if (!armed || !m_AdcStream.Start(AdcStream::Mode::Telemetry))
+		{
+			Error_Handler();
+		}
+	}
 
-		OutTime.Hours = RTC_ByteToBcd2(ptm.tm_hour);
-		OutTime.Minutes = RTC_ByteToBcd2(ptm.tm_min);
-		OutTime.Seconds = RTC_ByteToBcd2(ptm.tm_sec);
-		OutTime.DayLightSaving = RTC_DAYLIGHTSAVING_NONE;
-		OutTime.SecondFraction = 0;
-		OutTime.StoreOperation = 0;
-		OutTime.SubSeconds = 0;
-		OutTime.TimeFormat = RTC_HOURFORMAT_24;
+	bool AppMain::ArmRailWatchdog(uint32_t watchdog, uint32_t channel, uint16_t lowCode, uint16_t highCode)
+	{
+		ADC_AnalogWDGConfTypeDef config{};
+		config.WatchdogNumber = watchdog;
+		config.WatchdogMode = ADC_ANALOGWATCHDOG_SINGLE_REG;
+		config.Channel = channel;
+		config.ITMode = ENABLE;
+		config.HighThreshold = highCode;
+		config.LowThreshold = lowCode;
+		return HAL_ADC_AnalogWDGConfig(&hadc1, &config) == HAL_OK;
 	}
 
-	void AppMain::SetRtc(RTC_TimeTypeDef &Time, RTC_DateTypeDef &Date)
+	void AppMain::ScanMaskedRails()
 	{
-		HAL_RTC_SetTime(&hrtc, &Time, RTC_FORMAT_BCD);
-		HAL_RTC_SetDate(&hrtc, &Date, RTC_FORMAT_BCD);
+		// ISR side, once per sample period. A masked rail has its sag scans counted here and is
+		// watched by its watchdog again once the whole period stayed above the recovery code.
+		if (!m_RailGuard.IsArmed())
+		{
+			return;
+		}
+		for (Rail rail : {Rail::Reg5, Rail::RegPi})
+		{
+			if (!m_RailGuard.IsMasked(rail))
+			{
+				continue;
+			}
+			bool reg5 = rail == Rail::Reg5;
+			size_t below = 0;
+			uint16_t minimum = m_AdcStream.ScanHalf(reg5 ? Reg5Sample : RegPiSample, reg5 ? Reg5FaultCode : RegPiFaultCode, below);
+			m_RailGuard.OnScans(rail, below, minimum);
+			if (minimum >= (reg5 ? Reg5RecoveryCode : RegPiRecoveryCode))
+			{
+				UnmaskRailWatchdog(rail);
+			}
+		}
 	}
 
-	uint32_t AppMain::Crc32(const uint8_t *data, size_t size)
+	void AppMain::UnmaskRailWatchdog(Rail rail)
 	{
-		uint8_t *dataNc = const_cast<uint8_t*>(data);
-		return HAL_CRC_Calculate(&hcrc, reinterpret_cast<uint32_t*>(dataNc), size);
+		m_RailGuard.Unmask(rail);
+		// The watchdog kept flagging the scans while it was masked
+		if (rail == Rail::Reg5)
+		{
+			__HAL_ADC_CLEAR_FLAG(&hadc1, ADC_FLAG_AWD2);
+			__HAL_ADC_ENABLE_IT(&hadc1, ADC_IT_AWD2);
+		}
+		else
+		{
+			__HAL_ADC_CLEAR_FLAG(&hadc1, ADC_FLAG_AWD3);
+			__HAL_ADC_ENABLE_IT(&hadc1, ADC_IT_AWD3);
+		}
 	}
 
-	void AppMain::StartAdcOneShot()
+	uint32_t AppMain::GetFaultMicroVolts(const RailFault &fault, Rail rail) const
 	{
-		m_AdcComplete = false;
-		HAL_ADC_Start_DMA(&hadc1, reinterpret_cast<uint32_t*>(m_AdcBuffer.data()), m_AdcBuffer.size());
-		__HAL_DMA_DISABLE_IT(hadc1.DMA_Handle, DMA_IT_HT);
+		size_t index = static_cast<size_t>(rail);
+		if ((fault.Rails & (1 << index)) == 0)
+		{
+			return 0;
+		}
+		return AdcConversion::RailMicroVolts(fault.MinCodes[index]);
 	}
 
-	void AppMain::OnSetTimeCommand()
+	bool AppMain::OnSetTimeCommand(uint8_t *request)
 	{
 		PiSubmarine::Chipset::Api::Crc32Func crcFunc = [this](const uint8_t *data, size_t size)
 		{	return Crc32(data, size);};
 
 		Api::PacketSetTime setTime;
-		if (!setTime.Deserialize(m_RpiReceiveBuffer.data(), Api::PacketSetTime::Size, crcFunc))
+		if (!setTime.Deserialize(request, Api::PacketSetTime::Size, crcFunc))
 		{
-			printf("Cf\n");
-			return;
+			CHIPSET_LOG("Cf");
+			return false;
 		}
 
-		RTC_TimeTypeDef time;
-		RTC_DateTypeDef date;
-		ToRtc(setTime.RtcTime, time, date);
-		SetRtc(time, date);
+		m_Clock.Set(std::chrono::duration_cast<RtcClock::Duration>(setTime.RtcTime));
+		LogClock();
+		// The alarm compares the counter, which the new time does not move
+		ArmWindowEnd();
+		return true;
+	}
+
+	void AppMain::LogClock()
+	{
+		if (!m_Clock.IsSet())
+		{
+			CHIPSET_LOG("Clock: not set");
+			return;
+		}
+		CivilTime::DateTime time = CivilTime::FromUnixMilliseconds(GetTimestamp().count());
+		CHIPSET_LOG("Clock: %lu-%02lu-%02lu %02lu:%02lu:%02lu UTC", static_cast<uint32_t>(time.Date.Year), static_cast<uint32_t>(time.Date.Month),
+				static_cast<uint32_t>(time.Date.Day), static_cast<uint32_t>(time.Hours), static_cast<uint32_t>(time.Minutes),
+				static_cast<uint32_t>(time.Seconds));
 	}
 
-	void AppMain::OnShutdownCommand()
+	bool AppMain::OnShutdownCommand(uint8_t *request)
 	{
 		PiSubmarine::Chipset::Api::Crc32Func crcFunc = [this](const uint8_t *data, size_t size)
 		{	return Crc32(data, size);};
 
 		Api::PacketShutdown shutdown;
-		if (!shutdown.Deserialize(m_RpiReceiveBuffer.data(), Api::PacketShutdown::Size, crcFunc))
+		if (!shutdown.Deserialize(request, Api::PacketShutdown::Size, crcFunc))
 		{
-			printf("Cf\n");
-			return;
+			CHIPSET_LOG("Cf");
+			return false;
 		}
 
-		printf("Shutdown in %lu\n", static_cast<uint32_t>(shutdown.Delay.count()));
+		CHIPSET_LOG("Shutdown in %lu", static_cast<uint32_t>(shutdown.Delay.count()));
 
 		m_ShutdownDelay = shutdown.Delay;
 		m_PowerState = PowerState::Standby;
+		m_Persistent.SetShutdownReason(ShutdownReason::PiCommand);
+		return true;
+	}
+
+	CommandStatus AppMain::OnClearRailFaultCommand(uint8_t *response, size_t capacity, size_t &responseSize)
+	{
+		uint8_t rails = 0;
+		{
+			// A sag latched in between would be cleared unseen
+			CriticalSection lock;
+			rails = m_RailGuard.GetFault().Rails;
+			m_RailGuard.Clear();
+			// A rail that is still low is reported again at its next scan
+			for (Rail rail : {Rail::Reg5, Rail::RegPi})
+			{
+				if (m_RailGuard.IsMasked(rail))
+				{
+					UnmaskRailWatchdog(rail);
+				}
+			}
+		}
+		PublishRegisters();
+
+		if (response == nullptr)
+		{
+			return CommandStatus::Ok;
+		}
+		if (capacity < 2)
+		{
+			return CommandStatus::NoSpace;
+		}
+		response[0] = static_cast<uint8_t>(LocalCommand::ClearRailFault);
+		response[1] = rails;
+		responseSize = 2;
+		return CommandStatus::Ok;
+	}
+
+	void AppMain::OnSetEventMaskCommand(const uint8_t *request)
+	{
+		m_Notifier.SetEnabled(request[1]);
+		// Events pending already that were just enabled get their edge now
+		m_Notifier.Assert();
+		PublishRegisters();
+	}
+
+	CommandStatus AppMain::OnSetScheduleCommand(const uint8_t *request, uint8_t *response, size_t capacity, size_t &responseSize)
+	{
+		// Windows are in Unix time, which the Pi has to set first
+		size_t count = request[1];
+		if (!m_Clock.IsSet() || count > WakeSchedule::MaxEntries)
+		{
+			return CommandStatus::Rejected;
+		}
+
+		std::array<WakeEntry, WakeSchedule::MaxEntries> entries{};
+		RtcClock::Duration now = m_Clock.Now();
+		for (size_t i = 0; i < count; i++)
+		{
+			const uint8_t *entry = &request[2 + i * WakeSchedule::EntrySize];
+			entries[i].Start = LittleEndian::Read32(&entry[0]);
+			entries[i].Period = LittleEndian::Read32(&entry[4]);
+			entries[i].Duration = LittleEndian::Read32(&entry[8]);
+			// The table is left as it was if any entry is invalid
+			if (!WakeSchedule::IsValid(entries[i], now, std::chrono::duration_cast<RtcClock::Duration>(WindowGraceTime)))
+			{
+				CHIPSET_LOG("W: entry %lu invalid", static_cast<uint32_t>(i));
+				return CommandStatus::Rejected;
+			}
+		}
+		m_WakeSchedule.Set(entries, count);
+
+		WakeWindow window;
+		uint64_t next = 0;
+		if (m_WakeSchedule.FindNext(now, window))
+		{
+			next = static_cast<uint64_t>(ToTimestamp(window.Start).count());
+		}
+		CHIPSET_LOG("W: %lu entries, next at %lu", static_cast<uint32_t>(count), static_cast<uint32_t>(next / 1000));
+
+		if (response == nullptr)
+		{
+			return CommandStatus::Ok;
+		}
+		if (capacity < ScheduleResponseSize)
+		{
+			return CommandStatus::NoSpace;
+		}
+		response[0] = static_cast<uint8_t>(LocalCommand::SetSchedule);
+		response[1] = static_cast<uint8_t>(count);
+		LittleEndian::Write64(&response[2], next);
+		responseSize = ScheduleResponseSize;
+		return CommandStatus::Ok;
+	}
+
+	CommandStatus AppMain::OnReadHistoryCommand(const uint8_t *request, uint8_t *response, size_t capacity, size_t &responseSize)
+	{
+		if (response == nullptr)
+		{
+			return CommandStatus::Ok;
+		}
+		if (capacity < HistoryHeaderSize)
+		{
+			return CommandStatus::NoSpace;
+		}
+
+		uint32_t fromSequence = LittleEndian::Read32(&request[1]);
+		uint16_t maxRecords = LittleEndian::Read16(&request[5]);
+		uint32_t firstSequence;
+		uint16_t count;
+
+		// u8 command, u32 first sequence, u16 record count, u16 payload length, payload
+		size_t length = m_History.Read(fromSequence, maxRecords, &response[HistoryHeaderSize], capacity - HistoryHeaderSize, firstSequence, count);
+		response[0] = static_cast<uint8_t>(LocalCommand::ReadHistory);
+		LittleEndian::Write32(&response[1], firstSequence);
+		LittleEndian::Write16(&response[5], count);
+		LittleEndian::Write16(&response[7], static_cast<uint16_t>(length));
+		responseSize = HistoryHeaderSize + length;
+		return CommandStatus::Ok;
 	}
 
+	CommandStatus AppMain::OnReadProfileCommand(const uint8_t *request, uint8_t *response, size_t capacity, size_t &responseSize)
+	{
+		uint8_t firstSlot = request[1];
+		uint8_t flags = request[2];
+
+		if (flags & ProfileDumpFlag)
+		{
+			DumpProfile();
+		}
+		if (flags & ProfileCrcBenchmarkFlag)
+		{
+			BenchmarkCrc();
+		}
+
+		CommandStatus status = CommandStatus::Ok;
+		if (response != nullptr && capacity < ProfileHeaderSize)
+		{
+			status = CommandStatus::NoSpace;
+		}
+		else if (response != nullptr)
+		{
+			// u8 command, u8 first slot, u8 slot count, u8 total slots, u32 core clock, u64 awake cycles,
+			// u64 sleep cycles, per slot u32 count, u32 min, u32 max, u32 average
+			constexpr size_t slotSize = 4 * sizeof(uint32_t);
+			size_t slotsPerFrame = (capacity - ProfileHeaderSize) / slotSize;
+			size_t slotCount = firstSlot < CycleProfiler::SlotCount ? std::min(CycleProfiler::SlotCount - firstSlot, slotsPerFrame) : 0;
+
+			uint64_t awakeCycles;
+			uint64_t sleepCycles;
+			m_Profiler.GetDutyCycle(awakeCycles, sleepCycles);
+
+			response[0] = static_cast<uint8_t>(LocalCommand::ReadProfile);
+			response[1] = firstSlot;
+			response[2] = static_cast<uint8_t>(slotCount);
+			response[3] = static_cast<uint8_t>(CycleProfiler::SlotCount);
+			LittleEndian::Write32(&response[4], HAL_RCC_GetHCLKFreq());
+			LittleEndian::Write64(&response[8], awakeCycles);
+			LittleEndian::Write64(&response[16], sleepCycles);
+
+			uint8_t *slotData = &response[ProfileHeaderSize];
+			for (size_t i = 0; i < slotCount; i++, slotData += slotSize)
+			{
+				CycleProfiler::SlotStats stats = m_Profiler.GetSlot(static_cast<ProfileSlot>(firstSlot + i));
+				LittleEndian::Write32(&slotData[0], stats.Count);
+				LittleEndian::Write32(&slotData[4], stats.Count == 0 ? 0 : stats.Min);
+				LittleEndian::Write32(&slotData[8], stats.Max);
+				LittleEndian::Write32(&slotData[12], stats.GetAverage());
+			}
+			responseSize = ProfileHeaderSize + slotCount * slotSize;
+		}
+
+		if (flags & ProfileResetFlag)
+		{
+			m_Profiler.Reset();
+		}
+		return status;
+	}
+
+	void AppMain::DumpProfile()
+	{
+		uint64_t awakeCycles;
+		uint64_t sleepCycles;
+		m_Profiler.GetDutyCycle(awakeCycles, sleepCycles);
+		uint64_t totalCycles = awakeCycles + sleepCycles;
+		uint32_t awakePermille = totalCycles == 0 ? 0 : static_cast<uint32_t>(awakeCycles * 1000 / totalCycles);
+		uint32_t cyclesPerMs = HAL_RCC_GetHCLKFreq() / 1000;
+
+		// Log arguments are 32-bit
+		CHIPSET_LOG("P: awake %lu.%lu%% of %lu ms", awakePermille / 10, awakePermille % 10, static_cast<uint32_t>(totalCycles / cyclesPerMs));
+		for (size_t i = 0; i < CycleProfiler::SlotCount; i++)
+		{
+			ProfileSlot slot = static_cast<ProfileSlot>(i);
+			CycleProfiler::SlotStats stats = m_Profiler.GetSlot(slot);
+			if (stats.Count == 0)
+			{
+				continue;
+			}
+			CHIPSET_LOG("P: %s n=%lu min=%lu max=%lu avg=%lu", CycleProfiler::GetSlotToken(slot), stats.Count, stats.Min, stats.Max,
+					stats.GetAverage());
+		}
+	}
+
+	void AppMain::BenchmarkCrc()
+	{
+		// One Pi frame, the longest buffer the firmware checks. Fragments as a batch response is built.
+		constexpr size_t fragmentSize = RpiFrameSize / 4;
+		std::array<uint8_t, RpiFrameSize> data;
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			data[i] = static_cast<uint8_t>(i * 37 + 11);
+		}
+
+		// Interrupts would be counted, they are masked for the few hundred cycles of each run
+		auto measure = [this](auto run, uint32_t &result)
+		{
+			CriticalSection lock;
+			uint32_t start = m_Profiler.Now();
+			result = run();
+			return m_Profiler.Now() - start;
+		};
+
+		uint32_t results[3];
+		uint32_t cycles[3];
+		cycles[0] = measure([&]()
+		{	return m_Crc.Calculate(data.data(), data.size());}, results[0]);
+		cycles[1] = measure([&]()
+		{
+			m_Crc.Begin();
+			for (size_t offset = 0; offset < data.size(); offset += fragmentSize)
+			{
+				m_Crc.Accumulate(&data[offset], fragmentSize);
+			}
+			return m_Crc.GetValue();
+		}, results[1]);
+		cycles[2] = measure([&]()
+		{	return CrcEngine::CalculateSoftware(data.data(), data.size());}, results[2]);
+
+		const uint16_t names[3] = {CHIPSET_LOG_STRING("unit"), CHIPSET_LOG_STRING("unit 4 fragments"), CHIPSET_LOG_STRING("table")};
+		for (size_t i = 0; i < 3; i++)
+		{
+			uint32_t centiCycles = cycles[i] * 100 / data.size();
+			CHIPSET_LOG("P: crc %s %lu cycles, %lu.%02lu per byte", names[i], cycles[i], centiCycles / 100, centiCycles % 100);
+		}
+		if (results[1] != results[0] || results[2] != results[0])
+		{
+			CHIPSET_LOG("P: crc mismatch 0x%lX 0x%lX 0x%lX", results[0], results[1], results[2]);
+		}
+	}
+
+	bool AppMain::CheckRequestCrc(size_t requestSize)
+	{
+		uint32_t crc = LittleEndian::Read32(&m_RpiCommandBuffer[requestSize]);
+		if (Crc32(m_RpiCommandBuffer.data(), requestSize) != crc)
+		{
+			CHIPSET_LOG("Cf");
+			return false;
+		}
+		return true;
+	}
+
+	bool AppMain::BeginResponse()
+	{
+		// A frame that was not read yet is replaced. The one being transmitted must not be touched.
+		m_ResponseFramePending = false;
+		if (m_ResponseFrameSending)
+		{
+			return false;
+		}
+		m_ResponseFrame.fill(0);
+		return true;
+	}
+
+	void AppMain::SealResponse()
+	{
+		uint32_t frameCrc = Crc32(m_ResponseFrame.data(), ResponseFrameSize - sizeof(uint32_t));
+		LittleEndian::Write32(&m_ResponseFrame[ResponseFrameSize - sizeof(uint32_t)], frameCrc);
+		m_ResponseFramePending = true;
+	}
+
+	void TokenizedLog::Write(uint16_t token, const uint32_t *args, size_t count)
+	{
+		auto *app = AppMain::GetInstance();
+		if (!app)
+		{
+			return;
+		}
+		app->GetLog().WriteRecord(token, args, count);
+	}
 }
 
 extern "C"
@@ -654,19 +1904,53 @@ extern "C"
 	void AppMainRun(void *argument)
 	{
 		(void) argument;
-		PiSubmarine::Chipset::AppMain app;
+		// In .bss, where the linker accounts for it, instead of on the 1 KiB stack.
+		// Constructed here rather than at startup, once the HAL and the clocks are up.
+		static PiSubmarine::Chipset::AppMain app;
 		app.Run();
 	}
 
 	int __io_putchar(int ch)
 	{
-		HAL_UART_Transmit(&huart1, (uint8_t*) &ch, 1, 0xFFFF);
+		uint8_t byte = static_cast<uint8_t>(ch);
+		auto *app = PiSubmarine::Chipset::AppMain::GetInstance();
+		if (!app)
+		{
+			HAL_UART_Transmit(&huart1, &byte, 1, 0xFFFF);
+			return ch;
+		}
+		app->GetLog().Write(&byte, 1);
 		return ch;
 	}
 
+	/// Replaces the weak one in syscalls.c, which calls __io_putchar() once per character
+	int _write(int file, char *ptr, int len)
+	{
+		(void) file;
+		auto *app = PiSubmarine::Chipset::AppMain::GetInstance();
+		if (!app)
+		{
+			HAL_UART_Transmit(&huart1, reinterpret_cast<uint8_t*>(ptr), static_cast<uint16_t>(len), 0xFFFF);
+			return len;
+		}
+		app->GetLog().Write(reinterpret_cast<const uint8_t*>(ptr), static_cast<size_t>(len));
+		return len;
+	}
+
+	void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+	{
+		auto *app = PiSubmarine::Chipset::AppMain::GetInstance();
+		if (!app)
+		{
+			return;
+		}
+		app->UartTxCompleteCallback(huart);
+	}
+
 	int IsRtcCorrect()
 	{
-		return (RTC->ICSR & RTC_ICSR_INITS) != 0;
+		// Set by MX_RTC_Init() of an earlier boot, the backup domain was not reset since
+		return (RTC->ICSR & RTC_ICSR_BIN) == RTC_BINARY_ONLY && (RTC->PRER & RTC_PRER_PREDIV_A) == (PiSubmarine::Chipset::RtcClock::AsynchPrediv << RTC_PRER_PREDIV_A_Pos);
 	}
 
 	void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
@@ -685,12 +1969,14 @@ extern "C"
 		}
 		else
 		{
+			PiSubmarine::Chipset::ProfileScope scope(app->GetProfiler(), PiSubmarine::Chipset::ProfileSlot::I2CMaster);
 			/*
 			 if (hi2c == app->GetRpiDriver().GetHandlePtr())
 			 {
 			 app->GetRpiDriver().OnErrorCallback(hi2c);
 			 }
 			 */
+			app->I2CMasterCompleteCallback(hi2c);
 			if (hi2c == app->GetChipsetDriver().GetHandlePtr())
 			{
 				app->GetChipsetDriver().OnErrorCallback(hi2c);
@@ -702,10 +1988,27 @@ extern "C"
 		}
 	}
 
+	void HAL_I2C_AbortCpltCallback(I2C_HandleTypeDef *hi2c)
+	{
+		PiSubmarine::Chipset::AppMain *app = PiSubmarine::Chipset::AppMain::GetInstance();
+		PiSubmarine::Chipset::ProfileScope scope(app->GetProfiler(), PiSubmarine::Chipset::ProfileSlot::I2CMaster);
+		app->I2CMasterCompleteCallback(hi2c);
+		if (hi2c == app->GetChipsetDriver().GetHandlePtr())
+		{
+			app->GetChipsetDriver().OnAbortCplt(hi2c);
+		}
+		else if (hi2c == app->GetBatchgDriver().GetHandlePtr())
+		{
+			app->GetBatchgDriver().OnAbortCplt(hi2c);
+		}
+	}
+
 	void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c)
 	{
 
 		PiSubmarine::Chipset::AppMain *app = PiSubmarine::Chipset::AppMain::GetInstance();
+		PiSubmarine::Chipset::ProfileScope scope(app->GetProfiler(), PiSubmarine::Chipset::ProfileSlot::I2CMaster);
+		app->I2CMasterCompleteCallback(hi2c);
 		if (hi2c == app->GetRpiDriver().GetHandlePtr())
 		{
 			app->GetRpiDriver().OnMasterTxCplt(hi2c);
@@ -724,6 +2027,8 @@ extern "C"
 	{
 
 		PiSubmarine::Chipset::AppMain *app = PiSubmarine::Chipset::AppMain::GetInstance();
+		PiSubmarine::Chipset::ProfileScope scope(app->GetProfiler(), PiSubmarine::Chipset::ProfileSlot::I2CMaster);
+		app->I2CMasterCompleteCallback(hi2c);
 		if (hi2c == app->GetRpiDriver().GetHandlePtr())
 		{
 			app->GetRpiDriver().OnMasterRxCplt(hi2c);
@@ -738,9 +2043,83 @@ extern "C"
 		}
 	}
 
-	void HAL_LPTIM_CompareMatchCallback(LPTIM_HandleTypeDef *hlptim)
+	void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c)
+	{
+		// Register writes of the queued master engine end here instead of in MasterTxCplt
+		HAL_I2C_MasterTxCpltCallback(hi2c);
+	}
+
+	void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c)
+	{
+		HAL_I2C_MasterRxCpltCallback(hi2c);
+	}
+
+	void HAL_LPTIM_AutoReloadMatchCallback(LPTIM_HandleTypeDef *hlptim)
+	{
+		auto *app = PiSubmarine::Chipset::AppMain::GetInstance();
+		if (!app)
+		{
+			return;
+		}
+
+		app->LpTimAutoReloadCallback(hlptim);
+	}
+
+	void HAL_GPIO_EXTI_Rising_Callback(uint16_t GPIO_Pin)
+	{
+		auto *app = PiSubmarine::Chipset::AppMain::GetInstance();
+		if (!app)
+		{
+			return;
+		}
+
+		app->GpioRisingCallback(GPIO_Pin);
+	}
+
+	void HAL_GPIO_EXTI_Falling_Callback(uint16_t GPIO_Pin)
+	{
+		auto *app = PiSubmarine::Chipset::AppMain::GetInstance();
+		if (!app)
+		{
+			return;
+		}
+
+		app->GpioFallingCallback(GPIO_Pin);
+	}
+
+	void HAL_RTC_AlarmAEventCallback(RTC_HandleTypeDef *hrtc)
+	{
+		(void) hrtc;
+		auto *app = PiSubmarine::Chipset::AppMain::GetInstance();
+		if (!app)
+		{
+			return;
+		}
+
+		app->RtcAlarmCallback(RTC_ALARM_A);
+	}
+
+	void HAL_RTCEx_AlarmBEventCallback(RTC_HandleTypeDef *hrtc)
 	{
-		PiSubmarine::Chipset::AppMain::GetInstance()->LpTimCallback(hlptim);
+		(void) hrtc;
+		auto *app = PiSubmarine::Chipset::AppMain::GetInstance();
+		if (!app)
+		{
+			return;
+		}
+
+		app->RtcAlarmCallback(RTC_ALARM_B);
+	}
+
+	void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc)
+	{
+		auto *app = PiSubmarine::Chipset::AppMain::GetInstance();
+		if (!app)
+		{
+			return;
+		}
+
+		app->AdcHalfConvertionCompletedCallback(hadc);
 	}
 
 	void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc)
@@ -754,6 +2133,28 @@ extern "C"
 		app->AdcConvertionCompletedCallback(hadc);
 	}
 
+	void HAL_ADCEx_LevelOutOfWindow2Callback(ADC_HandleTypeDef *hadc)
+	{
+		auto *app = PiSubmarine::Chipset::AppMain::GetInstance();
+		if (!app)
+		{
+			return;
+		}
+
+		app->AdcLevelOutOfWindowCallback(hadc, ADC_ANALOGWATCHDOG_2);
+	}
+
+	void HAL_ADCEx_LevelOutOfWindow3Callback(ADC_HandleTypeDef *hadc)
+	{
+		auto *app = PiSubmarine::Chipset::AppMain::GetInstance();
+		if (!app)
+		{
+			return;
+		}
+
+		app->AdcLevelOutOfWindowCallback(hadc, ADC_ANALOGWATCHDOG_3);
+	}
+
 	void HAL_I2C_AddrCallback(I2C_HandleTypeDef *hi2c, uint8_t TransferDirection, uint16_t AddrMatchCode)
 	{
 		auto *app = PiSubmarine::Chipset::AppMain::GetInstance();
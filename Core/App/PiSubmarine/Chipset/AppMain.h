@@ -4,15 +4,113 @@
 
 #include <chrono>
 #include "PiSubmarine/Chipset/I2CDriver.h"
-#include "PiSubmarine/Bq25792/Device.h"
+#include "PiSubmarine/Chipset/Scheduler.h"
+#include "PiSubmarine/Chipset/EventRing.h"
+#include "PiSubmarine/Chipset/TxDoubleBuffer.h"
+#include "PiSubmarine/Chipset/TelemetryHistory.h"
+#include "PiSubmarine/Chipset/ChargerMonitor.h"
+#include "PiSubmarine/Chipset/AdcStream.h"
+#include "PiSubmarine/Chipset/AdcConversion.h"
+#include "PiSubmarine/Chipset/LptimWakeupTimer.h"
+#include "PiSubmarine/Chipset/CycleProfiler.h"
+#include "PiSubmarine/Chipset/ProfilingWakeupTimer.h"
+#include "PiSubmarine/Chipset/UartLog.h"
+#include "PiSubmarine/Chipset/TokenizedLog.h"
+#include "PiSubmarine/Chipset/LocalCommand.h"
+#include "PiSubmarine/Chipset/RegisterMap.h"
+#include "PiSubmarine/Chipset/CrcEngine.h"
+#include "PiSubmarine/Chipset/RtcClock.h"
+#include "PiSubmarine/Chipset/PersistentState.h"
+#include "PiSubmarine/Chipset/RailGuard.h"
+#include "PiSubmarine/Chipset/Notifier.h"
+#include "PiSubmarine/Chipset/PowerButton.h"
+#include "PiSubmarine/Chipset/WakeSchedule.h"
 #include "PiSubmarine/Chipset/Api/MicroVolts.h"
 #include "PiSubmarine/Chipset/Api/MicroKelvins.h"
 #include "PiSubmarine/Chipset/Api/PacketOut.h"
 #include "main.h"
 #include "i2c.h"
+#include "lptim.h"
+#include "usart.h"
+#include "crc.h"
 #include <array>
 #include "rtc.h"
 
+#ifndef CHIPSET_CHARGER_REFRESH_MS
+#define CHIPSET_CHARGER_REFRESH_MS 10000
+#endif
+
+/// The charger refresh tick that falls on this period re-reads the whole register map, not only the status
+#ifndef CHIPSET_CHARGER_FULL_REFRESH_MS
+#define CHIPSET_CHARGER_FULL_REFRESH_MS 300000
+#endif
+
+/// Size of the telemetry history, a power of two. 512 bytes keep about 100 samples.
+#ifndef CHIPSET_HISTORY_BYTES
+#define CHIPSET_HISTORY_BYTES 512
+#endif
+
+#ifndef CHIPSET_HISTORY_PERIOD_MS
+#define CHIPSET_HISTORY_PERIOD_MS 1000
+#endif
+
+/// Size of the USART1 log ring, a power of two. A full profile dump is 20 records of at most 24 bytes.
+#ifndef CHIPSET_LOG_BYTES
+#define CHIPSET_LOG_BYTES 512
+#endif
+
+/// RAM for the AppMain instance. Of the 8K, the linker scripts reserve 0x400 bytes of stack and 0x200 of
+/// heap, and about 2K are left for the HAL handles, the persistent mirror and newlib.
+#ifndef CHIPSET_APP_RAM_BYTES
+#define CHIPSET_APP_RAM_BYTES 4608
+#endif
+
+/// Period of the profile dump on USART1 while running, 0 prints it only on request
+#ifndef CHIPSET_PROFILE_DUMP_MS
+#define CHIPSET_PROFILE_DUMP_MS 0
+#endif
+
+/// Keeps a copy of the persistent state in SRAM that resets do not clear, needs the .noinit section
+#ifndef CHIPSET_PERSIST_MIRROR
+#define CHIPSET_PERSIST_MIRROR 1
+#endif
+
+/// Events raised within this window after the first one share one CHIPSET_INT edge, 0 asserts at once.
+/// Faults are never delayed.
+#ifndef CHIPSET_NOTIFY_COALESCE_MS
+#define CHIPSET_NOTIFY_COALESCE_MS 10
+#endif
+
+/// Cycles REG5 after a rail sag while running. Off by default, the Pi may ride through a short sag.
+#ifndef CHIPSET_BROWNOUT_RECOVERY
+#define CHIPSET_BROWNOUT_RECOVERY 0
+#endif
+
+/// How long REG5 stays off during a recovery, long enough for the Pi to reset
+#ifndef CHIPSET_BROWNOUT_OFF_MS
+#define CHIPSET_BROWNOUT_OFF_MS 1000
+#endif
+
+/// BUTTON_PWR counts as settled once it has not changed for this long
+#ifndef CHIPSET_BUTTON_DEBOUNCE_MS
+#define CHIPSET_BUTTON_DEBOUNCE_MS 20
+#endif
+
+/// Holding the power button this long switches everything off without waiting for the Pi
+#ifndef CHIPSET_BUTTON_LONG_MS
+#define CHIPSET_BUTTON_LONG_MS 4000
+#endif
+
+/// A second press starting within this time after a release makes a double press
+#ifndef CHIPSET_BUTTON_DOUBLE_MS
+#define CHIPSET_BUTTON_DOUBLE_MS 400
+#endif
+
+/// How long the Pi has to shut down after its scheduled window ended before the rails go off anyway
+#ifndef CHIPSET_WINDOW_GRACE_MS
+#define CHIPSET_WINDOW_GRACE_MS 60000
+#endif
+
 enum class PowerState
 {
 	FullReset,
@@ -25,6 +123,22 @@ enum class PowerState
 
 namespace PiSubmarine::Chipset
 {
+	enum class AppEventType : uint8_t
+	{
+		AdcComplete,
+		RpiCommand,
+		RpiListenComplete,
+		RpiTransmitComplete,
+		RpiError
+	};
+
+	/// Compact record pushed by ISRs and handled in the main loop.
+	struct AppEvent
+	{
+		AppEventType Type = AppEventType::AdcComplete;
+		uint8_t Arg = 0;
+	};
+
 	class AppMain
 	{
 	public:
@@ -35,8 +149,15 @@ namespace PiSubmarine::Chipset
 		virtual ~AppMain();
 		void Run();
 
-		void LpTimCallback(LPTIM_HandleTypeDef *hlptim);
+		void LpTimAutoReloadCallback(LPTIM_HandleTypeDef *hlptim);
+		void GpioRisingCallback(uint16_t pin);
+		void GpioFallingCallback(uint16_t pin);
+		void RtcAlarmCallback(uint32_t alarm);
+		void I2CMasterCompleteCallback(I2C_HandleTypeDef *hi2c);
+		void UartTxCompleteCallback(UART_HandleTypeDef *huart);
+		void AdcHalfConvertionCompletedCallback(ADC_HandleTypeDef *hadc);
 		void AdcConvertionCompletedCallback(ADC_HandleTypeDef *hadc);
+		void AdcLevelOutOfWindowCallback(ADC_HandleTypeDef *hadc, uint32_t watchdog);
 		void I2CAddressCallback(I2C_HandleTypeDef *hi2c, uint8_t TransferDirection, uint16_t AddrMatchCode);
 		void I2CListenCompleteCallback(I2C_HandleTypeDef *hi2c);
 		void I2CSlaveRxCompleteCallback(I2C_HandleTypeDef *hi2c);
@@ -46,26 +167,172 @@ namespace PiSubmarine::Chipset
 		I2CDriver& GetRpiDriver();
 		I2CDriver& GetChipsetDriver();
 		I2CDriver& GetBatchgDriver();
+		CycleProfiler& GetProfiler();
+		UartLog<CHIPSET_LOG_BYTES>& GetLog();
 
 	private:
+		enum Timer : size_t
+		{
+			ChargerRefreshTimer,
+			ProfileDumpTimer,
+			NotifyTimer,
+			ButtonDebounceTimer,
+			ButtonGestureTimer,
+			WindowGraceTimer
+		};
+
+		constexpr static std::chrono::milliseconds ChargerRefreshPeriod{CHIPSET_CHARGER_REFRESH_MS};
+		constexpr static uint32_t ChargerFullRefreshTicks = CHIPSET_CHARGER_FULL_REFRESH_MS / CHIPSET_CHARGER_REFRESH_MS;
+		static_assert(ChargerFullRefreshTicks >= 1, "CHIPSET_CHARGER_FULL_REFRESH_MS is shorter than the refresh period");
+		constexpr static std::chrono::milliseconds HistoryPeriod{CHIPSET_HISTORY_PERIOD_MS};
+		constexpr static std::chrono::milliseconds ProfileDumpPeriod{CHIPSET_PROFILE_DUMP_MS};
+		constexpr static std::chrono::milliseconds NotifyCoalescePeriod{CHIPSET_NOTIFY_COALESCE_MS};
+		constexpr static std::chrono::milliseconds ButtonDebounceTime{CHIPSET_BUTTON_DEBOUNCE_MS};
+		constexpr static std::chrono::milliseconds ButtonLongPressTime{CHIPSET_BUTTON_LONG_MS};
+		constexpr static std::chrono::milliseconds ButtonDoublePressGap{CHIPSET_BUTTON_DOUBLE_MS};
+		constexpr static std::chrono::milliseconds WindowGraceTime{CHIPSET_WINDOW_GRACE_MS};
+		/// The charger configuration gets two seconds, the I2C timeouts are checked between the polls
+		constexpr static std::chrono::milliseconds ChargerWaitPoll{20};
+		constexpr static uint32_t ChargerWaitPolls = 100;
+		/// USART1 runs at 115200 8N1. A full log ring is on the wire in this time, twice over.
+		constexpr static std::chrono::milliseconds LogDrainTimeout{2 * CHIPSET_LOG_BYTES * 10 * 1000 / 115200 + 1};
+		/// Alarm A wakes for the next window, alarm B ends the current one
+		constexpr static uint32_t WakeAlarm = RTC_ALARM_A;
+		constexpr static uint32_t WindowEndAlarm = RTC_ALARM_B;
+		constexpr static EventMask ButtonEvents = Event::ButtonEdge | Event::ButtonSettled | Event::ButtonTimeout;
+		/// A sample is recorded early when a channel moves this many LSB away from the last record:
+		/// about 1 % ballast, 50 mV on the rails and 1 K on the temperature sensor.
+		constexpr static std::array<uint16_t, AdcStream::ChannelCount> HistoryThresholds{41, 31, 31, 4};
+		/// Rails are good from these voltages on, compared by the ADC analog watchdogs in codes
+		constexpr static uint32_t Reg5GoodMicroVolts = 4900000;
+		constexpr static uint32_t RegPiGoodMicroVolts = 3200000;
+		constexpr static uint16_t Reg5GoodCode = AdcConversion::RailCode(Reg5GoodMicroVolts);
+		constexpr static uint16_t RegPiGoodCode = AdcConversion::RailCode(RegPiGoodMicroVolts);
+		/// While running, the rails sag below these. REG5 is at the Pi's own undervoltage warning.
+		constexpr static uint32_t Reg5FaultMicroVolts = 4630000;
+		constexpr static uint32_t RegPiFaultMicroVolts = 3100000;
+		constexpr static uint16_t Reg5FaultCode = AdcConversion::RailCode(Reg5FaultMicroVolts);
+		constexpr static uint16_t RegPiFaultCode = AdcConversion::RailCode(RegPiFaultMicroVolts);
+		/// A masked watchdog is unmasked once a whole sample period of scans stays above these
+		constexpr static uint32_t Reg5RecoveryMicroVolts = 4730000;
+		constexpr static uint32_t RegPiRecoveryMicroVolts = 3200000;
+		constexpr static uint16_t Reg5RecoveryCode = AdcConversion::RailCode(Reg5RecoveryMicroVolts);
+		constexpr static uint16_t RegPiRecoveryCode = AdcConversion::RailCode(RegPiRecoveryMicroVolts);
+		constexpr static std::chrono::milliseconds BrownoutOffTime{CHIPSET_BROWNOUT_OFF_MS};
+		constexpr static uint32_t Reg5Channel = ADC_CHANNEL_5;
+		constexpr static uint32_t RegPiChannel = ADC_CHANNEL_6;
+		constexpr static uint32_t Reg5Watchdog = ADC_ANALOGWATCHDOG_2;
+		constexpr static uint32_t RegPiWatchdog = ADC_ANALOGWATCHDOG_3;
+		/// Position of the rails in a scan
+		constexpr static size_t Reg5Sample = 1;
+		constexpr static size_t RegPiSample = 2;
+		/// Longest write of the Pi: a batch of a few commands
+		constexpr static size_t RpiFrameSize = 64;
+		constexpr static size_t ResponseFrameSize = 256;
+		constexpr static size_t BatchHeaderSize = 1 + 1;
+		constexpr static size_t BatchEntryHeaderSize = 1 + 1 + 2;
+		constexpr static size_t HistoryHeaderSize = 1 + 4 + 2 + 2;
+		constexpr static size_t ProfileHeaderSize = 1 + 1 + 1 + 1 + 4 + 8 + 8;
+		constexpr static size_t ScheduleResponseSize = 1 + 1 + 8;
+		constexpr static uint8_t ProfileResetFlag = 1 << 0;
+		constexpr static uint8_t ProfileDumpFlag = 1 << 1;
+		constexpr static uint8_t ProfileCrcBenchmarkFlag = 1 << 2;
+		constexpr static uint8_t TransmitPacketOut = 0;
+		constexpr static uint8_t TransmitResponse = 1;
+		constexpr static uint8_t TransmitRegisters = 2;
+		/// Nothing is queued on the Pi and hi2c2 buses, their drivers only take the HAL callbacks
+		using RpiI2CDriver = StaticI2CDriver<1, 16>;
+		using ChipsetI2CDriver = StaticI2CDriver<1, 16>;
+		/// The register cache queues one burst at a time, at most the whole BQ25792 map
+		using BatchgI2CDriver = StaticI2CDriver<2, ChargerMonitor::RegisterCount>;
+
 		static AppMain* Instance;
-		I2CDriver m_RpiI2CDriver{hi2c1};
-		I2CDriver m_ChipsetI2CDriver{hi2c2};
-		I2CDriver m_BatchgI2CDriver{hi2c3};
-		PiSubmarine::Bq25792::Device m_Batchg{m_BatchgI2CDriver};
-		bool m_Lptim1Expired = false;
-		bool m_AdcComplete = false;
+		UartLog<CHIPSET_LOG_BYTES> m_Log{huart1};
+		LptimWakeupTimer m_WakeupTimer{hlptim1};
+		CycleProfiler m_Profiler{TIM2};
+		CrcEngine m_Crc{&hcrc};
+		RtcClock m_Clock{hrtc};
+		PersistentState m_Persistent;
+		RtcClock::Duration m_BootTime{0};
+		ResetCause m_ResetCause = ResetCause::PowerOn;
+		uint8_t m_BootFlags = 0;
+		RailGuard m_RailGuard;
+		Notifier m_Notifier{CHIPSET_INT_GPIO_Port, CHIPSET_INT_Pin};
+		PowerButton m_Button{ButtonLongPressTime, ButtonDoublePressGap};
+		WakeSchedule m_WakeSchedule;
+		/// Unix time the current window ends, zero outside a window or when the Pi ends it
+		RtcClock::Duration m_WindowEnd{0};
+		ProfilingWakeupTimer m_ProfilingWakeupTimer{m_WakeupTimer, m_Profiler};
+		Scheduler m_Scheduler{m_ProfilingWakeupTimer};
+		RpiI2CDriver m_RpiI2CDriver{hi2c1, m_WakeupTimer};
+		ChipsetI2CDriver m_ChipsetI2CDriver{hi2c2, m_WakeupTimer};
+		BatchgI2CDriver m_BatchgI2CDriver{hi2c3, m_WakeupTimer};
+		ChargerMonitor m_ChargerMonitor{m_BatchgI2CDriver, m_Scheduler, Event::ChargerStatus};
+		std::chrono::milliseconds m_RailWaitStart{0};
 		PowerState m_PowerState = PowerState::FullReset;
-		std::array<uint16_t, 4> m_AdcBuffer{0};
+		AdcStream m_AdcStream{hadc1, TIM6};
+		AdcConversion::TemperatureCalibration m_TemperatureCalibration;
 		std::chrono::milliseconds m_ShutdownDelay;
 
-		std::array<uint8_t, 13> m_RpiReceiveBuffer{0};
-		std::array<uint8_t, Api::PacketOut::Size> m_PacketOutSerialized;
+		EventRing<AppEvent, 16> m_Events;
+
+		std::array<uint8_t, RpiFrameSize> m_RpiReceiveBuffer{0};
+		std::array<uint8_t, RpiFrameSize> m_RpiCommandBuffer{0};
+		size_t m_RpiCommandSize = 0;
+		volatile bool m_RpiCommandPending = false;
+		volatile bool m_RpiReceiving = false;
+		TxDoubleBuffer<Api::PacketOut::Size> m_PacketOutBuffer;
+		TxDoubleBuffer<RegisterMap::Size> m_RegisterImage;
+		/// Answer to a register read outside the map
+		std::array<uint8_t, 1> m_UnmappedRegister{0xFF};
+		/// Events register and PEC, built when its read starts
+		std::array<uint8_t, 2> m_EventRegister{0};
+		volatile uint8_t m_RegisterPointer = 0;
+		volatile bool m_RegisterReadPending = false;
+		volatile bool m_RegisterReading = false;
 		Api::PacketOut m_PacketOut;
+		Api::StatusFlags m_ChargerStatus{0};
+		uint32_t m_ChargerRefreshTicks = 0;
+
+		TelemetryHistory<CHIPSET_HISTORY_BYTES> m_History;
+		std::chrono::milliseconds m_LastHistoryTime{0};
+		std::array<uint16_t, AdcStream::ChannelCount> m_HistoryAdc{0};
+		Api::StatusFlags m_HistoryStatus{0};
+		std::array<uint8_t, ResponseFrameSize> m_ResponseFrame{0};
+		volatile bool m_ResponseFramePending = false;
+		volatile bool m_ResponseFrameSending = false;
+
 
+		void PushEvent(AppEventType type, EventMask wakeEvents, uint8_t arg = 0);
+		void DrainEvents();
+		void OnAdcComplete();
+		void OnRpiWriteComplete(size_t size);
+		void OnRpiCommand();
+		void PublishPacketOut();
+		void PublishRegisters();
+		void StartRegisterRead(I2C_HandleTypeDef *hi2c);
+		void SampleHistory();
+		void ReleaseRpiTransmit();
+		void RefreshCharger(uint8_t classMask);
+		void OnChargerStatus();
+		void OnRailFault();
+		void PostNotification(uint8_t events);
+		void RecoverRails();
+		void OnButtonEvents(EventMask events);
+		void OnButtonGesture(ButtonGesture gesture);
+		void ResetButton();
+		static bool IsButtonDown();
+		bool ArmWakeAlarm();
+		bool StartWindow();
+		void ArmWindowEnd();
+		void OnWindowEnd();
 
+		void StartPersistentState();
+		void UpdateUptime();
+		uint32_t GetSessionSeconds() const;
 		bool InitBatteryManagers();
-		void SleepWait(std::chrono::milliseconds delay, bool interruptable = false);
+		void SleepWait(std::chrono::milliseconds delay);
+		bool WaitForCharger();
 
 		void TickFullReset();
 
@@ -83,6 +350,8 @@ namespace PiSubmarine::Chipset
 
 		void EnterStandby(PowerState oldState);
 		void TickStandby();
+		void EnterStop();
+		void LeaveStandby();
 
 		uint16_t GetAdcBallast() const;
 		uint16_t GetAdcReg5() const;
@@ -92,15 +361,36 @@ namespace PiSubmarine::Chipset
 		Api::MicroVolts GetVoltageReg5(uint16_t reg5Adc) const;
 		Api::MicroVolts GetVoltageRegPi(uint16_t regPiAdc) const;
 		Api::MicroKelvins GetTemperature(uint16_t tempAdc) const;
+		static AdcConversion::TemperatureCalibration ReadTemperatureCalibration();
 
 		std::chrono::milliseconds GetTimestamp() const;
-		void ToRtc(std::chrono::milliseconds Timestamp, RTC_TimeTypeDef &OutTime, RTC_DateTypeDef &OutDate) const;
-		void SetRtc(RTC_TimeTypeDef &Time, RTC_DateTypeDef &Date);
+		std::chrono::milliseconds ToTimestamp(RtcClock::Duration time) const;
+		void LogClock();
 		uint32_t Crc32(const uint8_t* data, size_t size);
-		void StartAdcOneShot();
+		void StartAdcStream();
+		void StartRailGuard();
+		bool ArmRailWatchdog(uint32_t watchdog, uint32_t channel, uint16_t lowCode, uint16_t highCode);
+		void ScanMaskedRails();
+		void UnmaskRailWatchdog(Rail rail);
+		uint32_t GetFaultMicroVolts(const RailFault &fault, Rail rail) const;
 
-		void OnSetTimeCommand();
-		void OnShutdownCommand();
+		void OnSingleCommand(size_t size);
+		void OnBatchCommand(size_t size);
+		/// Runs a request without trailing CRC. A null response only runs the side effects.
+		CommandStatus ExecuteCommand(uint8_t *request, size_t size, uint8_t *response, size_t capacity, size_t &responseSize);
+		static size_t GetRequestSize(uint8_t command);
+		bool OnSetTimeCommand(uint8_t *request);
+		bool OnShutdownCommand(uint8_t *request);
+		CommandStatus OnClearRailFaultCommand(uint8_t *response, size_t capacity, size_t &responseSize);
+		void OnSetEventMaskCommand(const uint8_t *request);
+		CommandStatus OnSetScheduleCommand(const uint8_t *request, uint8_t *response, size_t capacity, size_t &responseSize);
+		CommandStatus OnReadHistoryCommand(const uint8_t *request, uint8_t *response, size_t capacity, size_t &responseSize);
+		CommandStatus OnReadProfileCommand(const uint8_t *request, uint8_t *response, size_t capacity, size_t &responseSize);
+		void DumpProfile();
+		void BenchmarkCrc();
+		bool CheckRequestCrc(size_t requestSize);
+		bool BeginResponse();
+		void SealResponse();
 	};
 }
 
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "PiSubmarine/Chipset/I2CDriver.h"
+#include "PiSubmarine/Chipset/RegisterCache.h"
+#include "PiSubmarine/Chipset/Scheduler.h"
+
+namespace PiSubmarine::Chipset
+{
+	/// BQ25792 register cache plus decoding of the status bits the firmware consumes.
+	/// Status and fault registers (REG1B..REG27) are re-read on BATCHG_INT, configuration is read once,
+	/// and ADC results only when asked for. The firmware settings are written through the same cache.
+	/// A refresh that reads the configuration back compares it with the settings, so a charger that
+	/// reset itself to its defaults is noticed.
+	class ChargerMonitor
+	{
+	public:
+		constexpr static uint8_t DeviceAddress = 0x6B;
+		constexpr static size_t RegisterCount = 0x49;
+
+		constexpr static uint8_t ChargeCurrentLimit = 0x03;
+		constexpr static uint8_t ChargerControl1 = 0x10;
+		constexpr static uint8_t ChargerControl2 = 0x11;
+		constexpr static uint8_t ChargerControl5 = 0x14;
+		constexpr static uint8_t NtcControl1 = 0x18;
+		/// REG19 ICO_ILIM, 16 bit over REG19..REG1A
+		constexpr static uint8_t IcoCurrentLimit = 0x19;
+		constexpr static uint8_t ChargerStatus0 = 0x1B;
+		constexpr static uint8_t ChargerStatus1 = 0x1C;
+		constexpr static uint8_t FaultStatus0 = 0x20;
+		constexpr static uint8_t FaultStatus1 = 0x21;
+		constexpr static uint8_t LastFlag = 0x27;
+		constexpr static uint8_t FirstAdcResult = 0x31;
+		constexpr static uint8_t LastAdcResult = 0x46;
+
+		constexpr static uint8_t VbusPresentMask = 1 << 0;
+		constexpr static uint8_t ChargeStatShift = 5;
+		constexpr static uint8_t ChargeStatNotCharging = 0;
+		constexpr static uint8_t ChargeStatTerminationDone = 7;
+
+		/// ICHG, 10 mA per step, MSB first in REG03..REG04
+		constexpr static uint16_t ChargeCurrentStepMilliAmperes = 10;
+		constexpr static uint16_t ChargeCurrentMilliAmperes = 3000;
+		/// REG10 WATCHDOG, 0 disables it
+		constexpr static uint8_t WatchdogMask = 0x07;
+		/// REG11 AUTO_INDET_EN
+		constexpr static uint8_t AutoDpDmDetection = 1 << 6;
+		/// REG14 EN_EXTILIM and EN_BATOC
+		constexpr static uint8_t IlimHizCurrentLimit = 1 << 1;
+		constexpr static uint8_t DischargeOcp = 1 << 0;
+		/// REG18 TS_IGNORE
+		constexpr static uint8_t TsIgnore = 1 << 0;
+
+		/// Bits of a configuration register the firmware sets
+		struct Setting
+		{
+			uint8_t Register;
+			uint8_t Mask;
+			uint8_t Value;
+		};
+
+		constexpr static uint16_t ChargeCurrentCode = ChargeCurrentMilliAmperes / ChargeCurrentStepMilliAmperes;
+		constexpr static std::array<Setting, 6> Settings{{
+			{ChargeCurrentLimit, 0xFF, static_cast<uint8_t>(ChargeCurrentCode >> 8)},
+			{ChargeCurrentLimit + 1, 0xFF, static_cast<uint8_t>(ChargeCurrentCode)},
+			{ChargerControl1, WatchdogMask, 0},
+			{ChargerControl2, AutoDpDmDetection, 0},
+			// The ADC and discharge current sensing stay off
+			{ChargerControl5, IlimHizCurrentLimit | DischargeOcp, DischargeOcp},
+			{NtcControl1, TsIgnore, TsIgnore}
+		}};
+
+		using Cache = RegisterCache<RegisterCount>;
+
+		constexpr static Cache::VolatilityTable MakeVolatilityTable()
+		{
+			Cache::VolatilityTable table{};
+			for (size_t reg = 0; reg < RegisterCount; reg++)
+			{
+				if (reg >= ChargerStatus0 && reg <= LastFlag)
+				{
+					table[reg] = Volatility::FastStatus;
+				}
+				else if ((reg >= IcoCurrentLimit && reg <= IcoCurrentLimit + 1) || (reg >= FirstAdcResult && reg <= LastAdcResult))
+				{
+					table[reg] = Volatility::SlowStatus;
+				}
+				else
+				{
+					table[reg] = Volatility::Static;
+				}
+			}
+			return table;
+		}
+
+		ChargerMonitor(I2CDriver &driver, Scheduler &scheduler, EventMask readyEvent) :
+				m_Cache(driver, DeviceAddress, GetVolatilityTable()), m_Scheduler(scheduler), m_ReadyEvent(readyEvent)
+		{
+
+		}
+
+		/// Reads the configuration registers, applies the firmware settings in the cache and writes back
+		/// the registers that differ. Posts the ready event when done, IsConfigured() tells the outcome.
+		bool RequestConfigure()
+		{
+			CriticalSection lock;
+			m_Configured = false;
+			if (!m_Cache.Refresh(static_cast<uint8_t>(Volatility::Static), [this](bool ok)
+			{	OnConfigurationRead(ok);}))
+			{
+				return false;
+			}
+			m_ConfigurationLost = false;
+			return true;
+		}
+
+		/// True once RequestConfigure() has written the settings
+		[[nodiscard]] bool IsConfigured() const
+		{
+			return m_Configured;
+		}
+
+		/// Queues a refresh of the given volatility classes. A request made while one is in flight is
+		/// merged into a follow-up refresh, so an interrupt that fires during the read is not lost.
+		/// Classes whose follow-up could not be queued are added to the next request.
+		bool RequestRefresh(uint8_t classMask)
+		{
+			CriticalSection lock;
+			if (m_Cache.IsBusy())
+			{
+				m_AgainMask = m_AgainMask | classMask;
+				m_MergedCount++;
+				return true;
+			}
+			return StartRefresh(static_cast<uint8_t>(classMask | m_AgainMask));
+		}
+
+		/// Requests merged into a follow-up because the cache was busy. Growing with every request
+		/// means the cache never finishes.
+		[[nodiscard]] uint32_t GetMergedCount() const
+		{
+			return m_MergedCount;
+		}
+
+		/// True once a status read has completed successfully
+		[[nodiscard]] bool IsValid() const
+		{
+			return m_Valid;
+		}
+
+		/// True if the cached configuration registers hold the firmware settings. Only meaningful
+		/// after a refresh that read Volatility::Static.
+		[[nodiscard]] bool HoldsConfiguration() const
+		{
+			for (const Setting &setting : Settings)
+			{
+				if ((Register(setting.Register) & setting.Mask) != setting.Value)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/// True once a refresh has read back configuration registers that lost the settings.
+		/// Cleared when RequestConfigure() starts.
+		[[nodiscard]] bool IsConfigurationLost() const
+		{
+			return m_ConfigurationLost;
+		}
+
+		[[nodiscard]] bool IsVbusPresent() const
+		{
+			return (Register(ChargerStatus0) & VbusPresentMask) != 0;
+		}
+
+		[[nodiscard]] uint8_t GetChargeStat() const
+		{
+			return static_cast<uint8_t>(Register(ChargerStatus1) >> ChargeStatShift);
+		}
+
+		[[nodiscard]] bool IsCharging() const
+		{
+			uint8_t chargeStat = GetChargeStat();
+			return chargeStat != ChargeStatNotCharging && chargeStat != ChargeStatTerminationDone;
+		}
+
+		[[nodiscard]] bool HasFault() const
+		{
+			return Register(FaultStatus0) != 0 || Register(FaultStatus1) != 0;
+		}
+
+		[[nodiscard]] uint8_t Register(uint8_t address) const
+		{
+			return m_Cache.Get(address);
+		}
+
+	private:
+		/// Built at compile time and placed in flash
+		static const Cache::VolatilityTable& GetVolatilityTable()
+		{
+			constexpr static Cache::VolatilityTable table = MakeVolatilityTable();
+			return table;
+		}
+
+		Cache m_Cache;
+		Scheduler &m_Scheduler;
+		EventMask m_ReadyEvent;
+		volatile uint8_t m_AgainMask = 0;
+		uint32_t m_MergedCount = 0;
+		/// Classes of the refresh in flight
+		uint8_t m_RefreshMask = 0;
+		volatile bool m_Valid = false;
+		volatile bool m_Configured = false;
+		volatile bool m_ConfigurationLost = false;
+
+		bool StartRefresh(uint8_t classMask)
+		{
+			m_AgainMask = 0;
+			m_RefreshMask = classMask;
+			if (m_Cache.Refresh(classMask, [this](bool ok)
+			{	OnRefreshed(ok);}))
+			{
+				return true;
+			}
+			m_AgainMask = m_AgainMask | classMask;
+			return false;
+		}
+
+		/// Clears and sets the bits in mask of a cached register
+		void Modify(uint8_t reg, uint8_t mask, uint8_t value)
+		{
+			m_Cache.Set(reg, static_cast<uint8_t>((m_Cache.Get(reg) & ~mask) | value));
+		}
+
+		void ApplyConfiguration()
+		{
+			for (const Setting &setting : Settings)
+			{
+				Modify(setting.Register, setting.Mask, setting.Value);
+			}
+		}
+
+		/// Completion interrupt of the configuration read
+		void OnConfigurationRead(bool ok)
+		{
+			if (ok)
+			{
+				ApplyConfiguration();
+				ok = m_Cache.Flush([this](bool flushed)
+				{	OnConfigurationWritten(flushed);});
+				if (ok)
+				{
+					return;
+				}
+			}
+			m_Scheduler.Post(m_ReadyEvent);
+		}
+
+		/// Completion interrupt of the write-back
+		void OnConfigurationWritten(bool ok)
+		{
+			m_Configured = ok;
+			m_Scheduler.Post(m_ReadyEvent);
+		}
+
+		/// Completion interrupt of the last burst
+		void OnRefreshed(bool ok)
+		{
+			m_Valid = ok;
+			if (ok && (m_RefreshMask & static_cast<uint8_t>(Volatility::Static)) != 0 && !HoldsConfiguration())
+			{
+				m_ConfigurationLost = true;
+			}
+			uint8_t again = m_AgainMask;
+			if (again != 0 && StartRefresh(again))
+			{
+				return;
+			}
+			m_Scheduler.Post(m_ReadyEvent);
+		}
+	};
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+
+/// UTC calendar arithmetic for the log, in place of newlib's mktime() and gmtime_r(): no time zone
+/// state, no heap, a few dozen integer operations. Day numbers use Howard Hinnant's days_from_civil
+/// and civil_from_days on the proleptic Gregorian calendar and fit 32 bits, so Cortex-M0+ only
+/// divides by constants there. The RTC counts years 2000 to 2099, the static_asserts below walk
+/// every day of that range against a month-by-month count.
+namespace PiSubmarine::Chipset::CivilTime
+{
+	constexpr int64_t MillisecondsPerSecond = 1000;
+	constexpr int64_t SecondsPerDay = 86400;
+
+	struct Date
+	{
+		int32_t Year = 1970;
+		/// 1 to 12
+		uint8_t Month = 1;
+		/// 1 to 31
+		uint8_t Day = 1;
+	};
+
+	struct DateTime
+	{
+		CivilTime::Date Date;
+		uint8_t Hours = 0;
+		uint8_t Minutes = 0;
+		uint8_t Seconds = 0;
+		uint16_t Milliseconds = 0;
+	};
+
+	/// Days since 1970-01-01
+	constexpr int32_t DaysFromCivil(const Date &date)
+	{
+		int32_t year = date.Year - (date.Month <= 2 ? 1 : 0);
+		int32_t era = (year >= 0 ? year : year - 399) / 400;
+		uint32_t yearOfEra = static_cast<uint32_t>(year - era * 400);
+		uint32_t month = date.Month;
+		uint32_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + date.Day - 1;
+		uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+		return era * 146097 + static_cast<int32_t>(dayOfEra) - 719468;
+	}
+
+	constexpr Date CivilFromDays(int32_t days)
+	{
+		days += 719468;
+		int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+		uint32_t dayOfEra = static_cast<uint32_t>(days - era * 146097);
+		uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+		uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+		uint32_t monthIndex = (5 * dayOfYear + 2) / 153;
+		uint32_t month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+
+		Date date;
+		date.Year = static_cast<int32_t>(yearOfEra) + era * 400 + (month <= 2 ? 1 : 0);
+		date.Month = static_cast<uint8_t>(month);
+		date.Day = static_cast<uint8_t>(dayOfYear - (153 * monthIndex + 2) / 5 + 1);
+		return date;
+	}
+
+	/// 1 for Monday to 7 for Sunday, like RTC_WEEKDAY_*. 1970-01-01 was a Thursday.
+	constexpr uint8_t WeekDay(int32_t days)
+	{
+		int32_t sinceMonday = (days + 3) % 7;
+		return static_cast<uint8_t>((sinceMonday < 0 ? sinceMonday + 7 : sinceMonday) + 1);
+	}
+
+	/// Milliseconds since the Unix epoch
+	constexpr int64_t ToUnixMilliseconds(const DateTime &time)
+	{
+		int64_t seconds = static_cast<int64_t>(DaysFromCivil(time.Date)) * SecondsPerDay + time.Hours * 3600 + time.Minutes * 60 + time.Seconds;
+		return seconds * MillisecondsPerSecond + time.Milliseconds;
+	}
+
+	/// Rounds toward the past, also for times before 1970
+	constexpr DateTime FromUnixMilliseconds(int64_t milliseconds)
+	{
+		int64_t seconds = milliseconds / MillisecondsPerSecond;
+		int64_t millisecond = milliseconds % MillisecondsPerSecond;
+		if (millisecond < 0)
+		{
+			seconds--;
+			millisecond += MillisecondsPerSecond;
+		}
+		int64_t days = seconds / SecondsPerDay;
+		int64_t secondOfDay = seconds % SecondsPerDay;
+		if (secondOfDay < 0)
+		{
+			days--;
+			secondOfDay += SecondsPerDay;
+		}
+
+		// Below a day the values fit 32 bits
+		uint32_t second = static_cast<uint32_t>(secondOfDay);
+		DateTime time;
+		time.Date = CivilFromDays(static_cast<int32_t>(days));
+		time.Hours = static_cast<uint8_t>(second / 3600);
+		time.Minutes = static_cast<uint8_t>(second / 60 % 60);
+		time.Seconds = static_cast<uint8_t>(second % 60);
+		time.Milliseconds = static_cast<uint16_t>(millisecond);
+		return time;
+	}
+
+	namespace Detail
+	{
+		constexpr bool IsLeapYear(int32_t year)
+		{
+			return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+		}
+
+		constexpr uint8_t DaysInMonth(int32_t year, uint8_t month)
+		{
+			constexpr uint8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+			return month == 2 && IsLeapYear(year) ? 29 : days[month - 1];
+		}
+
+		/// Walks the calendar day by day and compares both directions
+		constexpr bool CalendarMatches(int32_t firstYear, int32_t lastYear)
+		{
+			int32_t days = DaysFromCivil(Date{firstYear, 1, 1});
+			for (int32_t year = firstYear; year <= lastYear; year++)
+			{
+				for (uint8_t month = 1; month <= 12; month++)
+				{
+					for (uint8_t day = 1; day <= DaysInMonth(year, month); day++, days++)
+					{
+						Date date = CivilFromDays(days);
+						if (DaysFromCivil(Date{year, month, day}) != days || date.Year != year || date.Month != month || date.Day != day)
+						{
+							return false;
+						}
+					}
+				}
+			}
+			return true;
+		}
+	}
+
+	static_assert(DaysFromCivil(Date{1970, 1, 1}) == 0, "Epoch is day 0");
+	static_assert(DaysFromCivil(Date{2000, 1, 1}) == 10957, "2000-01-01 is day 10957");
+	static_assert(WeekDay(DaysFromCivil(Date{2000, 1, 1})) == 6, "2000-01-01 was a Saturday");
+	static_assert(Detail::CalendarMatches(2000, 2099), "Day numbers deviate from the calendar");
+	static_assert(ToUnixMilliseconds(FromUnixMilliseconds(-1)) == -1, "Times before 1970 round toward the past");
+	static_assert(FromUnixMilliseconds(4102444799999).Date.Year == 2099, "Last millisecond of the RTC range");
+}
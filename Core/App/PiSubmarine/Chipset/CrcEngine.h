@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "main.h"
+
+namespace PiSubmarine::Chipset
+{
+	/// CRC-32/MPEG-2 of the Api packets and the local frames: polynomial 0x04C11DB7, initial value
+	/// 0xFFFFFFFF, byte input, no reflection and no final XOR, the reset configuration of the CRC unit.
+	/// Data split over several buffers is accumulated: Begin(), Accumulate() per fragment, then GetValue().
+	/// The unit holds the running value of one computation, so it is used from the main loop only.
+	class CrcEngine
+	{
+	public:
+		constexpr static uint32_t Polynomial = 0x04C11DB7;
+		constexpr static uint32_t InitialValue = 0xFFFFFFFF;
+
+		explicit CrcEngine(CRC_HandleTypeDef *handle) : m_Handle(handle)
+		{
+
+		}
+
+		[[nodiscard]] uint32_t Calculate(const uint8_t *data, size_t size)
+		{
+			// The HAL takes a word pointer but reads bytes in the byte input format
+			m_Value = HAL_CRC_Calculate(m_Handle, reinterpret_cast<uint32_t*>(const_cast<uint8_t*>(data)), size);
+			return m_Value;
+		}
+
+		void Begin()
+		{
+			__HAL_CRC_DR_RESET(m_Handle);
+			m_Value = InitialValue;
+		}
+
+		void Accumulate(const uint8_t *data, size_t size)
+		{
+			m_Value = HAL_CRC_Accumulate(m_Handle, reinterpret_cast<uint32_t*>(const_cast<uint8_t*>(data)), size);
+		}
+
+		/// CRC of everything accumulated since Begin()
+		[[nodiscard]] uint32_t GetValue() const
+		{
+			return m_Value;
+		}
+
+		/// Same CRC in software, 8 bits per step with a 1 KB table. Pass the previous result as crc to
+		/// continue over another fragment. Used where the unit is not available, the simulation models
+		/// the unit with it.
+		[[nodiscard]] static uint32_t CalculateSoftware(const uint8_t *data, size_t size, uint32_t crc = InitialValue)
+		{
+			for (size_t i = 0; i < size; i++)
+			{
+				crc = (crc << 8) ^ Table[(crc >> 24) ^ data[i]];
+			}
+			return crc;
+		}
+
+	private:
+		CRC_HandleTypeDef *m_Handle;
+		uint32_t m_Value = InitialValue;
+
+		constexpr static std::array<uint32_t, 256> MakeTable()
+		{
+			std::array<uint32_t, 256> table{};
+			for (uint32_t i = 0; i < table.size(); i++)
+			{
+				uint32_t crc = i << 24;
+				for (int bit = 0; bit < 8; bit++)
+				{
+					crc = (crc & 0x80000000) ? (crc << 1) ^ Polynomial : crc << 1;
+				}
+				table[i] = crc;
+			}
+			return table;
+		}
+
+		static const std::array<uint32_t, 256> Table;
+	};
+
+	inline constexpr std::array<uint32_t, 256> CrcEngine::Table = CrcEngine::MakeTable();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__arm__)
+#include "main.h"
+#endif
+
+namespace PiSubmarine::Chipset
+{
+	/// Masks interrupts for the lifetime of the object and restores the previous PRIMASK on exit.
+	/// Cortex-M0+ has no LDREX/STREX, so this is the only way to do read-modify-write on state shared with ISRs.
+	class CriticalSection
+	{
+	public:
+		CriticalSection()
+		{
+#if defined(__arm__)
+			m_Primask = __get_PRIMASK();
+			__disable_irq();
+#endif
+		}
+
+		~CriticalSection()
+		{
+#if defined(__arm__)
+			__set_PRIMASK(m_Primask);
+#endif
+		}
+
+		CriticalSection(const CriticalSection&) = delete;
+		CriticalSection& operator=(const CriticalSection&) = delete;
+
+	private:
+		uint32_t m_Primask = 0;
+	};
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "main.h"
+#include "PiSubmarine/Chipset/CriticalSection.h"
+#include "PiSubmarine/Chipset/TokenizedLog.h"
+
+namespace PiSubmarine::Chipset
+{
+	/// Code measured by CycleProfiler. Interrupt handlers come first, main loop handlers after FirstMainLoop.
+	enum class ProfileSlot : uint8_t
+	{
+		LptimAutoReload,
+		GpioRising,
+		I2CMaster,
+		AdcHalfComplete,
+		AdcComplete,
+		AdcWatchdog,
+		I2CAddress,
+		I2CListenComplete,
+		I2CSlaveRxComplete,
+		I2CSlaveTxComplete,
+		I2CError,
+		GpioFalling,
+		RtcAlarm,
+
+		TickWaitForReg12,
+		TickWaitForReg5,
+		TickWaitForRegPi,
+		TickRunning,
+		TickStandby,
+		DrainEvents,
+
+		Count,
+		FirstMainLoop = TickWaitForReg12
+	};
+
+	/// Always-on cycle accounting. Cortex-M0+ has no DWT cycle counter, so the 32-bit TIM2 runs
+	/// unprescaled from PCLK, which equals HCLK: one tick is one core cycle, and it wraps after
+	/// 268 s at 16 MHz. Handler times exclude the sleeps and interrupts that happened inside them.
+	/// The counter halts in STOP mode, time spent there is not counted.
+	class CycleProfiler
+	{
+	public:
+		constexpr static size_t SlotCount = static_cast<size_t>(ProfileSlot::Count);
+
+		struct SlotStats
+		{
+			uint32_t Count = 0;
+			uint32_t Min = UINT32_MAX;
+			uint32_t Max = 0;
+			uint64_t Total = 0;
+
+			[[nodiscard]] uint32_t GetAverage() const
+			{
+				return Count == 0 ? 0 : static_cast<uint32_t>(Total / Count);
+			}
+		};
+
+		explicit CycleProfiler(TIM_TypeDef *timer) : m_Timer(timer)
+		{
+
+		}
+
+		void Start()
+		{
+			// TIM HAL is not part of this project, the timer only has to count
+			__HAL_RCC_TIM2_CLK_ENABLE();
+			m_Timer->CR1 = 0;
+			m_Timer->PSC = 0;
+			m_Timer->ARR = UINT32_MAX;
+			m_Timer->EGR = TIM_EGR_UG;
+			m_Timer->CR1 = TIM_CR1_CEN;
+			m_Mark = Now();
+		}
+
+		[[nodiscard]] uint32_t Now() const
+		{
+			return m_Timer->CNT;
+		}
+
+		/// Cycles spent in sleeps and interrupt handlers so far, modulo 2^32
+		[[nodiscard]] uint32_t GetExcluded() const
+		{
+			return m_Excluded;
+		}
+
+		/// Called by the scope that measured the slot. Interrupt slots are only written from
+		/// interrupts and main loop slots only from the main loop, so no lock is needed.
+		void Record(ProfileSlot slot, uint32_t cycles)
+		{
+			SlotStats &stats = m_Slots[static_cast<size_t>(slot)];
+			stats.Count++;
+			stats.Total += cycles;
+			if (cycles < stats.Min)
+			{
+				stats.Min = cycles;
+			}
+			if (cycles > stats.Max)
+			{
+				stats.Max = cycles;
+			}
+
+			if (slot < ProfileSlot::FirstMainLoop)
+			{
+				// Interrupts share one priority and never nest, this is the only writer while it runs
+				m_Excluded = m_Excluded + cycles;
+			}
+		}
+
+		/// Called with interrupts masked around the WFI. The LPTIM wakes the core at least once per
+		/// 65 s, so the 32-bit differences never wrap.
+		void OnIdle(uint32_t start, uint32_t end)
+		{
+			uint32_t sleep = end - start;
+			m_AwakeCycles += start - m_Mark;
+			m_SleepCycles += sleep;
+			m_Excluded = m_Excluded + sleep;
+			m_Mark = end;
+		}
+
+		/// Copied under lock, an interrupt could update the 64-bit total halfway through the read
+		[[nodiscard]] SlotStats GetSlot(ProfileSlot slot) const
+		{
+			CriticalSection lock;
+			return m_Slots[static_cast<size_t>(slot)];
+		}
+
+		void GetDutyCycle(uint64_t &awakeCycles, uint64_t &sleepCycles) const
+		{
+			CriticalSection lock;
+			awakeCycles = m_AwakeCycles + (Now() - m_Mark);
+			sleepCycles = m_SleepCycles;
+		}
+
+		void Reset()
+		{
+			CriticalSection lock;
+			m_Slots = {};
+			m_AwakeCycles = 0;
+			m_SleepCycles = 0;
+			m_Mark = Now();
+		}
+
+		/// Slot name as a string token for CHIPSET_LOG()
+		static uint16_t GetSlotToken(ProfileSlot slot)
+		{
+			switch (slot)
+			{
+			case ProfileSlot::LptimAutoReload:
+				return CHIPSET_LOG_STRING("LptimAutoReload");
+			case ProfileSlot::GpioRising:
+				return CHIPSET_LOG_STRING("GpioRising");
+			case ProfileSlot::I2CMaster:
+				return CHIPSET_LOG_STRING("I2CMaster");
+			case ProfileSlot::AdcHalfComplete:
+				return CHIPSET_LOG_STRING("AdcHalfComplete");
+			case ProfileSlot::AdcComplete:
+				return CHIPSET_LOG_STRING("AdcComplete");
+			case ProfileSlot::AdcWatchdog:
+				return CHIPSET_LOG_STRING("AdcWatchdog");
+			case ProfileSlot::I2CAddress:
+				return CHIPSET_LOG_STRING("I2CAddress");
+			case ProfileSlot::I2CListenComplete:
+				return CHIPSET_LOG_STRING("I2CListenComplete");
+			case ProfileSlot::I2CSlaveRxComplete:
+				return CHIPSET_LOG_STRING("I2CSlaveRxComplete");
+			case ProfileSlot::I2CSlaveTxComplete:
+				return CHIPSET_LOG_STRING("I2CSlaveTxComplete");
+			case ProfileSlot::I2CError:
+				return CHIPSET_LOG_STRING("I2CError");
+			case ProfileSlot::GpioFalling:
+				return CHIPSET_LOG_STRING("GpioFalling");
+			case ProfileSlot::RtcAlarm:
+				return CHIPSET_LOG_STRING("RtcAlarm");
+			case ProfileSlot::TickWaitForReg12:
+				return CHIPSET_LOG_STRING("TickWaitForReg12");
+			case ProfileSlot::TickWaitForReg5:
+				return CHIPSET_LOG_STRING("TickWaitForReg5");
+			case ProfileSlot::TickWaitForRegPi:
+				return CHIPSET_LOG_STRING("TickWaitForRegPi");
+			case ProfileSlot::TickRunning:
+				return CHIPSET_LOG_STRING("TickRunning");
+			case ProfileSlot::TickStandby:
+				return CHIPSET_LOG_STRING("TickStandby");
+			case ProfileSlot::DrainEvents:
+				return CHIPSET_LOG_STRING("DrainEvents");
+			default:
+				return CHIPSET_LOG_STRING("?");
+			}
+		}
+
+	private:
+		TIM_TypeDef *m_Timer;
+		std::array<SlotStats, SlotCount> m_Slots{};
+		volatile uint32_t m_Excluded = 0;
+		uint32_t m_Mark = 0;
+		uint64_t m_AwakeCycles = 0;
+		uint64_t m_SleepCycles = 0;
+	};
+
+	/// Measures the enclosing block into a slot of the profiler
+	class ProfileScope
+	{
+	public:
+		ProfileScope(CycleProfiler &profiler, ProfileSlot slot) :
+				m_Profiler(profiler), m_Slot(slot), m_Start(profiler.Now()), m_Excluded(profiler.GetExcluded())
+		{
+
+		}
+
+		~ProfileScope()
+		{
+			uint32_t elapsed = m_Profiler.Now() - m_Start;
+			uint32_t excluded = m_Profiler.GetExcluded() - m_Excluded;
+			m_Profiler.Record(m_Slot, elapsed - excluded);
+		}
+
+		ProfileScope(const ProfileScope&) = delete;
+		ProfileScope& operator=(const ProfileScope&) = delete;
+
+	private:
+		CycleProfiler &m_Profiler;
+		ProfileSlot m_Slot;
+		uint32_t m_Start;
+		uint32_t m_Excluded;
+	};
+}
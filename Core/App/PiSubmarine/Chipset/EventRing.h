@@ -0,0 +1,72 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace PiSubmarine::Chipset
+{
+	/// Single-producer/single-consumer lock-free ring buffer.
+	/// Only aligned 32-bit loads and stores are used, which are atomic on Cortex-M0+ without LDREX/STREX.
+	/// Indices run freely and are masked on access, so all Capacity slots are usable.
+	template<typename T, size_t Capacity>
+	class EventRing
+	{
+		static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+		constexpr static uint32_t Mask = Capacity - 1;
+
+	public:
+		/// Producer side. Returns false and counts a drop if the ring is full.
+		bool Push(const T &item)
+		{
+			uint32_t head = m_Head.load(std::memory_order_relaxed);
+			uint32_t tail = m_Tail.load(std::memory_order_acquire);
+			if (head - tail >= Capacity)
+			{
+				m_Dropped.store(m_Dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				return false;
+			}
+
+			m_Items[head & Mask] = item;
+			m_Head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		/// Consumer side. Returns false if the ring is empty.
+		bool Pop(T &item)
+		{
+			uint32_t tail = m_Tail.load(std::memory_order_relaxed);
+			uint32_t head = m_Head.load(std::memory_order_acquire);
+			if (head == tail)
+			{
+				return false;
+			}
+
+			item = m_Items[tail & Mask];
+			m_Tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		[[nodiscard]] bool IsEmpty() const
+		{
+			return m_Head.load(std::memory_order_acquire) == m_Tail.load(std::memory_order_acquire);
+		}
+
+		[[nodiscard]] size_t GetSize() const
+		{
+			return m_Head.load(std::memory_order_acquire) - m_Tail.load(std::memory_order_acquire);
+		}
+
+		[[nodiscard]] uint32_t GetDroppedCount() const
+		{
+			return m_Dropped.load(std::memory_order_relaxed);
+		}
+
+	private:
+		std::array<T, Capacity> m_Items{};
+		std::atomic<uint32_t> m_Head{0};
+		std::atomic<uint32_t> m_Tail{0};
+		std::atomic<uint32_t> m_Dropped{0};
+	};
+}
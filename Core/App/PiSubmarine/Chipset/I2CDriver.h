@@ -1,24 +1,39 @@
 #pragma once
 
 #include "main.h"
-#include <functional>
+#include <array>
+#include <chrono>
 #include <cstring>
-#include "PiSubmarine/I2C/Api/IDriverAsync.h"
+#include "PiSubmarine/Chipset/InplaceDelegate.h"
+#include "PiSubmarine/Chipset/IWakeupTimer.h"
+#include "PiSubmarine/Chipset/CriticalSection.h"
 
 namespace PiSubmarine::Chipset
 {
-	class I2CDriver : public I2C::Api::IDriverAsync
+	enum class I2CStatus : uint8_t
 	{
-		using I2CCallback = std::function<void(uint8_t deviceAddress, bool)>;
+		Ok,
+		Error,
+		Timeout
+	};
+
+	template<size_t QueueCapacity, size_t ArenaSize>
+	struct I2CDriverStorage;
 
+	/// Master driver with a FIFO of queued DMA transactions. The next transaction is started from the
+	/// completion interrupt of the previous one, so callers never have to wait for the bus to be free.
+	/// The descriptors and the write arena are owned by StaticI2CDriver, sized per bus.
+	class I2CDriver
+	{
 		constexpr static uint32_t HalDelay = 1000;
 
 	public:
-		explicit I2CDriver(I2C_HandleTypeDef& i2cHandle) : m_I2CHandle(i2cHandle)
-		{
+		constexpr static std::chrono::milliseconds DefaultTimeout{20};
 
-		}
+		/// Completion callback storage, room for a lambda capturing one pointer such as [this]
+		using CompletionDelegate = InplaceDelegate<void(uint8_t deviceAddress, I2CStatus status), sizeof(void*)>;
 
+		/// Blocking transfers. Must not be mixed with queued ones.
 		bool Read(uint8_t deviceAddress, uint8_t* rxData, size_t len) const
 		{
 			return HAL_I2C_Master_Receive(&m_I2CHandle, deviceAddress << 1, rxData, len, HalDelay) == HAL_OK;
@@ -29,30 +44,58 @@ namespace PiSubmarine::Chipset
 			return HAL_I2C_Master_Transmit(&m_I2CHandle, deviceAddress << 1, txData, len, HalDelay) == HAL_OK;
 		}
 
-		bool ReadAsync(uint8_t deviceAddress, uint8_t* rxData, size_t len, I2CCallback callback) override
+		/// Queues a register address write followed by a repeated-start read. rxData must stay valid
+		/// until the callback runs. Returns false if the descriptor pool is exhausted.
+		bool ReadRegisters(uint8_t deviceAddress, uint8_t reg, uint8_t* rxData, size_t len, CompletionDelegate callback, std::chrono::milliseconds timeout = DefaultTimeout)
 		{
-			if(m_Callback)
-			{
-				return false;
-			}
-			m_LastAddress = deviceAddress;
-			m_Callback = callback;
-			return HAL_I2C_Master_Receive_DMA(&m_I2CHandle, deviceAddress << 1, rxData, len) == HAL_OK;
+			return Submit(Kind::ReadRegisters, deviceAddress, reg, rxData, len, std::move(callback), timeout);
+		}
+
+		/// Queues a register address plus data write. The data is copied, the caller may reuse txData at once.
+		bool WriteRegisters(uint8_t deviceAddress, uint8_t reg, const uint8_t* txData, size_t len, CompletionDelegate callback, std::chrono::milliseconds timeout = DefaultTimeout)
+		{
+			return Submit(Kind::WriteRegisters, deviceAddress, reg, const_cast<uint8_t*>(txData), len, std::move(callback), timeout);
 		}
 
-		bool WriteAsync(uint8_t deviceAddress, uint8_t* txData, size_t len, I2CCallback callback) override
+		/// Main loop. Fails the active transaction with I2CStatus::Timeout once its deadline has passed.
+		void CheckTimeouts()
 		{
-			if(m_Callback)
+			CriticalSection lock;
+			if (m_Count == 0 || m_Aborting)
 			{
-				return false;
+				return;
+			}
+
+			Transaction &active = m_Transactions[m_Head];
+			if (m_Clock.Now() < active.Deadline)
+			{
+				return;
+			}
+
+			m_TimeoutCount++;
+			m_Aborting = true;
+			if (HAL_I2C_Master_Abort_IT(&m_I2CHandle, active.Address << 1) != HAL_OK)
+			{
+				// Not in a master transfer anymore, the peripheral is reset instead
+				HAL_I2C_DeInit(&m_I2CHandle);
+				HAL_I2C_Init(&m_I2CHandle);
+				m_Aborting = false;
+			}
+			CompleteHead(I2CStatus::Timeout);
+			if (!m_Aborting)
+			{
+				StartNext();
 			}
+		}
 
-			m_LastAddress = deviceAddress;
-			m_Callback = callback;
+		[[nodiscard]] bool IsIdle() const
+		{
+			return m_Count == 0;
+		}
 
-			memcpy(m_TransmitBuffer.data(), txData, len);
-			auto halResult = HAL_I2C_Master_Transmit_DMA(&m_I2CHandle, deviceAddress << 1, m_TransmitBuffer.data(), len);
-			return halResult == HAL_OK;
+		[[nodiscard]] uint32_t GetTimeoutCount() const
+		{
+			return m_TimeoutCount;
 		}
 
 		void OnMasterTxCplt(I2C_HandleTypeDef *hi2c)
@@ -62,12 +105,7 @@ namespace PiSubmarine::Chipset
 				return;
 			}
 
-			auto cb = m_Callback;
-			m_Callback = nullptr;
-			if(cb)
-			{
-				cb(m_LastAddress, true);
-			}
+			Finish(I2CStatus::Ok);
 		}
 
 		void OnMasterRxCplt(I2C_HandleTypeDef *hi2c)
@@ -77,12 +115,7 @@ namespace PiSubmarine::Chipset
 				return;
 			}
 
-			auto cb = m_Callback;
-			m_Callback = nullptr;
-			if(cb)
-			{
-				cb(m_LastAddress, true);
-			}
+			Finish(I2CStatus::Ok);
 		}
 
 		void OnErrorCallback(I2C_HandleTypeDef *hi2c)
@@ -92,12 +125,20 @@ namespace PiSubmarine::Chipset
 				return;
 			}
 
-			auto cb = m_Callback;
-			m_Callback = nullptr;
-			if(cb)
+			Finish(I2CStatus::Error);
+		}
+
+		/// The abort requested by CheckTimeouts() has finished, the bus is free again
+		void OnAbortCplt(I2C_HandleTypeDef *hi2c)
+		{
+			if(&m_I2CHandle != hi2c)
 			{
-				cb(m_LastAddress, false);
+				return;
 			}
+
+			CriticalSection lock;
+			m_Aborting = false;
+			StartNext();
 		}
 
 		[[nodiscard]] I2C_HandleTypeDef* GetHandlePtr() const
@@ -105,11 +146,225 @@ namespace PiSubmarine::Chipset
 			return &m_I2CHandle;
 		}
 
+		[[nodiscard]] size_t GetQueueCapacity() const
+		{
+			return m_QueueCapacity;
+		}
+
+		[[nodiscard]] size_t GetArenaSize() const
+		{
+			return m_ArenaSize;
+		}
+
+	protected:
+		template<size_t QueueCapacity, size_t ArenaSize>
+		friend struct I2CDriverStorage;
+
+		enum class Kind : uint8_t
+		{
+			ReadRegisters,
+			WriteRegisters
+		};
+
+		struct Transaction
+		{
+			Kind Type = Kind::ReadRegisters;
+			uint8_t Address = 0;
+			uint8_t Register = 0;
+			uint16_t Length = 0;
+			uint8_t *Data = nullptr;
+			uint16_t ArenaBytes = 0;
+			std::chrono::milliseconds Timeout{0};
+			std::chrono::milliseconds Deadline{0};
+			CompletionDelegate Callback;
+		};
+
+		I2CDriver(I2C_HandleTypeDef& i2cHandle, const IWakeupTimer& clock, Transaction* transactions, size_t queueCapacity, uint8_t* arena, size_t arenaSize) :
+				m_I2CHandle(i2cHandle), m_Clock(clock), m_Transactions(transactions), m_QueueCapacity(queueCapacity), m_Arena(arena), m_ArenaSize(arenaSize)
+		{
+
+		}
+
 	private:
 		I2C_HandleTypeDef& m_I2CHandle;
-		uint8_t m_LastAddress = 0;
-		I2CCallback m_Callback = nullptr;
+		const IWakeupTimer& m_Clock;
+
+		/// FIFO of descriptors; m_Head is the active one
+		Transaction* m_Transactions;
+		size_t m_QueueCapacity;
+		volatile size_t m_Head = 0;
+		volatile size_t m_Count = 0;
+		volatile bool m_Active = false;
+		volatile bool m_Aborting = false;
+		uint32_t m_TimeoutCount = 0;
+
+		/// Write payloads are copied here. Allocated and freed in FIFO order together with the descriptors.
+		uint8_t* m_Arena;
+		size_t m_ArenaSize;
+		size_t m_ArenaHead = 0;
+		size_t m_ArenaUsed = 0;
+
+		bool Submit(Kind type, uint8_t deviceAddress, uint8_t reg, uint8_t* data, size_t len, CompletionDelegate&& callback, std::chrono::milliseconds timeout)
+		{
+			CriticalSection lock;
+			if (m_Count == m_QueueCapacity || len > UINT16_MAX)
+			{
+				return false;
+			}
+
+			size_t index = (m_Head + m_Count) % m_QueueCapacity;
+			Transaction &transaction = m_Transactions[index];
+			transaction.Type = type;
+			transaction.Address = deviceAddress;
+			transaction.Register = reg;
+			transaction.Length = static_cast<uint16_t>(len);
+			transaction.Data = data;
+			transaction.Timeout = timeout;
+			transaction.ArenaBytes = 0;
+
+			if (type == Kind::WriteRegisters)
+			{
+				size_t arenaBytes = 0;
+				uint8_t *copy = AllocateArena(len, arenaBytes);
+				if (copy == nullptr)
+				{
+					return false;
+				}
+				memcpy(copy, data, len);
+				transaction.Data = copy;
+				transaction.ArenaBytes = static_cast<uint16_t>(arenaBytes);
+			}
+
+			transaction.Callback = std::move(callback);
+			m_Count = m_Count + 1;
+			if (!m_Aborting)
+			{
+				StartNext();
+			}
+			return true;
+		}
+
+		/// Payloads are freed in allocation order, so the used byte count alone tells where the free space is
+		uint8_t* AllocateArena(size_t len, size_t &arenaBytes)
+		{
+			size_t start = m_ArenaUsed == 0 ? 0 : m_ArenaHead;
+			size_t wasted = 0;
+			if (start + len > m_ArenaSize)
+			{
+				// Payloads are contiguous: skip the end of the arena
+				wasted = m_ArenaSize - start;
+				start = 0;
+			}
+			if (m_ArenaUsed + wasted + len > m_ArenaSize)
+			{
+				return nullptr;
+			}
+			arenaBytes = wasted + len;
+			m_ArenaUsed += arenaBytes;
+			m_ArenaHead = (start + len) % m_ArenaSize;
+			return &m_Arena[start];
+		}
+
+		/// Starts the head transaction unless one is already on the bus. Transactions that fail to start
+		/// are completed with an error.
+		void StartNext()
+		{
+			while (m_Count > 0 && !m_Active)
+			{
+				Transaction &transaction = m_Transactions[m_Head];
+				transaction.Deadline = m_Clock.Now() + transaction.Timeout;
 
-		std::array<uint8_t, 255> m_TransmitBuffer{0};
+				uint16_t address = transaction.Address << 1;
+				HAL_StatusTypeDef result = HAL_ERROR;
+				switch (transaction.Type)
+				{
+				case Kind::ReadRegisters:
+					result = HAL_I2C_Mem_Read_DMA(&m_I2CHandle, address, transaction.Register, I2C_MEMADD_SIZE_8BIT, transaction.Data, transaction.Length);
+					break;
+				case Kind::WriteRegisters:
+					result = HAL_I2C_Mem_Write_DMA(&m_I2CHandle, address, transaction.Register, I2C_MEMADD_SIZE_8BIT, transaction.Data, transaction.Length);
+					break;
+				}
+
+				if (result == HAL_OK)
+				{
+					m_Active = true;
+					return;
+				}
+				CompleteHead(I2CStatus::Error);
+			}
+		}
+
+		/// ISR side: the active transaction has ended
+		void Finish(I2CStatus status)
+		{
+			CriticalSection lock;
+			if (m_Aborting)
+			{
+				// The transfer that timed out was already completed. An error ends its abort like
+				// OnAbortCplt() does, a late success is ignored until the abort finishes.
+				if (status == I2CStatus::Error)
+				{
+					m_Aborting = false;
+					StartNext();
+				}
+				return;
+			}
+
+			if (m_Count == 0)
+			{
+				return;
+			}
+
+			CompleteHead(status);
+			StartNext();
+		}
+
+		void CompleteHead(I2CStatus status)
+		{
+			Transaction &transaction = m_Transactions[m_Head];
+			uint8_t address = transaction.Address;
+			CompletionDelegate callback = std::move(transaction.Callback);
+
+			m_Active = false;
+			m_ArenaUsed -= transaction.ArenaBytes;
+			m_Head = (m_Head + 1) % m_QueueCapacity;
+			m_Count = m_Count - 1;
+
+			// Runs with the slot already free, so the callback can queue a follow-up transaction
+			if (callback)
+			{
+				callback(address, status);
+			}
+		}
+	};
+
+	/// Descriptors and arena of a StaticI2CDriver. A base class of it, so it is constructed before I2CDriver.
+	template<size_t QueueCapacity, size_t ArenaSize>
+	struct I2CDriverStorage
+	{
+		std::array<I2CDriver::Transaction, QueueCapacity> Transactions;
+		std::array<uint8_t, ArenaSize> Arena{0};
+	};
+
+	/// I2CDriver with QueueCapacity descriptors and an ArenaSize byte arena for write payloads.
+	/// The arena must hold the longest write that is queued on the bus.
+	template<size_t QueueCapacityValue, size_t ArenaSizeValue>
+	class StaticI2CDriver : private I2CDriverStorage<QueueCapacityValue, ArenaSizeValue>, public I2CDriver
+	{
+		static_assert(QueueCapacityValue > 0, "I2CDriver needs at least one descriptor");
+		static_assert(ArenaSizeValue > 0, "I2CDriver needs an arena");
+
+		using Storage = I2CDriverStorage<QueueCapacityValue, ArenaSizeValue>;
+
+	public:
+		constexpr static size_t QueueCapacity = QueueCapacityValue;
+		constexpr static size_t ArenaSize = ArenaSizeValue;
+
+		StaticI2CDriver(I2C_HandleTypeDef& i2cHandle, const IWakeupTimer& clock) :
+				Storage(), I2CDriver(i2cHandle, clock, Storage::Transactions.data(), QueueCapacity, Storage::Arena.data(), ArenaSize)
+		{
+
+		}
 	};
 }
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <chrono>
+
+namespace PiSubmarine::Chipset
+{
+	/// Hardware side of the Scheduler: a monotonic millisecond clock plus a single wakeup deadline.
+	/// The firmware implementation is LptimWakeupTimer; tests and the host build can provide a fake clock.
+	class IWakeupTimer
+	{
+	public:
+		virtual ~IWakeupTimer() = default;
+
+		virtual std::chrono::milliseconds Now() const = 0;
+
+		/// Arms the wakeup for the given absolute deadline.
+		/// Returns false if the deadline has already been reached, in which case the caller must not sleep.
+		virtual bool ArmWakeup(std::chrono::milliseconds deadline) = 0;
+
+		virtual void DisarmWakeup() = 0;
+
+		/// Called with interrupts masked. Must return once any interrupt is pending.
+		virtual void Idle() = 0;
+	};
+}
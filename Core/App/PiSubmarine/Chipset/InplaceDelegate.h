@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace PiSubmarine::Chipset
+{
+	template<typename Signature, size_t Capacity = 2 * sizeof(void*)>
+	class InplaceDelegate;
+
+	/// Move-only callable wrapper that keeps the target inside the object and never allocates.
+	/// Targets larger than Capacity are rejected at compile time. Trivially copyable targets,
+	/// such as lambdas capturing a few pointers, are moved with a plain memcpy.
+	template<typename R, typename... Args, size_t Capacity>
+	class InplaceDelegate<R(Args...), Capacity>
+	{
+	public:
+		InplaceDelegate() = default;
+
+		InplaceDelegate(std::nullptr_t)
+		{
+
+		}
+
+		template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InplaceDelegate>
+				&& !std::is_same_v<std::decay_t<F>, std::nullptr_t>>>
+		InplaceDelegate(F &&function)
+		{
+			Emplace(std::forward<F>(function));
+		}
+
+		InplaceDelegate(InplaceDelegate &&other) noexcept
+		{
+			MoveFrom(other);
+		}
+
+		InplaceDelegate& operator=(InplaceDelegate &&other) noexcept
+		{
+			if (this != &other)
+			{
+				Reset();
+				MoveFrom(other);
+			}
+			return *this;
+		}
+
+		InplaceDelegate& operator=(std::nullptr_t)
+		{
+			Reset();
+			return *this;
+		}
+
+		InplaceDelegate(const InplaceDelegate&) = delete;
+		InplaceDelegate& operator=(const InplaceDelegate&) = delete;
+
+		~InplaceDelegate()
+		{
+			Reset();
+		}
+
+		template<typename F>
+		void Emplace(F &&function)
+		{
+			using Target = std::decay_t<F>;
+			static_assert(sizeof(Target) <= Capacity, "Callable does not fit into the delegate, reduce its captures");
+			static_assert(alignof(Target) <= alignof(std::max_align_t), "Callable is over-aligned");
+			static_assert(std::is_nothrow_move_constructible_v<Target>, "Callable must be nothrow move constructible");
+			static_assert(std::is_invocable_r_v<R, Target&, Args...>, "Callable does not match the delegate signature");
+
+			Reset();
+			new (m_Storage) Target(std::forward<F>(function));
+			m_Invoke = [](void *storage, Args... args) -> R
+			{
+				return (*static_cast<Target*>(storage))(std::forward<Args>(args)...);
+			};
+
+			if constexpr (!std::is_trivially_copyable_v<Target>)
+			{
+				m_Manage = [](void *destination, void *source)
+				{
+					if (destination != nullptr)
+					{
+						new (destination) Target(std::move(*static_cast<Target*>(source)));
+					}
+					static_cast<Target*>(source)->~Target();
+				};
+			}
+		}
+
+		void Reset()
+		{
+			if (m_Manage != nullptr)
+			{
+				m_Manage(nullptr, m_Storage);
+			}
+			m_Invoke = nullptr;
+			m_Manage = nullptr;
+		}
+
+		R operator()(Args... args) const
+		{
+			return m_Invoke(m_Storage, std::forward<Args>(args)...);
+		}
+
+		explicit operator bool() const
+		{
+			return m_Invoke != nullptr;
+		}
+
+	private:
+		using InvokeFunc = R (*)(void*, Args...);
+		/// Moves source into destination (if not null) and destroys source
+		using ManageFunc = void (*)(void *destination, void *source);
+
+		alignas(std::max_align_t) mutable unsigned char m_Storage[Capacity];
+		InvokeFunc m_Invoke = nullptr;
+		ManageFunc m_Manage = nullptr;
+
+		void MoveFrom(InplaceDelegate &other)
+		{
+			if (other.m_Manage != nullptr)
+			{
+				other.m_Manage(m_Storage, other.m_Storage);
+			}
+			else if (other.m_Invoke != nullptr)
+			{
+				std::memcpy(m_Storage, other.m_Storage, Capacity);
+			}
+			m_Invoke = other.m_Invoke;
+			m_Manage = other.m_Manage;
+			other.m_Invoke = nullptr;
+			other.m_Manage = nullptr;
+		}
+	};
+}
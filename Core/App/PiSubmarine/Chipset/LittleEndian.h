@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+namespace PiSubmarine::Chipset::LittleEndian
+{
+	inline void Write16(uint8_t *data, uint16_t value)
+	{
+		data[0] = static_cast<uint8_t>(value);
+		data[1] = static_cast<uint8_t>(value >> 8);
+	}
+
+	inline void Write32(uint8_t *data, uint32_t value)
+	{
+		Write16(data, static_cast<uint16_t>(value));
+		Write16(data + 2, static_cast<uint16_t>(value >> 16));
+	}
+
+	inline void Write64(uint8_t *data, uint64_t value)
+	{
+		Write32(data, static_cast<uint32_t>(value));
+		Write32(data + 4, static_cast<uint32_t>(value >> 32));
+	}
+
+	inline uint16_t Read16(const uint8_t *data)
+	{
+		return static_cast<uint16_t>(data[0] | (data[1] << 8));
+	}
+
+	inline uint32_t Read32(const uint8_t *data)
+	{
+		return Read16(data) | (static_cast<uint32_t>(Read16(data + 2)) << 16);
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+namespace PiSubmarine::Chipset
+{
+	/// Commands implemented by this firmware that Chipset.Api does not define yet.
+	/// IDs start at 0x80 to stay clear of Api::Command.
+	/// Requests are little-endian. Sent alone, they end with the CRC32 of the preceding bytes.
+	enum class LocalCommand : uint8_t
+	{
+		/// u8 command, u32 first sequence, u16 max records, u32 CRC.
+		/// The next read returns a history frame instead of PacketOut.
+		ReadHistory = 0x80,
+		/// u8 command, u8 first slot, u8 flags, u32 CRC. Flags: bit 0 resets the profiler after the read,
+		/// bit 1 also prints the table on USART1, bit 2 times the CRC paths and prints the result.
+		/// The next read returns a profile frame.
+		ReadProfile = 0x81,
+		/// u8 command, u8 entries length, entries, u32 CRC. An entry is a u8 length and a request:
+		/// a local command without its CRC or a whole Api packet. The entries run in order and the
+		/// next read returns one frame: u8 command, u8 entry count, per entry u8 command, u8 CommandStatus,
+		/// u16 length and the response a single request would get, zero padding, u32 CRC.
+		Batch = 0x82,
+		/// u8 command, u32 CRC. Clears the latched RailFault register, so the next sag is reported again.
+		/// The next read returns a frame of u8 command and the u8 rails of the cleared record.
+		ClearRailFault = 0x83,
+		/// u8 command, u8 entry count, four entries of u32 start, u32 period and u32 duration, u32 CRC.
+		/// Replaces the wake table: from Standby the chipset boots at each window and switches off when
+		/// it ends. Times are Unix seconds, entries past the count are ignored, count 0 clears the table.
+		/// A period of 0 is a single window. Rejected while the clock is not set, if a single window has
+		/// ended already or if a repeating window plus the grace time before the forced switch-off does
+		/// not fit its period. The next read returns a frame of u8 command, u8 entry count and the u64
+		/// Unix time in ms of the next window, 0 if there is none.
+		SetSchedule = 0x84,
+		/// u8 command, u8 Notify events, u32 CRC. Sets the events that assert CHIPSET_INT, see the
+		/// EventMask register. Disabled events are still latched in the Events register.
+		SetEventMask = 0x85
+	};
+
+	constexpr uint8_t FirstLocalCommand = 0x80;
+
+	/// Outcome of one entry of a batch
+	enum class CommandStatus : uint8_t
+	{
+		Ok = 0,
+		/// Wrong length or failed the Api packet check
+		Rejected = 1,
+		Unknown = 2,
+		/// Ran, but its response did not fit into the frame
+		NoSpace = 3
+	};
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "main.h"
+#include "lptim.h"
+#include "PiSubmarine/Chipset/IWakeupTimer.h"
+#include "PiSubmarine/Chipset/CriticalSection.h"
+
+namespace PiSubmarine::Chipset
+{
+	/// IWakeupTimer on a free-running LPTIM clocked at 1 kHz (LSI / 32).
+	/// The 16-bit counter is extended by counting auto-reload matches; CCR1 holds the next deadline.
+	class LptimWakeupTimer : public IWakeupTimer
+	{
+		constexpr static uint32_t CounterPeriod = 0x10000;
+
+	public:
+		explicit LptimWakeupTimer(LPTIM_HandleTypeDef &lptimHandle) : m_LptimHandle(lptimHandle)
+		{
+
+		}
+
+		void Start()
+		{
+			m_Overflows = 0;
+			m_Compare = CounterPeriod;
+			HAL_LPTIM_Counter_Start_IT(&m_LptimHandle);
+
+			__HAL_LPTIM_CLEAR_FLAG(&m_LptimHandle, LPTIM_FLAG_DIEROK);
+			__HAL_LPTIM_ENABLE_IT(&m_LptimHandle, LPTIM_IT_CC1);
+			while (!__HAL_LPTIM_GET_FLAG(&m_LptimHandle, LPTIM_FLAG_DIEROK))
+			{
+			}
+		}
+
+		/// Stops the counter, e.g. before STOP mode. Time spent stopped is not counted.
+		void Suspend()
+		{
+			m_Base = Now();
+			m_Overflows = 0;
+			HAL_LPTIM_Counter_Stop_IT(&m_LptimHandle);
+		}
+
+		void Resume()
+		{
+			Start();
+		}
+
+		std::chrono::milliseconds Now() const override
+		{
+			CriticalSection lock;
+			uint32_t overflows = m_Overflows;
+			uint32_t counter = ReadCounter();
+			if (__HAL_LPTIM_GET_FLAG(&m_LptimHandle, LPTIM_FLAG_ARRM))
+			{
+				// Wrapped, but the ISR has not run yet
+				counter = ReadCounter();
+				overflows++;
+			}
+			return m_Base + std::chrono::milliseconds(static_cast<int64_t>(overflows) * CounterPeriod + counter);
+		}
+
+		bool ArmWakeup(std::chrono::milliseconds deadline) override
+		{
+			auto now = Now();
+			auto delta = (deadline - now).count();
+			if (delta <= 0)
+			{
+				return false;
+			}
+
+			if (delta >= CounterPeriod - 1)
+			{
+				// Too far away: the auto-reload match wakes us at least once per period anyway
+				return true;
+			}
+
+			uint32_t compare = static_cast<uint32_t>((deadline - m_Base).count()) & (CounterPeriod - 1);
+			if (compare != m_Compare)
+			{
+				__HAL_LPTIM_CLEAR_FLAG(&m_LptimHandle, LPTIM_FLAG_CMP1OK);
+				__HAL_LPTIM_COMPARE_SET(&m_LptimHandle, LPTIM_CHANNEL_1, compare);
+				while (!__HAL_LPTIM_GET_FLAG(&m_LptimHandle, LPTIM_FLAG_CMP1OK))
+				{
+				}
+				m_Compare = compare;
+			}
+
+			// The counter may have passed the compare value while it was being written
+			return Now() < deadline;
+		}
+
+		void DisarmWakeup() override
+		{
+			// CC1 stays enabled and matches once per counter period. Such a spurious wakeup
+			// just makes the Scheduler re-check its timers and go back to sleep.
+		}
+
+		void Idle() override
+		{
+			HAL_SuspendTick();
+			HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
+			HAL_ResumeTick();
+		}
+
+		void OnAutoReloadMatch(LPTIM_HandleTypeDef *hlptim)
+		{
+			if (&m_LptimHandle != hlptim)
+			{
+				return;
+			}
+			m_Overflows = m_Overflows + 1;
+		}
+
+	private:
+		LPTIM_HandleTypeDef &m_LptimHandle;
+		std::chrono::milliseconds m_Base{0};
+		volatile uint32_t m_Overflows = 0;
+		uint32_t m_Compare = CounterPeriod;
+
+		uint32_t ReadCounter() const
+		{
+			// The counter runs asynchronously to APB: only two equal consecutive reads are reliable
+			uint32_t first;
+			uint32_t second = HAL_LPTIM_ReadCounter(&m_LptimHandle);
+			do
+			{
+				first = second;
+				second = HAL_LPTIM_ReadCounter(&m_LptimHandle);
+			} while (first != second);
+			return second;
+		}
+	};
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include "main.h"
+#include "PiSubmarine/Chipset/CriticalSection.h"
+
+namespace PiSubmarine::Chipset
+{
+	/// Events the Pi is notified of through CHIPSET_INT, the bits of the RegisterMap Events register
+	namespace Notify
+	{
+		/// A new telemetry sample was published
+		constexpr uint8_t AdcSample = 1 << 0;
+		constexpr uint8_t ChargerStatus = 1 << 1;
+		/// The RailFault register latched a sag
+		constexpr uint8_t Fault = 1 << 2;
+		/// A command was executed, its response frame is ready if it has one
+		constexpr uint8_t CommandComplete = 1 << 3;
+		/// A short press of the power button or the end of a scheduled window: the Pi shuts down and
+		/// then sends the Shutdown command
+		constexpr uint8_t ShutdownRequest = 1 << 4;
+		/// A double press of the power button, left to the Pi
+		constexpr uint8_t ButtonDouble = 1 << 5;
+
+		/// Events that assert the line until the Pi sets its own mask. A sample every 50 ms would keep
+		/// a Pi that sleeps until the edge awake, so it is only latched in the Events register.
+		constexpr uint8_t DefaultEnabled = static_cast<uint8_t>(~AdcSample);
+	}
+
+	/// Pending-event mask behind the CHIPSET_INT line to the Pi. The line goes high with Assert() and
+	/// stays high until the Pi takes the mask by reading the Events register. Raising and asserting are
+	/// separate, so the owner can coalesce events over a window. Only enabled events drive the line,
+	/// the others are still reported with the next read. All methods are safe in interrupts.
+	class Notifier
+	{
+	public:
+		Notifier(GPIO_TypeDef *port, uint16_t pin) : m_Port(port), m_Pin(pin)
+		{
+
+		}
+
+		void Raise(uint8_t events)
+		{
+			CriticalSection lock;
+			m_Pending = static_cast<uint8_t>(m_Pending | events);
+		}
+
+		/// Drives the line if enabled events are pending
+		void Assert()
+		{
+			CriticalSection lock;
+			if ((m_Pending & m_Enabled) != 0 && !m_Asserted)
+			{
+				m_Asserted = true;
+				HAL_GPIO_WritePin(m_Port, m_Pin, GPIO_PIN_SET);
+			}
+		}
+
+		/// Releases the line but keeps the events, e.g. while the Pi is unpowered
+		void Release()
+		{
+			CriticalSection lock;
+			m_Asserted = false;
+			HAL_GPIO_WritePin(m_Port, m_Pin, GPIO_PIN_RESET);
+		}
+
+		/// The Pi reads the mask: returns and clears the pending events and releases the line
+		uint8_t Take()
+		{
+			CriticalSection lock;
+			uint8_t events = m_Pending;
+			m_Pending = 0;
+			Release();
+			return events;
+		}
+
+		[[nodiscard]] uint8_t GetPending() const
+		{
+			return m_Pending;
+		}
+
+		[[nodiscard]] bool IsAsserted() const
+		{
+			return m_Asserted;
+		}
+
+		void SetEnabled(uint8_t events)
+		{
+			m_Enabled = events;
+		}
+
+		[[nodiscard]] uint8_t GetEnabled() const
+		{
+			return m_Enabled;
+		}
+
+	private:
+		GPIO_TypeDef *m_Port;
+		uint16_t m_Pin;
+		volatile uint8_t m_Enabled = Notify::DefaultEnabled;
+		volatile uint8_t m_Pending = 0;
+		volatile bool m_Asserted = false;
+	};
+}
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "main.h"
+#include "PiSubmarine/Chipset/CrcEngine.h"
+#include "PiSubmarine/Chipset/CriticalSection.h"
+#include "PiSubmarine/Chipset/LittleEndian.h"
+
+namespace PiSubmarine::Chipset
+{
+	/// What started this boot, from the RCC reset flags
+	enum class ResetCause : uint8_t
+	{
+		PowerOn,
+		Pin,
+		Software,
+		Watchdog,
+		/// Low power or option byte loader reset
+		Other
+	};
+
+	/// Why the firmware last switched the rails off
+	enum class ShutdownReason : uint8_t
+	{
+		None,
+		PiCommand,
+		/// The rail guard cycled REG5 after a sag
+		Brownout,
+		/// The power button was held while running
+		Button,
+		/// A scheduled window ended and the Pi did not shut down in time
+		Schedule
+	};
+
+	/// State kept across STOP and resets. The values of the previous boot are in the record until
+	/// Start() counts the new one.
+	struct PersistentRecord
+	{
+		constexpr static size_t CountedCauses = 4;
+		/// The charger holds the configuration written by an earlier boot
+		constexpr static uint8_t ChargerConfiguredFlag = 1 << 0;
+
+		uint32_t BootCount = 0;
+		/// Seconds since boot, summed over all boots
+		uint32_t UptimeSeconds = 0;
+		uint32_t SessionSeconds = 0;
+		/// Boots per ResetCause up to Watchdog, saturating at 255
+		std::array<uint8_t, CountedCauses> ResetCounts{};
+		uint8_t PowerState = 0;
+		ShutdownReason Shutdown = ShutdownReason::None;
+		uint8_t Flags = 0;
+	};
+
+	/// Persists a PersistentRecord in the RTC backup registers DR3 to DR8, next to the RtcClock offset.
+	/// The registers belong to the tamper domain: they survive resets and STOP and are only lost with
+	/// the backup domain or a tamper event, and writing them costs no flash wear. Five data words are
+	/// followed by a CRC-32 over them, a record torn by a reset in the middle of Save() fails the check.
+	/// Optionally the same words are mirrored in SRAM that the startup code does not clear. It survives
+	/// every reset except a power loss and is the fallback when the backup registers do not check out.
+	class PersistentState
+	{
+	public:
+		constexpr static uint32_t FirstRegister = RTC_BKP_DR3;
+		constexpr static size_t DataWords = 5;
+		constexpr static size_t WordCount = DataWords + 1;
+		using Words = std::array<uint32_t, WordCount>;
+		/// Changes with the layout, older records are discarded
+		constexpr static uint8_t Version = 1;
+		/// Uptime is written at most this often, other changes are written at once
+		constexpr static uint32_t UptimeSavePeriodSeconds = 60;
+
+		enum class Source : uint8_t
+		{
+			None,
+			BackupRegisters,
+			Mirror
+		};
+
+		/// mirror may be null, which disables the SRAM fallback
+		PersistentState(RTC_HandleTypeDef &handle, Words *mirror) : m_Handle(handle), m_Mirror(mirror)
+		{
+
+		}
+
+		/// Loads the record of the earlier boots and counts this one. Without a valid record the
+		/// counting starts over.
+		void Start(ResetCause cause)
+		{
+			Words words;
+			for (size_t i = 0; i < WordCount; i++)
+			{
+				words[i] = HAL_RTCEx_BKUPRead(&m_Handle, FirstRegister + i);
+			}
+			if (Decode(words, m_Previous))
+			{
+				m_Source = Source::BackupRegisters;
+			}
+			else if (m_Mirror != nullptr && Decode(*m_Mirror, m_Previous))
+			{
+				m_Source = Source::Mirror;
+			}
+			else
+			{
+				m_Source = Source::None;
+				m_Previous = PersistentRecord{};
+			}
+
+			m_Record = m_Previous;
+			m_Record.BootCount++;
+			m_Record.SessionSeconds = 0;
+			size_t index = static_cast<size_t>(cause);
+			if (index < m_Record.ResetCounts.size() && m_Record.ResetCounts[index] < UINT8_MAX)
+			{
+				m_Record.ResetCounts[index]++;
+			}
+			// A power loss may have reset the charger too
+			if (cause == ResetCause::PowerOn || cause == ResetCause::Other)
+			{
+				m_Record.Flags &= static_cast<uint8_t>(~PersistentRecord::ChargerConfiguredFlag);
+			}
+			Save();
+		}
+
+		[[nodiscard]] Source GetSource() const
+		{
+			return m_Source;
+		}
+
+		/// The record as the previous boot left it
+		[[nodiscard]] const PersistentRecord& GetPrevious() const
+		{
+			return m_Previous;
+		}
+
+		[[nodiscard]] const PersistentRecord& GetRecord() const
+		{
+			return m_Record;
+		}
+
+		void SetPowerState(uint8_t powerState)
+		{
+			m_Record.PowerState = powerState;
+			Save();
+		}
+
+		void SetShutdownReason(ShutdownReason reason)
+		{
+			m_Record.Shutdown = reason;
+			Save();
+		}
+
+		void SetFlags(uint8_t flags)
+		{
+			m_Record.Flags = flags;
+			Save();
+		}
+
+		/// Adds the time since boot to the uptime of the earlier boots
+		void SetSessionSeconds(uint32_t seconds)
+		{
+			m_Record.SessionSeconds = seconds;
+			m_Record.UptimeSeconds = m_Previous.UptimeSeconds + seconds;
+			if (seconds - m_SavedSessionSeconds >= UptimeSavePeriodSeconds)
+			{
+				Save();
+			}
+		}
+
+		/// Safe in interrupts, the CRC is computed in software
+		void Save()
+		{
+			Words words = Encode(m_Record);
+			CriticalSection lock;
+			for (size_t i = 0; i < WordCount; i++)
+			{
+				HAL_RTCEx_BKUPWrite(&m_Handle, FirstRegister + i, words[i]);
+			}
+			if (m_Mirror != nullptr)
+			{
+				*m_Mirror = words;
+			}
+			m_SavedSessionSeconds = m_Record.SessionSeconds;
+		}
+
+		static ResetCause ToResetCause(uint32_t resetFlags)
+		{
+			// A power-on reset also drives NRST, so the pin flag comes last
+			if (resetFlags & RCC_RESET_FLAG_PWR)
+			{
+				return ResetCause::PowerOn;
+			}
+			if (resetFlags & (RCC_RESET_FLAG_IWDG | RCC_RESET_FLAG_WWDG))
+			{
+				return ResetCause::Watchdog;
+			}
+			if (resetFlags & RCC_RESET_FLAG_SW)
+			{
+				return ResetCause::Software;
+			}
+			if (resetFlags & (RCC_RESET_FLAG_LPWR | RCC_RESET_FLAG_OBL))
+			{
+				return ResetCause::Other;
+			}
+			if (resetFlags & RCC_RESET_FLAG_PIN)
+			{
+				return ResetCause::Pin;
+			}
+			return ResetCause::Other;
+		}
+
+		static Words Encode(const PersistentRecord &record)
+		{
+			Words words{};
+			words[0] = Version | (record.Flags << 8) | (record.PowerState << 16) | (static_cast<uint32_t>(record.Shutdown) << 24);
+			words[1] = record.BootCount;
+			words[2] = record.UptimeSeconds;
+			words[3] = record.SessionSeconds;
+			words[4] = LittleEndian::Read32(record.ResetCounts.data());
+			words[DataWords] = Crc(words);
+			return words;
+		}
+
+		static bool Decode(const Words &words, PersistentRecord &record)
+		{
+			if (words[DataWords] != Crc(words) || (words[0] & 0xFF) != Version)
+			{
+				return false;
+			}
+			record.Flags = static_cast<uint8_t>(words[0] >> 8);
+			record.PowerState = static_cast<uint8_t>(words[0] >> 16);
+			record.Shutdown = static_cast<ShutdownReason>(words[0] >> 24);
+			record.BootCount = words[1];
+			record.UptimeSeconds = words[2];
+			record.SessionSeconds = words[3];
+			LittleEndian::Write32(record.ResetCounts.data(), words[4]);
+			return true;
+		}
+
+	private:
+		RTC_HandleTypeDef &m_Handle;
+		Words *m_Mirror;
+		Source m_Source = Source::None;
+		PersistentRecord m_Previous;
+		PersistentRecord m_Record;
+		uint32_t m_SavedSessionSeconds = 0;
+
+		static uint32_t Crc(const Words &words)
+		{
+			std::array<uint8_t, DataWords * sizeof(uint32_t)> bytes;
+			for (size_t i = 0; i < DataWords; i++)
+			{
+				LittleEndian::Write32(&bytes[i * sizeof(uint32_t)], words[i]);
+			}
+			return CrcEngine::CalculateSoftware(bytes.data(), bytes.size());
+		}
+	};
+}
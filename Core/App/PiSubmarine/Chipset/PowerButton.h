@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace PiSubmarine::Chipset
+{
+	enum class ButtonGesture : uint8_t
+	{
+		None,
+		/// Pressed and released once, with no second press within the double-press gap
+		Short,
+		/// Two presses, the second starting within the double-press gap
+		Double,
+		/// Held for the long-press time, reported while still held
+		Long
+	};
+
+	/// Classifies the debounced levels of BUTTON_PWR into gestures. It keeps no time itself: the owner
+	/// runs one timer for GetTimeout() after every call and reports its expiry with OnTimeout(). A short
+	/// press is only known once the double-press gap has passed.
+	class PowerButton
+	{
+	public:
+		PowerButton(std::chrono::milliseconds longPressTime, std::chrono::milliseconds doublePressGap) :
+				m_LongPressTime(longPressTime), m_DoublePressGap(doublePressGap)
+		{
+
+		}
+
+		/// Starts over at the given level. A button held at this point is ignored until it is released.
+		void Reset(bool pressed)
+		{
+			m_Pressed = pressed;
+			m_State = pressed ? State::Held : State::Idle;
+		}
+
+		/// A debounced level, repeated levels are ignored
+		ButtonGesture OnLevel(bool pressed)
+		{
+			if (pressed == m_Pressed)
+			{
+				return ButtonGesture::None;
+			}
+			m_Pressed = pressed;
+
+			switch (m_State)
+			{
+			case State::Idle:
+				m_State = State::FirstPress;
+				break;
+			case State::FirstPress:
+				m_State = State::Released;
+				break;
+			case State::Released:
+				m_State = State::SecondPress;
+				break;
+			case State::SecondPress:
+				m_State = State::Idle;
+				return ButtonGesture::Double;
+			case State::Held:
+				m_State = State::Idle;
+				break;
+			}
+			return ButtonGesture::None;
+		}
+
+		/// The timer of the last GetTimeout() expired
+		ButtonGesture OnTimeout()
+		{
+			switch (m_State)
+			{
+			case State::FirstPress:
+			case State::SecondPress:
+				m_State = State::Held;
+				return ButtonGesture::Long;
+			case State::Released:
+				m_State = State::Idle;
+				return ButtonGesture::Short;
+			default:
+				return ButtonGesture::None;
+			}
+		}
+
+		/// Timer to run from now on, zero stops it
+		[[nodiscard]] std::chrono::milliseconds GetTimeout() const
+		{
+			switch (m_State)
+			{
+			case State::FirstPress:
+			case State::SecondPress:
+				return m_LongPressTime;
+			case State::Released:
+				return m_DoublePressGap;
+			default:
+				return std::chrono::milliseconds(0);
+			}
+		}
+
+		[[nodiscard]] bool IsPressed() const
+		{
+			return m_Pressed;
+		}
+
+	private:
+		enum class State : uint8_t
+		{
+			Idle,
+			FirstPress,
+			/// Released after a short first press, a second press may follow
+			Released,
+			SecondPress,
+			/// Pressed, but the press already counted or was ignored
+			Held
+		};
+
+		std::chrono::milliseconds m_LongPressTime;
+		std::chrono::milliseconds m_DoublePressGap;
+		State m_State = State::Idle;
+		bool m_Pressed = false;
+	};
+}
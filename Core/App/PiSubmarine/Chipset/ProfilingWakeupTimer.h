@@ -0,0 +1,43 @@
+#pragma once
+
+#include "PiSubmarine/Chipset/IWakeupTimer.h"
+#include "PiSubmarine/Chipset/CycleProfiler.h"
+
+namespace PiSubmarine::Chipset
+{
+	/// Passes through to another IWakeupTimer and tells the profiler how long each Idle() slept.
+	class ProfilingWakeupTimer : public IWakeupTimer
+	{
+	public:
+		ProfilingWakeupTimer(IWakeupTimer &timer, CycleProfiler &profiler) : m_Timer(timer), m_Profiler(profiler)
+		{
+
+		}
+
+		std::chrono::milliseconds Now() const override
+		{
+			return m_Timer.Now();
+		}
+
+		bool ArmWakeup(std::chrono::milliseconds deadline) override
+		{
+			return m_Timer.ArmWakeup(deadline);
+		}
+
+		void DisarmWakeup() override
+		{
+			m_Timer.DisarmWakeup();
+		}
+
+		void Idle() override
+		{
+			uint32_t start = m_Profiler.Now();
+			m_Timer.Idle();
+			m_Profiler.OnIdle(start, m_Profiler.Now());
+		}
+
+	private:
+		IWakeupTimer &m_Timer;
+		CycleProfiler &m_Profiler;
+	};
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "PiSubmarine/Chipset/CriticalSection.h"
+#include "PiSubmarine/Chipset/RtcClock.h"
+
+namespace PiSubmarine::Chipset
+{
+	/// Rails watched while the Pi runs
+	enum class Rail : uint8_t
+	{
+		Reg5,
+		RegPi
+	};
+
+	/// Sags latched since the record was last cleared
+	struct RailFault
+	{
+		constexpr static size_t RailCount = 2;
+
+		/// Bit per Rail that sagged
+		uint8_t Rails = 0;
+		/// Scans below a threshold, saturating
+		uint16_t Scans = 0;
+		/// Lowest ADC code per Rail, only valid for the rails in Rails
+		std::array<uint16_t, RailCount> MinCodes{UINT16_MAX, UINT16_MAX};
+		/// RTC time of the first sag
+		RtcClock::Duration Time{0};
+	};
+
+	/// Latches the rail sags that the ADC analog watchdogs report while the rails are supposed to be
+	/// up. The watchdog interrupt fills the record by itself, the main loop only reads and clears it.
+	/// A sagging rail interrupts once: the owner masks its watchdog, counts the following scans from
+	/// the DMA buffer with OnScans() and unmasks it once the rail has recovered. All interrupts share
+	/// one priority, so OnSag() and OnScans() are never preempted by another writer.
+	class RailGuard
+	{
+	public:
+		void Arm()
+		{
+			m_Masked = 0;
+			m_Armed = true;
+		}
+
+		void Disarm()
+		{
+			m_Armed = false;
+		}
+
+		/// Tells the watchdog interrupt whether it reports a sag or a rail coming up
+		[[nodiscard]] bool IsArmed() const
+		{
+			return m_Armed;
+		}
+
+		/// ISR side: a scan found the rail below its threshold, its watchdog is masked from now on.
+		/// True for the first sag since Clear().
+		bool OnSag(Rail rail, uint16_t code, RtcClock::Duration time)
+		{
+			size_t index = static_cast<size_t>(rail);
+			bool first = m_Fault.Rails == 0;
+			if (first)
+			{
+				m_Fault.Time = time;
+			}
+			m_Fault.Rails = static_cast<uint8_t>(m_Fault.Rails | (1 << index));
+			m_Masked = static_cast<uint8_t>(m_Masked | (1 << index));
+			OnScans(rail, 1, code);
+			return first;
+		}
+
+		/// ISR side: scans of a masked rail below its threshold, with their lowest code
+		void OnScans(Rail rail, size_t count, uint16_t minCode)
+		{
+			size_t index = static_cast<size_t>(rail);
+			m_Fault.Scans = static_cast<uint16_t>(std::min<size_t>(m_Fault.Scans + count, UINT16_MAX));
+			if (count > 0 && minCode < m_Fault.MinCodes[index])
+			{
+				m_Fault.MinCodes[index] = minCode;
+			}
+		}
+
+		/// The watchdog of the rail is masked after a sag
+		[[nodiscard]] bool IsMasked(Rail rail) const
+		{
+			return (m_Masked & (1 << static_cast<size_t>(rail))) != 0;
+		}
+
+		void Unmask(Rail rail)
+		{
+			CriticalSection lock;
+			m_Masked = static_cast<uint8_t>(m_Masked & ~(1 << static_cast<size_t>(rail)));
+		}
+
+		/// A copy, the interrupt may update the record meanwhile
+		[[nodiscard]] RailFault GetFault() const
+		{
+			CriticalSection lock;
+			return m_Fault;
+		}
+
+		void Clear()
+		{
+			CriticalSection lock;
+			m_Fault = RailFault{};
+		}
+
+	private:
+		volatile bool m_Armed = false;
+		/// Bit per Rail whose watchdog interrupt is masked
+		volatile uint8_t m_Masked = 0;
+		RailFault m_Fault;
+	};
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "PiSubmarine/Chipset/I2CDriver.h"
+#include "PiSubmarine/Chipset/InplaceDelegate.h"
+#include "PiSubmarine/Chipset/CriticalSection.h"
+
+namespace PiSubmarine::Chipset
+{
+	/// How often a register can change without the firmware writing it
+	enum class Volatility : uint8_t
+	{
+		/// Configuration, only changes when written
+		Static = 1 << 0,
+		/// Measurements that change slowly or only while a feature is enabled
+		SlowStatus = 1 << 1,
+		/// Status, fault and flag registers
+		FastStatus = 1 << 2
+	};
+
+	constexpr uint8_t operator|(Volatility lhs, Volatility rhs)
+	{
+		return static_cast<uint8_t>(lhs) | static_cast<uint8_t>(rhs);
+	}
+
+	constexpr uint8_t AllVolatilityClasses = 0x07;
+
+	/// Shadow copy of a device register map on a queued I2CDriver.
+	/// Refresh() reads only the registers of the requested volatility classes, coalesced into bursts.
+	/// Set() is write-back: it marks registers dirty, Flush() writes contiguous dirty runs in bursts.
+	/// Reads land in a staging buffer, so a Set() made while a read is in flight is not overwritten.
+	/// One Refresh() or Flush() runs at a time; bursts are chained from the completion interrupt.
+	/// A failed burst, e.g. a timeout, ends the operation, so the bus is not held by bursts that
+	/// would most likely fail as well.
+	template<size_t Count>
+	class RegisterCache
+	{
+	public:
+		using VolatilityTable = std::array<Volatility, Count>;
+		using DoneDelegate = InplaceDelegate<void(bool ok)>;
+
+		/// Unselected registers between two selected ones are read along if the gap is at most this long.
+		/// A new burst costs a start, the device address twice and the register address.
+		constexpr static size_t MaxGap = 3;
+
+		RegisterCache(I2CDriver &driver, uint8_t deviceAddress, const VolatilityTable &volatility) :
+				m_Driver(driver), m_DeviceAddress(deviceAddress), m_Volatility(volatility)
+		{
+
+		}
+
+		/// Reads all registers whose class is in classMask. done runs in interrupt context.
+		/// Returns false if another operation is in progress or the transfer could not be queued.
+		bool Refresh(uint8_t classMask, DoneDelegate done)
+		{
+			CriticalSection lock;
+			if (m_Busy)
+			{
+				return false;
+			}
+			m_Busy = true;
+			m_Writing = false;
+			m_ClassMask = classMask;
+			m_Cursor = 0;
+			m_Ok = true;
+			m_Done = std::move(done);
+			return Continue();
+		}
+
+		/// Writes all dirty registers. done runs in interrupt context.
+		bool Flush(DoneDelegate done)
+		{
+			CriticalSection lock;
+			if (m_Busy)
+			{
+				return false;
+			}
+			m_Busy = true;
+			m_Writing = true;
+			m_Cursor = 0;
+			m_Ok = true;
+			m_Done = std::move(done);
+			return Continue();
+		}
+
+		[[nodiscard]] uint8_t Get(uint8_t reg) const
+		{
+			return m_Values[reg];
+		}
+
+		/// Write-back: only registers whose value differs from the cache are marked dirty
+		void Set(uint8_t reg, uint8_t value)
+		{
+			CriticalSection lock;
+			if (m_Values[reg] == value && m_Valid[reg])
+			{
+				return;
+			}
+			m_Values[reg] = value;
+			m_Dirty[reg] = true;
+		}
+
+		[[nodiscard]] bool IsDirty(uint8_t reg) const
+		{
+			return m_Dirty[reg];
+		}
+
+		[[nodiscard]] bool IsBusy() const
+		{
+			return m_Busy;
+		}
+
+		/// Register payload bytes moved over the bus so far
+		[[nodiscard]] uint32_t GetTransferredBytes() const
+		{
+			return m_TransferredBytes;
+		}
+
+	private:
+		I2CDriver &m_Driver;
+		uint8_t m_DeviceAddress;
+		const VolatilityTable &m_Volatility;
+
+		std::array<uint8_t, Count> m_Values{0};
+		std::array<uint8_t, Count> m_ReadBuffer{0};
+		std::array<bool, Count> m_Valid{false};
+		std::array<bool, Count> m_Dirty{false};
+
+		volatile bool m_Busy = false;
+		bool m_Writing = false;
+		bool m_Ok = true;
+		uint8_t m_ClassMask = 0;
+		size_t m_Cursor = 0;
+		size_t m_BurstStart = 0;
+		size_t m_BurstLength = 0;
+		DoneDelegate m_Done;
+		uint32_t m_TransferredBytes = 0;
+
+		bool IsSelected(size_t reg) const
+		{
+			if (m_Writing)
+			{
+				return m_Dirty[reg];
+			}
+			return !m_Dirty[reg] && (static_cast<uint8_t>(m_Volatility[reg]) & m_ClassMask) != 0;
+		}
+
+		/// Registers a burst must not cover: clean ones when writing, dirty ones when reading
+		bool IsBarrier(size_t reg) const
+		{
+			return m_Writing ? !m_Dirty[reg] : m_Dirty[reg];
+		}
+
+		/// Finds the next burst from m_Cursor on. Returns false if there is none.
+		bool NextBurst()
+		{
+			size_t start = m_Cursor;
+			while (start < Count && !IsSelected(start))
+			{
+				start++;
+			}
+			if (start == Count)
+			{
+				return false;
+			}
+
+			size_t end = start + 1;
+			size_t gap = 0;
+			for (size_t reg = end; reg < Count; reg++)
+			{
+				if (IsSelected(reg))
+				{
+					end = reg + 1;
+					gap = 0;
+				}
+				// Reading a few extra registers is cheaper than a new burst
+				else if (IsBarrier(reg) || ++gap > MaxGap)
+				{
+					break;
+				}
+			}
+
+			m_BurstStart = start;
+			m_BurstLength = end - start;
+			m_Cursor = end;
+			return true;
+		}
+
+		bool Continue()
+		{
+			while (NextBurst())
+			{
+				auto callback = [this](uint8_t, I2CStatus status)
+				{	OnBurst(status);};
+				uint8_t reg = static_cast<uint8_t>(m_BurstStart);
+				bool queued = m_Writing ?
+						m_Driver.WriteRegisters(m_DeviceAddress, reg, &m_Values[m_BurstStart], m_BurstLength, callback) :
+						m_Driver.ReadRegisters(m_DeviceAddress, reg, &m_ReadBuffer[m_BurstStart], m_BurstLength, callback);
+				if (queued)
+				{
+					if (m_Writing)
+					{
+						// A Set() during the transfer marks the register dirty again
+						for (size_t i = 0; i < m_BurstLength; i++)
+						{
+							m_Dirty[m_BurstStart + i] = false;
+						}
+					}
+					return true;
+				}
+				m_Ok = false;
+			}
+
+			Complete();
+			return m_Ok;
+		}
+
+		/// Completion interrupt of one burst
+		void OnBurst(I2CStatus status)
+		{
+			CriticalSection lock;
+			if (status == I2CStatus::Ok)
+			{
+				m_TransferredBytes += m_BurstLength;
+				for (size_t reg = m_BurstStart; reg < m_BurstStart + m_BurstLength; reg++)
+				{
+					if (m_Writing)
+					{
+						m_Valid[reg] = true;
+					}
+					// A register that was Set() meanwhile keeps the value that Flush() has to write
+					else if (!m_Dirty[reg])
+					{
+						m_Values[reg] = m_ReadBuffer[reg];
+						m_Valid[reg] = true;
+					}
+				}
+			}
+			else
+			{
+				m_Ok = false;
+				m_Cursor = Count;
+				if (m_Writing)
+				{
+					for (size_t i = 0; i < m_BurstLength; i++)
+					{
+						m_Dirty[m_BurstStart + i] = true;
+					}
+				}
+			}
+			Continue();
+		}
+
+		void Complete()
+		{
+			m_Busy = false;
+			DoneDelegate done = std::move(m_Done);
+			if (done)
+			{
+				done(m_Ok);
+			}
+		}
+	};
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "PiSubmarine/Chipset/LittleEndian.h"
+
+namespace PiSubmarine::Chipset
+{
+	/// Register addresses of the telemetry map on the RPI_I2C slave. The Pi writes one address byte and
+	/// reads from there, the address auto-increments across blocks. Each block ends with the SMBus PEC
+	/// (CRC-8, polynomial 0x07, over the block's data bytes), so one value can be read and checked alone.
+	/// Values are little-endian.
+	enum class Register : uint8_t
+	{
+		/// u8 Api::StatusFlags, u8 PowerState
+		Status = 0x00,
+		/// u16 ADC code
+		Ballast = 0x03,
+		/// u32 microvolts
+		Reg5Voltage = 0x06,
+		/// u32 microvolts
+		RegPiVoltage = 0x0B,
+		/// u32 microkelvins
+		ChipsetTemperature = 0x10,
+		/// u64 milliseconds, the ChipsetTime of PacketOut
+		ChipsetTime = 0x15,
+		/// u32 boot count, u8 ResetCause, u8 PowerState at the previous reset, u8 ShutdownReason of the
+		/// last shutdown, u8 BootFlags
+		Boot = 0x1E,
+		/// u32 seconds over all boots, u32 seconds since this boot, u32 seconds of the previous boot
+		Uptime = 0x27,
+		/// u8 boots per ResetCause: power-on, pin, software, watchdog
+		ResetCounts = 0x34,
+		/// u8 rails that sagged (bit 0 REG5, bit 1 REGPI), u16 scans below a threshold, u32 lowest REG5
+		/// and u32 lowest REGPI microvolts (0 for a rail that did not sag), u64 milliseconds of the first
+		/// sag. Latched until LocalCommand::ClearRailFault.
+		RailFault = 0x39,
+		/// u8 Notify events pending behind CHIPSET_INT. A read that starts here returns the live mask,
+		/// clears it and releases the line. A read running into it returns the mask of the last image.
+		Events = 0x4D,
+		/// u8 Notify events that assert CHIPSET_INT, set with LocalCommand::SetEventMask
+		EventMask = 0x4F
+	};
+
+	namespace BootFlags
+	{
+		/// The state of the earlier boots was found, the counters continue
+		constexpr uint8_t StateRestored = 1 << 0;
+		/// The backup registers were lost and the SRAM copy was used
+		constexpr uint8_t RestoredFromMirror = 1 << 1;
+		/// Only the MCU was reset, the charger configuration was kept
+		constexpr uint8_t WarmBoot = 1 << 2;
+	}
+
+	/// Builds the register image served by DMA. The main loop rebuilds it with every PacketOut.
+	class RegisterMap
+	{
+	public:
+		constexpr static size_t Size = static_cast<size_t>(Register::EventMask) + 1 + 1;
+
+		struct Values
+		{
+			uint8_t Status = 0;
+			uint8_t PowerState = 0;
+			uint16_t BallastAdc = 0;
+			uint32_t Reg5MicroVolts = 0;
+			uint32_t RegPiMicroVolts = 0;
+			uint32_t TemperatureMicroKelvins = 0;
+			uint64_t TimeMs = 0;
+			uint32_t BootCount = 0;
+			uint8_t ResetCause = 0;
+			uint8_t PreviousPowerState = 0;
+			uint8_t ShutdownReason = 0;
+			uint8_t BootFlags = 0;
+			uint32_t UptimeSeconds = 0;
+			uint32_t SessionSeconds = 0;
+			uint32_t PreviousSessionSeconds = 0;
+			std::array<uint8_t, 4> ResetCounts{};
+			uint8_t FaultRails = 0;
+			uint16_t FaultScans = 0;
+			uint32_t FaultReg5MicroVolts = 0;
+			uint32_t FaultRegPiMicroVolts = 0;
+			uint64_t FaultTimeMs = 0;
+			uint8_t PendingEvents = 0;
+			uint8_t EventMask = 0;
+		};
+
+		static void Build(uint8_t *image, const Values &values)
+		{
+			uint8_t *block = Block(image, Register::Status);
+			block[0] = values.Status;
+			block[1] = values.PowerState;
+			Seal(block, 2);
+
+			block = Block(image, Register::Ballast);
+			LittleEndian::Write16(block, values.BallastAdc);
+			Seal(block, 2);
+
+			block = Block(image, Register::Reg5Voltage);
+			LittleEndian::Write32(block, values.Reg5MicroVolts);
+			Seal(block, 4);
+
+			block = Block(image, Register::RegPiVoltage);
+			LittleEndian::Write32(block, values.RegPiMicroVolts);
+			Seal(block, 4);
+
+			block = Block(image, Register::ChipsetTemperature);
+			LittleEndian::Write32(block, values.TemperatureMicroKelvins);
+			Seal(block, 4);
+
+			block = Block(image, Register::ChipsetTime);
+			LittleEndian::Write64(block, values.TimeMs);
+			Seal(block, 8);
+
+			block = Block(image, Register::Boot);
+			LittleEndian::Write32(block, values.BootCount);
+			block[4] = values.ResetCause;
+			block[5] = values.PreviousPowerState;
+			block[6] = values.ShutdownReason;
+			block[7] = values.BootFlags;
+			Seal(block, 8);
+
+			block = Block(image, Register::Uptime);
+			LittleEndian::Write32(block, values.UptimeSeconds);
+			LittleEndian::Write32(block + 4, values.SessionSeconds);
+			LittleEndian::Write32(block + 8, values.PreviousSessionSeconds);
+			Seal(block, 12);
+
+			block = Block(image, Register::ResetCounts);
+			std::copy(values.ResetCounts.begin(), values.ResetCounts.end(), block);
+			Seal(block, values.ResetCounts.size());
+
+			block = Block(image, Register::RailFault);
+			block[0] = values.FaultRails;
+			LittleEndian::Write16(block + 1, values.FaultScans);
+			LittleEndian::Write32(block + 3, values.FaultReg5MicroVolts);
+			LittleEndian::Write32(block + 7, values.FaultRegPiMicroVolts);
+			LittleEndian::Write64(block + 11, values.FaultTimeMs);
+			Seal(block, 19);
+
+			block = Block(image, Register::Events);
+			block[0] = values.PendingEvents;
+			Seal(block, 1);
+
+			block = Block(image, Register::EventMask);
+			block[0] = values.EventMask;
+			Seal(block, 1);
+		}
+
+		/// SMBus packet error code
+		static uint8_t Pec(const uint8_t *data, size_t size)
+		{
+			uint8_t crc = 0;
+			for (size_t i = 0; i < size; i++)
+			{
+				crc ^= data[i];
+				for (int bit = 0; bit < 8; bit++)
+				{
+					crc = (crc & 0x80) ? static_cast<uint8_t>((crc << 1) ^ 0x07) : static_cast<uint8_t>(crc << 1);
+				}
+			}
+			return crc;
+		}
+
+		/// The Events register alone, built by the interrupt that serves the read
+		static void BuildEvents(uint8_t *block, uint8_t events)
+		{
+			block[0] = events;
+			Seal(block, 1);
+		}
+
+	private:
+		static uint8_t* Block(uint8_t *image, Register address)
+		{
+			return &image[static_cast<size_t>(address)];
+		}
+
+		static void Seal(uint8_t *block, size_t size)
+		{
+			block[size] = Pec(block, size);
+		}
+	};
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include "main.h"
+#include "PiSubmarine/Chipset/CriticalSection.h"
+
+namespace PiSubmarine::Chipset
+{
+	/// Unix time on the RTC in binary mode. The subsecond register is a free-running 32-bit down-counter
+	/// clocked at LSI / (PREDIV_A + 1) = 4 kHz, so reading the time is one register read with 250 us
+	/// resolution. The Unix time at counter value 0xFFFFFFFF lives in backup registers, and with it the
+	/// time survives resets and STOP as long as the backup domain is powered.
+	/// The counter wraps every 12.4 days. The wrap is added to the stored offset by Poll(), which has to
+	/// run at least once per wrap period; until then Now() accounts for a pending wrap itself. The owner
+	/// keeps an alarm within MaxAlarmDelay while the core is in STOP, so it wakes to poll.
+	class RtcClock
+	{
+	public:
+		constexpr static uint32_t AsynchPrediv = 7;
+		constexpr static uint32_t TickRate = LSI_VALUE / (AsynchPrediv + 1);
+		using Duration = std::chrono::duration<int64_t, std::ratio<1, TickRate>>;
+		/// The counter runs through 2^32 ticks per wrap
+		constexpr static Duration WrapPeriod{int64_t{1} << 32};
+		/// Alarms further out are set to this, well within a wrap, so the owner wakes and sets them again.
+		/// The alarm compares the counter only, it would fire a wrap early otherwise.
+		constexpr static Duration MaxAlarmDelay = std::chrono::hours(24);
+		/// Alarms in the past fire this soon
+		constexpr static Duration MinAlarmDelay{4};
+
+		constexpr static uint32_t OffsetLowRegister = RTC_BKP_DR0;
+		constexpr static uint32_t OffsetHighRegister = RTC_BKP_DR1;
+		constexpr static uint32_t MarkerRegister = RTC_BKP_DR2;
+		/// "RTC1", written last when the time is set
+		constexpr static uint32_t Marker = 0x52544331;
+
+		explicit RtcClock(RTC_HandleTypeDef &handle) : m_Handle(handle)
+		{
+
+		}
+
+		/// Loads the offset kept in the backup registers
+		void Start()
+		{
+			m_Set = HAL_RTCEx_BKUPRead(&m_Handle, MarkerRegister) == Marker;
+			if (m_Set)
+			{
+				uint64_t low = HAL_RTCEx_BKUPRead(&m_Handle, OffsetLowRegister);
+				uint64_t high = HAL_RTCEx_BKUPRead(&m_Handle, OffsetHighRegister);
+				m_Offset = Duration(static_cast<int64_t>((high << 32) | low));
+			}
+			Poll();
+		}
+
+		/// False until the Pi sets the time, after a backup domain reset
+		[[nodiscard]] bool IsSet() const
+		{
+			return m_Set;
+		}
+
+		/// Unix time, or the time since the counter started while it is not set. Safe in interrupts.
+		[[nodiscard]] Duration Now() const
+		{
+			uint32_t elapsed = ~m_Handle.Instance->SSR;
+			if (__HAL_RTC_GET_FLAG(&m_Handle, RTC_FLAG_SSRUF))
+			{
+				// The wrap is not in the offset yet. Read again, the first value may predate it.
+				elapsed = ~m_Handle.Instance->SSR;
+				return m_Offset + WrapPeriod + Duration(elapsed);
+			}
+			return m_Offset + Duration(elapsed);
+		}
+
+		/// Like Now(), but Set() does not move it. Measures intervals across a time change.
+		[[nodiscard]] Duration Monotonic() const
+		{
+			return Now() - m_Adjustment;
+		}
+
+		/// The counter keeps running, only the offset changes
+		void Set(Duration unixTime)
+		{
+			CriticalSection lock;
+			Poll();
+			Duration offset = unixTime - Now() + m_Offset;
+			uint64_t ticks = static_cast<uint64_t>(offset.count());
+
+			// A reset halfway leaves the clock unset rather than wrong
+			HAL_RTCEx_BKUPWrite(&m_Handle, MarkerRegister, 0);
+			HAL_RTCEx_BKUPWrite(&m_Handle, OffsetLowRegister, static_cast<uint32_t>(ticks));
+			HAL_RTCEx_BKUPWrite(&m_Handle, OffsetHighRegister, static_cast<uint32_t>(ticks >> 32));
+			HAL_RTCEx_BKUPWrite(&m_Handle, MarkerRegister, Marker);
+			m_Adjustment += offset - m_Offset;
+			m_Offset = offset;
+			m_Set = true;
+		}
+
+		/// Moves a counter wrap into the offset. A wrap adds exactly 2^32 ticks, only the high word changes.
+		void Poll()
+		{
+			CriticalSection lock;
+			if (!__HAL_RTC_GET_FLAG(&m_Handle, RTC_FLAG_SSRUF))
+			{
+				return;
+			}
+			m_Offset += WrapPeriod;
+			HAL_RTCEx_BKUPWrite(&m_Handle, OffsetHighRegister, static_cast<uint32_t>(static_cast<uint64_t>(m_Offset.count()) >> 32));
+			__HAL_RTC_CLEAR_FLAG(&m_Handle, RTC_CLEAR_SSRUF);
+		}
+
+		/// Fires RTC_ALARM_A or RTC_ALARM_B at the given time in the timebase of Now(), once the counter
+		/// reaches the matching value. A later Set() does not move the alarm.
+		bool SetAlarm(uint32_t alarm, Duration time)
+		{
+			Poll();
+			Duration now = Now();
+			Duration delay = std::clamp(time - now, MinAlarmDelay, MaxAlarmDelay);
+
+			RTC_AlarmTypeDef config{};
+			config.Alarm = alarm;
+			config.AlarmTime.SubSeconds = ~static_cast<uint32_t>((now + delay - m_Offset).count());
+			config.AlarmSubSecondMask = RTC_ALARMSUBSECONDBINMASK_NONE;
+			config.BinaryAutoClr = RTC_ALARMSUBSECONDBIN_AUTOCLR_NO;
+			return HAL_RTC_SetAlarm_IT(&m_Handle, &config, RTC_FORMAT_BIN) == HAL_OK;
+		}
+
+		void ClearAlarm(uint32_t alarm)
+		{
+			HAL_RTC_DeactivateAlarm(&m_Handle, alarm);
+		}
+
+	private:
+		RTC_HandleTypeDef &m_Handle;
+		Duration m_Offset{0};
+		/// Sum of the corrections by Set() since Start()
+		Duration m_Adjustment{0};
+		bool m_Set = false;
+	};
+}
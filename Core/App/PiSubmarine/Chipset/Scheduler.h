@@ -0,0 +1,222 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include "PiSubmarine/Chipset/IWakeupTimer.h"
+#include "PiSubmarine/Chipset/CriticalSection.h"
+
+namespace PiSubmarine::Chipset
+{
+	using EventMask = uint32_t;
+
+	namespace Event
+	{
+		constexpr EventMask None = 0;
+		constexpr EventMask AdcComplete = 1UL << 0;
+		constexpr EventMask I2CComplete = 1UL << 1;
+		constexpr EventMask Reg12PowerGood = 1UL << 2;
+		constexpr EventMask BatchgInt = 1UL << 3;
+		constexpr EventMask RpiCommand = 1UL << 4;
+		constexpr EventMask ChargerRefresh = 1UL << 5;
+		constexpr EventMask ChargerStatus = 1UL << 6;
+		constexpr EventMask ProfileDump = 1UL << 7;
+		constexpr EventMask Reg5Good = 1UL << 8;
+		constexpr EventMask RegPiGood = 1UL << 9;
+		constexpr EventMask RailFault = 1UL << 10;
+		constexpr EventMask NotifyFlush = 1UL << 11;
+		constexpr EventMask ButtonEdge = 1UL << 12;
+		constexpr EventMask ButtonSettled = 1UL << 13;
+		constexpr EventMask ButtonTimeout = 1UL << 14;
+		constexpr EventMask WakeAlarm = 1UL << 15;
+		constexpr EventMask WindowEnd = 1UL << 16;
+		constexpr EventMask WindowGrace = 1UL << 17;
+		constexpr EventMask LogDrained = 1UL << 18;
+
+		/// Reserved for Scheduler::Sleep and Scheduler::WaitFor.
+		constexpr EventMask Timeout = 1UL << 31;
+		constexpr EventMask All = ~Timeout;
+	}
+
+	/// Tickless event scheduler. ISRs Post() events, the main loop Wait()s on a mask of them.
+	/// Software timers post events when their deadline expires. Between events the core sleeps,
+	/// with the wakeup timer armed for the nearest deadline only.
+	class Scheduler
+	{
+	public:
+		constexpr static size_t MaxTimers = 8;
+
+		explicit Scheduler(IWakeupTimer& wakeupTimer) : m_WakeupTimer(wakeupTimer)
+		{
+
+		}
+
+		/// Safe to call from interrupt context.
+		void Post(EventMask events)
+		{
+			CriticalSection lock;
+			m_Pending = m_Pending | events;
+		}
+
+		/// Drops pending events, e.g. edges that happened before the state that waits for them was entered.
+		void Clear(EventMask events)
+		{
+			CriticalSection lock;
+			m_Pending = m_Pending & ~events;
+		}
+
+		void StartTimer(size_t index, std::chrono::milliseconds delay, EventMask events, bool periodic = false)
+		{
+			TimerSlot &timer = m_Timers[index];
+			timer.Deadline = m_WakeupTimer.Now() + delay;
+			timer.Period = periodic ? delay : std::chrono::milliseconds(0);
+			timer.Events = events;
+			timer.Active = true;
+		}
+
+		void StopTimer(size_t index)
+		{
+			m_Timers[index].Active = false;
+		}
+
+		[[nodiscard]] bool IsTimerActive(size_t index) const
+		{
+			return m_Timers[index].Active;
+		}
+
+		/// Returns and consumes the pending events in mask without sleeping.
+		EventMask Poll(EventMask mask)
+		{
+			ExpireTimers();
+			CriticalSection lock;
+			return Take(mask);
+		}
+
+		/// Sleeps until at least one event in mask is pending, then returns and consumes those events.
+		EventMask Wait(EventMask mask)
+		{
+			while (true)
+			{
+				ExpireTimers();
+				{
+					CriticalSection lock;
+					EventMask ready = Take(mask);
+					if (ready != Event::None)
+					{
+						return ready;
+					}
+
+					if (!ArmNextDeadline())
+					{
+						continue;
+					}
+
+					// WFI wakes on a pending interrupt even with PRIMASK set, so an event posted
+					// between Take() and here cannot be lost. The ISR runs once the lock is released.
+					m_WakeupTimer.Idle();
+					m_WakeCount++;
+				}
+			}
+		}
+
+		/// Like Wait(), but gives up after timeout. Returns Event::None on timeout.
+		EventMask WaitFor(EventMask mask, std::chrono::milliseconds timeout)
+		{
+			StartTimer(TimeoutTimer, timeout, Event::Timeout);
+			EventMask ready = Wait(mask | Event::Timeout);
+			StopTimer(TimeoutTimer);
+			Clear(Event::Timeout);
+			return ready & mask;
+		}
+
+		void Sleep(std::chrono::milliseconds delay)
+		{
+			if (delay.count() <= 0)
+			{
+				return;
+			}
+			WaitFor(Event::None, delay);
+		}
+
+		[[nodiscard]] std::chrono::milliseconds Now() const
+		{
+			return m_WakeupTimer.Now();
+		}
+
+		/// Number of times the core was woken from Idle(). Useful to measure idle efficiency.
+		[[nodiscard]] uint32_t GetWakeCount() const
+		{
+			return m_WakeCount;
+		}
+
+	private:
+		struct TimerSlot
+		{
+			std::chrono::milliseconds Deadline{0};
+			std::chrono::milliseconds Period{0};
+			EventMask Events = Event::None;
+			bool Active = false;
+		};
+
+		constexpr static size_t TimeoutTimer = MaxTimers;
+
+		IWakeupTimer &m_WakeupTimer;
+		std::array<TimerSlot, MaxTimers + 1> m_Timers{};
+		volatile EventMask m_Pending = Event::None;
+		uint32_t m_WakeCount = 0;
+
+		EventMask Take(EventMask mask)
+		{
+			EventMask ready = m_Pending & mask;
+			m_Pending = m_Pending & ~ready;
+			return ready;
+		}
+
+		void ExpireTimers()
+		{
+			auto now = m_WakeupTimer.Now();
+			for (auto &timer : m_Timers)
+			{
+				if (!timer.Active || timer.Deadline > now)
+				{
+					continue;
+				}
+
+				if (timer.Period.count() > 0)
+				{
+					// Skip missed periods instead of firing a burst of them
+					do
+					{
+						timer.Deadline += timer.Period;
+					} while (timer.Deadline <= now);
+				}
+				else
+				{
+					timer.Active = false;
+				}
+				Post(timer.Events);
+			}
+		}
+
+		bool ArmNextDeadline()
+		{
+			const TimerSlot *next = nullptr;
+			for (const auto &timer : m_Timers)
+			{
+				if (timer.Active && (next == nullptr || timer.Deadline < next->Deadline))
+				{
+					next = &timer;
+				}
+			}
+
+			if (next == nullptr)
+			{
+				m_WakeupTimer.DisarmWakeup();
+				return true;
+			}
+
+			return m_WakeupTimer.ArmWakeup(next->Deadline);
+		}
+	};
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <initializer_list>
+
+namespace PiSubmarine::Chipset
+{
+	struct TelemetrySample
+	{
+		uint64_t TimestampMs = 0;
+		uint16_t Reg5MilliVolts = 0;
+		uint16_t RegPiMilliVolts = 0;
+		uint16_t TemperatureCentiKelvins = 0;
+		uint16_t BallastAdc = 0;
+		uint8_t Status = 0;
+	};
+
+	/// Byte ring of delta-encoded, sequence-numbered telemetry samples.
+	///
+	/// Record layout (little-endian):
+	/// - Keyframe: 0x80, u64 timestamp, u16 reg5, u16 regPi, u16 temperature, u16 ballast, u8 status.
+	/// - Delta: field mask (bit 0 reg5, 1 regPi, 2 temperature, 3 ballast, 4 status), zigzag varint of the
+	///   timestamp delta, zigzag varints of the changed u16 fields, raw status byte if it changed.
+	///
+	/// Every KeyframeInterval-th record is a keyframe. The oldest record is always a keyframe, so the
+	/// oldest samples are evicted a whole keyframe group at a time and any read can be decoded on its own.
+	template<size_t Capacity>
+	class TelemetryHistory
+	{
+	public:
+		constexpr static uint8_t KeyframeFlag = 0x80;
+		constexpr static uint8_t Reg5Changed = 1 << 0;
+		constexpr static uint8_t RegPiChanged = 1 << 1;
+		constexpr static uint8_t TemperatureChanged = 1 << 2;
+		constexpr static uint8_t BallastChanged = 1 << 3;
+		constexpr static uint8_t StatusChanged = 1 << 4;
+		constexpr static size_t KeyframeSize = 1 + 8 + 4 * 2 + 1;
+		constexpr static size_t MaxDeltaSize = 1 + 5 + 4 * 3 + 1;
+		constexpr static size_t MaxRecordSize = KeyframeSize > MaxDeltaSize ? KeyframeSize : MaxDeltaSize;
+		constexpr static uint32_t KeyframeInterval = 16;
+
+		static_assert(Capacity >= 2 * MaxRecordSize, "History is too small");
+		static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+		void Append(const TelemetrySample &sample)
+		{
+			std::array<uint8_t, MaxRecordSize> record{};
+			size_t length = Encode(sample, record);
+			while (Capacity - m_Used < length)
+			{
+				EvictGroup();
+				if (m_Used == 0)
+				{
+					// The delta base went away with the evicted group
+					m_SinceKeyframe = KeyframeInterval;
+					length = Encode(sample, record);
+				}
+			}
+
+			for (size_t i = 0; i < length; i++)
+			{
+				m_Buffer[(m_Tail + m_Used + i) & (Capacity - 1)] = record[i];
+			}
+			m_Used += length;
+			m_NextSequence++;
+			m_Last = sample;
+		}
+
+		/// Copies whole records, starting at the last keyframe at or before fromSequence, into output.
+		/// Returns the number of bytes written; firstSequence and count describe the copied records.
+		size_t Read(uint32_t fromSequence, uint16_t maxRecords, uint8_t *output, size_t capacity, uint32_t &firstSequence, uint16_t &count) const
+		{
+			count = 0;
+			firstSequence = m_FirstSequence;
+			if (m_Used == 0 || static_cast<int32_t>(fromSequence - m_NextSequence) >= 0)
+			{
+				firstSequence = m_NextSequence;
+				return 0;
+			}
+
+			size_t offset = 0;
+			uint32_t sequence = m_FirstSequence;
+			size_t start = 0;
+			if (static_cast<int32_t>(fromSequence - m_FirstSequence) > 0)
+			{
+				while (sequence != fromSequence)
+				{
+					offset += RecordLength(offset);
+					sequence++;
+					if (IsKeyframe(offset))
+					{
+						start = offset;
+						firstSequence = sequence;
+					}
+				}
+			}
+
+			offset = start;
+			size_t written = 0;
+			while (offset < m_Used && count < maxRecords)
+			{
+				size_t length = RecordLength(offset);
+				if (written + length > capacity)
+				{
+					break;
+				}
+				for (size_t i = 0; i < length; i++)
+				{
+					output[written + i] = At(offset + i);
+				}
+				written += length;
+				offset += length;
+				count++;
+			}
+			return written;
+		}
+
+		[[nodiscard]] uint32_t GetFirstSequence() const
+		{
+			return m_FirstSequence;
+		}
+
+		[[nodiscard]] uint32_t GetNextSequence() const
+		{
+			return m_NextSequence;
+		}
+
+		[[nodiscard]] bool IsEmpty() const
+		{
+			return m_Used == 0;
+		}
+
+		[[nodiscard]] const TelemetrySample& GetLast() const
+		{
+			return m_Last;
+		}
+
+	private:
+		std::array<uint8_t, Capacity> m_Buffer{};
+		size_t m_Tail = 0;
+		size_t m_Used = 0;
+		uint32_t m_FirstSequence = 0;
+		uint32_t m_NextSequence = 0;
+		uint32_t m_SinceKeyframe = KeyframeInterval;
+		TelemetrySample m_Last;
+
+		uint8_t At(size_t offset) const
+		{
+			return m_Buffer[(m_Tail + offset) & (Capacity - 1)];
+		}
+
+		bool IsKeyframe(size_t offset) const
+		{
+			return offset < m_Used && (At(offset) & KeyframeFlag) != 0;
+		}
+
+		size_t RecordLength(size_t offset) const
+		{
+			uint8_t header = At(offset);
+			if (header & KeyframeFlag)
+			{
+				return KeyframeSize;
+			}
+
+			size_t length = 1;
+			auto skipVarint = [this, offset, &length]()
+			{
+				while (At(offset + length++) & 0x80)
+				{
+				}
+			};
+
+			skipVarint();
+			for (uint8_t field = Reg5Changed; field <= BallastChanged; field <<= 1)
+			{
+				if (header & field)
+				{
+					skipVarint();
+				}
+			}
+			if (header & StatusChanged)
+			{
+				length++;
+			}
+			return length;
+		}
+
+		void EvictGroup()
+		{
+			size_t offset = 0;
+			do
+			{
+				offset += RecordLength(offset);
+				m_FirstSequence++;
+			} while (offset < m_Used && !IsKeyframe(offset));
+
+			m_Tail = (m_Tail + offset) & (Capacity - 1);
+			m_Used -= offset;
+		}
+
+		size_t Encode(const TelemetrySample &sample, std::array<uint8_t, MaxRecordSize> &record)
+		{
+			int64_t timeDelta = static_cast<int64_t>(sample.TimestampMs - m_Last.TimestampMs);
+			bool keyframe = m_Used == 0 || m_SinceKeyframe >= KeyframeInterval || timeDelta > INT32_MAX || timeDelta < INT32_MIN;
+			size_t length = 0;
+
+			if (keyframe)
+			{
+				record[length++] = KeyframeFlag;
+				for (size_t i = 0; i < 8; i++)
+				{
+					record[length++] = static_cast<uint8_t>(sample.TimestampMs >> (i * 8));
+				}
+				for (uint16_t value : {sample.Reg5MilliVolts, sample.RegPiMilliVolts, sample.TemperatureCentiKelvins, sample.BallastAdc})
+				{
+					record[length++] = static_cast<uint8_t>(value);
+					record[length++] = static_cast<uint8_t>(value >> 8);
+				}
+				record[length++] = sample.Status;
+				m_SinceKeyframe = 1;
+				return length;
+			}
+
+			uint8_t header = 0;
+			length = 1;
+			WriteVarint(record, length, ZigZag(static_cast<int32_t>(timeDelta)));
+
+			const uint16_t current[] = {sample.Reg5MilliVolts, sample.RegPiMilliVolts, sample.TemperatureCentiKelvins, sample.BallastAdc};
+			const uint16_t previous[] = {m_Last.Reg5MilliVolts, m_Last.RegPiMilliVolts, m_Last.TemperatureCentiKelvins, m_Last.BallastAdc};
+			for (size_t i = 0; i < 4; i++)
+			{
+				if (current[i] != previous[i])
+				{
+					header |= static_cast<uint8_t>(1 << i);
+					WriteVarint(record, length, ZigZag(static_cast<int32_t>(current[i]) - previous[i]));
+				}
+			}
+			if (sample.Status != m_Last.Status)
+			{
+				header |= StatusChanged;
+				record[length++] = sample.Status;
+			}
+
+			record[0] = header;
+			m_SinceKeyframe++;
+			return length;
+		}
+
+		static uint32_t ZigZag(int32_t value)
+		{
+			return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+		}
+
+		static void WriteVarint(std::array<uint8_t, MaxRecordSize> &record, size_t &length, uint32_t value)
+		{
+			while (value >= 0x80)
+			{
+				record[length++] = static_cast<uint8_t>(value | 0x80);
+				value >>= 7;
+			}
+			record[length++] = static_cast<uint8_t>(value);
+		}
+	};
+}
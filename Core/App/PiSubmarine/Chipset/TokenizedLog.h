@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+#define CHIPSET_LOG_STRINGIFY_(x) #x
+#define CHIPSET_LOG_STRINGIFY(x) CHIPSET_LOG_STRINGIFY_(x)
+
+/// Format strings of CHIPSET_LOG() and the strings of CHIPSET_LOG_STRING() are kept here. The linker
+/// script places the sections at address 0 as INFO, so they stay in the ELF for LogDecode.py but take no flash.
+/// Every site gets its own section: sites in inline functions land in COMDAT groups, which cannot share
+/// a section with the others.
+#define CHIPSET_LOG_SECTION ".chipset_log_strings." CHIPSET_LOG_STRINGIFY(__LINE__) "." CHIPSET_LOG_STRINGIFY(__COUNTER__)
+
+/// Logs a printf-style message as a 16-bit token plus up to six raw 32-bit arguments.
+/// No formatting happens on the device. The format must be a string literal without a trailing newline.
+/// Integer conversions print the argument, %s prints a string token from CHIPSET_LOG_STRING().
+#define CHIPSET_LOG(format, ...) \
+	do \
+	{ \
+		[[gnu::section(CHIPSET_LOG_SECTION), gnu::used]] static const char chipsetLogFormat[] = format; \
+		constexpr uint16_t chipsetLogToken = ::PiSubmarine::Chipset::TokenizedLog::Token(format); \
+		::PiSubmarine::Chipset::TokenizedLog::Emit(chipsetLogToken __VA_OPT__(,) __VA_ARGS__); \
+	} while (0)
+
+/// Token of a string literal, for %s arguments of CHIPSET_LOG()
+#define CHIPSET_LOG_STRING(text) \
+	([]() \
+	{ \
+		[[gnu::section(CHIPSET_LOG_SECTION), gnu::used]] static const char chipsetLogString[] = text; \
+		return ::PiSubmarine::Chipset::TokenizedLog::Token(text); \
+	}())
+
+namespace PiSubmarine::Chipset::TokenizedLog
+{
+	constexpr size_t MaxArgs = 6;
+
+	/// FNV-1a of the string folded to 16 bits. 0 is left to UartLog's drop report.
+	/// LogDecode.py computes the same hash over the strings of the ELF section and reports collisions.
+	template<size_t N>
+	constexpr uint16_t Token(const char (&text)[N])
+	{
+		uint32_t hash = 2166136261u;
+		for (size_t i = 0; i + 1 < N; i++)
+		{
+			hash ^= static_cast<uint8_t>(text[i]);
+			hash *= 16777619u;
+		}
+		uint16_t token = static_cast<uint16_t>((hash >> 16) ^ (hash & 0xFFFF));
+		return token == 0 ? 1 : token;
+	}
+
+	/// Queues a record on the log output. Defined by the application, safe in any context.
+	void Write(uint16_t token, const uint32_t *args, size_t count);
+
+	template<typename T>
+	constexpr uint32_t ToArg(T value)
+	{
+		static_assert(std::is_integral_v<T> || std::is_enum_v<T>, "Log arguments must be integers or enums");
+		if constexpr (std::is_enum_v<T>)
+		{
+			return static_cast<uint32_t>(static_cast<std::underlying_type_t<T>>(value));
+		}
+		else
+		{
+			return static_cast<uint32_t>(value);
+		}
+	}
+
+	template<typename... Args>
+	void Emit(uint16_t token, Args... args)
+	{
+		static_assert(sizeof...(Args) <= MaxArgs, "Too many log arguments");
+		if constexpr (sizeof...(Args) == 0)
+		{
+			Write(token, nullptr, 0);
+		}
+		else
+		{
+			const std::array<uint32_t, sizeof...(Args)> values{ToArg(args)...};
+			Write(token, values.data(), values.size());
+		}
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace PiSubmarine::Chipset
+{
+	/// Two serialized copies of an outgoing packet. The main loop writes the back copy and publishes it
+	/// by swapping an index; the ISR only picks the front copy and hands it to DMA.
+	/// A copy that is being transmitted is never rewritten: publishing is deferred until it is released.
+	template<size_t Size>
+	class TxDoubleBuffer
+	{
+		constexpr static uint8_t NoBuffer = 0xFF;
+
+	public:
+		/// Main loop. Returns the back copy to serialize into, or nullptr while DMA still reads it.
+		uint8_t* BeginWrite()
+		{
+			uint8_t back = m_Front ^ 1;
+			if (m_Sending == back)
+			{
+				m_Deferred = true;
+				return nullptr;
+			}
+			return m_Buffers[back].data();
+		}
+
+		/// Main loop. Makes the copy returned by BeginWrite() the one served to the next read.
+		void Commit()
+		{
+			m_Front = m_Front ^ 1;
+			m_Valid = true;
+			m_Deferred = false;
+		}
+
+		/// ISR. Returns the published copy and marks it in flight, or nullptr if nothing was published yet.
+		const uint8_t* Acquire()
+		{
+			if (!m_Valid)
+			{
+				return nullptr;
+			}
+			uint8_t front = m_Front;
+			m_Sending = front;
+			return m_Buffers[front].data();
+		}
+
+		/// ISR. The transfer that used the acquired copy has ended.
+		void Release()
+		{
+			m_Sending = NoBuffer;
+		}
+
+		/// A publish was skipped because its target was in flight
+		[[nodiscard]] bool IsDeferred() const
+		{
+			return m_Deferred;
+		}
+
+		[[nodiscard]] constexpr size_t GetSize() const
+		{
+			return Size;
+		}
+
+	private:
+		std::array<std::array<uint8_t, Size>, 2> m_Buffers{};
+		volatile uint8_t m_Front = 0;
+		volatile uint8_t m_Sending = NoBuffer;
+		volatile bool m_Valid = false;
+		bool m_Deferred = false;
+	};
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "main.h"
+#include "usart.h"
+#include "PiSubmarine/Chipset/CriticalSection.h"
+#include "PiSubmarine/Chipset/LittleEndian.h"
+
+namespace PiSubmarine::Chipset
+{
+	/// Non-blocking log output. Text and binary records are copied into a byte ring and the UART
+	/// interrupt drains it, so a log call costs a copy instead of the time on the wire.
+	/// All seven DMA1 channels of STM32U031 serve I2C and the ADC, so the 8-byte TX FIFO is used
+	/// instead: with the threshold at empty, one interrupt moves eight bytes.
+	/// Writers may be ISRs and the main loop. Cortex-M0+ has no compare-and-swap, so a writer
+	/// masks interrupts for the copy only. What does not fit is dropped whole and counted.
+	template<size_t Capacity>
+	class UartLog
+	{
+		static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+		constexpr static uint32_t Mask = Capacity - 1;
+
+	public:
+		/// Starts a binary record. Never part of the text output.
+		constexpr static uint8_t RecordMarker = 0x00;
+		/// Record ID reporting how many writes were dropped since the last report
+		constexpr static uint16_t DroppedRecordId = 0x0000;
+		constexpr static size_t MaxRecordArgs = 6;
+		/// u8 marker, u16 ID, u8 argument count, u32 arguments, all little-endian
+		constexpr static size_t MaxRecordSize = 1 + 2 + 1 + MaxRecordArgs * sizeof(uint32_t);
+
+		explicit UartLog(UART_HandleTypeDef &uartHandle) : m_UartHandle(uartHandle)
+		{
+
+		}
+
+		/// Any context. Queues all of the text or none of it.
+		bool Write(const uint8_t *data, size_t size)
+		{
+			bool queued;
+			{
+				CriticalSection lock;
+				ReportDropped();
+				queued = Push(data, size);
+			}
+			Kick();
+			return queued;
+		}
+
+		/// Any context. Queues a binary record with up to MaxRecordArgs arguments.
+		bool WriteRecord(uint16_t id, const uint32_t *args, size_t count)
+		{
+			std::array<uint8_t, MaxRecordSize> record;
+			size_t size = EncodeRecord(record.data(), id, args, std::min(count, MaxRecordArgs));
+
+			bool queued;
+			{
+				CriticalSection lock;
+				ReportDropped();
+				queued = Push(record.data(), size);
+			}
+			Kick();
+			return queued;
+		}
+
+		/// ISR. The chunk handed to the UART is on the wire.
+		void OnTransmitComplete(UART_HandleTypeDef *huart)
+		{
+			if (&m_UartHandle != huart)
+			{
+				return;
+			}
+			m_Tail = m_Tail + m_Sending;
+			m_Sending = 0;
+			Kick();
+		}
+
+		/// Everything queued is on the wire, e.g. before STOP mode stops the UART clock
+		[[nodiscard]] bool IsEmpty() const
+		{
+			return m_Head == m_Tail;
+		}
+
+		[[nodiscard]] uint32_t GetDroppedCount() const
+		{
+			return m_Dropped;
+		}
+
+	private:
+		UART_HandleTypeDef &m_UartHandle;
+		std::array<uint8_t, Capacity> m_Buffer{};
+		volatile uint32_t m_Head = 0;
+		volatile uint32_t m_Tail = 0;
+		volatile uint32_t m_Sending = 0;
+		volatile uint32_t m_Dropped = 0;
+		uint32_t m_DroppedReported = 0;
+
+		/// Called with interrupts masked
+		bool Push(const uint8_t *data, size_t size)
+		{
+			uint32_t head = m_Head;
+			if (Capacity - (head - m_Tail) < size)
+			{
+				m_Dropped = m_Dropped + 1;
+				return false;
+			}
+			for (size_t i = 0; i < size; i++)
+			{
+				m_Buffer[(head + i) & Mask] = data[i];
+			}
+			m_Head = head + size;
+			return true;
+		}
+
+		/// Called with interrupts masked. Queues a drop report ahead of the next write if one is due.
+		void ReportDropped()
+		{
+			uint32_t dropped = m_Dropped - m_DroppedReported;
+			if (dropped == 0)
+			{
+				return;
+			}
+
+			std::array<uint8_t, MaxRecordSize> record;
+			size_t size = EncodeRecord(record.data(), DroppedRecordId, &dropped, 1);
+			if (Capacity - (m_Head - m_Tail) < size)
+			{
+				return;
+			}
+			Push(record.data(), size);
+			m_DroppedReported += dropped;
+		}
+
+		void Kick()
+		{
+			CriticalSection lock;
+			if (m_Sending != 0)
+			{
+				return;
+			}
+
+			uint32_t tail = m_Tail;
+			uint32_t used = m_Head - tail;
+			if (used == 0)
+			{
+				return;
+			}
+
+			// A chunk ends at the end of the buffer, the completion interrupt sends the wrapped part
+			uint32_t offset = tail & Mask;
+			uint32_t chunk = std::min<uint32_t>(used, Capacity - offset);
+			if (HAL_UART_Transmit_IT(&m_UartHandle, &m_Buffer[offset], static_cast<uint16_t>(chunk)) == HAL_OK)
+			{
+				m_Sending = chunk;
+			}
+		}
+
+		static size_t EncodeRecord(uint8_t *record, uint16_t id, const uint32_t *args, size_t count)
+		{
+			record[0] = RecordMarker;
+			LittleEndian::Write16(&record[1], id);
+			record[3] = static_cast<uint8_t>(count);
+			for (size_t i = 0; i < count; i++)
+			{
+				LittleEndian::Write32(&record[4 + i * sizeof(uint32_t)], args[i]);
+			}
+			return 4 + count * sizeof(uint32_t);
+		}
+	};
+}
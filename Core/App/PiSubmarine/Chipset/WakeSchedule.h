@@ -0,0 +1,141 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include "PiSubmarine/Chipset/RtcClock.h"
+
+namespace PiSubmarine::Chipset
+{
+	/// One entry of the wake table, in Unix seconds
+	struct WakeEntry
+	{
+		uint32_t Start = 0;
+		/// Repeats the window this often, 0 for a single window
+		uint32_t Period = 0;
+		/// How long the rails stay up, 0 leaves the end to the Pi
+		uint32_t Duration = 0;
+	};
+
+	/// A window due at Start. End is zero when the Pi ends it with the Shutdown command.
+	struct WakeWindow
+	{
+		RtcClock::Duration Start{0};
+		RtcClock::Duration End{0};
+	};
+
+	/// The windows the Pi programmed with LocalCommand::SetSchedule. Kept in SRAM only, as the backup
+	/// registers are taken by RtcClock and PersistentState, so a reset clears the table and the Pi
+	/// programs it again once it runs.
+	class WakeSchedule
+	{
+	public:
+		constexpr static size_t MaxEntries = 4;
+		/// u32 start, u32 period, u32 duration
+		constexpr static size_t EntrySize = 4 + 4 + 4;
+		/// A window without a duration still counts as due this long after its start, e.g. when the
+		/// core woke a little late or the button booted it just before
+		constexpr static RtcClock::Duration StartSlack = std::chrono::seconds(60);
+
+		/// A repeating window has to be over before the next one starts, including the grace time the
+		/// Pi gets to shut down before the rails are forced off, or the rails stay up through the next
+		/// window and it is skipped. A single window must not have ended already. Repeating windows
+		/// may start in the past, FindNext() rolls them forward.
+		static bool IsValid(const WakeEntry &entry, RtcClock::Duration now, RtcClock::Duration grace)
+		{
+			RtcClock::Duration start = std::chrono::seconds(entry.Start);
+			RtcClock::Duration length = GetLength(entry);
+			if (entry.Period == 0)
+			{
+				return start + length > now;
+			}
+			RtcClock::Duration busy = entry.Duration != 0 ? length + grace : length;
+			return busy < RtcClock::Duration(std::chrono::seconds(entry.Period));
+		}
+
+		/// Entries must pass IsValid()
+		void Set(const std::array<WakeEntry, MaxEntries> &entries, size_t count)
+		{
+			m_Entries = entries;
+			m_Count = count < MaxEntries ? count : MaxEntries;
+		}
+
+		void Clear()
+		{
+			m_Count = 0;
+		}
+
+		[[nodiscard]] bool IsEmpty() const
+		{
+			return m_Count == 0;
+		}
+
+		[[nodiscard]] size_t GetCount() const
+		{
+			return m_Count;
+		}
+
+		/// A window is started once, a Pi that shuts down before its end is not booted again for it.
+		/// Kept across Set(), so reprogramming the table within a window does not repeat it either.
+		void MarkStarted(const WakeWindow &window)
+		{
+			m_LastStart = window.Start;
+		}
+
+		/// The window that is due at the given Unix time or the next one to start, skipping the ones
+		/// started already. Of two overlapping windows the earlier one wins. False when none is left.
+		bool FindNext(RtcClock::Duration time, WakeWindow &window) const
+		{
+			bool found = false;
+			for (size_t i = 0; i < m_Count; i++)
+			{
+				WakeWindow candidate;
+				if (FindNext(m_Entries[i], time, m_LastStart, candidate) && (!found || candidate.Start < window.Start))
+				{
+					window = candidate;
+					found = true;
+				}
+			}
+			return found;
+		}
+
+	private:
+		std::array<WakeEntry, MaxEntries> m_Entries{};
+		size_t m_Count = 0;
+		RtcClock::Duration m_LastStart{-1};
+
+		static RtcClock::Duration GetLength(const WakeEntry &entry)
+		{
+			return entry.Duration != 0 ? RtcClock::Duration(std::chrono::seconds(entry.Duration)) : StartSlack;
+		}
+
+		static bool FindNext(const WakeEntry &entry, RtcClock::Duration time, RtcClock::Duration lastStart, WakeWindow &window)
+		{
+			RtcClock::Duration start = std::chrono::seconds(entry.Start);
+			RtcClock::Duration period = std::chrono::seconds(entry.Period);
+			RtcClock::Duration length = GetLength(entry);
+
+			if (time >= start + length)
+			{
+				if (period.count() == 0)
+				{
+					return false;
+				}
+				// First repetition that has not ended yet
+				start += ((time - start - length) / period + 1) * period;
+			}
+			if (start <= lastStart)
+			{
+				if (period.count() == 0)
+				{
+					return false;
+				}
+				start += ((lastStart - start) / period + 1) * period;
+			}
+			window.Start = start;
+			window.End = entry.Duration != 0 ? start + length : RtcClock::Duration(0);
+			return true;
+		}
+	};
+}
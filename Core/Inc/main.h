@@ -93,8 +93,10 @@ void Error_Handler(void);
 #define LED_BAT_GPIO_Port GPIOB
 #define BUTTON_PWR_Pin GPIO_PIN_15
 #define BUTTON_PWR_GPIO_Port GPIOB
+#define BUTTON_PWR_EXTI_IRQn EXTI4_15_IRQn
 #define REG12_PG_Pin GPIO_PIN_8
 #define REG12_PG_GPIO_Port GPIOA
+#define REG12_PG_EXTI_IRQn EXTI4_15_IRQn
 #define CHIPSET_INT_Pin GPIO_PIN_5
 #define CHIPSET_INT_GPIO_Port GPIOB
 #define RPI_SCL_Pin GPIO_PIN_6
@@ -51,7 +51,9 @@ void HardFault_Handler(void);
 void SVC_Handler(void);
 void PendSV_Handler(void);
 void SysTick_Handler(void);
+void RTC_TAMP_IRQHandler(void);
 void EXTI0_1_IRQHandler(void);
+void EXTI4_15_IRQHandler(void);
 void DMA1_Channel1_IRQHandler(void);
 void DMA1_Channel2_3_IRQHandler(void);
 void DMA1_Ch4_7_DMAMUX_OVR_IRQHandler(void);
@@ -59,6 +61,7 @@ void ADC_COMP1_IRQHandler(void);
 void TIM6_DAC_LPTIM1_IRQHandler(void);
 void I2C1_IRQHandler(void);
 void I2C2_3_IRQHandler(void);
+void USART1_IRQHandler(void);
 /* USER CODE BEGIN EFP */
 
 /* USER CODE END EFP */
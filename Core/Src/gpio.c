@@ -33,7 +33,6 @@
 /* USER CODE END 1 */
 
 /** Configure pins
-     PB15   ------> PWR_WKUP7
      PA13 (SWDIO)   ------> DEBUG_JTMS-SWDIO
      PA14 (SWCLK)   ------> DEBUG_JTCK-SWCLK
 */
@@ -80,6 +79,12 @@ void MX_GPIO_Init(void)
   GPIO_InitStruct.Pull = GPIO_PULLUP;
   HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
+  /*Configure GPIO pin : BUTTON_PWR_Pin */
+  GPIO_InitStruct.Pin = BUTTON_PWR_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
+  GPIO_InitStruct.Pull = GPIO_PULLUP;
+  HAL_GPIO_Init(BUTTON_PWR_GPIO_Port, &GPIO_InitStruct);
+
   /*Configure GPIO pins : LED_REG12_Pin REG5_EN_Pin REG12_EN_Pin LED_BAT_Pin
                            CHIPSET_INT_Pin */
   GPIO_InitStruct.Pin = LED_REG12_Pin|REG5_EN_Pin|REG12_EN_Pin|LED_BAT_Pin
@@ -91,7 +96,7 @@ void MX_GPIO_Init(void)
 
   /*Configure GPIO pin : REG12_PG_Pin */
   GPIO_InitStruct.Pin = REG12_PG_Pin;
-  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING;
   GPIO_InitStruct.Pull = GPIO_PULLUP;
   HAL_GPIO_Init(REG12_PG_GPIO_Port, &GPIO_InitStruct);
 
@@ -111,6 +116,9 @@ void MX_GPIO_Init(void)
   HAL_NVIC_SetPriority(EXTI0_1_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(EXTI0_1_IRQn);
 
+  HAL_NVIC_SetPriority(EXTI4_15_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(EXTI4_15_IRQn);
+
 }
 
 /* USER CODE BEGIN 2 */
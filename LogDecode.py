@@ -0,0 +1,158 @@
+import argparse
+import re
+import struct
+import sys
+
+# Decodes the UART log of the chipset. Text passes through, binary records from CHIPSET_LOG() are
+# formatted with the strings of the .chipset_log_strings section of the firmware ELF.
+# Record: u8 0x00, u16 token, u8 argument count, u32 arguments, all little-endian.
+#
+#   python LogDecode.py build/Debug/PiSubmarine.Chipset.elf capture.bin
+#   python LogDecode.py build/Debug/PiSubmarine.Chipset.elf - < /dev/ttyUSB0
+
+section_name = ".chipset_log_strings"
+record_marker = 0x00
+dropped_token = 0x0000
+max_args = 6
+
+conversion = re.compile(r"%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|z|j|t)?([diouxXcs%])")
+
+
+def token_of(text):
+    # Same as PiSubmarine::Chipset::TokenizedLog::Token()
+    value = 2166136261
+    for byte in text:
+        value ^= byte
+        value = (value * 16777619) & 0xFFFFFFFF
+    token = ((value >> 16) ^ value) & 0xFFFF
+    return 1 if token == 0 else token
+
+
+def read_sections(elf_path, name):
+    with open(elf_path, "rb") as file:
+        elf = file.read()
+
+    if elf[:4] != b"\x7fELF":
+        raise ValueError(f"{elf_path} is not an ELF file")
+    if elf[5] != 1:
+        raise ValueError(f"{elf_path} is not little-endian")
+
+    if elf[4] == 1:
+        shoff, = struct.unpack_from("<I", elf, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x2E)
+        header = lambda index: struct.unpack_from("<IIIIII", elf, shoff + index * shentsize)
+    else:
+        shoff, = struct.unpack_from("<Q", elf, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x3A)
+        header = lambda index: struct.unpack_from("<IIQQQQ", elf, shoff + index * shentsize)
+
+    # The linker script merges the per-site sections, an ELF linked without it still has them apart
+    data = b""
+    found = False
+    names_offset = header(shstrndx)[4]
+    for index in range(shnum):
+        name_offset, _, _, _, offset, size = header(index)
+        end = elf.index(b"\0", names_offset + name_offset)
+        section = elf[names_offset + name_offset:end].decode()
+        if section == name or section.startswith(name + "."):
+            data += elf[offset:offset + size] + b"\0"
+            found = True
+
+    if not found:
+        raise ValueError(f"{elf_path} has no {name} section")
+    return data
+
+
+def load_strings(elf_path):
+    strings = {}
+    for text in read_sections(elf_path, section_name).split(b"\0"):
+        if not text:
+            continue
+        token = token_of(text)
+        known = strings.get(token)
+        if known is not None and known != text:
+            print(f"Token 0x{token:04X} collides: {known!r} and {text!r}", file=sys.stderr)
+            continue
+        strings[token] = text
+    return strings
+
+
+def format_record(strings, token, args):
+    if token == dropped_token:
+        return f"<dropped {args[0] if args else 0} log writes>"
+
+    text = strings.get(token)
+    if text is None:
+        return f"<unknown token 0x{token:04X} {' '.join(f'0x{arg:X}' for arg in args)}>"
+
+    remaining = list(args)
+
+    def replace(match):
+        flags, width, precision, length, conv = match.groups()
+        if conv == "%":
+            return "%"
+        if not remaining:
+            return match.group(0)
+        value = remaining.pop(0)
+        spec = "%" + flags + width + (f".{precision}" if precision else "")
+        if conv == "s":
+            return (spec + "s") % strings.get(value & 0xFFFF, f"<0x{value:04X}>".encode()).decode(errors="replace")
+        if conv == "c":
+            return (spec + "c") % chr(value & 0xFF)
+        if conv in "di":
+            bits = {"hh": 8, "h": 16}.get(length, 32)
+            value &= (1 << bits) - 1
+            if value >= 1 << (bits - 1):
+                value -= 1 << bits
+            return (spec + "d") % value
+        return (spec + ("d" if conv == "u" else conv)) % value
+
+    return conversion.sub(replace, text.decode(errors="replace"))
+
+
+def decode(strings, stream, output):
+    while True:
+        byte = stream.read(1)
+        if not byte:
+            return
+        if byte[0] != record_marker:
+            output.write(byte.decode("latin-1"))
+            continue
+
+        header = stream.read(3)
+        if len(header) < 3:
+            return
+        token, count = struct.unpack("<HB", header)
+        if count > max_args:
+            # Not a record, the capture probably started mid-record. Resynchronize on the next marker.
+            output.write(f"<bad record 0x{token:04X} with {count} arguments>\n")
+            continue
+        payload = stream.read(4 * count)
+        if len(payload) < 4 * count:
+            return
+        output.write(format_record(strings, token, struct.unpack(f"<{count}I", payload)) + "\n")
+        output.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a chipset UART log capture")
+    parser.add_argument("elf", help="firmware ELF the capture was made with")
+    parser.add_argument("capture", nargs="?", default="-", help="raw UART capture, - for stdin")
+    parser.add_argument("--list", action="store_true", help="print the token table and exit")
+    args = parser.parse_args()
+
+    strings = load_strings(args.elf)
+    if args.list:
+        for token, text in sorted(strings.items()):
+            print(f"0x{token:04X} {text.decode(errors='replace')}")
+        return
+
+    if args.capture == "-":
+        decode(strings, sys.stdin.buffer, sys.stdout)
+    else:
+        with open(args.capture, "rb") as capture:
+            decode(strings, capture, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
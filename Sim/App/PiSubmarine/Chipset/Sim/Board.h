@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include "main.h"
+#include "PiSubmarine/Chipset/Sim/VirtualTime.h"
+
+namespace PiSubmarine::Chipset::Sim
+{
+	/// GPIO levels plus the power rails around the STM32: REG12 reports power good some time after it is
+	/// enabled, REG5 is fed from REG12, and the Raspberry Pi regulator follows REG5.
+	class Board
+	{
+	public:
+		constexpr static SimTime Reg12PowerGoodDelay{20000};
+		constexpr static SimTime Reg5RampTime{5000};
+		constexpr static SimTime RegPiRampTime{30000};
+		constexpr static SimTime BatchgIntPulse{256};
+		/// The button contacts toggle this many times, this far apart, before they hold a level
+		constexpr static int ButtonBounces = 4;
+		constexpr static SimTime ButtonBounceInterval{300};
+		constexpr static uint32_t Reg5MicroVolts = 5050000;
+		constexpr static uint32_t RegPiMicroVolts = 3350000;
+		/// REGPI follows REG5 once REG5 drops below RegPiMicroVolts plus this
+		constexpr static uint32_t RegPiDropoutMicroVolts = 200000;
+		constexpr static uint32_t AdcReferenceMicroVolts = 3300000;
+		constexpr static uint32_t AdcFullScale = 4095;
+
+		explicit Board(VirtualTime &time) : m_Time(time)
+		{
+			// Open-drain interrupt lines idle high
+			SimGpioB.IDR = BATCHG_INT_Pin | BATMON_ALERT_Pin | BUTTON_PWR_Pin;
+		}
+
+		/// Called by HAL_GPIO_WritePin
+		void OnOutput(GPIO_TypeDef *port, uint16_t pin, bool level)
+		{
+			if (port == REG12_EN_GPIO_Port && pin == REG12_EN_Pin)
+			{
+				SetReg12Enabled(level);
+			}
+			else if (port == REG5_EN_GPIO_Port && pin == REG5_EN_Pin)
+			{
+				SetReg5Enabled(level);
+			}
+			else if (port == CHIPSET_INT_GPIO_Port && pin == CHIPSET_INT_Pin && level != m_ChipsetInt)
+			{
+				m_ChipsetInt = level;
+				m_Time.Trace("CHIPSET_INT %s", level ? "asserted" : "released");
+				if (level && m_ChipsetIntListener)
+				{
+					m_ChipsetIntListener();
+				}
+			}
+		}
+
+		/// Called on every rising edge of CHIPSET_INT
+		void SetChipsetIntListener(std::function<void()> listener)
+		{
+			m_ChipsetIntListener = std::move(listener);
+		}
+
+		/// Drives an input. A rising edge raises the EXTI interrupt of the pin, a falling edge only
+		/// that of BUTTON_PWR, the one pin configured for both edges.
+		void SetInput(GPIO_TypeDef *port, uint16_t pin, bool level)
+		{
+			bool old = (port->IDR & pin) != 0;
+			if (level)
+			{
+				port->IDR = port->IDR | pin;
+			}
+			else
+			{
+				port->IDR = port->IDR & ~static_cast<uint32_t>(pin);
+			}
+
+			if (level && !old)
+			{
+				HAL_GPIO_EXTI_Rising_Callback(pin);
+			}
+			else if (!level && old && port == BUTTON_PWR_GPIO_Port && pin == BUTTON_PWR_Pin)
+			{
+				HAL_GPIO_EXTI_Falling_Callback(pin);
+			}
+		}
+
+		/// Holds the active-low power button down for a while, the contacts bounce at both ends
+		void PressButton(SimTime duration)
+		{
+			m_Time.Trace("button pressed");
+			BounceButton(false);
+			m_Time.Schedule(duration, [this]()
+			{
+				m_Time.Trace("button released");
+				BounceButton(true);
+			});
+		}
+
+		/// Active-low interrupt pulse of the charger, the EXTI fires on its rising edge
+		void PulseBatchgInt()
+		{
+			SetInput(BATCHG_INT_GPIO_Port, BATCHG_INT_Pin, false);
+			m_Time.Schedule(BatchgIntPulse, [this]()
+			{	SetInput(BATCHG_INT_GPIO_Port, BATCHG_INT_Pin, true);});
+		}
+
+		/// 12-bit ADC code of a rail behind the 1:2 divider
+		[[nodiscard]] uint16_t RailCode(uint32_t microVolts) const
+		{
+			uint64_t pinMicroVolts = microVolts / 2;
+			uint64_t code = pinMicroVolts * AdcFullScale / AdcReferenceMicroVolts;
+			return static_cast<uint16_t>(code > AdcFullScale ? AdcFullScale : code);
+		}
+
+		[[nodiscard]] uint32_t GetReg5MicroVolts() const
+		{
+			return m_Reg5MicroVolts;
+		}
+
+		[[nodiscard]] uint32_t GetRegPiMicroVolts() const
+		{
+			return m_RegPiMicroVolts;
+		}
+
+		[[nodiscard]] bool IsRegPiUp() const
+		{
+			return m_RegPiMicroVolts != 0;
+		}
+
+		/// REG5 drops to the given voltage for a while, as under a load step. Switching the rail
+		/// off and on ends the sag early.
+		void Sag(uint32_t reg5MicroVolts, SimTime duration)
+		{
+			if (m_Reg5MicroVolts == 0)
+			{
+				return;
+			}
+			m_Reg5MicroVolts = std::min(m_Reg5MicroVolts, reg5MicroVolts);
+			uint32_t regPi = reg5MicroVolts > RegPiDropoutMicroVolts ? reg5MicroVolts - RegPiDropoutMicroVolts : 0;
+			m_RegPiMicroVolts = std::min(m_RegPiMicroVolts, regPi);
+			m_Time.Trace("REG5 sags to %lu uV", static_cast<unsigned long>(reg5MicroVolts));
+
+			uint32_t generation = m_Reg5Generation;
+			m_Time.Schedule(duration, [this, generation]()
+			{
+				if (generation != m_Reg5Generation)
+				{
+					return;
+				}
+				m_Reg5MicroVolts = Reg5MicroVolts;
+				m_RegPiMicroVolts = RegPiMicroVolts;
+				m_Time.Trace("REG5 recovered");
+			});
+		}
+
+	private:
+		VirtualTime &m_Time;
+		bool m_Reg12Enabled = false;
+		bool m_Reg5Enabled = false;
+		bool m_ChipsetInt = false;
+		std::function<void()> m_ChipsetIntListener;
+		uint32_t m_Reg5MicroVolts = 0;
+		uint32_t m_RegPiMicroVolts = 0;
+		/// Invalidate ramps that were scheduled before a rail was switched off
+		uint32_t m_Reg12Generation = 0;
+		uint32_t m_Reg5Generation = 0;
+
+		void SetReg12Enabled(bool enabled)
+		{
+			if (enabled == m_Reg12Enabled)
+			{
+				return;
+			}
+			m_Reg12Enabled = enabled;
+			m_Time.Trace("REG12 %s", enabled ? "on" : "off");
+
+			if (!enabled)
+			{
+				m_Reg12Generation++;
+				m_Reg5Generation++;
+				SetInput(REG12_PG_GPIO_Port, REG12_PG_Pin, false);
+				DropReg5();
+				return;
+			}
+
+			uint32_t generation = m_Reg12Generation;
+			m_Time.Schedule(Reg12PowerGoodDelay, [this, generation]()
+			{
+				if (generation != m_Reg12Generation)
+				{
+					return;
+				}
+				SetInput(REG12_PG_GPIO_Port, REG12_PG_Pin, true);
+				if (m_Reg5Enabled)
+				{
+					RampReg5();
+				}
+			});
+		}
+
+		void SetReg5Enabled(bool enabled)
+		{
+			if (enabled == m_Reg5Enabled)
+			{
+				return;
+			}
+			m_Reg5Enabled = enabled;
+			m_Time.Trace("REG5 %s", enabled ? "on" : "off");
+
+			if (!enabled)
+			{
+				m_Reg5Generation++;
+				DropReg5();
+				return;
+			}
+
+			if ((REG12_PG_GPIO_Port->IDR & REG12_PG_Pin) != 0)
+			{
+				RampReg5();
+			}
+		}
+
+		void RampReg5()
+		{
+			uint32_t generation = m_Reg5Generation;
+			m_Time.Schedule(Reg5RampTime, [this, generation]()
+			{
+				if (generation != m_Reg5Generation)
+				{
+					return;
+				}
+				m_Reg5MicroVolts = Reg5MicroVolts;
+				m_Time.Trace("REG5 good");
+			});
+			m_Time.Schedule(Reg5RampTime + RegPiRampTime, [this, generation]()
+			{
+				if (generation != m_Reg5Generation)
+				{
+					return;
+				}
+				m_RegPiMicroVolts = RegPiMicroVolts;
+				m_Time.Trace("REGPI good");
+			});
+		}
+
+		void BounceButton(bool level)
+		{
+			for (int i = 0; i <= ButtonBounces; i++)
+			{
+				bool bounce = i % 2 == 0 ? level : !level;
+				m_Time.Schedule(ButtonBounceInterval * i, [this, bounce]()
+				{	SetInput(BUTTON_PWR_GPIO_Port, BUTTON_PWR_Pin, bounce);});
+			}
+		}
+
+		void DropReg5()
+		{
+			m_Reg5MicroVolts = 0;
+			m_RegPiMicroVolts = 0;
+		}
+	};
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "PiSubmarine/Chipset/Sim/I2CBus.h"
+#include "PiSubmarine/Chipset/Sim/Board.h"
+
+namespace PiSubmarine::Chipset::Sim
+{
+	/// Register map of the BQ25792 charger with an auto-incrementing register pointer.
+	/// Only what the firmware looks at is modelled: VBUS presence, the charge state and the
+	/// clear-on-read flag registers that come with an INT pulse.
+	class Bq25792Model : public II2CTarget
+	{
+	public:
+		constexpr static uint8_t Address = 0x6B;
+		constexpr static size_t RegisterCount = 0x49;
+
+		constexpr static uint8_t ChargerStatus0 = 0x1B;
+		constexpr static uint8_t ChargerStatus1 = 0x1C;
+		constexpr static uint8_t FirstFlag = 0x22;
+		constexpr static uint8_t LastFlag = 0x27;
+		constexpr static uint8_t PartInformation = 0x48;
+
+		constexpr static uint8_t VbusPresent = 1 << 0;
+		constexpr static uint8_t ChargeStatShift = 5;
+		constexpr static uint8_t ChargeStatFastCharge = 3;
+
+		explicit Bq25792Model(Board &board) : m_Board(board)
+		{
+			// Part number 3 (BQ25792), revision 1
+			m_Registers[PartInformation] = 0x19;
+		}
+
+		bool Write(const uint8_t *data, size_t length) override
+		{
+			if (length == 0)
+			{
+				return true;
+			}
+			m_Pointer = data[0];
+			for (size_t i = 1; i < length; i++)
+			{
+				if (m_Pointer < RegisterCount && !IsReadOnly(m_Pointer))
+				{
+					m_Registers[m_Pointer] = data[i];
+				}
+				m_Pointer++;
+			}
+			return true;
+		}
+
+		bool Read(uint8_t *data, size_t length) override
+		{
+			for (size_t i = 0; i < length; i++)
+			{
+				data[i] = m_Pointer < RegisterCount ? m_Registers[m_Pointer] : 0;
+				if (m_Pointer >= FirstFlag && m_Pointer <= LastFlag)
+				{
+					m_Registers[m_Pointer] = 0;
+				}
+				m_Pointer++;
+			}
+			return true;
+		}
+
+		/// Plugs or unplugs the charging source and pulses INT like the charger does
+		void SetVbus(bool present)
+		{
+			if (present)
+			{
+				m_Registers[ChargerStatus0] |= VbusPresent;
+				m_Registers[ChargerStatus1] = static_cast<uint8_t>(ChargeStatFastCharge << ChargeStatShift);
+			}
+			else
+			{
+				m_Registers[ChargerStatus0] &= static_cast<uint8_t>(~VbusPresent);
+				m_Registers[ChargerStatus1] = 0;
+			}
+			m_Registers[FirstFlag] |= VbusPresent;
+			m_Board.PulseBatchgInt();
+		}
+
+		[[nodiscard]] uint8_t GetRegister(uint8_t reg) const
+		{
+			return m_Registers[reg];
+		}
+
+	private:
+		Board &m_Board;
+		std::array<uint8_t, RegisterCount> m_Registers{};
+		uint8_t m_Pointer = 0;
+
+		static bool IsReadOnly(uint8_t reg)
+		{
+			return reg >= ChargerStatus0 && reg <= LastFlag;
+		}
+	};
+}
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include "main.h"
+#include "PiSubmarine/Chipset/Sim/VirtualTime.h"
+
+namespace PiSubmarine::Chipset::Sim
+{
+	/// Device on a simulated bus. Returning false NACKs the transfer.
+	class II2CTarget
+	{
+	public:
+		virtual ~II2CTarget() = default;
+		virtual bool Write(const uint8_t *data, size_t length) = 0;
+		virtual bool Read(uint8_t *data, size_t length) = 0;
+	};
+
+	/// One I2C peripheral and the bus behind it. Master DMA transfers complete after the time the
+	/// bytes take on a 100 kHz bus, targets are looked up by 7-bit address. The slave side only
+	/// records what the firmware set up, the external master (RpiModel) drives it.
+	class I2CBus
+	{
+	public:
+		constexpr static uint32_t BitRate = 100000;
+
+		enum class Kind : uint8_t
+		{
+			Transmit,
+			Receive,
+			MemWrite,
+			MemRead
+		};
+
+		struct SlaveTransfer
+		{
+			uint8_t *Data = nullptr;
+			uint16_t Size = 0;
+		};
+
+		I2CBus(VirtualTime &time, I2C_HandleTypeDef &handle, const char *name) : m_Time(time), m_Handle(handle), m_Name(name)
+		{
+
+		}
+
+		void Attach(uint8_t address, II2CTarget &target)
+		{
+			m_Targets[address & 0x7F] = &target;
+		}
+
+		[[nodiscard]] I2C_HandleTypeDef& GetHandle() const
+		{
+			return m_Handle;
+		}
+
+		/// Time a transfer of the given number of bytes, address bytes included, occupies the bus
+		[[nodiscard]] static SimTime WireTime(size_t bytes)
+		{
+			// 9 clocks per byte plus start and stop
+			return SimTime((bytes * 9 + 2) * 1000000 / BitRate);
+		}
+
+		HAL_StatusTypeDef StartMaster(Kind kind, uint16_t address, uint16_t reg, uint8_t *data, uint16_t size)
+		{
+			if (m_Busy)
+			{
+				return HAL_BUSY;
+			}
+			m_Busy = true;
+			m_Handle.ErrorCode = HAL_I2C_ERROR_NONE;
+
+			size_t wireBytes = 1 + size;
+			if (kind == Kind::MemWrite)
+			{
+				wireBytes += 1;
+			}
+			else if (kind == Kind::MemRead)
+			{
+				wireBytes += 2;
+			}
+
+			uint32_t generation = m_Generation;
+			m_Time.Schedule(WireTime(wireBytes), [this, generation, kind, address, reg, data, size]()
+			{
+				if (generation != m_Generation)
+				{
+					return;
+				}
+				m_Busy = false;
+				CompleteMaster(kind, address, reg, data, size);
+			});
+			return HAL_OK;
+		}
+
+		/// Blocking transfers run in zero virtual time
+		HAL_StatusTypeDef TransferBlocking(Kind kind, uint16_t address, uint8_t *data, uint16_t size)
+		{
+			if (m_Busy)
+			{
+				return HAL_BUSY;
+			}
+			return Execute(kind, address, 0, data, size) ? HAL_OK : HAL_ERROR;
+		}
+
+		HAL_StatusTypeDef Abort()
+		{
+			if (!m_Busy)
+			{
+				return HAL_ERROR;
+			}
+			m_Generation++;
+			m_Busy = false;
+			m_Time.Schedule(WireTime(1), [this]()
+			{	HAL_I2C_AbortCpltCallback(&m_Handle);});
+			return HAL_OK;
+		}
+
+		/// Peripheral reset: drops the transfer in flight and the listen mode
+		void Reset()
+		{
+			m_Generation++;
+			m_Busy = false;
+			m_Listening = false;
+			m_SlaveRx = {};
+			m_SlaveTx = {};
+		}
+
+		void SetListening(bool listening)
+		{
+			m_Listening = listening;
+		}
+
+		[[nodiscard]] bool IsListening() const
+		{
+			return m_Listening;
+		}
+
+		void SetSlaveRx(uint8_t *data, uint16_t size)
+		{
+			m_SlaveRx = {data, size};
+		}
+
+		void SetSlaveTx(uint8_t *data, uint16_t size)
+		{
+			m_SlaveTx = {data, size};
+		}
+
+		/// Returns and clears the buffer the firmware set up for the external master
+		SlaveTransfer TakeSlaveRx()
+		{
+			SlaveTransfer transfer = m_SlaveRx;
+			m_SlaveRx = {};
+			return transfer;
+		}
+
+		SlaveTransfer TakeSlaveTx()
+		{
+			SlaveTransfer transfer = m_SlaveTx;
+			m_SlaveTx = {};
+			return transfer;
+		}
+
+		[[nodiscard]] uint64_t GetTransferCount() const
+		{
+			return m_TransferCount;
+		}
+
+		[[nodiscard]] uint64_t GetByteCount() const
+		{
+			return m_ByteCount;
+		}
+
+		[[nodiscard]] uint64_t GetNackCount() const
+		{
+			return m_NackCount;
+		}
+
+		[[nodiscard]] const char* GetName() const
+		{
+			return m_Name;
+		}
+
+	private:
+		VirtualTime &m_Time;
+		I2C_HandleTypeDef &m_Handle;
+		const char *m_Name;
+		std::array<II2CTarget*, 128> m_Targets{};
+		bool m_Busy = false;
+		bool m_Listening = false;
+		uint32_t m_Generation = 0;
+		SlaveTransfer m_SlaveRx;
+		SlaveTransfer m_SlaveTx;
+		uint64_t m_TransferCount = 0;
+		uint64_t m_ByteCount = 0;
+		uint64_t m_NackCount = 0;
+		std::vector<uint8_t> m_Frame;
+
+		bool Execute(Kind kind, uint16_t address, uint16_t reg, uint8_t *data, uint16_t size)
+		{
+			II2CTarget *target = m_Targets[(address >> 1) & 0x7F];
+			m_TransferCount++;
+			m_Time.Trace("%s %s 0x%02X reg 0x%02X len %u%s", m_Name, KindName(kind), address >> 1, reg, size, target ? "" : " NACK");
+			if (target == nullptr)
+			{
+				m_NackCount++;
+				return false;
+			}
+
+			uint8_t regByte = static_cast<uint8_t>(reg);
+			bool ack = true;
+			switch (kind)
+			{
+			case Kind::Transmit:
+				ack = target->Write(data, size);
+				break;
+			case Kind::Receive:
+				ack = target->Read(data, size);
+				break;
+			case Kind::MemWrite:
+			{
+				// Register address and data go out in one write transfer
+				m_Frame.resize(size + 1);
+				m_Frame[0] = regByte;
+				memcpy(&m_Frame[1], data, size);
+				ack = target->Write(m_Frame.data(), m_Frame.size());
+				break;
+			}
+			case Kind::MemRead:
+				ack = target->Write(&regByte, 1) && target->Read(data, size);
+				break;
+			}
+
+			if (!ack)
+			{
+				m_NackCount++;
+				return false;
+			}
+			m_ByteCount += size;
+			return true;
+		}
+
+		void CompleteMaster(Kind kind, uint16_t address, uint16_t reg, uint8_t *data, uint16_t size)
+		{
+			if (!Execute(kind, address, reg, data, size))
+			{
+				m_Handle.ErrorCode = HAL_I2C_ERROR_AF;
+				HAL_I2C_ErrorCallback(&m_Handle);
+				return;
+			}
+
+			switch (kind)
+			{
+			case Kind::Transmit:
+				HAL_I2C_MasterTxCpltCallback(&m_Handle);
+				break;
+			case Kind::Receive:
+				HAL_I2C_MasterRxCpltCallback(&m_Handle);
+				break;
+			case Kind::MemWrite:
+				HAL_I2C_MemTxCpltCallback(&m_Handle);
+				break;
+			case Kind::MemRead:
+				HAL_I2C_MemRxCpltCallback(&m_Handle);
+				break;
+			}
+		}
+
+		static const char* KindName(Kind kind)
+		{
+			switch (kind)
+			{
+			case Kind::Transmit:
+				return "write";
+			case Kind::Receive:
+				return "read";
+			case Kind::MemWrite:
+				return "mem-write";
+			case Kind::MemRead:
+				return "mem-read";
+			}
+			return "?";
+		}
+	};
+}
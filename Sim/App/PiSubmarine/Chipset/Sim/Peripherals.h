@@ -0,0 +1,471 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <optional>
+#include "main.h"
+#include "PiSubmarine/Chipset/Sim/VirtualTime.h"
+#include "PiSubmarine/Chipset/Sim/Board.h"
+
+namespace PiSubmarine::Chipset::Sim
+{
+	/// LPTIM1 as the firmware uses it: a 16-bit up-counter at 1 kHz with the auto-reload match
+	/// interrupt and the CC1 compare interrupt. ARRM is raised when the counter wraps to zero.
+	class LptimModel
+	{
+	public:
+		constexpr static SimTime TickPeriod{1000};
+		constexpr static uint64_t CounterPeriod = 0x10000;
+
+		explicit LptimModel(LPTIM_HandleTypeDef &handle) : m_Handle(handle)
+		{
+
+		}
+
+		[[nodiscard]] LPTIM_HandleTypeDef& GetHandle() const
+		{
+			return m_Handle;
+		}
+
+		void Start(SimTime now)
+		{
+			m_Running = true;
+			m_Start = now;
+			m_LastWrapTick = 0;
+		}
+
+		void Stop()
+		{
+			m_Running = false;
+		}
+
+		[[nodiscard]] uint32_t ReadCounter(SimTime now) const
+		{
+			if (!m_Running)
+			{
+				return 0;
+			}
+			return static_cast<uint32_t>(Ticks(now) % CounterPeriod);
+		}
+
+		/// Time of the next interrupt after now, if any is enabled
+		[[nodiscard]] std::optional<SimTime> NextInterrupt(SimTime now) const
+		{
+			if (!m_Running)
+			{
+				return std::nullopt;
+			}
+
+			uint64_t ticks = Ticks(now);
+			uint64_t next = (ticks / CounterPeriod + 1) * CounterPeriod;
+			if (m_Handle.Instance->DIER & LPTIM_IT_CC1)
+			{
+				uint64_t match = ticks - ticks % CounterPeriod + m_Handle.Instance->CCR1;
+				if (match <= ticks)
+				{
+					match += CounterPeriod;
+				}
+				next = std::min(next, match);
+			}
+			return m_Start + TickPeriod * static_cast<int64_t>(next);
+		}
+
+		/// Raises the auto-reload interrupt if the counter wrapped at now. A compare match only wakes the core.
+		void Dispatch(SimTime now)
+		{
+			if (!m_Running || now < m_Start || (now - m_Start) % TickPeriod != SimTime(0))
+			{
+				return;
+			}
+
+			uint64_t ticks = Ticks(now);
+			if (ticks == 0 || ticks % CounterPeriod != 0 || ticks == m_LastWrapTick)
+			{
+				return;
+			}
+			m_LastWrapTick = ticks;
+			HAL_LPTIM_AutoReloadMatchCallback(&m_Handle);
+		}
+
+	private:
+		LPTIM_HandleTypeDef &m_Handle;
+		bool m_Running = false;
+		SimTime m_Start{0};
+		uint64_t m_LastWrapTick = 0;
+
+		[[nodiscard]] uint64_t Ticks(SimTime now) const
+		{
+			return static_cast<uint64_t>((now - m_Start) / TickPeriod);
+		}
+	};
+
+	/// ADC1 in circular DMA mode, triggered by TIM6. Each trigger converts the four channels into
+	/// the next half of the DMA buffer and raises the half or full transfer interrupt.
+	class AdcModel
+	{
+	public:
+		constexpr static size_t ChannelCount = 4;
+
+		AdcModel(VirtualTime &time, Board &board, ADC_HandleTypeDef &handle) : m_Time(time), m_Board(board), m_Handle(handle)
+		{
+
+		}
+
+		void SetBallastCode(uint16_t code)
+		{
+			m_BallastCode = code;
+		}
+
+		void SetTemperatureCode(uint16_t code)
+		{
+			m_TemperatureCode = code;
+		}
+
+		void StartDma(uint16_t *buffer, size_t length)
+		{
+			m_Buffer = buffer;
+			m_Length = length;
+			m_Offset = 0;
+			m_Generation++;
+			m_Scheduled = false;
+			// HAL_ADC_Start_DMA() enables both transfer interrupts
+			m_DmaInterrupts = DMA_IT_HT | DMA_IT_TC;
+		}
+
+		/// Analog watchdogs 2 and 3, which monitor a set of channels
+		void SetWatchdog(uint32_t number, uint32_t channel, uint16_t low, uint16_t high)
+		{
+			if (number < ADC_ANALOGWATCHDOG_2 || number > ADC_ANALOGWATCHDOG_3)
+			{
+				return;
+			}
+			Watchdog &watchdog = m_Watchdogs[number - ADC_ANALOGWATCHDOG_2];
+			watchdog.Channels |= 1U << channel;
+			watchdog.Low = low;
+			watchdog.High = high;
+		}
+
+		void EnableInterrupts(uint32_t interrupts)
+		{
+			m_AdcInterrupts |= interrupts;
+		}
+
+		void DisableInterrupts(uint32_t interrupts)
+		{
+			m_AdcInterrupts &= ~interrupts;
+		}
+
+		void EnableDmaInterrupts(uint32_t interrupts)
+		{
+			m_DmaInterrupts |= interrupts;
+		}
+
+		void DisableDmaInterrupts(uint32_t interrupts)
+		{
+			m_DmaInterrupts &= ~interrupts;
+		}
+
+		void StopDma()
+		{
+			m_Buffer = nullptr;
+			m_Generation++;
+			m_Scheduled = false;
+		}
+
+		/// The firmware drives TIM6 by register writes, so its state is picked up before every sleep
+		void Poll(uint32_t timerClock)
+		{
+			if (m_Scheduled || !IsTriggered())
+			{
+				return;
+			}
+
+			uint64_t ticks = static_cast<uint64_t>(TIM6->PSC + 1) * (TIM6->ARR + 1);
+			SimTime period(ticks * 1000000 / timerClock);
+			uint32_t generation = m_Generation;
+			m_Scheduled = true;
+			m_Time.Schedule(period, [this, generation, timerClock]()
+			{
+				if (generation != m_Generation)
+				{
+					m_Time.MarkQuiet();
+					return;
+				}
+				m_Scheduled = false;
+				if (!IsTriggered())
+				{
+					m_Time.MarkQuiet();
+					return;
+				}
+				Convert();
+				Poll(timerClock);
+			});
+		}
+
+		/// Transfers left until the circular buffer wraps, like CNDTR
+		[[nodiscard]] uint32_t GetDmaCounter() const
+		{
+			return static_cast<uint32_t>(m_Length - m_Offset);
+		}
+
+		[[nodiscard]] uint64_t GetScanCount() const
+		{
+			return m_ScanCount;
+		}
+
+	private:
+		VirtualTime &m_Time;
+		Board &m_Board;
+		ADC_HandleTypeDef &m_Handle;
+		uint16_t *m_Buffer = nullptr;
+		size_t m_Length = 0;
+		size_t m_Offset = 0;
+		uint32_t m_Generation = 0;
+		bool m_Scheduled = false;
+		uint16_t m_BallastCode = 2048;
+		uint16_t m_TemperatureCode = 0;
+		uint64_t m_ScanCount = 0;
+
+		struct Watchdog
+		{
+			/// Bit per channel number
+			uint32_t Channels = 0;
+			uint16_t Low = 0;
+			uint16_t High = 0xFFF;
+		};
+
+		std::array<Watchdog, 2> m_Watchdogs{};
+		uint32_t m_AdcInterrupts = 0;
+		uint32_t m_DmaInterrupts = 0;
+
+		[[nodiscard]] bool IsTriggered() const
+		{
+			return m_Buffer != nullptr && m_Length >= 2 * ChannelCount && m_Length % (2 * ChannelCount) == 0 && (TIM6->CR1 & TIM_CR1_CEN) != 0;
+		}
+
+		void Convert()
+		{
+			const std::array<uint16_t, ChannelCount> codes { m_BallastCode, m_Board.RailCode(m_Board.GetReg5MicroVolts()), m_Board.RailCode(
+					m_Board.GetRegPiMicroVolts()), m_TemperatureCode };
+			// Channels 4 to 6 come first in the sequence, the temperature sensor last. A watchdog
+			// interrupts at the end of the conversion, with its result still in DR.
+			bool interrupted = false;
+			for (size_t i = 0; i < ChannelCount; i++)
+			{
+				SimAdc1.DR = codes[i];
+				m_Buffer[m_Offset + i] = codes[i];
+				if (i + 1 < ChannelCount && CheckWatchdogs(ADC_CHANNEL_4 + i, codes[i]))
+				{
+					interrupted = true;
+				}
+			}
+			m_ScanCount++;
+
+			m_Offset += ChannelCount;
+			if (m_Offset == m_Length / 2 && (m_DmaInterrupts & DMA_IT_HT) != 0)
+			{
+				HAL_ADC_ConvHalfCpltCallback(&m_Handle);
+				interrupted = true;
+			}
+			else if (m_Offset == m_Length)
+			{
+				m_Offset = 0;
+				if ((m_DmaInterrupts & DMA_IT_TC) != 0)
+				{
+					HAL_ADC_ConvCpltCallback(&m_Handle);
+					interrupted = true;
+				}
+			}
+			if (!interrupted)
+			{
+				m_Time.MarkQuiet();
+			}
+		}
+
+		/// True if a watchdog interrupted
+		bool CheckWatchdogs(uint32_t channel, uint16_t code)
+		{
+			bool interrupted = false;
+			for (size_t i = 0; i < m_Watchdogs.size(); i++)
+			{
+				const Watchdog &watchdog = m_Watchdogs[i];
+				bool outside = code < watchdog.Low || code > watchdog.High;
+				if ((m_AdcInterrupts & (ADC_IT_AWD2 << i)) == 0 || (watchdog.Channels & (1U << channel)) == 0 || !outside)
+				{
+					continue;
+				}
+				if (i == 0)
+				{
+					HAL_ADCEx_LevelOutOfWindow2Callback(&m_Handle);
+				}
+				else
+				{
+					HAL_ADCEx_LevelOutOfWindow3Callback(&m_Handle);
+				}
+				interrupted = true;
+			}
+			return interrupted;
+		}
+	};
+
+	/// RTC in binary mode, as configured by CubeMX: the subsecond register counts down from 0xFFFFFFFF
+	/// at LSI / (PREDIV_A + 1) and flags every wrap. The counter runs from the start of the simulation,
+	/// like an RTC configured by an earlier boot, and the backup registers keep their values for the
+	/// whole run.
+	class RtcModel
+	{
+	public:
+		constexpr static uint32_t AsynchPrediv = 7;
+		constexpr static uint64_t TickRate = LSI_VALUE / (AsynchPrediv + 1);
+		constexpr static size_t BackupRegisterCount = 9;
+
+		explicit RtcModel(VirtualTime &time) : m_Time(time)
+		{
+
+		}
+
+		/// Counter value at the start, to reach a wrap without simulating 12 days
+		void SetStartCounter(uint32_t counter)
+		{
+			m_StartCounter = counter;
+		}
+
+		void Init()
+		{
+			SimRtc.ICSR = RTC_BINARY_ONLY;
+			SimRtc.PRER = AsynchPrediv << RTC_PRER_PREDIV_A_Pos;
+		}
+
+		/// Brings SSR and the underflow flag up to virtual time
+		void Sync()
+		{
+			uint64_t ticks = static_cast<uint64_t>(m_Time.Now().count()) * TickRate / 1000000 + (UINT32_MAX - m_StartCounter);
+			SimRtc.SSR = UINT32_MAX - static_cast<uint32_t>(ticks);
+			uint64_t wraps = ticks >> 32;
+			if (wraps > m_Wraps)
+			{
+				m_Wraps = wraps;
+				SimRtc.SR = SimRtc.SR | RTC_SR_SSRUF;
+				m_Time.Trace("rtc counter wrap");
+			}
+		}
+
+		void ClearFlags(uint32_t flags)
+		{
+			SimRtc.SR = SimRtc.SR & ~flags;
+		}
+
+		void WriteBackup(uint32_t index, uint32_t value)
+		{
+			if (index < BackupRegisterCount)
+			{
+				m_Backup[index] = value;
+			}
+		}
+
+		[[nodiscard]] uint32_t ReadBackup(uint32_t index) const
+		{
+			return index < BackupRegisterCount ? m_Backup[index] : 0;
+		}
+
+		/// Alarm 0 is A, 1 is B. Fires when SSR counts down to the value, a whole wrap later if it is
+		/// there already.
+		void SetAlarm(RTC_HandleTypeDef *hrtc, size_t alarm, uint32_t counter)
+		{
+			Sync();
+			uint64_t ticks = static_cast<uint32_t>(SimRtc.SSR - counter);
+			if (ticks == 0)
+			{
+				ticks = uint64_t{1} << 32;
+			}
+			// Virtual time of the first tick with that count, SSR steps every 250 us
+			uint64_t elapsed = static_cast<uint64_t>(m_Time.Now().count()) * TickRate / 1000000 + ticks;
+			SimTime due((elapsed * 1000000 + TickRate - 1) / TickRate);
+			uint32_t generation = ++m_AlarmGenerations[alarm];
+			m_Time.Schedule(due - m_Time.Now(), [this, hrtc, alarm, generation]()
+			{
+				if (generation != m_AlarmGenerations[alarm])
+				{
+					return;
+				}
+				m_Time.Trace("rtc alarm %c", static_cast<char>('A' + alarm));
+				if (alarm == 0)
+				{
+					HAL_RTC_AlarmAEventCallback(hrtc);
+				}
+				else
+				{
+					HAL_RTCEx_AlarmBEventCallback(hrtc);
+				}
+			});
+		}
+
+		void ClearAlarm(size_t alarm)
+		{
+			m_AlarmGenerations[alarm]++;
+		}
+
+	private:
+		VirtualTime &m_Time;
+		uint32_t m_StartCounter = UINT32_MAX;
+		uint64_t m_Wraps = 0;
+		std::array<uint32_t, BackupRegisterCount> m_Backup{};
+		/// Setting or clearing an alarm drops the one scheduled before
+		std::array<uint32_t, 2> m_AlarmGenerations{};
+	};
+
+	/// USART1 transmitter at 115200 8N1. Bytes go to the output stream as they are handed over,
+	/// the completion interrupt follows after their time on the wire.
+	class UartModel
+	{
+	public:
+		constexpr static uint32_t BaudRate = 115200;
+
+		explicit UartModel(VirtualTime &time) : m_Time(time)
+		{
+
+		}
+
+		bool Transmit(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size)
+		{
+			if (m_Busy)
+			{
+				return false;
+			}
+			m_Busy = true;
+			m_ByteCount += size;
+			fwrite(data, 1, size, m_Output);
+			m_Time.Schedule(SimTime(static_cast<int64_t>(size) * 10 * 1000000 / BaudRate), [this, huart]()
+			{
+				m_Busy = false;
+				HAL_UART_TxCpltCallback(huart);
+			});
+			return true;
+		}
+
+		/// The polled transfer, the firmware uses it before the application exists
+		void TransmitBlocking(const uint8_t *data, uint16_t size)
+		{
+			m_ByteCount += size;
+			fwrite(data, 1, size, m_Output);
+		}
+
+		void SetOutput(FILE *output)
+		{
+			m_Output = output;
+		}
+
+		[[nodiscard]] uint64_t GetByteCount() const
+		{
+			return m_ByteCount;
+		}
+
+	private:
+		VirtualTime &m_Time;
+		FILE *m_Output = stdout;
+		bool m_Busy = false;
+		uint64_t m_ByteCount = 0;
+	};
+}
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "main.h"
+#include "PiSubmarine/Chipset/Sim/VirtualTime.h"
+#include "PiSubmarine/Chipset/Sim/Board.h"
+#include "PiSubmarine/Chipset/Sim/I2CBus.h"
+
+namespace PiSubmarine::Chipset::Sim
+{
+	/// The Raspberry Pi as I2C master of the RPI_I2C bus. Once REGPI is up and the Pi has booted it
+	/// reads the status packet periodically, and it sends scripted command frames. It can also sleep on
+	/// CHIPSET_INT and read the Events register at every edge.
+	class RpiModel
+	{
+	public:
+		constexpr static SimTime BootTime{2000000};
+		/// From the CHIPSET_INT edge to the start of the read, a GPIO interrupt in Linux user space
+		constexpr static SimTime InterruptLatency{200};
+		constexpr static SimTime RetryDelay{1000};
+		constexpr static uint8_t EventsRegister = 0x4D;
+
+		RpiModel(VirtualTime &time, Board &board, I2CBus &bus) : m_Time(time), m_Board(board), m_Bus(bus)
+		{
+
+		}
+
+		/// Starts the periodic reads. A zero period disables them.
+		void StartPolling(std::chrono::milliseconds period)
+		{
+			if (period.count() <= 0)
+			{
+				return;
+			}
+			m_Period = period;
+			m_Time.Schedule(m_Period, [this]()
+			{	Poll();});
+		}
+
+		/// Reads the Events register after every CHIPSET_INT edge
+		void ListenToInterrupt()
+		{
+			m_Board.SetChipsetIntListener([this]()
+			{
+				m_InterruptCount++;
+				m_Time.Schedule(InterruptLatency, [this]()
+				{	ReadEvents();});
+			});
+		}
+
+		/// Sends data at the given time, if the Pi is up by then
+		void ScheduleWrite(std::chrono::milliseconds at, std::vector<uint8_t> data)
+		{
+			m_Time.Schedule(at - std::chrono::duration_cast<SimTime>(m_Time.Now()), [this, data = std::move(data)]()
+			{	Write(data);});
+		}
+
+		/// Reads count bytes of the register map from address at the given time: the address byte is
+		/// written, then a repeated START reads
+		void ScheduleRegisterRead(std::chrono::milliseconds at, uint8_t address, size_t count)
+		{
+			m_Time.Schedule(at - std::chrono::duration_cast<SimTime>(m_Time.Now()), [this, address, count]()
+			{	ReadRegisters(address, count);});
+		}
+
+		[[nodiscard]] uint64_t GetReadCount() const
+		{
+			return m_ReadCount;
+		}
+
+		[[nodiscard]] uint64_t GetWriteCount() const
+		{
+			return m_WriteCount;
+		}
+
+		[[nodiscard]] uint64_t GetNackCount() const
+		{
+			return m_NackCount;
+		}
+
+		[[nodiscard]] uint64_t GetInterruptCount() const
+		{
+			return m_InterruptCount;
+		}
+
+		/// Last bytes read from the chipset
+		[[nodiscard]] const std::vector<uint8_t>& GetLastRead() const
+		{
+			return m_LastRead;
+		}
+
+	private:
+		VirtualTime &m_Time;
+		Board &m_Board;
+		I2CBus &m_Bus;
+		std::chrono::milliseconds m_Period{0};
+		SimTime m_PoweredSince{-1};
+		bool m_Transferring = false;
+		std::vector<uint8_t> m_LastRead;
+		uint64_t m_ReadCount = 0;
+		uint64_t m_WriteCount = 0;
+		uint64_t m_NackCount = 0;
+		uint64_t m_InterruptCount = 0;
+
+		bool IsBooted()
+		{
+			if (!m_Board.IsRegPiUp())
+			{
+				m_PoweredSince = SimTime(-1);
+				return false;
+			}
+			if (m_PoweredSince < SimTime(0))
+			{
+				m_PoweredSince = m_Time.Now();
+			}
+			return m_Time.Now() - m_PoweredSince >= BootTime;
+		}
+
+		/// The address phase. The firmware answers from the address interrupt or the master sees a NACK.
+		bool Address(uint8_t direction)
+		{
+			if (m_Transferring || !m_Bus.IsListening())
+			{
+				m_NackCount++;
+				m_Time.Trace("rpi address nack%s", m_Transferring ? ", bus busy" : "");
+				return false;
+			}
+			I2C_HandleTypeDef &handle = m_Bus.GetHandle();
+			HAL_I2C_AddrCallback(&handle, direction, static_cast<uint16_t>(handle.Init.OwnAddress1));
+			return true;
+		}
+
+		void Poll()
+		{
+			m_Time.Schedule(m_Period, [this]()
+			{	Poll();});
+
+			if (!IsBooted() || !Address(I2C_DIRECTION_RECEIVE))
+			{
+				// Nothing reached the chipset, a core in STOP sleeps on
+				m_Time.MarkQuiet();
+				return;
+			}
+
+			I2CBus::SlaveTransfer transfer = m_Bus.TakeSlaveTx();
+			if (transfer.Data == nullptr)
+			{
+				m_NackCount++;
+				m_Time.Trace("rpi read nack, nothing to send");
+				return;
+			}
+
+			bool sequential = m_Bus.IsListening();
+			m_Transferring = true;
+			m_Time.Schedule(I2CBus::WireTime(1 + transfer.Size), [this, transfer, sequential]()
+			{
+				m_Transferring = false;
+				m_Time.Trace("rpi read %u bytes", transfer.Size);
+				EndRead(transfer, transfer.Size, sequential);
+			});
+		}
+
+		void ReadEvents()
+		{
+			if (!IsBooted())
+			{
+				// The driver reads the register once it loads, an edge during the boot is not lost
+				if (m_PoweredSince >= SimTime(0))
+				{
+					m_Time.Schedule(m_PoweredSince + BootTime - m_Time.Now(), [this]()
+					{	ReadEvents();});
+				}
+				return;
+			}
+			if (!ReadRegisters(EventsRegister, 2))
+			{
+				m_Time.Schedule(RetryDelay, [this]()
+				{	ReadEvents();});
+			}
+		}
+
+		/// False if the chipset did not answer the address
+		bool ReadRegisters(uint8_t address, size_t count)
+		{
+			if (!IsBooted() || !Address(I2C_DIRECTION_TRANSMIT))
+			{
+				m_Time.Trace("rpi register read dropped");
+				return false;
+			}
+
+			I2CBus::SlaveTransfer pointer = m_Bus.TakeSlaveRx();
+			if (pointer.Data == nullptr)
+			{
+				m_NackCount++;
+				m_Time.Trace("rpi write nack, no receive buffer");
+				return false;
+			}
+			pointer.Data[0] = address;
+			m_Bus.GetHandle().pBuffPtr = pointer.Data + 1;
+
+			// Repeated START, the slave is still receiving
+			HAL_I2C_AddrCallback(&m_Bus.GetHandle(), I2C_DIRECTION_RECEIVE, static_cast<uint16_t>(m_Bus.GetHandle().Init.OwnAddress1));
+			I2CBus::SlaveTransfer transfer = m_Bus.TakeSlaveTx();
+			if (transfer.Data == nullptr)
+			{
+				m_NackCount++;
+				m_Time.Trace("rpi register read nack, nothing to send");
+				return true;
+			}
+
+			m_Transferring = true;
+			m_Time.Schedule(I2CBus::WireTime(2 + 1 + count), [this, transfer, address, count]()
+			{
+				m_Transferring = false;
+				std::string bytes;
+				for (size_t i = 0; i < std::min<size_t>(count, transfer.Size); i++)
+				{
+					char hex[4];
+					snprintf(hex, sizeof(hex), " %02X", transfer.Data[i]);
+					bytes += hex;
+				}
+				m_Time.Trace("rpi register 0x%02X read%s", address, bytes.c_str());
+				EndRead(transfer, count, true);
+			});
+			return true;
+		}
+
+		/// A plain transmit ends with its completion. A sequential one in listen mode ends at the
+		/// STOP: the master's NACK before the last byte is an error, and listening stops.
+		void EndRead(const I2CBus::SlaveTransfer &transfer, size_t count, bool sequential)
+		{
+			size_t length = std::min<size_t>(count, transfer.Size);
+			m_LastRead.assign(transfer.Data, transfer.Data + length);
+			m_ReadCount++;
+
+			I2C_HandleTypeDef &handle = m_Bus.GetHandle();
+			if (count > transfer.Size)
+			{
+				// The real slave stretches the clock until the master gives up
+				m_Time.Trace("rpi read past the %u bytes offered", transfer.Size);
+			}
+			if (!sequential)
+			{
+				HAL_I2C_SlaveTxCpltCallback(&handle);
+				return;
+			}
+
+			if (count >= transfer.Size)
+			{
+				HAL_I2C_SlaveTxCpltCallback(&handle);
+			}
+			else
+			{
+				handle.ErrorCode = HAL_I2C_ERROR_AF;
+				HAL_I2C_ErrorCallback(&handle);
+			}
+			m_Bus.SetListening(false);
+			HAL_I2C_ListenCpltCallback(&handle);
+		}
+
+		void Write(const std::vector<uint8_t> &data)
+		{
+			if (!IsBooted() || !Address(I2C_DIRECTION_TRANSMIT))
+			{
+				m_Time.Trace("rpi write dropped");
+				return;
+			}
+
+			I2CBus::SlaveTransfer transfer = m_Bus.TakeSlaveRx();
+			if (transfer.Data == nullptr)
+			{
+				m_NackCount++;
+				m_Time.Trace("rpi write nack, no receive buffer");
+				return;
+			}
+
+			m_Transferring = true;
+			m_Time.Schedule(I2CBus::WireTime(1 + data.size()), [this, transfer, data]()
+			{
+				m_Transferring = false;
+				size_t length = std::min<size_t>(data.size(), transfer.Size);
+				memcpy(transfer.Data, data.data(), length);
+				m_WriteCount++;
+				m_Time.Trace("rpi write %zu bytes", data.size());
+
+				// Sequential reception in listen mode: a full buffer completes the transfer, a STOP before
+				// that is reported as a NACK error, and the STOP always ends the listen cycle
+				I2C_HandleTypeDef &handle = m_Bus.GetHandle();
+				handle.pBuffPtr = transfer.Data + length;
+				if (data.size() >= transfer.Size)
+				{
+					if (data.size() > transfer.Size)
+					{
+						// The real slave stretches the clock until the master gives up
+						m_Time.Trace("rpi write overran the %u byte buffer", transfer.Size);
+					}
+					HAL_I2C_SlaveRxCpltCallback(&handle);
+				}
+				else
+				{
+					handle.ErrorCode = HAL_I2C_ERROR_AF;
+					HAL_I2C_ErrorCallback(&handle);
+				}
+				m_Bus.SetListening(false);
+				HAL_I2C_ListenCpltCallback(&handle);
+			});
+		}
+	};
+}
@@ -0,0 +1,545 @@
+/*
+ * SimHal.cpp
+ *
+ * HAL functions and peripheral instances of the simulation build. They stand in for the STM32U0 HAL
+ * and the CubeMX init code, and forward everything with timing to the Simulation.
+ */
+
+#include <cstdio>
+#include <stdexcept>
+#include "main.h"
+#include "adc.h"
+#include "crc.h"
+#include "dma.h"
+#include "gpio.h"
+#include "i2c.h"
+#include "lptim.h"
+#include "rtc.h"
+#include "usart.h"
+#include "PiSubmarine/Chipset/CrcEngine.h"
+#include "PiSubmarine/Chipset/Sim/Simulation.h"
+
+using PiSubmarine::Chipset::Sim::Simulation;
+using PiSubmarine::Chipset::Sim::I2CBus;
+using PiSubmarine::Chipset::CrcEngine;
+
+namespace
+{
+	I2CBus* Bus(const I2C_HandleTypeDef *hi2c)
+	{
+		return Simulation::Get().GetBus(hi2c);
+	}
+
+	HAL_StatusTypeDef StartMaster(I2C_HandleTypeDef *hi2c, I2CBus::Kind kind, uint16_t address, uint16_t reg, uint8_t *data, uint16_t size)
+	{
+		I2CBus *bus = Bus(hi2c);
+		return bus ? bus->StartMaster(kind, address, reg, data, size) : HAL_ERROR;
+	}
+
+	/// Data register of the CRC unit. The software CRC computes the same as the unit in its reset configuration.
+	uint32_t SimCrcValue = CrcEngine::InitialValue;
+}
+
+extern "C"
+{
+	GPIO_TypeDef SimGpioA;
+	GPIO_TypeDef SimGpioB;
+	TIM_TypeDef SimTim2;
+	TIM_TypeDef SimTim6;
+	LPTIM_TypeDef SimLptim1;
+	LPTIM_TypeDef SimLptim2;
+	RTC_TypeDef SimRtc;
+	ADC_TypeDef SimAdc1;
+	uint16_t SimTemperatureCalibration[2] = {Simulation::TsCal1, Simulation::TsCal2};
+
+	DMA_HandleTypeDef hdma_adc1;
+	ADC_HandleTypeDef hadc1 = {ADC1, {}, &hdma_adc1};
+	CRC_HandleTypeDef hcrc;
+	I2C_HandleTypeDef hi2c1 = {nullptr, {0x00303D5B, 186}, nullptr, HAL_I2C_ERROR_NONE};
+	I2C_HandleTypeDef hi2c2 = {nullptr, {0x00303D5B, 0}, nullptr, HAL_I2C_ERROR_NONE};
+	I2C_HandleTypeDef hi2c3 = {nullptr, {0x00303D5B, 0}, nullptr, HAL_I2C_ERROR_NONE};
+	LPTIM_HandleTypeDef hlptim1 = {LPTIM1};
+	LPTIM_HandleTypeDef hlptim2 = {LPTIM2};
+	RTC_HandleTypeDef hrtc = {RTC};
+	UART_HandleTypeDef huart1;
+
+	void Error_Handler(void)
+	{
+		throw std::runtime_error("Error_Handler() called");
+	}
+
+	/* Init functions of the CubeMX code, the simulated peripherals need no setup */
+
+	void MX_GPIO_Init(void)
+	{
+	}
+
+	void MX_DMA_Init(void)
+	{
+	}
+
+	void MX_ADC1_Init(void)
+	{
+	}
+
+	void MX_CRC_Init(void)
+	{
+	}
+
+	void MX_LPTIM1_Init(void)
+	{
+	}
+
+	void MX_LPTIM2_Init(void)
+	{
+	}
+
+	void MX_RTC_Init(void)
+	{
+		Simulation::Get().GetRtc().Init();
+	}
+
+	void MX_USART1_UART_Init(void)
+	{
+	}
+
+	void MX_I2C1_Init(void)
+	{
+		HAL_I2C_Init(&hi2c1);
+	}
+
+	void MX_I2C2_Init(void)
+	{
+		HAL_I2C_Init(&hi2c2);
+	}
+
+	void MX_I2C3_Init(void)
+	{
+		HAL_I2C_Init(&hi2c3);
+	}
+
+	/* Core */
+
+	uint32_t HAL_GetTick(void)
+	{
+		auto now = Simulation::Get().GetTime().Now();
+		return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+	}
+
+	void HAL_Delay(uint32_t Delay)
+	{
+		// Busy wait: time passes, interrupts are raised but the caller does not return early
+		auto &time = Simulation::Get().GetTime();
+		auto end = time.Now() + std::chrono::milliseconds(Delay);
+		time.Schedule(end - time.Now(), []()
+		{
+		});
+		while (time.Now() < end)
+		{
+			Simulation::Get().Idle(false);
+		}
+	}
+
+	void HAL_SuspendTick(void)
+	{
+	}
+
+	void HAL_ResumeTick(void)
+	{
+	}
+
+	uint32_t HAL_RCC_GetPCLK1Freq(void)
+	{
+		return Simulation::Pclk1Frequency;
+	}
+
+	uint32_t HAL_RCC_GetHCLKFreq(void)
+	{
+		return Simulation::Pclk1Frequency;
+	}
+
+	uint32_t HAL_RCC_GetResetSource(void)
+	{
+		return Simulation::Get().TakeResetFlags();
+	}
+
+	void HAL_PWR_EnterSLEEPMode(uint32_t Regulator, uint8_t SLEEPEntry)
+	{
+		(void) Regulator;
+		(void) SLEEPEntry;
+		Simulation::Get().Idle(false);
+	}
+
+	void HAL_PWR_EnterSTOPMode(uint32_t Regulator, uint8_t STOPEntry)
+	{
+		(void) Regulator;
+		(void) STOPEntry;
+		Simulation::Get().GetTime().Trace("STOP");
+		Simulation::Get().Idle(true);
+	}
+
+	/* GPIO */
+
+	void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+	{
+		if (PinState == GPIO_PIN_SET)
+		{
+			GPIOx->ODR = GPIOx->ODR | GPIO_Pin;
+		}
+		else
+		{
+			GPIOx->ODR = GPIOx->ODR & ~static_cast<uint32_t>(GPIO_Pin);
+		}
+		Simulation::Get().GetBoard().OnOutput(GPIOx, GPIO_Pin, PinState == GPIO_PIN_SET);
+	}
+
+	GPIO_PinState HAL_GPIO_ReadPin(const GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+	{
+		return (GPIOx->IDR & GPIO_Pin) != 0 ? GPIO_PIN_SET : GPIO_PIN_RESET;
+	}
+
+	/* ADC */
+
+	HAL_StatusTypeDef HAL_ADC_Init(ADC_HandleTypeDef *hadc)
+	{
+		(void) hadc;
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_ADCEx_Calibration_Start(ADC_HandleTypeDef *hadc)
+	{
+		(void) hadc;
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef *hadc, const uint32_t *pData, uint32_t Length)
+	{
+		(void) hadc;
+		// Half-word transfers, as configured for the ADC DMA channel
+		Simulation::Get().GetAdc().StartDma(reinterpret_cast<uint16_t*>(const_cast<uint32_t*>(pData)), Length);
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_ADC_Stop_DMA(ADC_HandleTypeDef *hadc)
+	{
+		(void) hadc;
+		Simulation::Get().GetAdc().StopDma();
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_ADC_AnalogWDGConfig(ADC_HandleTypeDef *hadc, const ADC_AnalogWDGConfTypeDef *pAnalogWDGConfig)
+	{
+		Simulation::Get().GetAdc().SetWatchdog(pAnalogWDGConfig->WatchdogNumber, pAnalogWDGConfig->Channel,
+				static_cast<uint16_t>(pAnalogWDGConfig->LowThreshold), static_cast<uint16_t>(pAnalogWDGConfig->HighThreshold));
+		uint32_t interrupt = ADC_IT_AWD1 << (pAnalogWDGConfig->WatchdogNumber - ADC_ANALOGWATCHDOG_1);
+		if (pAnalogWDGConfig->ITMode == ENABLE)
+		{
+			SimAdcEnableIt(hadc, interrupt);
+		}
+		else
+		{
+			SimAdcDisableIt(hadc, interrupt);
+		}
+		return HAL_OK;
+	}
+
+	void SimAdcEnableIt(ADC_HandleTypeDef *hadc, uint32_t Interrupts)
+	{
+		(void) hadc;
+		Simulation::Get().GetAdc().EnableInterrupts(Interrupts);
+	}
+
+	void SimAdcDisableIt(ADC_HandleTypeDef *hadc, uint32_t Interrupts)
+	{
+		(void) hadc;
+		Simulation::Get().GetAdc().DisableInterrupts(Interrupts);
+	}
+
+	/* DMA */
+
+	void SimDmaEnableIt(DMA_HandleTypeDef *hdma, uint32_t Interrupts)
+	{
+		(void) hdma;
+		Simulation::Get().GetAdc().EnableDmaInterrupts(Interrupts);
+	}
+
+	void SimDmaDisableIt(DMA_HandleTypeDef *hdma, uint32_t Interrupts)
+	{
+		(void) hdma;
+		Simulation::Get().GetAdc().DisableDmaInterrupts(Interrupts);
+	}
+
+	uint32_t SimDmaGetCounter(DMA_HandleTypeDef *hdma)
+	{
+		(void) hdma;
+		return Simulation::Get().GetAdc().GetDmaCounter();
+	}
+
+	/* CRC */
+
+	void SimCrcReset(CRC_HandleTypeDef *hcrc)
+	{
+		(void) hcrc;
+		SimCrcValue = CrcEngine::InitialValue;
+	}
+
+	uint32_t HAL_CRC_Accumulate(CRC_HandleTypeDef *hcrc, uint32_t pBuffer[], uint32_t BufferLength)
+	{
+		(void) hcrc;
+		SimCrcValue = CrcEngine::CalculateSoftware(reinterpret_cast<const uint8_t*>(pBuffer), BufferLength, SimCrcValue);
+		return SimCrcValue;
+	}
+
+	uint32_t HAL_CRC_Calculate(CRC_HandleTypeDef *hcrc, uint32_t pBuffer[], uint32_t BufferLength)
+	{
+		SimCrcReset(hcrc);
+		return HAL_CRC_Accumulate(hcrc, pBuffer, BufferLength);
+	}
+
+	/* I2C */
+
+	HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c)
+	{
+		I2CBus *bus = Bus(hi2c);
+		if (bus == nullptr)
+		{
+			return HAL_ERROR;
+		}
+		bus->Reset();
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c)
+	{
+		return HAL_I2C_Init(hi2c);
+	}
+
+	void HAL_I2C_MspDeInit(I2C_HandleTypeDef *hi2c)
+	{
+		HAL_I2C_Init(hi2c);
+	}
+
+	uint32_t HAL_I2C_GetError(const I2C_HandleTypeDef *hi2c)
+	{
+		return hi2c->ErrorCode;
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Master_Transmit(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+	{
+		(void) Timeout;
+		I2CBus *bus = Bus(hi2c);
+		return bus ? bus->TransferBlocking(I2CBus::Kind::Transmit, DevAddress, pData, Size) : HAL_ERROR;
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Master_Receive(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+	{
+		(void) Timeout;
+		I2CBus *bus = Bus(hi2c);
+		return bus ? bus->TransferBlocking(I2CBus::Kind::Receive, DevAddress, pData, Size) : HAL_ERROR;
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Master_Transmit_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size)
+	{
+		return StartMaster(hi2c, I2CBus::Kind::Transmit, DevAddress, 0, pData, Size);
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Master_Receive_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size)
+	{
+		return StartMaster(hi2c, I2CBus::Kind::Receive, DevAddress, 0, pData, Size);
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Mem_Write_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData,
+			uint16_t Size)
+	{
+		(void) MemAddSize;
+		return StartMaster(hi2c, I2CBus::Kind::MemWrite, DevAddress, MemAddress, pData, Size);
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData,
+			uint16_t Size)
+	{
+		(void) MemAddSize;
+		return StartMaster(hi2c, I2CBus::Kind::MemRead, DevAddress, MemAddress, pData, Size);
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Master_Abort_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress)
+	{
+		(void) DevAddress;
+		I2CBus *bus = Bus(hi2c);
+		return bus ? bus->Abort() : HAL_ERROR;
+	}
+
+	HAL_StatusTypeDef HAL_I2C_EnableListen_IT(I2C_HandleTypeDef *hi2c)
+	{
+		I2CBus *bus = Bus(hi2c);
+		if (bus == nullptr)
+		{
+			return HAL_ERROR;
+		}
+		bus->SetListening(true);
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_I2C_DisableListen_IT(I2C_HandleTypeDef *hi2c)
+	{
+		I2CBus *bus = Bus(hi2c);
+		if (bus == nullptr)
+		{
+			return HAL_ERROR;
+		}
+		bus->SetListening(false);
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Slave_Seq_Receive_IT(I2C_HandleTypeDef *hi2c, uint8_t *pData, uint16_t Size, uint32_t XferOptions)
+	{
+		(void) XferOptions;
+		I2CBus *bus = Bus(hi2c);
+		if (bus == nullptr || !bus->IsListening())
+		{
+			return HAL_ERROR;
+		}
+		bus->SetSlaveRx(pData, Size);
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Slave_Transmit_DMA(I2C_HandleTypeDef *hi2c, uint8_t *pData, uint16_t Size)
+	{
+		I2CBus *bus = Bus(hi2c);
+		if (bus == nullptr)
+		{
+			return HAL_ERROR;
+		}
+		bus->SetSlaveTx(pData, Size);
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Slave_Seq_Transmit_DMA(I2C_HandleTypeDef *hi2c, uint8_t *pData, uint16_t Size, uint32_t XferOptions)
+	{
+		(void) XferOptions;
+		I2CBus *bus = Bus(hi2c);
+		if (bus == nullptr || !bus->IsListening())
+		{
+			return HAL_ERROR;
+		}
+		bus->SetSlaveTx(pData, Size);
+		return HAL_OK;
+	}
+
+	/* LPTIM */
+
+	void SimLptimClearFlag(LPTIM_HandleTypeDef *hlptim, uint32_t Flag)
+	{
+		hlptim->Instance->ISR = hlptim->Instance->ISR & ~Flag;
+	}
+
+	void SimLptimEnableIt(LPTIM_HandleTypeDef *hlptim, uint32_t Interrupt)
+	{
+		hlptim->Instance->DIER = hlptim->Instance->DIER | Interrupt;
+		hlptim->Instance->ISR = hlptim->Instance->ISR | LPTIM_FLAG_DIEROK;
+	}
+
+	void SimLptimSetCompare(LPTIM_HandleTypeDef *hlptim, uint32_t Channel, uint32_t Compare)
+	{
+		(void) Channel;
+		hlptim->Instance->CCR1 = Compare;
+		hlptim->Instance->ISR = hlptim->Instance->ISR | LPTIM_FLAG_CMP1OK;
+	}
+
+	HAL_StatusTypeDef HAL_LPTIM_Counter_Start_IT(LPTIM_HandleTypeDef *hlptim)
+	{
+		if (hlptim == &hlptim1)
+		{
+			hlptim->Instance->ARR = 0xFFFF;
+			Simulation::Get().GetLptim().Start(Simulation::Get().GetTime().Now());
+		}
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_LPTIM_Counter_Stop_IT(LPTIM_HandleTypeDef *hlptim)
+	{
+		if (hlptim == &hlptim1)
+		{
+			hlptim->Instance->DIER = 0;
+			Simulation::Get().GetLptim().Stop();
+		}
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_LPTIM_PWM_Start(LPTIM_HandleTypeDef *hlptim, uint32_t Channel)
+	{
+		// LPTIM2 only drives an LED
+		(void) hlptim;
+		(void) Channel;
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_LPTIM_PWM_Stop(LPTIM_HandleTypeDef *hlptim, uint32_t Channel)
+	{
+		(void) hlptim;
+		(void) Channel;
+		return HAL_OK;
+	}
+
+	uint32_t HAL_LPTIM_ReadCounter(const LPTIM_HandleTypeDef *hlptim)
+	{
+		if (hlptim != &hlptim1)
+		{
+			return 0;
+		}
+		return Simulation::Get().GetLptim().ReadCounter(Simulation::Get().GetTime().Now());
+	}
+
+	/* RTC */
+
+	uint32_t SimRtcGetFlag(uint32_t Flag)
+	{
+		return SimRtc.SR & (1U << (Flag & 0xFFU));
+	}
+
+	void SimRtcClearFlag(uint32_t Flag)
+	{
+		Simulation::Get().GetRtc().ClearFlags(Flag);
+	}
+
+	void HAL_RTCEx_BKUPWrite(const RTC_HandleTypeDef *hrtc, uint32_t BackupRegister, uint32_t Data)
+	{
+		(void) hrtc;
+		Simulation::Get().GetRtc().WriteBackup(BackupRegister, Data);
+	}
+
+	uint32_t HAL_RTCEx_BKUPRead(const RTC_HandleTypeDef *hrtc, uint32_t BackupRegister)
+	{
+		(void) hrtc;
+		return Simulation::Get().GetRtc().ReadBackup(BackupRegister);
+	}
+
+	HAL_StatusTypeDef HAL_RTC_SetAlarm_IT(RTC_HandleTypeDef *hrtc, RTC_AlarmTypeDef *sAlarm, uint32_t Format)
+	{
+		(void) Format;
+		Simulation::Get().GetRtc().SetAlarm(hrtc, sAlarm->Alarm == RTC_ALARM_A ? 0 : 1, sAlarm->AlarmTime.SubSeconds);
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_RTC_DeactivateAlarm(RTC_HandleTypeDef *hrtc, uint32_t Alarm)
+	{
+		(void) hrtc;
+		Simulation::Get().GetRtc().ClearAlarm(Alarm == RTC_ALARM_A ? 0 : 1);
+		return HAL_OK;
+	}
+
+	/* UART */
+
+	HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size, uint32_t Timeout)
+	{
+		(void) huart;
+		(void) Timeout;
+		Simulation::Get().GetUart().TransmitBlocking(pData, Size);
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size)
+	{
+		return Simulation::Get().GetUart().Transmit(huart, pData, Size) ? HAL_OK : HAL_BUSY;
+	}
+}
@@ -0,0 +1,228 @@
+/*
+ * Simulation.cpp
+ *
+ * Virtual-time board model behind the simulated HAL.
+ */
+
+#include "PiSubmarine/Chipset/Sim/Simulation.h"
+#include "PiSubmarine/Chipset/RtcClock.h"
+#include "rtc.h"
+
+namespace PiSubmarine::Chipset::Sim
+{
+	Simulation& Simulation::Get()
+	{
+		static Simulation instance;
+		return instance;
+	}
+
+	Simulation::Simulation()
+	{
+		m_BatchgBus.Attach(Bq25792Model::Address, m_Batchg);
+	}
+
+	void Simulation::Configure(const SimulationConfig &config)
+	{
+		m_Time.SetTracing(config.Trace);
+		m_End = std::chrono::duration_cast<SimTime>(config.Duration);
+		m_Adc.SetBallastCode(config.BallastCode);
+		m_Adc.SetTemperatureCode(TemperatureCode(config.TemperatureCelsius));
+		m_ResetFlags = config.ResetFlags;
+		m_BackupFile = config.BackupFile;
+		if (!m_BackupFile.empty() && LoadBackupDomain())
+		{
+			// An earlier run configured the RTC, MX_RTC_Init() leaves it running
+			m_Rtc.Init();
+		}
+		if (config.RtcStartCounter)
+		{
+			m_Rtc.SetStartCounter(*config.RtcStartCounter);
+		}
+		m_Rtc.Sync();
+		if (config.RtcEpochSeconds)
+		{
+			// As if the Pi had set the time during an earlier boot
+			m_Rtc.Init();
+			RtcClock(hrtc).Set(std::chrono::seconds(*config.RtcEpochSeconds));
+		}
+
+		for (const auto &[at, present] : config.VbusChanges)
+		{
+			m_Time.Schedule(std::chrono::duration_cast<SimTime>(at), [this, present]()
+			{
+				m_Time.Trace("VBUS %s", present ? "plugged" : "unplugged");
+				m_Batchg.SetVbus(present);
+			});
+		}
+
+		for (const auto &[at, microVolts, duration] : config.Sags)
+		{
+			m_Time.Schedule(std::chrono::duration_cast<SimTime>(at), [this, microVolts, duration]()
+			{
+				m_Board.Sag(microVolts, std::chrono::duration_cast<SimTime>(duration));
+			});
+		}
+
+		for (const auto &[at, duration] : config.ButtonPresses)
+		{
+			m_Time.Schedule(std::chrono::duration_cast<SimTime>(at), [this, duration]()
+			{
+				m_Board.PressButton(std::chrono::duration_cast<SimTime>(duration));
+			});
+		}
+
+		for (const auto &[at, data] : config.RpiWrites)
+		{
+			m_Rpi.ScheduleWrite(at, data);
+		}
+		for (const auto &[at, address, count] : config.RpiRegisterReads)
+		{
+			m_Rpi.ScheduleRegisterRead(at, address, count);
+		}
+		m_Rpi.StartPolling(config.RpiPeriod);
+		if (config.RpiInterrupt)
+		{
+			m_Rpi.ListenToInterrupt();
+		}
+	}
+
+	void Simulation::Idle(bool stopMode)
+	{
+		if (stopMode)
+		{
+			m_StopCount++;
+		}
+		else
+		{
+			m_SleepCount++;
+		}
+
+		m_Adc.Poll(Pclk1Frequency);
+
+		bool interrupted = false;
+		while (!interrupted)
+		{
+			std::optional<SimTime> wake = m_Time.NextEventTime();
+			std::optional<SimTime> lptimWake = m_Lptim.NextInterrupt(m_Time.Now());
+			bool lptim = lptimWake && (!wake || *lptimWake <= *wake);
+			if (lptim)
+			{
+				wake = lptimWake;
+			}
+
+			SimTime sleepStart = m_Time.Now();
+			if (!wake || *wake > m_End)
+			{
+				m_Time.AdvanceTo(m_End);
+				throw SimulationEnd {};
+			}
+
+			m_Time.AdvanceTo(*wake);
+			AdvanceCycleCounter(m_Time.Now() - sleepStart);
+			m_Rtc.Sync();
+			m_Lptim.Dispatch(m_Time.Now());
+			// Events without an interrupt, such as ADC scans into masked DMA, do not end the sleep
+			interrupted = m_Time.RunDue() || lptim;
+		}
+	}
+
+	bool Simulation::LoadBackupDomain()
+	{
+		FILE *file = fopen(m_BackupFile.c_str(), "r");
+		if (file == nullptr)
+		{
+			return false;
+		}
+		unsigned int counter = 0;
+		bool valid = fscanf(file, "%x", &counter) == 1;
+		for (uint32_t i = 0; i < RtcModel::BackupRegisterCount && valid; i++)
+		{
+			unsigned int value = 0;
+			valid = fscanf(file, "%x", &value) == 1;
+			m_Rtc.WriteBackup(i, value);
+		}
+		fclose(file);
+		if (valid)
+		{
+			m_Rtc.SetStartCounter(counter);
+		}
+		return valid;
+	}
+
+	void Simulation::SaveBackupDomain()
+	{
+		if (m_BackupFile.empty())
+		{
+			return;
+		}
+		FILE *file = fopen(m_BackupFile.c_str(), "w");
+		if (file == nullptr)
+		{
+			return;
+		}
+		m_Rtc.Sync();
+		fprintf(file, "%08X\n", SimRtc.SSR);
+		for (uint32_t i = 0; i < RtcModel::BackupRegisterCount; i++)
+		{
+			fprintf(file, "%08X\n", m_Rtc.ReadBackup(i));
+		}
+		fclose(file);
+	}
+
+	I2CBus* Simulation::GetBus(const I2C_HandleTypeDef *handle)
+	{
+		for (I2CBus *bus : {&m_RpiBus, &m_ChipsetBus, &m_BatchgBus})
+		{
+			if (&bus->GetHandle() == handle)
+			{
+				return bus;
+			}
+		}
+		return nullptr;
+	}
+
+	void Simulation::PrintSummary(FILE *stream, std::chrono::steady_clock::duration wallTime) const
+	{
+		double virtualSeconds = std::chrono::duration<double>(m_Time.Now()).count();
+		double wallSeconds = std::chrono::duration<double>(wallTime).count();
+
+		fprintf(stream, "\n--- simulation summary ---\n");
+		fprintf(stream, "virtual time   %.3f s\n", virtualSeconds);
+		fprintf(stream, "wall time      %.3f s (%.0fx real time)\n", wallSeconds, wallSeconds > 0 ? virtualSeconds / wallSeconds : 0.0);
+		fprintf(stream, "wakeups        %llu sleep, %llu stop\n", static_cast<unsigned long long>(m_SleepCount),
+				static_cast<unsigned long long>(m_StopCount));
+		fprintf(stream, "events         %llu\n", static_cast<unsigned long long>(m_Time.GetEventCount()));
+		fprintf(stream, "adc scans      %llu\n", static_cast<unsigned long long>(m_Adc.GetScanCount()));
+		fprintf(stream, "uart           %llu bytes\n", static_cast<unsigned long long>(m_Uart.GetByteCount()));
+		for (const I2CBus *bus : {&m_RpiBus, &m_ChipsetBus, &m_BatchgBus})
+		{
+			fprintf(stream, "i2c %-10s %llu transfers, %llu bytes, %llu nack\n", bus->GetName(),
+					static_cast<unsigned long long>(bus->GetTransferCount()), static_cast<unsigned long long>(bus->GetByteCount()),
+					static_cast<unsigned long long>(bus->GetNackCount()));
+		}
+		fprintf(stream, "rpi            %llu reads, %llu writes, %llu nack, %llu interrupts\n", static_cast<unsigned long long>(m_Rpi.GetReadCount()),
+				static_cast<unsigned long long>(m_Rpi.GetWriteCount()), static_cast<unsigned long long>(m_Rpi.GetNackCount()),
+				static_cast<unsigned long long>(m_Rpi.GetInterruptCount()));
+		fprintf(stream, "rails          REG5 %lu uV, REGPI %lu uV\n", static_cast<unsigned long>(m_Board.GetReg5MicroVolts()),
+				static_cast<unsigned long>(m_Board.GetRegPiMicroVolts()));
+	}
+
+	void Simulation::AdvanceCycleCounter(SimTime elapsed)
+	{
+		// Code runs in zero virtual time, so the profiler sees every cycle as sleep
+		if (!(SimTim2.CR1 & TIM_CR1_CEN))
+		{
+			return;
+		}
+		uint64_t ticks = static_cast<uint64_t>(elapsed.count()) * (Pclk1Frequency / 1000000) / (SimTim2.PSC + 1);
+		SimTim2.CNT = static_cast<uint32_t>(SimTim2.CNT + ticks);
+	}
+
+	uint16_t Simulation::TemperatureCode(int32_t celsius)
+	{
+		// Inverse of the firmware conversion, which scales the 3.0 V calibration values to 3.3 V
+		int32_t cal1 = TsCal1 * 33 / 30;
+		int32_t cal2 = TsCal2 * 33 / 30;
+		return static_cast<uint16_t>(cal1 + (celsius - 30) * (cal2 - cal1) / 100);
+	}
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "main.h"
+#include "i2c.h"
+#include "adc.h"
+#include "lptim.h"
+#include "PiSubmarine/Chipset/Sim/VirtualTime.h"
+#include "PiSubmarine/Chipset/Sim/Board.h"
+#include "PiSubmarine/Chipset/Sim/I2CBus.h"
+#include "PiSubmarine/Chipset/Sim/Peripherals.h"
+#include "PiSubmarine/Chipset/Sim/Bq25792Model.h"
+#include "PiSubmarine/Chipset/Sim/RpiModel.h"
+
+namespace PiSubmarine::Chipset::Sim
+{
+	/// Thrown from the idle loop once the scenario duration has passed
+	struct SimulationEnd
+	{
+	};
+
+	struct SimulationConfig
+	{
+		std::chrono::milliseconds Duration{3600000};
+		std::chrono::milliseconds RpiPeriod{1000};
+		/// The Pi reads the Events register at every CHIPSET_INT edge
+		bool RpiInterrupt = false;
+		std::vector<std::pair<std::chrono::milliseconds, bool>> VbusChanges;
+		/// Time, REG5 voltage during the sag and its duration
+		std::vector<std::tuple<std::chrono::milliseconds, uint32_t, std::chrono::milliseconds>> Sags;
+		/// Time and duration of power button presses
+		std::vector<std::pair<std::chrono::milliseconds, std::chrono::milliseconds>> ButtonPresses;
+		std::vector<std::pair<std::chrono::milliseconds, std::vector<uint8_t>>> RpiWrites;
+		/// Time, register address and byte count
+		std::vector<std::tuple<std::chrono::milliseconds, uint8_t, size_t>> RpiRegisterReads;
+		std::optional<int64_t> RtcEpochSeconds;
+		std::optional<uint32_t> RtcStartCounter;
+		/// RCC reset flags of this boot
+		uint32_t ResetFlags = RCC_RESET_FLAG_PWR | RCC_RESET_FLAG_PIN;
+		/// Backup domain of an earlier run, written back at the end
+		std::string BackupFile;
+		int32_t TemperatureCelsius = 25;
+		uint16_t BallastCode = 2048;
+		bool Trace = false;
+	};
+
+	/// The board around the firmware, driven by a virtual clock. The HAL stand-in forwards to it, and
+	/// the firmware's sleep calls are where time advances and peripheral interrupts are raised.
+	class Simulation
+	{
+	public:
+		constexpr static uint32_t Pclk1Frequency = 16000000;
+		/// Factory calibration values at 30 and 130 degrees C
+		constexpr static uint16_t TsCal1 = 1034;
+		constexpr static uint16_t TsCal2 = 1372;
+
+		static Simulation& Get();
+
+		void Configure(const SimulationConfig &config);
+
+		/// Sleeps until the next interrupt and raises it. STOP mode sleeps the same way, the
+		/// firmware has stopped the peripherals that must not wake it.
+		void Idle(bool stopMode);
+
+		void PrintSummary(FILE *stream, std::chrono::steady_clock::duration wallTime) const;
+
+		/// Writes the backup registers and the RTC counter to the backup file, the next run continues
+		/// from there like the MCU after a reset
+		void SaveBackupDomain();
+
+		/// Reading the RCC reset flags clears them
+		uint32_t TakeResetFlags()
+		{
+			return std::exchange(m_ResetFlags, 0);
+		}
+
+		[[nodiscard]] VirtualTime& GetTime()
+		{
+			return m_Time;
+		}
+
+		[[nodiscard]] Board& GetBoard()
+		{
+			return m_Board;
+		}
+
+		[[nodiscard]] LptimModel& GetLptim()
+		{
+			return m_Lptim;
+		}
+
+		[[nodiscard]] AdcModel& GetAdc()
+		{
+			return m_Adc;
+		}
+
+		[[nodiscard]] RtcModel& GetRtc()
+		{
+			return m_Rtc;
+		}
+
+		[[nodiscard]] UartModel& GetUart()
+		{
+			return m_Uart;
+		}
+
+		/// Bus of a HAL handle, nullptr for an unknown handle
+		I2CBus* GetBus(const I2C_HandleTypeDef *handle);
+
+	private:
+		VirtualTime m_Time;
+		Board m_Board{m_Time};
+		LptimModel m_Lptim{hlptim1};
+		AdcModel m_Adc{m_Time, m_Board, hadc1};
+		RtcModel m_Rtc{m_Time};
+		UartModel m_Uart{m_Time};
+		I2CBus m_RpiBus{m_Time, hi2c1, "rpi"};
+		I2CBus m_ChipsetBus{m_Time, hi2c2, "chipset"};
+		I2CBus m_BatchgBus{m_Time, hi2c3, "batchg"};
+		Bq25792Model m_Batchg{m_Board};
+		RpiModel m_Rpi{m_Time, m_Board, m_RpiBus};
+
+		SimTime m_End{0};
+		uint32_t m_ResetFlags = 0;
+		std::string m_BackupFile;
+		uint64_t m_SleepCount = 0;
+		uint64_t m_StopCount = 0;
+
+		Simulation();
+
+		bool LoadBackupDomain();
+
+		/// TIM2 is the firmware's cycle counter, it counts PCLK ticks while the core sleeps
+		void AdvanceCycleCounter(SimTime elapsed);
+
+		/// Temperature sensor code the firmware converts back to the given temperature
+		static uint16_t TemperatureCode(int32_t celsius);
+	};
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <optional>
+#include <vector>
+
+namespace PiSubmarine::Chipset::Sim
+{
+	using SimTime = std::chrono::microseconds;
+
+	/// Virtual clock plus the queue of future peripheral events. Time only moves when the
+	/// firmware idles, so code between two wakeups takes no virtual time at all.
+	class VirtualTime
+	{
+	public:
+		[[nodiscard]] SimTime Now() const
+		{
+			return m_Now;
+		}
+
+		/// Runs action delay from now. Events due at the same time run in the order they were scheduled.
+		void Schedule(SimTime delay, std::function<void()> action)
+		{
+			m_Events.push_back(Entry { m_Now + std::max(delay, SimTime(0)), m_Sequence++, std::move(action) });
+			std::push_heap(m_Events.begin(), m_Events.end(), Later);
+		}
+
+		[[nodiscard]] std::optional<SimTime> NextEventTime() const
+		{
+			if (m_Events.empty())
+			{
+				return std::nullopt;
+			}
+			return m_Events.front().At;
+		}
+
+		/// Moves the clock forward. Never moves it back.
+		void AdvanceTo(SimTime time)
+		{
+			m_Now = std::max(m_Now, time);
+		}
+
+		/// Runs all events that are due, including the ones they schedule for now. True if one of
+		/// them interrupted the core.
+		bool RunDue()
+		{
+			bool interrupted = false;
+			while (!m_Events.empty() && m_Events.front().At <= m_Now)
+			{
+				std::pop_heap(m_Events.begin(), m_Events.end(), Later);
+				Entry entry = std::move(m_Events.back());
+				m_Events.pop_back();
+				m_EventCount++;
+				m_Quiet = false;
+				entry.Action();
+				interrupted = interrupted || !m_Quiet;
+			}
+			return interrupted;
+		}
+
+		/// Called by a running event that raised no interrupt, such as a DMA transfer with its
+		/// interrupts masked. The core sleeps on through it.
+		void MarkQuiet()
+		{
+			m_Quiet = true;
+		}
+
+		[[nodiscard]] uint64_t GetEventCount() const
+		{
+			return m_EventCount;
+		}
+
+		void SetTracing(bool enabled)
+		{
+			m_Tracing = enabled;
+		}
+
+		/// Prints a line prefixed with the virtual time in seconds to stderr when tracing is on
+		[[gnu::format(printf, 2, 3)]] void Trace(const char *format, ...) const
+		{
+			if (!m_Tracing)
+			{
+				return;
+			}
+
+			auto us = m_Now.count();
+			fprintf(stderr, "[%6lld.%06lld] ", static_cast<long long>(us / 1000000), static_cast<long long>(us % 1000000));
+			va_list args;
+			va_start(args, format);
+			vfprintf(stderr, format, args);
+			va_end(args);
+			fputc('\n', stderr);
+		}
+
+	private:
+		struct Entry
+		{
+			SimTime At;
+			uint64_t Sequence;
+			std::function<void()> Action;
+		};
+
+		SimTime m_Now{0};
+		uint64_t m_Sequence = 0;
+		uint64_t m_EventCount = 0;
+		bool m_Quiet = false;
+		bool m_Tracing = false;
+		std::vector<Entry> m_Events;
+
+		static bool Later(const Entry &lhs, const Entry &rhs)
+		{
+			if (lhs.At != rhs.At)
+			{
+				return lhs.At > rhs.At;
+			}
+			return lhs.Sequence > rhs.Sequence;
+		}
+	};
+}
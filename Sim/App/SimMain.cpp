@@ -0,0 +1,262 @@
+/*
+ * SimMain.cpp
+ *
+ * Entry point of the host simulation build. Runs the unmodified application against the simulated
+ * board for a scenario given on the command line. Firmware output goes to stdout, the trace and the
+ * summary to stderr.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <unistd.h>
+#include "PiSubmarine/Chipset/AppMain.h"
+#include "PiSubmarine/Chipset/Sim/Simulation.h"
+
+using namespace PiSubmarine::Chipset::Sim;
+
+extern "C" int _write(int file, char *ptr, int len);
+
+namespace
+{
+	ssize_t WriteFirmwareOutput(void *cookie, const char *data, size_t size)
+	{
+		(void) cookie;
+		return _write(STDOUT_FILENO, const_cast<char*>(data), static_cast<int>(size));
+	}
+
+	/// newlib hands printf() output to _write(). Host stdout is pointed at the firmware's
+	/// _write() the same way, and the simulated UART writes to the real stdout.
+	void RouteStdoutToFirmware(Simulation &simulation)
+	{
+		FILE *terminal = fdopen(dup(STDOUT_FILENO), "w");
+		cookie_io_functions_t functions{nullptr, WriteFirmwareOutput, nullptr, nullptr};
+		FILE *firmwareOutput = fopencookie(nullptr, "w", functions);
+		if (terminal == nullptr || firmwareOutput == nullptr)
+		{
+			return;
+		}
+		setvbuf(terminal, nullptr, _IOLBF, BUFSIZ);
+		setvbuf(firmwareOutput, nullptr, _IOLBF, BUFSIZ);
+		simulation.GetUart().SetOutput(terminal);
+		stdout = firmwareOutput;
+	}
+
+	void PrintUsage(const char *program)
+	{
+		fprintf(stderr, "Usage: %s [options]\n"
+				"  --duration-ms N        virtual time to simulate (default 3600000)\n"
+				"  --rpi-period-ms N      status packet read period of the Pi, 0 disables (default 1000)\n"
+				"  --rpi-int              the Pi reads the Events register at every CHIPSET_INT edge\n"
+				"  --rpi-write MS:HEX     the Pi writes the given bytes at MS\n"
+				"  --rpi-read-reg MS:REG:N  the Pi reads N bytes of the register map from REG (hex) at MS\n"
+				"  --vbus MS:0|1          unplugs or plugs the charging source at MS\n"
+				"  --sag MS:UV:N          REG5 drops to UV microvolts at MS for N ms, REGPI follows\n"
+				"  --button MS:N          presses the power button at MS for N ms\n"
+				"  --rtc EPOCH            starts the RTC at the given Unix time instead of uninitialised\n"
+				"  --rtc-counter HEX      RTC binary counter value at the start, counting down to its wrap\n"
+				"  --backup FILE          loads the backup domain of an earlier run and saves it at the end\n"
+				"  --reset-cause CAUSE    power, pin, software or watchdog (default power)\n"
+				"  --temperature C        chip temperature (default 25)\n"
+				"  --ballast CODE         ballast ADC code (default 2048)\n"
+				"  --trace                logs pins, rails and bus traffic with virtual timestamps\n", program);
+	}
+
+	bool ParseTimed(const char *text, std::chrono::milliseconds &at, std::string &value)
+	{
+		const char *colon = strchr(text, ':');
+		if (colon == nullptr)
+		{
+			return false;
+		}
+		at = std::chrono::milliseconds(strtoll(text, nullptr, 10));
+		value = colon + 1;
+		return true;
+	}
+
+	bool ParseHex(const std::string &text, std::vector<uint8_t> &bytes)
+	{
+		if (text.size() % 2 != 0)
+		{
+			return false;
+		}
+		for (size_t i = 0; i < text.size(); i += 2)
+		{
+			char *end = nullptr;
+			std::string pair = text.substr(i, 2);
+			unsigned long value = strtoul(pair.c_str(), &end, 16);
+			if (*end != '\0')
+			{
+				return false;
+			}
+			bytes.push_back(static_cast<uint8_t>(value));
+		}
+		return true;
+	}
+
+	bool ParseArguments(int argc, char **argv, SimulationConfig &config)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string option = argv[i];
+			if (option == "--trace")
+			{
+				config.Trace = true;
+				continue;
+			}
+			if (option == "--rpi-int")
+			{
+				config.RpiInterrupt = true;
+				continue;
+			}
+
+			if (i + 1 >= argc)
+			{
+				return false;
+			}
+			const char *value = argv[++i];
+			std::chrono::milliseconds at{0};
+			std::string text;
+
+			if (option == "--duration-ms")
+			{
+				config.Duration = std::chrono::milliseconds(strtoll(value, nullptr, 10));
+			}
+			else if (option == "--rpi-period-ms")
+			{
+				config.RpiPeriod = std::chrono::milliseconds(strtoll(value, nullptr, 10));
+			}
+			else if (option == "--rpi-write")
+			{
+				std::vector<uint8_t> bytes;
+				if (!ParseTimed(value, at, text) || !ParseHex(text, bytes))
+				{
+					return false;
+				}
+				config.RpiWrites.emplace_back(at, std::move(bytes));
+			}
+			else if (option == "--rpi-read-reg")
+			{
+				std::chrono::milliseconds unused;
+				std::string count;
+				if (!ParseTimed(value, at, text) || !ParseTimed(text.c_str(), unused, count))
+				{
+					return false;
+				}
+				uint8_t address = static_cast<uint8_t>(strtoul(text.c_str(), nullptr, 16));
+				config.RpiRegisterReads.emplace_back(at, address, static_cast<size_t>(strtoul(count.c_str(), nullptr, 10)));
+			}
+			else if (option == "--vbus")
+			{
+				if (!ParseTimed(value, at, text))
+				{
+					return false;
+				}
+				config.VbusChanges.emplace_back(at, text != "0");
+			}
+			else if (option == "--sag")
+			{
+				std::chrono::milliseconds unused;
+				std::string duration;
+				if (!ParseTimed(value, at, text) || !ParseTimed(text.c_str(), unused, duration))
+				{
+					return false;
+				}
+				uint32_t microVolts = static_cast<uint32_t>(strtoul(text.c_str(), nullptr, 10));
+				config.Sags.emplace_back(at, microVolts, std::chrono::milliseconds(strtoll(duration.c_str(), nullptr, 10)));
+			}
+			else if (option == "--button")
+			{
+				if (!ParseTimed(value, at, text))
+				{
+					return false;
+				}
+				config.ButtonPresses.emplace_back(at, std::chrono::milliseconds(strtoll(text.c_str(), nullptr, 10)));
+			}
+			else if (option == "--rtc")
+			{
+				config.RtcEpochSeconds = strtoll(value, nullptr, 10);
+			}
+			else if (option == "--rtc-counter")
+			{
+				config.RtcStartCounter = static_cast<uint32_t>(strtoul(value, nullptr, 16));
+			}
+			else if (option == "--backup")
+			{
+				config.BackupFile = value;
+			}
+			else if (option == "--reset-cause")
+			{
+				std::string cause = value;
+				if (cause == "power")
+				{
+					config.ResetFlags = RCC_RESET_FLAG_PWR | RCC_RESET_FLAG_PIN;
+				}
+				else if (cause == "pin")
+				{
+					config.ResetFlags = RCC_RESET_FLAG_PIN;
+				}
+				else if (cause == "software")
+				{
+					config.ResetFlags = RCC_RESET_FLAG_SW | RCC_RESET_FLAG_PIN;
+				}
+				else if (cause == "watchdog")
+				{
+					config.ResetFlags = RCC_RESET_FLAG_IWDG | RCC_RESET_FLAG_PIN;
+				}
+				else
+				{
+					return false;
+				}
+			}
+			else if (option == "--temperature")
+			{
+				config.TemperatureCelsius = static_cast<int32_t>(strtol(value, nullptr, 10));
+			}
+			else if (option == "--ballast")
+			{
+				config.BallastCode = static_cast<uint16_t>(strtoul(value, nullptr, 10));
+			}
+			else
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	SimulationConfig config;
+	if (!ParseArguments(argc, argv, config))
+	{
+		PrintUsage(argv[0]);
+		return 2;
+	}
+
+	Simulation &simulation = Simulation::Get();
+	simulation.Configure(config);
+	RouteStdoutToFirmware(simulation);
+
+	int result = 0;
+	auto wallStart = std::chrono::steady_clock::now();
+	try
+	{
+		AppMainRun(nullptr);
+	}
+	catch (const SimulationEnd&)
+	{
+	}
+	catch (const std::exception &exception)
+	{
+		fprintf(stderr, "Simulation aborted: %s\n", exception.what());
+		result = 1;
+	}
+	simulation.SaveBackupDomain();
+	simulation.PrintSummary(stderr, std::chrono::steady_clock::now() - wallStart);
+	return result;
+}
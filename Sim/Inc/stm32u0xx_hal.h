@@ -0,0 +1,440 @@
+/*
+ * stm32u0xx_hal.h
+ *
+ * Host stand-in for the STM32U0 HAL, used by the simulation build only.
+ * It declares just the part of the HAL the application uses. Peripheral register blocks are plain
+ * structs, and the functions are implemented in SimHal.cpp on top of the virtual-time Simulation.
+ * The CubeMX headers in Core/Inc (main.h, i2c.h, ...) are used unchanged and include this file.
+ */
+
+#ifndef __STM32U0xx_HAL_H
+#define __STM32U0xx_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum
+{
+	HAL_OK = 0x00U,
+	HAL_ERROR = 0x01U,
+	HAL_BUSY = 0x02U,
+	HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+typedef enum
+{
+	DISABLE = 0U,
+	ENABLE = !DISABLE
+} FunctionalState;
+
+typedef enum
+{
+	EXTI0_1_IRQn = 5,
+	EXTI2_3_IRQn = 6,
+	EXTI4_15_IRQn = 7
+} IRQn_Type;
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+void HAL_SuspendTick(void);
+void HAL_ResumeTick(void);
+
+/* RCC ---------------------------------------------------------------------- */
+
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+uint32_t HAL_RCC_GetHCLKFreq(void);
+uint32_t HAL_RCC_GetResetSource(void);
+
+#define RCC_RESET_FLAG_OBL (1U << 25)
+#define RCC_RESET_FLAG_PIN (1U << 26)
+#define RCC_RESET_FLAG_PWR (1U << 27)
+#define RCC_RESET_FLAG_SW (1U << 28)
+#define RCC_RESET_FLAG_IWDG (1U << 29)
+#define RCC_RESET_FLAG_WWDG (1U << 30)
+#define RCC_RESET_FLAG_LPWR (1U << 31)
+
+#define __HAL_RCC_TIM2_CLK_ENABLE() do { } while (0)
+#define __HAL_RCC_TIM2_CLK_DISABLE() do { } while (0)
+#define __HAL_RCC_TIM6_CLK_ENABLE() do { } while (0)
+#define __HAL_RCC_TIM6_CLK_DISABLE() do { } while (0)
+
+/* PWR ---------------------------------------------------------------------- */
+
+#define PWR_MAINREGULATOR_ON 0x00000000U
+#define PWR_LOWPOWERREGULATOR_ON 0x00004000U
+#define PWR_SLEEPENTRY_WFI ((uint8_t)0x01)
+
+void HAL_PWR_EnterSLEEPMode(uint32_t Regulator, uint8_t SLEEPEntry);
+void HAL_PWR_EnterSTOPMode(uint32_t Regulator, uint8_t STOPEntry);
+
+/* GPIO --------------------------------------------------------------------- */
+
+typedef struct
+{
+	volatile uint32_t IDR;
+	volatile uint32_t ODR;
+} GPIO_TypeDef;
+
+typedef enum
+{
+	GPIO_PIN_RESET = 0U,
+	GPIO_PIN_SET
+} GPIO_PinState;
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_2 ((uint16_t)0x0004)
+#define GPIO_PIN_3 ((uint16_t)0x0008)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+#define GPIO_PIN_6 ((uint16_t)0x0040)
+#define GPIO_PIN_7 ((uint16_t)0x0080)
+#define GPIO_PIN_8 ((uint16_t)0x0100)
+#define GPIO_PIN_9 ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+extern GPIO_TypeDef SimGpioA;
+extern GPIO_TypeDef SimGpioB;
+#define GPIOA (&SimGpioA)
+#define GPIOB (&SimGpioB)
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+GPIO_PinState HAL_GPIO_ReadPin(const GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_EXTI_Rising_Callback(uint16_t GPIO_Pin);
+void HAL_GPIO_EXTI_Falling_Callback(uint16_t GPIO_Pin);
+
+/* TIM (register level only) ------------------------------------------------ */
+
+typedef struct
+{
+	volatile uint32_t CR1;
+	volatile uint32_t CR2;
+	volatile uint32_t SR;
+	volatile uint32_t EGR;
+	volatile uint32_t CNT;
+	volatile uint32_t PSC;
+	volatile uint32_t ARR;
+} TIM_TypeDef;
+
+extern TIM_TypeDef SimTim2;
+extern TIM_TypeDef SimTim6;
+#define TIM2 (&SimTim2)
+#define TIM6 (&SimTim6)
+
+#define TIM_CR1_CEN (0x1UL << 0)
+#define TIM_CR2_MMS_1 (0x2UL << 4)
+#define TIM_EGR_UG (0x1UL << 0)
+
+/* DMA ---------------------------------------------------------------------- */
+
+typedef struct
+{
+	void *Instance;
+} DMA_HandleTypeDef;
+
+#define DMA_IT_TC (0x1UL << 1)
+#define DMA_IT_HT (0x1UL << 2)
+
+void SimDmaEnableIt(DMA_HandleTypeDef *hdma, uint32_t Interrupts);
+void SimDmaDisableIt(DMA_HandleTypeDef *hdma, uint32_t Interrupts);
+uint32_t SimDmaGetCounter(DMA_HandleTypeDef *hdma);
+
+/// Channels are not modelled, only the transfer interrupts of the ADC channel
+#define __HAL_DMA_ENABLE(h) do { (void) (h); } while (0)
+#define __HAL_DMA_DISABLE(h) do { (void) (h); } while (0)
+#define __HAL_DMA_ENABLE_IT(h, it) SimDmaEnableIt((h), (it))
+#define __HAL_DMA_DISABLE_IT(h, it) SimDmaDisableIt((h), (it))
+#define __HAL_DMA_GET_COUNTER(h) SimDmaGetCounter((h))
+
+/* ADC ---------------------------------------------------------------------- */
+
+typedef struct
+{
+	uint32_t Ratio;
+	uint32_t RightBitShift;
+} ADC_OversamplingTypeDef;
+
+typedef struct
+{
+	ADC_OversamplingTypeDef Oversampling;
+} ADC_InitTypeDef;
+
+/* The simulation writes DR with every conversion */
+typedef struct
+{
+	volatile uint32_t DR;
+} ADC_TypeDef;
+
+extern ADC_TypeDef SimAdc1;
+#define ADC1 (&SimAdc1)
+
+typedef struct
+{
+	ADC_TypeDef *Instance;
+	ADC_InitTypeDef Init;
+	DMA_HandleTypeDef *DMA_Handle;
+} ADC_HandleTypeDef;
+
+/// Channel numbers of the regular sequence, which follows the numbers
+#define ADC_CHANNEL_4 4U
+#define ADC_CHANNEL_5 5U
+#define ADC_CHANNEL_6 6U
+
+#define ADC_ANALOGWATCHDOG_1 1U
+#define ADC_ANALOGWATCHDOG_2 2U
+#define ADC_ANALOGWATCHDOG_3 3U
+#define ADC_ANALOGWATCHDOG_NONE 0x00000000U
+#define ADC_ANALOGWATCHDOG_SINGLE_REG 0x00C00000U
+
+#define ADC_IT_AWD1 (0x1UL << 7)
+#define ADC_IT_AWD2 (0x1UL << 8)
+#define ADC_IT_AWD3 (0x1UL << 9)
+
+typedef struct
+{
+	uint32_t WatchdogNumber;
+	uint32_t WatchdogMode;
+	uint32_t Channel;
+	FunctionalState ITMode;
+	uint32_t HighThreshold;
+	uint32_t LowThreshold;
+} ADC_AnalogWDGConfTypeDef;
+
+void SimAdcEnableIt(ADC_HandleTypeDef *hadc, uint32_t Interrupts);
+void SimAdcDisableIt(ADC_HandleTypeDef *hadc, uint32_t Interrupts);
+
+#define __HAL_ADC_ENABLE_IT(h, it) SimAdcEnableIt((h), (it))
+#define __HAL_ADC_DISABLE_IT(h, it) SimAdcDisableIt((h), (it))
+
+/* The model only interrupts on new conversions, so the flags need no state */
+#define ADC_FLAG_AWD2 ADC_IT_AWD2
+#define ADC_FLAG_AWD3 ADC_IT_AWD3
+#define __HAL_ADC_CLEAR_FLAG(h, flag) ((void) (h), (void) (flag))
+
+/// Factory temperature sensor calibration, read from system memory on the target
+extern uint16_t SimTemperatureCalibration[2];
+#define TEMPSENSOR_CAL1_ADDR (&SimTemperatureCalibration[0])
+#define TEMPSENSOR_CAL2_ADDR (&SimTemperatureCalibration[1])
+
+HAL_StatusTypeDef HAL_ADC_Init(ADC_HandleTypeDef *hadc);
+HAL_StatusTypeDef HAL_ADCEx_Calibration_Start(ADC_HandleTypeDef *hadc);
+HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef *hadc, const uint32_t *pData, uint32_t Length);
+HAL_StatusTypeDef HAL_ADC_Stop_DMA(ADC_HandleTypeDef *hadc);
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc);
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc);
+HAL_StatusTypeDef HAL_ADC_AnalogWDGConfig(ADC_HandleTypeDef *hadc, const ADC_AnalogWDGConfTypeDef *pAnalogWDGConfig);
+void HAL_ADCEx_LevelOutOfWindow2Callback(ADC_HandleTypeDef *hadc);
+void HAL_ADCEx_LevelOutOfWindow3Callback(ADC_HandleTypeDef *hadc);
+
+/* CRC ---------------------------------------------------------------------- */
+
+typedef struct
+{
+	void *Instance;
+} CRC_HandleTypeDef;
+
+uint32_t HAL_CRC_Calculate(CRC_HandleTypeDef *hcrc, uint32_t pBuffer[], uint32_t BufferLength);
+uint32_t HAL_CRC_Accumulate(CRC_HandleTypeDef *hcrc, uint32_t pBuffer[], uint32_t BufferLength);
+void SimCrcReset(CRC_HandleTypeDef *hcrc);
+
+#define __HAL_CRC_DR_RESET(__HANDLE__) SimCrcReset((__HANDLE__))
+
+/* I2C ---------------------------------------------------------------------- */
+
+typedef struct
+{
+	uint32_t Timing;
+	uint32_t OwnAddress1;
+} I2C_InitTypeDef;
+
+typedef struct __I2C_HandleTypeDef
+{
+	void *Instance;
+	I2C_InitTypeDef Init;
+	uint8_t *pBuffPtr;
+	volatile uint32_t ErrorCode;
+} I2C_HandleTypeDef;
+
+#define I2C_MEMADD_SIZE_8BIT (0x00000001U)
+#define I2C_DIRECTION_TRANSMIT (0x00000000U)
+#define I2C_DIRECTION_RECEIVE (0x00000001U)
+#define I2C_FIRST_AND_LAST_FRAME (0x02000000U)
+#define I2C_LAST_FRAME (0x02000000U)
+
+#define HAL_I2C_ERROR_NONE (0x00000000U)
+#define HAL_I2C_ERROR_AF (0x00000004U)
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MspDeInit(I2C_HandleTypeDef *hi2c);
+uint32_t HAL_I2C_GetError(const I2C_HandleTypeDef *hi2c);
+
+HAL_StatusTypeDef HAL_I2C_Master_Transmit(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Master_Receive(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Master_Transmit_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Master_Receive_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Mem_Write_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Master_Abort_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress);
+
+HAL_StatusTypeDef HAL_I2C_EnableListen_IT(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2C_DisableListen_IT(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2C_Slave_Seq_Receive_IT(I2C_HandleTypeDef *hi2c, uint8_t *pData, uint16_t Size, uint32_t XferOptions);
+HAL_StatusTypeDef HAL_I2C_Slave_Transmit_DMA(I2C_HandleTypeDef *hi2c, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Slave_Seq_Transmit_DMA(I2C_HandleTypeDef *hi2c, uint8_t *pData, uint16_t Size, uint32_t XferOptions);
+
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_SlaveTxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_SlaveRxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_AddrCallback(I2C_HandleTypeDef *hi2c, uint8_t TransferDirection, uint16_t AddrMatchCode);
+void HAL_I2C_ListenCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_AbortCpltCallback(I2C_HandleTypeDef *hi2c);
+
+/* LPTIM -------------------------------------------------------------------- */
+
+typedef struct
+{
+	volatile uint32_t ISR;
+	volatile uint32_t DIER;
+	volatile uint32_t CCR1;
+	volatile uint32_t ARR;
+} LPTIM_TypeDef;
+
+typedef struct
+{
+	LPTIM_TypeDef *Instance;
+} LPTIM_HandleTypeDef;
+
+extern LPTIM_TypeDef SimLptim1;
+extern LPTIM_TypeDef SimLptim2;
+#define LPTIM1 (&SimLptim1)
+#define LPTIM2 (&SimLptim2)
+
+#define LPTIM_CHANNEL_1 0x00000000U
+
+#define LPTIM_FLAG_ARRM (0x1UL << 1)
+#define LPTIM_FLAG_CMP1OK (0x1UL << 3)
+#define LPTIM_FLAG_DIEROK (0x1UL << 24)
+#define LPTIM_IT_CC1 (0x1UL << 0)
+
+/// Register writes take effect at once in the simulation, so the write-complete flags are set immediately
+void SimLptimClearFlag(LPTIM_HandleTypeDef *hlptim, uint32_t Flag);
+void SimLptimEnableIt(LPTIM_HandleTypeDef *hlptim, uint32_t Interrupt);
+void SimLptimSetCompare(LPTIM_HandleTypeDef *hlptim, uint32_t Channel, uint32_t Compare);
+
+#define __HAL_LPTIM_CLEAR_FLAG(__HANDLE__, __FLAG__) SimLptimClearFlag((__HANDLE__), (__FLAG__))
+#define __HAL_LPTIM_ENABLE_IT(__HANDLE__, __INTERRUPT__) SimLptimEnableIt((__HANDLE__), (__INTERRUPT__))
+#define __HAL_LPTIM_GET_FLAG(__HANDLE__, __FLAG__) ((((__HANDLE__)->Instance->ISR) & (__FLAG__)) == (__FLAG__))
+#define __HAL_LPTIM_COMPARE_SET(__HANDLE__, __CHANNEL__, __VALUE__) SimLptimSetCompare((__HANDLE__), (__CHANNEL__), (__VALUE__))
+
+HAL_StatusTypeDef HAL_LPTIM_Counter_Start_IT(LPTIM_HandleTypeDef *hlptim);
+HAL_StatusTypeDef HAL_LPTIM_Counter_Stop_IT(LPTIM_HandleTypeDef *hlptim);
+HAL_StatusTypeDef HAL_LPTIM_PWM_Start(LPTIM_HandleTypeDef *hlptim, uint32_t Channel);
+HAL_StatusTypeDef HAL_LPTIM_PWM_Stop(LPTIM_HandleTypeDef *hlptim, uint32_t Channel);
+uint32_t HAL_LPTIM_ReadCounter(const LPTIM_HandleTypeDef *hlptim);
+void HAL_LPTIM_AutoReloadMatchCallback(LPTIM_HandleTypeDef *hlptim);
+
+/* RTC ---------------------------------------------------------------------- */
+
+#define LSI_VALUE 32000U
+
+/* The simulation keeps SSR and SR current whenever virtual time advances */
+typedef struct
+{
+	volatile uint32_t ICSR;
+	volatile uint32_t PRER;
+	volatile uint32_t SSR;
+	volatile uint32_t SR;
+} RTC_TypeDef;
+
+extern RTC_TypeDef SimRtc;
+#define RTC (&SimRtc)
+
+#define RTC_ICSR_BIN (0x3UL << 8)
+#define RTC_BINARY_ONLY (0x1UL << 8)
+#define RTC_PRER_PREDIV_A_Pos (16U)
+#define RTC_PRER_PREDIV_A (0x7FUL << RTC_PRER_PREDIV_A_Pos)
+#define RTC_SR_SSRUF (0x1UL << 6)
+
+typedef struct
+{
+	RTC_TypeDef *Instance;
+} RTC_HandleTypeDef;
+
+#define RTC_FLAG_SSRUF 0x00000206U
+#define RTC_CLEAR_SSRUF RTC_SR_SSRUF
+
+#define RTC_BKP_DR0 0x00U
+#define RTC_BKP_DR1 0x01U
+#define RTC_BKP_DR2 0x02U
+#define RTC_BKP_DR3 0x03U
+#define RTC_BKP_DR4 0x04U
+#define RTC_BKP_DR5 0x05U
+#define RTC_BKP_DR6 0x06U
+#define RTC_BKP_DR7 0x07U
+#define RTC_BKP_DR8 0x08U
+
+#define RTC_ALARM_A 0x00000100U
+#define RTC_ALARM_B 0x00000200U
+#define RTC_FORMAT_BIN 0x00000000U
+#define RTC_ALARMSUBSECONDBINMASK_NONE (32UL << 24)
+#define RTC_ALARMSUBSECONDBIN_AUTOCLR_NO 0UL
+
+typedef struct
+{
+	uint32_t SubSeconds;
+} RTC_TimeTypeDef;
+
+/* Only the binary-mode fields */
+typedef struct
+{
+	RTC_TimeTypeDef AlarmTime;
+	uint32_t AlarmSubSecondMask;
+	uint32_t BinaryAutoClr;
+	uint32_t Alarm;
+} RTC_AlarmTypeDef;
+
+uint32_t SimRtcGetFlag(uint32_t Flag);
+void SimRtcClearFlag(uint32_t Flag);
+
+#define __HAL_RTC_GET_FLAG(__HANDLE__, __FLAG__) SimRtcGetFlag((__FLAG__))
+#define __HAL_RTC_CLEAR_FLAG(__HANDLE__, __FLAG__) SimRtcClearFlag((__FLAG__))
+
+void HAL_RTCEx_BKUPWrite(const RTC_HandleTypeDef *hrtc, uint32_t BackupRegister, uint32_t Data);
+uint32_t HAL_RTCEx_BKUPRead(const RTC_HandleTypeDef *hrtc, uint32_t BackupRegister);
+HAL_StatusTypeDef HAL_RTC_SetAlarm_IT(RTC_HandleTypeDef *hrtc, RTC_AlarmTypeDef *sAlarm, uint32_t Format);
+HAL_StatusTypeDef HAL_RTC_DeactivateAlarm(RTC_HandleTypeDef *hrtc, uint32_t Alarm);
+void HAL_RTC_AlarmAEventCallback(RTC_HandleTypeDef *hrtc);
+void HAL_RTCEx_AlarmBEventCallback(RTC_HandleTypeDef *hrtc);
+
+/* UART --------------------------------------------------------------------- */
+
+typedef struct
+{
+	void *Instance;
+} UART_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STM32U0xx_HAL_H */
@@ -0,0 +1,80 @@
+/*
+ * AdcConversionTest.cpp
+ *
+ * Exhaustive checks of the reciprocal kernels against the division formulas. The static_asserts in
+ * AdcConversion.h stop at the 12-bit codes the ADC produces, here the rail kernel is swept over every
+ * 16-bit input and the temperature kernel over a grid of calibration values.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include "PiSubmarine/Chipset/AdcConversion.h"
+#include "Check.h"
+
+using namespace PiSubmarine::Chipset::AdcConversion;
+using namespace PiSubmarine::Chipset::Tests;
+
+namespace
+{
+	void RailKernelMatchesEverySixteenBitCode()
+	{
+		uint32_t mismatches = 0;
+		for (uint32_t code = 0; code <= UINT16_MAX; code++)
+		{
+			uint64_t expected = RailMicroVoltsByDivision(static_cast<uint16_t>(code));
+			if (RailMicroVolts(static_cast<uint16_t>(code)) != expected)
+			{
+				if (mismatches == 0)
+				{
+					std::fprintf(stderr, "code %lu: %lu uV, expected %llu uV\n", static_cast<unsigned long>(code),
+							static_cast<unsigned long>(RailMicroVolts(static_cast<uint16_t>(code))), static_cast<unsigned long long>(expected));
+				}
+				mismatches++;
+			}
+		}
+		CHIPSET_CHECK(mismatches == 0);
+		CHIPSET_CHECK(RailMicroVolts(AdcMax) == 6600000);
+	}
+
+	void RailCodeIsMonotonic()
+	{
+		uint16_t previous = 0;
+		for (uint32_t microVolts = 0; microVolts <= RailMicroVolts(AdcMax); microVolts += 997)
+		{
+			uint16_t code = RailCode(microVolts);
+			CHIPSET_CHECK(code >= previous);
+			previous = code;
+		}
+		CHIPSET_CHECK(RailCode(RailMicroVolts(AdcMax) + 1) == AdcMax);
+	}
+
+	/// The calibration values differ per chip, so the divisor is not known at compile time
+	void TemperatureKernelMatchesAcrossCalibrations()
+	{
+		uint32_t mismatches = 0;
+		for (uint32_t tsCal1 = 0; tsCal1 < AdcMax; tsCal1 += 31)
+		{
+			for (uint32_t tsCal2 = tsCal1 + 1; tsCal2 <= AdcMax; tsCal2 += 47)
+			{
+				TemperatureCalibration calibration(static_cast<uint16_t>(tsCal1), static_cast<uint16_t>(tsCal2));
+				CHIPSET_CHECK(calibration.IsValid());
+				for (uint32_t code = 0; code <= AdcMax; code++)
+				{
+					int64_t expected = TemperatureMicroKelvinsByDivision(static_cast<uint16_t>(code), static_cast<uint16_t>(tsCal1),
+							static_cast<uint16_t>(tsCal2));
+					mismatches += calibration.ToMicroKelvins(static_cast<uint16_t>(code)) != expected ? 1 : 0;
+				}
+			}
+		}
+		CHIPSET_CHECK(mismatches == 0);
+		CHIPSET_CHECK(!TemperatureCalibration(1368, 1368).IsValid());
+	}
+}
+
+int main()
+{
+	RailKernelMatchesEverySixteenBitCode();
+	RailCodeIsMonotonic();
+	TemperatureKernelMatchesAcrossCalibrations();
+	return Result();
+}
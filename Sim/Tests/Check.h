@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdio>
+
+namespace PiSubmarine::Chipset::Tests
+{
+	inline int &FailureCount()
+	{
+		static int count = 0;
+		return count;
+	}
+
+	inline bool Check(bool condition, const char *expression, const char *file, int line)
+	{
+		if (!condition)
+		{
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+			FailureCount()++;
+		}
+		return condition;
+	}
+
+	/// Exit code of the test executable
+	inline int Result()
+	{
+		if (FailureCount() != 0)
+		{
+			std::fprintf(stderr, "%d checks failed\n", FailureCount());
+			return 1;
+		}
+		return 0;
+	}
+}
+
+/// Records a failure and carries on, so one run reports every failed check
+#define CHIPSET_CHECK(condition) PiSubmarine::Chipset::Tests::Check((condition), #condition, __FILE__, __LINE__)
@@ -0,0 +1,95 @@
+/*
+ * CivilTimeTest.cpp
+ *
+ * CivilTime against the host C library, which the firmware no longer links for it: timegm() and
+ * gmtime_r() for every day of the years 2000 to 2099, at a time of day that moves through the whole
+ * day, and every second around the leap days.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <initializer_list>
+#include "PiSubmarine/Chipset/CivilTime.h"
+#include "Check.h"
+
+using namespace PiSubmarine::Chipset;
+using namespace PiSubmarine::Chipset::Tests;
+
+namespace
+{
+	constexpr int64_t First = 946684800; // 2000-01-01 00:00:00
+	constexpr int64_t End = 4102444800; // 2100-01-01 00:00:00
+
+	bool MatchesLibc(int64_t seconds, uint16_t milliseconds)
+	{
+		time_t time = static_cast<time_t>(seconds);
+		tm expected{};
+		if (gmtime_r(&time, &expected) == nullptr)
+		{
+			return false;
+		}
+
+		CivilTime::DateTime actual = CivilTime::FromUnixMilliseconds(seconds * CivilTime::MillisecondsPerSecond + milliseconds);
+		bool matches = actual.Date.Year == expected.tm_year + 1900 && actual.Date.Month == expected.tm_mon + 1 && actual.Date.Day == expected.tm_mday
+				&& actual.Hours == expected.tm_hour && actual.Minutes == expected.tm_min && actual.Seconds == expected.tm_sec
+				&& actual.Milliseconds == milliseconds;
+
+		// RTC_WEEKDAY_* counts from Monday, tm_wday from Sunday
+		int32_t days = CivilTime::DaysFromCivil(actual.Date);
+		matches = matches && CivilTime::WeekDay(days) == (expected.tm_wday == 0 ? 7 : expected.tm_wday);
+
+		matches = matches && CivilTime::ToUnixMilliseconds(actual) == seconds * CivilTime::MillisecondsPerSecond + milliseconds;
+		matches = matches && static_cast<int64_t>(timegm(&expected)) == seconds;
+		if (!matches)
+		{
+			std::fprintf(stderr, "%lld: %04d-%02d-%02d %02d:%02d:%02d, libc %04d-%02d-%02d %02d:%02d:%02d\n", static_cast<long long>(seconds),
+					static_cast<int>(actual.Date.Year), actual.Date.Month, actual.Date.Day, actual.Hours, actual.Minutes, actual.Seconds,
+					expected.tm_year + 1900, expected.tm_mon + 1, expected.tm_mday, expected.tm_hour, expected.tm_min, expected.tm_sec);
+		}
+		return matches;
+	}
+
+	void EveryDayMatchesLibc()
+	{
+		uint32_t mismatches = 0;
+		uint32_t day = 0;
+		for (int64_t midnight = First; midnight < End; midnight += CivilTime::SecondsPerDay, day++)
+		{
+			// A prime step moves the time of day through the whole day over the century
+			int64_t secondOfDay = (static_cast<int64_t>(day) * 7919) % CivilTime::SecondsPerDay;
+			uint16_t milliseconds = static_cast<uint16_t>(day % 1000);
+			mismatches += MatchesLibc(midnight, 0) ? 0 : 1;
+			mismatches += MatchesLibc(midnight + secondOfDay, milliseconds) ? 0 : 1;
+			mismatches += MatchesLibc(midnight + CivilTime::SecondsPerDay - 1, 999) ? 0 : 1;
+		}
+		CHIPSET_CHECK(day == 36525);
+		CHIPSET_CHECK(mismatches == 0);
+	}
+
+	void EverySecondAroundLeapDays()
+	{
+		uint32_t mismatches = 0;
+		for (int32_t year : {2000, 2024, 2096})
+		{
+			tm leapDay{};
+			leapDay.tm_year = year - 1900;
+			leapDay.tm_mon = 1;
+			leapDay.tm_mday = 29;
+			int64_t start = static_cast<int64_t>(timegm(&leapDay));
+			CHIPSET_CHECK(start == CivilTime::DaysFromCivil(CivilTime::Date{year, 2, 29}) * CivilTime::SecondsPerDay);
+			for (int64_t seconds = start - CivilTime::SecondsPerDay; seconds < start + 2 * CivilTime::SecondsPerDay; seconds++)
+			{
+				mismatches += MatchesLibc(seconds, 500) ? 0 : 1;
+			}
+		}
+		CHIPSET_CHECK(mismatches == 0);
+	}
+}
+
+int main()
+{
+	EveryDayMatchesLibc();
+	EverySecondAroundLeapDays();
+	return Result();
+}
@@ -0,0 +1,117 @@
+/*
+ * EventRingTest.cpp
+ *
+ * EventRing as an ISR and the main loop use it: one thread pushes while another pops. Every item
+ * must arrive once, in order and intact, with drops only while the ring is full.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include "PiSubmarine/Chipset/EventRing.h"
+#include "Check.h"
+
+using namespace PiSubmarine::Chipset;
+using namespace PiSubmarine::Chipset::Tests;
+
+namespace
+{
+	/// Two halves of a sequence number, so a torn copy of the slot shows as a mismatch
+	struct Item
+	{
+		uint32_t Sequence = 0;
+		uint32_t Inverted = 0;
+	};
+
+	void FullRingDropsAndCounts()
+	{
+		EventRing<Item, 4> ring;
+		for (uint32_t i = 0; i < 4; i++)
+		{
+			CHIPSET_CHECK(ring.Push(Item{i, ~i}));
+		}
+		CHIPSET_CHECK(!ring.Push(Item{4, ~4U}));
+		CHIPSET_CHECK(ring.GetSize() == 4);
+		CHIPSET_CHECK(ring.GetDroppedCount() == 1);
+
+		Item item;
+		CHIPSET_CHECK(ring.Pop(item) && item.Sequence == 0);
+		CHIPSET_CHECK(ring.Push(Item{5, ~5U}));
+		for (uint32_t expected : {1U, 2U, 3U, 5U})
+		{
+			CHIPSET_CHECK(ring.Pop(item) && item.Sequence == expected);
+		}
+		CHIPSET_CHECK(!ring.Pop(item));
+		CHIPSET_CHECK(ring.IsEmpty());
+	}
+
+	/// A producer that yields on a full ring loses nothing. One that does not, like an ISR, loses the
+	/// items it could not push but never corrupts or reorders the others.
+	void InterleavedProducerAndConsumer(bool yieldWhenFull)
+	{
+		constexpr uint32_t Count = 1000000;
+		EventRing<Item, 16> ring;
+
+		uint32_t pushed = 0;
+		uint32_t failed = 0;
+		std::atomic<bool> done{false};
+		std::thread producer([&ring, &pushed, &failed, &done, yieldWhenFull]()
+		{
+			for (uint32_t i = 0; i < Count; i++)
+			{
+				if (ring.Push(Item{i, ~i}))
+				{
+					pushed++;
+					continue;
+				}
+				failed++;
+				if (yieldWhenFull)
+				{
+					std::this_thread::yield();
+					i--;
+				}
+			}
+			done.store(true, std::memory_order_release);
+		});
+
+		uint32_t received = 0;
+		uint32_t corrupted = 0;
+		uint32_t outOfOrder = 0;
+		int64_t last = -1;
+		while (true)
+		{
+			// Read before the pop, so an empty ring after the producer finished means everything arrived
+			bool finished = done.load(std::memory_order_acquire);
+			Item item;
+			if (!ring.Pop(item))
+			{
+				if (finished)
+				{
+					break;
+				}
+				std::this_thread::yield();
+				continue;
+			}
+			corrupted += item.Inverted != ~item.Sequence ? 1 : 0;
+			outOfOrder += static_cast<int64_t>(item.Sequence) <= last ? 1 : 0;
+			last = item.Sequence;
+			received++;
+		}
+		producer.join();
+
+		CHIPSET_CHECK(corrupted == 0);
+		CHIPSET_CHECK(outOfOrder == 0);
+		CHIPSET_CHECK(received == pushed);
+		// Every failed push counts as a drop, also the ones that were retried
+		CHIPSET_CHECK(ring.GetDroppedCount() == failed);
+		CHIPSET_CHECK(pushed == (yieldWhenFull ? Count : Count - failed));
+	}
+}
+
+int main()
+{
+	FullRingDropsAndCounts();
+	InterleavedProducerAndConsumer(true);
+	InterleavedProducerAndConsumer(false);
+	return Result();
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+#include "PiSubmarine/Chipset/IWakeupTimer.h"
+
+namespace PiSubmarine::Chipset::Tests
+{
+	/// IWakeupTimer on a virtual millisecond clock. Idle() jumps straight to the armed deadline or to
+	/// the next scheduled interrupt, whichever comes first, so a test runs hours of firmware time in
+	/// microseconds and every wake-up is exactly where the Scheduler asked for it.
+	class FakeWakeupTimer : public IWakeupTimer
+	{
+	public:
+		[[nodiscard]] std::chrono::milliseconds Now() const override
+		{
+			return m_Now;
+		}
+
+		bool ArmWakeup(std::chrono::milliseconds deadline) override
+		{
+			if (deadline <= m_Now)
+			{
+				return false;
+			}
+			m_Deadline = deadline;
+			m_Armed = true;
+			return true;
+		}
+
+		void DisarmWakeup() override
+		{
+			m_Armed = false;
+		}
+
+		void Idle() override
+		{
+			m_IdleCount++;
+			auto next = m_Interrupts.end();
+			for (auto it = m_Interrupts.begin(); it != m_Interrupts.end(); ++it)
+			{
+				if (next == m_Interrupts.end() || it->Time < next->Time)
+				{
+					next = it;
+				}
+			}
+
+			if (next != m_Interrupts.end() && (!m_Armed || next->Time <= m_Deadline))
+			{
+				Interrupt interrupt = std::move(*next);
+				m_Interrupts.erase(next);
+				m_Now = std::max(m_Now, interrupt.Time);
+				interrupt.Handler();
+				return;
+			}
+			if (!m_Armed)
+			{
+				// Nothing could ever wake the core, the firmware would hang here
+				std::fprintf(stderr, "Idle() at %lld ms without a deadline or an interrupt\n", static_cast<long long>(m_Now.count()));
+				std::abort();
+			}
+			m_Now = m_Deadline;
+			m_Armed = false;
+		}
+
+		/// Runs handler as an interrupt at the given absolute time, once the core idles
+		void ScheduleInterrupt(std::chrono::milliseconds time, std::function<void()> handler)
+		{
+			m_Interrupts.push_back(Interrupt{time, std::move(handler)});
+		}
+
+		/// Time spent outside Idle(), e.g. a long handler in the main loop
+		void Advance(std::chrono::milliseconds delay)
+		{
+			m_Now += delay;
+		}
+
+		[[nodiscard]] uint32_t GetIdleCount() const
+		{
+			return m_IdleCount;
+		}
+
+	private:
+		struct Interrupt
+		{
+			std::chrono::milliseconds Time;
+			std::function<void()> Handler;
+		};
+
+		std::chrono::milliseconds m_Now{0};
+		std::chrono::milliseconds m_Deadline{0};
+		bool m_Armed = false;
+		uint32_t m_IdleCount = 0;
+		std::vector<Interrupt> m_Interrupts;
+	};
+}
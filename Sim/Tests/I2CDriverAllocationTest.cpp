@@ -0,0 +1,181 @@
+/*
+ * I2CDriverAllocationTest.cpp
+ *
+ * The queued I2C path must not touch the heap: callbacks live in InplaceDelegate, payloads in the
+ * driver's arena. Counts operator new over 10000 register reads and writes of varying length.
+ */
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include "PiSubmarine/Chipset/I2CDriver.h"
+#include "Check.h"
+#include "FakeWakeupTimer.h"
+
+using namespace PiSubmarine::Chipset;
+using namespace PiSubmarine::Chipset::Tests;
+
+namespace
+{
+	size_t AllocationCount = 0;
+
+	/// The one DMA transfer the fake peripheral has on the bus
+	struct FakeTransfer
+	{
+		bool Active = false;
+		bool Receive = false;
+		uint8_t *Data = nullptr;
+		uint16_t Size = 0;
+	};
+
+	FakeTransfer Transfer;
+
+	HAL_StatusTypeDef StartTransfer(bool receive, uint8_t *data, uint16_t size)
+	{
+		if (Transfer.Active)
+		{
+			return HAL_BUSY;
+		}
+		Transfer = FakeTransfer{true, receive, data, size};
+		return HAL_OK;
+	}
+}
+
+void *operator new(size_t size)
+{
+	AllocationCount++;
+	void *memory = std::malloc(size == 0 ? 1 : size);
+	if (memory == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void *memory, size_t) noexcept
+{
+	std::free(memory);
+}
+
+extern "C"
+{
+	HAL_StatusTypeDef HAL_I2C_Mem_Write_DMA(I2C_HandleTypeDef*, uint16_t, uint16_t, uint16_t, uint8_t *pData, uint16_t Size)
+	{
+		return StartTransfer(false, pData, Size);
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef*, uint16_t, uint16_t, uint16_t, uint8_t *pData, uint16_t Size)
+	{
+		return StartTransfer(true, pData, Size);
+	}
+}
+
+int main()
+{
+	constexpr uint32_t Transactions = 10000;
+	constexpr uint8_t Address = 0x6B;
+
+	I2C_HandleTypeDef handle{};
+	FakeWakeupTimer clock;
+	// Two 28 byte writes fill the arena, so it wraps around as well
+	StaticI2CDriver<4, 64> driver(handle, clock);
+
+	std::array<uint8_t, 32> rx{};
+	std::array<uint8_t, 28> tx{};
+	struct Counts
+	{
+		uint32_t Completed = 0;
+		uint32_t Failed = 0;
+	} counts;
+	uint32_t corruptPayloads = 0;
+
+	// One pointer of captures, like the [this] of RegisterCache
+	auto onStatus = [counts = &counts](uint8_t address, I2CStatus status)
+	{
+		counts->Completed++;
+		counts->Failed += status != I2CStatus::Ok || address != Address ? 1 : 0;
+	};
+
+	size_t allocationsBefore = AllocationCount;
+	uint32_t submitted = 0;
+	uint32_t transferred = 0;
+	while (submitted < Transactions)
+	{
+		// Fill the queue, then let the fake bus drain it, so the arena and the FIFO wrap around
+		for (size_t slot = 0; slot < driver.QueueCapacity && submitted < Transactions; slot++, submitted++)
+		{
+			tx.fill(static_cast<uint8_t>(submitted));
+			bool queued = false;
+			switch (submitted % 4)
+			{
+			case 0:
+				queued = driver.ReadRegisters(Address, 0x1B, rx.data(), 13, onStatus);
+				break;
+			case 1:
+				queued = driver.WriteRegisters(Address, 0x00, tx.data(), tx.size(), onStatus);
+				break;
+			case 2:
+				queued = driver.ReadRegisters(Address, 0x31, rx.data(), 4, onStatus);
+				break;
+			case 3:
+				queued = driver.WriteRegisters(Address, 0x10, tx.data(), 2, onStatus);
+				break;
+			}
+			CHIPSET_CHECK(queued);
+		}
+
+		while (!driver.IsIdle() && Transfer.Active)
+		{
+			FakeTransfer transfer = Transfer;
+			Transfer.Active = false;
+			uint8_t fill = static_cast<uint8_t>(transferred++);
+			if (transfer.Receive)
+			{
+				driver.OnMasterRxCplt(&handle);
+			}
+			else
+			{
+				// The payload was copied at submit time, tx has been refilled since
+				corruptPayloads += transfer.Data == tx.data() ? 1 : 0;
+				for (uint16_t i = 0; i < transfer.Size; i++)
+				{
+					corruptPayloads += transfer.Data[i] != fill ? 1 : 0;
+				}
+				driver.OnMasterTxCplt(&handle);
+			}
+		}
+	}
+	size_t allocations = AllocationCount - allocationsBefore;
+
+	CHIPSET_CHECK(driver.IsIdle());
+	CHIPSET_CHECK(counts.Completed == Transactions);
+	CHIPSET_CHECK(counts.Failed == 0);
+	CHIPSET_CHECK(corruptPayloads == 0);
+	CHIPSET_CHECK(allocations == 0);
+	if (allocations != 0)
+	{
+		std::fprintf(stderr, "%zu heap allocations\n", allocations);
+	}
+	return Result();
+}
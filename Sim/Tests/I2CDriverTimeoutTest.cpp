@@ -0,0 +1,151 @@
+/*
+ * I2CDriverTimeoutTest.cpp
+ *
+ * Deadlines of the queued I2CDriver: a transfer that never completes is failed with
+ * I2CStatus::Timeout once DefaultTimeout has passed, and the queue behind it moves on after the
+ * abort, or at once when the peripheral has to be reset instead.
+ */
+
+#include <array>
+#include <cstdint>
+#include "PiSubmarine/Chipset/I2CDriver.h"
+#include "Check.h"
+#include "FakeWakeupTimer.h"
+
+using namespace PiSubmarine::Chipset;
+using namespace PiSubmarine::Chipset::Tests;
+
+namespace
+{
+	/// Transfers are started and then left hanging, as on a stuck bus
+	struct FakeBus
+	{
+		uint32_t Started = 0;
+		uint32_t Aborts = 0;
+		uint32_t Resets = 0;
+		HAL_StatusTypeDef AbortResult = HAL_OK;
+	};
+
+	FakeBus Bus;
+
+	struct Results
+	{
+		uint32_t Calls = 0;
+		I2CStatus Last = I2CStatus::Ok;
+	};
+
+	struct Bench
+	{
+		I2C_HandleTypeDef Handle{};
+		FakeWakeupTimer Clock;
+		StaticI2CDriver<2, 8> Driver{Handle, Clock};
+		std::array<uint8_t, 4> Rx{};
+		Results First;
+		Results Second;
+
+		bool Queue(Results &results)
+		{
+			return Driver.ReadRegisters(0x6B, 0x1B, Rx.data(), Rx.size(), [&results](uint8_t, I2CStatus status)
+			{
+				results.Calls++;
+				results.Last = status;
+			});
+		}
+	};
+
+	void HungTransferTimesOut()
+	{
+		Bus = FakeBus{};
+		Bench bench;
+		CHIPSET_CHECK(bench.Queue(bench.First));
+		CHIPSET_CHECK(bench.Queue(bench.Second));
+		CHIPSET_CHECK(Bus.Started == 1);
+
+		bench.Clock.Advance(I2CDriver::DefaultTimeout - std::chrono::milliseconds(1));
+		bench.Driver.CheckTimeouts();
+		CHIPSET_CHECK(bench.First.Calls == 0);
+
+		bench.Clock.Advance(std::chrono::milliseconds(1));
+		bench.Driver.CheckTimeouts();
+		CHIPSET_CHECK(bench.First.Calls == 1);
+		CHIPSET_CHECK(bench.First.Last == I2CStatus::Timeout);
+		CHIPSET_CHECK(bench.Driver.GetTimeoutCount() == 1);
+		CHIPSET_CHECK(Bus.Aborts == 1);
+
+		// The bus is not free before the abort has finished
+		CHIPSET_CHECK(Bus.Started == 1);
+		bench.Driver.CheckTimeouts();
+		CHIPSET_CHECK(bench.Driver.GetTimeoutCount() == 1);
+		bench.Driver.OnAbortCplt(&bench.Handle);
+		CHIPSET_CHECK(Bus.Started == 2);
+
+		// The follow-up gets a deadline of its own from its start
+		bench.Clock.Advance(I2CDriver::DefaultTimeout);
+		bench.Driver.CheckTimeouts();
+		CHIPSET_CHECK(bench.Second.Calls == 1);
+		CHIPSET_CHECK(bench.Second.Last == I2CStatus::Timeout);
+		bench.Driver.OnAbortCplt(&bench.Handle);
+		CHIPSET_CHECK(bench.Driver.IsIdle());
+	}
+
+	void FailedAbortResetsThePeripheral()
+	{
+		Bus = FakeBus{};
+		Bus.AbortResult = HAL_ERROR;
+		Bench bench;
+		CHIPSET_CHECK(bench.Queue(bench.First));
+		CHIPSET_CHECK(bench.Queue(bench.Second));
+
+		bench.Clock.Advance(I2CDriver::DefaultTimeout);
+		bench.Driver.CheckTimeouts();
+		CHIPSET_CHECK(bench.First.Last == I2CStatus::Timeout);
+		CHIPSET_CHECK(Bus.Resets == 1);
+		// No abort completion will come, the next transfer starts at once
+		CHIPSET_CHECK(Bus.Started == 2);
+		CHIPSET_CHECK(bench.Second.Calls == 0);
+
+		bench.Driver.OnMasterRxCplt(&bench.Handle);
+		CHIPSET_CHECK(bench.Second.Calls == 1);
+		CHIPSET_CHECK(bench.Second.Last == I2CStatus::Ok);
+		CHIPSET_CHECK(bench.Driver.IsIdle());
+	}
+}
+
+extern "C"
+{
+	HAL_StatusTypeDef HAL_I2C_Mem_Write_DMA(I2C_HandleTypeDef*, uint16_t, uint16_t, uint16_t, uint8_t*, uint16_t)
+	{
+		Bus.Started++;
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef*, uint16_t, uint16_t, uint16_t, uint8_t*, uint16_t)
+	{
+		Bus.Started++;
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Master_Abort_IT(I2C_HandleTypeDef*, uint16_t)
+	{
+		Bus.Aborts++;
+		return Bus.AbortResult;
+	}
+
+	HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef*)
+	{
+		Bus.Resets++;
+		return HAL_OK;
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef*)
+	{
+		return HAL_OK;
+	}
+}
+
+int main()
+{
+	HungTransferTimesOut();
+	FailedAbortResetsThePeripheral();
+	return Result();
+}
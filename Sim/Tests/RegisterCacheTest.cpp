@@ -0,0 +1,394 @@
+/*
+ * RegisterCacheTest.cpp
+ *
+ * RegisterCache and ChargerMonitor on a fake BQ25792 behind the queued I2CDriver: the volatility
+ * classes of the register map, selective and
+ * coalesced reads, write-back of the dirty registers only, a Set() racing a read burst, the
+ * charger configuration that InitBatteryManagers writes through the cache, a charger reset
+ * noticed by a full refresh, and a timed-out refresh handing over to the merged follow-up.
+ */
+
+#include <array>
+#include <cstdint>
+#include "PiSubmarine/Chipset/ChargerMonitor.h"
+#include "Check.h"
+#include "FakeWakeupTimer.h"
+
+using namespace PiSubmarine::Chipset;
+using namespace PiSubmarine::Chipset::Tests;
+
+namespace
+{
+	constexpr size_t RegisterCount = ChargerMonitor::RegisterCount;
+
+	/// Register file with the DMA transfer that is on the bus. Completes only when told to.
+	struct FakeCharger
+	{
+		std::array<uint8_t, RegisterCount> Registers{};
+		bool Active = false;
+		bool Receive = false;
+		uint16_t Register = 0;
+		uint8_t *Data = nullptr;
+		uint16_t Size = 0;
+		uint32_t Reads = 0;
+		uint32_t Writes = 0;
+	};
+
+	FakeCharger Charger;
+
+	HAL_StatusTypeDef StartTransfer(bool receive, uint16_t reg, uint8_t *data, uint16_t size)
+	{
+		if (Charger.Active)
+		{
+			return HAL_BUSY;
+		}
+		Charger.Active = true;
+		Charger.Receive = receive;
+		Charger.Register = reg;
+		Charger.Data = data;
+		Charger.Size = size;
+		return HAL_OK;
+	}
+
+	/// Finishes the transfer on the bus, returns false if there is none
+	bool CompleteTransfer(I2C_HandleTypeDef &handle, I2CDriver &driver)
+	{
+		if (!Charger.Active)
+		{
+			return false;
+		}
+		Charger.Active = false;
+		for (uint16_t i = 0; i < Charger.Size; i++)
+		{
+			if (Charger.Receive)
+			{
+				Charger.Data[i] = Charger.Registers[Charger.Register + i];
+			}
+			else
+			{
+				Charger.Registers[Charger.Register + i] = Charger.Data[i];
+			}
+		}
+		if (Charger.Receive)
+		{
+			Charger.Reads++;
+			driver.OnMasterRxCplt(&handle);
+		}
+		else
+		{
+			Charger.Writes++;
+			driver.OnMasterTxCplt(&handle);
+		}
+		return true;
+	}
+
+	void Drain(I2C_HandleTypeDef &handle, I2CDriver &driver)
+	{
+		while (CompleteTransfer(handle, driver))
+		{
+		}
+	}
+
+	void Reset()
+	{
+		Charger = FakeCharger{};
+		for (size_t reg = 0; reg < RegisterCount; reg++)
+		{
+			Charger.Registers[reg] = static_cast<uint8_t>(0x80 + reg);
+		}
+	}
+
+	struct Bench
+	{
+		I2C_HandleTypeDef Handle{};
+		FakeWakeupTimer Clock;
+		StaticI2CDriver<2, ChargerMonitor::RegisterCount> Driver{Handle, Clock};
+	};
+
+	constexpr ChargerMonitor::Cache::VolatilityTable ChargerTable = ChargerMonitor::MakeVolatilityTable();
+
+	void VolatilityTableMatchesTheRegisterMap()
+	{
+		CHIPSET_CHECK(ChargerTable[ChargerMonitor::NtcControl1] == Volatility::Static);
+		// ICO_ILIM is 16 bit, both bytes change while input current optimization runs
+		CHIPSET_CHECK(ChargerTable[ChargerMonitor::IcoCurrentLimit] == Volatility::SlowStatus);
+		CHIPSET_CHECK(ChargerTable[0x1A] == Volatility::SlowStatus);
+		CHIPSET_CHECK(ChargerTable[ChargerMonitor::ChargerStatus0] == Volatility::FastStatus);
+		CHIPSET_CHECK(ChargerTable[ChargerMonitor::LastFlag] == Volatility::FastStatus);
+		CHIPSET_CHECK(ChargerTable[ChargerMonitor::LastFlag + 1] == Volatility::Static);
+		CHIPSET_CHECK(ChargerTable[ChargerMonitor::FirstAdcResult] == Volatility::SlowStatus);
+		CHIPSET_CHECK(ChargerTable[ChargerMonitor::LastAdcResult] == Volatility::SlowStatus);
+		CHIPSET_CHECK(ChargerTable[ChargerMonitor::LastAdcResult + 1] == Volatility::Static);
+		// A configuration check only reads Volatility::Static
+		for (const ChargerMonitor::Setting &setting : ChargerMonitor::Settings)
+		{
+			CHIPSET_CHECK(ChargerTable[setting.Register] == Volatility::Static);
+		}
+	}
+
+	void RefreshReadsOnlySelectedClasses()
+	{
+		Reset();
+		Bench bench;
+		ChargerMonitor::Cache cache(bench.Driver, ChargerMonitor::DeviceAddress, ChargerTable);
+		bool done = false;
+		bool result = false;
+
+		CHIPSET_CHECK(cache.Refresh(static_cast<uint8_t>(Volatility::FastStatus), [&done, &result](bool ok)
+		{	done = true; result = ok;}));
+		CHIPSET_CHECK(cache.IsBusy());
+		Drain(bench.Handle, bench.Driver);
+
+		CHIPSET_CHECK(done && result);
+		CHIPSET_CHECK(!cache.IsBusy());
+		// REG1B..REG27 in one burst
+		CHIPSET_CHECK(Charger.Reads == 1);
+		CHIPSET_CHECK(cache.GetTransferredBytes() == ChargerMonitor::LastFlag - ChargerMonitor::ChargerStatus0 + 1);
+		CHIPSET_CHECK(cache.Get(ChargerMonitor::ChargerStatus0) == 0x80 + ChargerMonitor::ChargerStatus0);
+		CHIPSET_CHECK(cache.Get(ChargerMonitor::LastFlag) == 0x80 + ChargerMonitor::LastFlag);
+		CHIPSET_CHECK(cache.Get(ChargerMonitor::ChargerControl1) == 0);
+	}
+
+	void ShortGapsAreCoalesced()
+	{
+		Reset();
+		Bench bench;
+		ChargerMonitor::Cache::VolatilityTable table{};
+		table.fill(Volatility::Static);
+		// 2 and 6 are bridged by a gap of three, 12 is a burst of its own
+		for (size_t reg : {2, 6, 12})
+		{
+			table[reg] = Volatility::FastStatus;
+		}
+		ChargerMonitor::Cache cache(bench.Driver, ChargerMonitor::DeviceAddress, table);
+
+		CHIPSET_CHECK(cache.Refresh(static_cast<uint8_t>(Volatility::FastStatus), nullptr));
+		Drain(bench.Handle, bench.Driver);
+		CHIPSET_CHECK(Charger.Reads == 2);
+		CHIPSET_CHECK(cache.GetTransferredBytes() == 5 + 1);
+		CHIPSET_CHECK(cache.Get(12) == 0x80 + 12);
+	}
+
+	void FlushWritesOnlyChangedRegisters()
+	{
+		Reset();
+		Bench bench;
+		ChargerMonitor::Cache cache(bench.Driver, ChargerMonitor::DeviceAddress, ChargerTable);
+		CHIPSET_CHECK(cache.Refresh(static_cast<uint8_t>(Volatility::Static), nullptr));
+		Drain(bench.Handle, bench.Driver);
+
+		// The same value as the device does not need a write
+		cache.Set(0x05, 0x85);
+		CHIPSET_CHECK(!cache.IsDirty(0x05));
+		cache.Set(0x03, 0x01);
+		cache.Set(0x04, 0x2C);
+		cache.Set(0x10, 0x00);
+		CHIPSET_CHECK(cache.IsDirty(0x03) && cache.IsDirty(0x04) && cache.IsDirty(0x10));
+
+		uint32_t before = cache.GetTransferredBytes();
+		bool result = false;
+		CHIPSET_CHECK(cache.Flush([&result](bool ok)
+		{	result = ok;}));
+		Drain(bench.Handle, bench.Driver);
+		CHIPSET_CHECK(result);
+		CHIPSET_CHECK(Charger.Writes == 2);
+		CHIPSET_CHECK(cache.GetTransferredBytes() - before == 3);
+		CHIPSET_CHECK(Charger.Registers[0x03] == 0x01 && Charger.Registers[0x04] == 0x2C && Charger.Registers[0x10] == 0x00);
+		CHIPSET_CHECK(Charger.Registers[0x05] == 0x85 && Charger.Registers[0x11] == 0x91);
+		CHIPSET_CHECK(!cache.IsDirty(0x03) && !cache.IsDirty(0x10));
+
+		// A failed write leaves the run dirty for the next Flush()
+		cache.Set(0x10, 0x05);
+		CHIPSET_CHECK(cache.Flush([&result](bool ok)
+		{	result = ok;}));
+		Charger.Active = false;
+		bench.Driver.OnErrorCallback(&bench.Handle);
+		CHIPSET_CHECK(!result);
+		CHIPSET_CHECK(cache.IsDirty(0x10));
+	}
+
+	void SetDuringReadIsNotOverwritten()
+	{
+		Reset();
+		Bench bench;
+		ChargerMonitor::Cache cache(bench.Driver, ChargerMonitor::DeviceAddress, ChargerTable);
+		CHIPSET_CHECK(cache.Refresh(static_cast<uint8_t>(Volatility::Static), nullptr));
+
+		// REG00..REG18 is on the bus when the register is changed
+		CHIPSET_CHECK(Charger.Active && Charger.Receive && Charger.Register == 0);
+		cache.Set(0x10, 0x00);
+		Drain(bench.Handle, bench.Driver);
+		CHIPSET_CHECK(cache.Get(0x10) == 0x00);
+		CHIPSET_CHECK(cache.IsDirty(0x10));
+		CHIPSET_CHECK(cache.Get(0x11) == 0x91);
+
+		CHIPSET_CHECK(cache.Flush(nullptr));
+		Drain(bench.Handle, bench.Driver);
+		CHIPSET_CHECK(Charger.Registers[0x10] == 0x00);
+		CHIPSET_CHECK(!cache.IsDirty(0x10));
+	}
+
+	void ChargerConfigurationIsWrittenThroughTheCache()
+	{
+		Reset();
+		// Power-on defaults of the fields that are changed
+		Charger.Registers[ChargerMonitor::ChargeCurrentLimit] = 0x00;
+		Charger.Registers[ChargerMonitor::ChargeCurrentLimit + 1] = 0x64;
+		Charger.Registers[ChargerMonitor::ChargerControl1] = 0x85;
+		Charger.Registers[ChargerMonitor::ChargerControl2] = 0x7D;
+		Charger.Registers[ChargerMonitor::ChargerControl5] = 0x16;
+		Charger.Registers[ChargerMonitor::NtcControl1] = 0x54;
+		std::array<uint8_t, RegisterCount> defaults = Charger.Registers;
+
+		Bench bench;
+		Scheduler scheduler(bench.Clock);
+		ChargerMonitor monitor(bench.Driver, scheduler, Event::ChargerStatus);
+
+		CHIPSET_CHECK(monitor.RequestConfigure());
+		Drain(bench.Handle, bench.Driver);
+		CHIPSET_CHECK(monitor.IsConfigured());
+		CHIPSET_CHECK(scheduler.Poll(Event::ChargerStatus) == Event::ChargerStatus);
+
+		// 3000 mA
+		CHIPSET_CHECK(Charger.Registers[ChargerMonitor::ChargeCurrentLimit] == 0x01);
+		CHIPSET_CHECK(Charger.Registers[ChargerMonitor::ChargeCurrentLimit + 1] == 0x2C);
+		CHIPSET_CHECK(Charger.Registers[ChargerMonitor::ChargerControl1] == 0x80);
+		CHIPSET_CHECK(Charger.Registers[ChargerMonitor::ChargerControl2] == 0x3D);
+		CHIPSET_CHECK(Charger.Registers[ChargerMonitor::ChargerControl5] == 0x15);
+		CHIPSET_CHECK(Charger.Registers[ChargerMonitor::NtcControl1] == 0x55);
+
+		uint32_t changed = 0;
+		for (size_t reg = 0; reg < RegisterCount; reg++)
+		{
+			changed += Charger.Registers[reg] != defaults[reg] ? 1 : 0;
+		}
+		CHIPSET_CHECK(changed == 6);
+		// Three bursts of configuration read, REG03..REG04, REG10..REG11, REG14 and REG18 written back
+		CHIPSET_CHECK(Charger.Reads == 3);
+		CHIPSET_CHECK(Charger.Writes == 4);
+
+		// Configuring again finds nothing to write
+		CHIPSET_CHECK(monitor.RequestConfigure());
+		Drain(bench.Handle, bench.Driver);
+		CHIPSET_CHECK(monitor.IsConfigured());
+		CHIPSET_CHECK(Charger.Writes == 4);
+	}
+
+	void FailedConfigurationReadIsReported()
+	{
+		Reset();
+		Bench bench;
+		Scheduler scheduler(bench.Clock);
+		ChargerMonitor monitor(bench.Driver, scheduler, Event::ChargerStatus);
+
+		CHIPSET_CHECK(monitor.RequestConfigure());
+		Charger.Active = false;
+		bench.Driver.OnErrorCallback(&bench.Handle);
+		Drain(bench.Handle, bench.Driver);
+		CHIPSET_CHECK(!monitor.IsConfigured());
+		CHIPSET_CHECK(scheduler.Poll(Event::ChargerStatus) == Event::ChargerStatus);
+		CHIPSET_CHECK(Charger.Writes == 0);
+	}
+
+	void ChargerResetIsNoticedByAFullRefresh()
+	{
+		Reset();
+		std::array<uint8_t, RegisterCount> defaults = Charger.Registers;
+		Bench bench;
+		Scheduler scheduler(bench.Clock);
+		ChargerMonitor monitor(bench.Driver, scheduler, Event::ChargerStatus);
+
+		CHIPSET_CHECK(monitor.RequestConfigure());
+		Drain(bench.Handle, bench.Driver);
+		CHIPSET_CHECK(monitor.IsConfigured());
+		uint32_t configureWrites = Charger.Writes;
+
+		// A status refresh does not read the configuration, so it cannot tell
+		Charger.Registers = defaults;
+		CHIPSET_CHECK(monitor.RequestRefresh(static_cast<uint8_t>(Volatility::FastStatus)));
+		Drain(bench.Handle, bench.Driver);
+		CHIPSET_CHECK(!monitor.IsConfigurationLost());
+		CHIPSET_CHECK(monitor.HoldsConfiguration());
+
+		CHIPSET_CHECK(monitor.RequestRefresh(AllVolatilityClasses));
+		Drain(bench.Handle, bench.Driver);
+		CHIPSET_CHECK(monitor.IsConfigurationLost());
+		CHIPSET_CHECK(!monitor.HoldsConfiguration());
+
+		CHIPSET_CHECK(monitor.RequestConfigure());
+		CHIPSET_CHECK(!monitor.IsConfigurationLost());
+		Drain(bench.Handle, bench.Driver);
+		CHIPSET_CHECK(monitor.IsConfigured());
+		// The same bursts as the first configuration
+		CHIPSET_CHECK(Charger.Writes == 2 * configureWrites);
+
+		CHIPSET_CHECK(monitor.RequestRefresh(AllVolatilityClasses));
+		Drain(bench.Handle, bench.Driver);
+		CHIPSET_CHECK(!monitor.IsConfigurationLost());
+		CHIPSET_CHECK(monitor.HoldsConfiguration());
+	}
+
+	void TimedOutRefreshStartsTheMergedFollowUp()
+	{
+		Reset();
+		Bench bench;
+		Scheduler scheduler(bench.Clock);
+		ChargerMonitor monitor(bench.Driver, scheduler, Event::ChargerStatus);
+
+		// REG00..REG30 and REG47..REG48, the ADC results in between are skipped
+		CHIPSET_CHECK(monitor.RequestRefresh(Volatility::Static | Volatility::FastStatus));
+		CHIPSET_CHECK(Charger.Active && Charger.Register == 0);
+		// An interrupt during the refresh
+		CHIPSET_CHECK(monitor.RequestRefresh(static_cast<uint8_t>(Volatility::FastStatus)));
+		CHIPSET_CHECK(monitor.GetMergedCount() == 1);
+
+		// The first burst never completes. The second one is dropped and the follow-up
+		// goes on the bus once the abort is done.
+		bench.Clock.Advance(I2CDriver::DefaultTimeout);
+		bench.Driver.CheckTimeouts();
+		CHIPSET_CHECK(!monitor.IsValid());
+		Charger.Active = false;
+		bench.Driver.OnAbortCplt(&bench.Handle);
+		CHIPSET_CHECK(Charger.Active && Charger.Register == ChargerMonitor::ChargerStatus0);
+
+		Drain(bench.Handle, bench.Driver);
+		CHIPSET_CHECK(Charger.Reads == 1);
+		CHIPSET_CHECK(monitor.IsValid());
+		CHIPSET_CHECK(scheduler.Poll(Event::ChargerStatus) == Event::ChargerStatus);
+		CHIPSET_CHECK(monitor.RequestRefresh(static_cast<uint8_t>(Volatility::FastStatus)));
+		CHIPSET_CHECK(monitor.GetMergedCount() == 1);
+		Drain(bench.Handle, bench.Driver);
+	}
+}
+
+extern "C"
+{
+	HAL_StatusTypeDef HAL_I2C_Mem_Write_DMA(I2C_HandleTypeDef*, uint16_t, uint16_t MemAddress, uint16_t, uint8_t *pData, uint16_t Size)
+	{
+		return StartTransfer(false, MemAddress, pData, Size);
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef*, uint16_t, uint16_t MemAddress, uint16_t, uint8_t *pData, uint16_t Size)
+	{
+		return StartTransfer(true, MemAddress, pData, Size);
+	}
+
+	HAL_StatusTypeDef HAL_I2C_Master_Abort_IT(I2C_HandleTypeDef*, uint16_t)
+	{
+		return HAL_OK;
+	}
+}
+
+int main()
+{
+	VolatilityTableMatchesTheRegisterMap();
+	RefreshReadsOnlySelectedClasses();
+	ShortGapsAreCoalesced();
+	FlushWritesOnlyChangedRegisters();
+	SetDuringReadIsNotOverwritten();
+	ChargerConfigurationIsWrittenThroughTheCache();
+	FailedConfigurationReadIsReported();
+	ChargerResetIsNoticedByAFullRefresh();
+	TimedOutRefreshStartsTheMergedFollowUp();
+	return Result();
+}
@@ -0,0 +1,152 @@
+/*
+ * SchedulerTest.cpp
+ *
+ * Wake-up counts and event latency of the tickless Scheduler on a fake wakeup timer. The core must
+ * wake exactly once per distinct deadline or interrupt, and an event must be returned at the time
+ * it was posted, not at the next tick.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include "PiSubmarine/Chipset/Scheduler.h"
+#include "Check.h"
+#include "FakeWakeupTimer.h"
+
+using namespace std::chrono_literals;
+using namespace PiSubmarine::Chipset;
+using namespace PiSubmarine::Chipset::Tests;
+
+namespace
+{
+	constexpr EventMask EventA = 1UL << 0;
+	constexpr EventMask EventB = 1UL << 1;
+
+	void PendingEventDoesNotSleep()
+	{
+		FakeWakeupTimer timer;
+		Scheduler scheduler(timer);
+
+		scheduler.Post(EventA);
+		CHIPSET_CHECK(scheduler.Wait(EventA) == EventA);
+		CHIPSET_CHECK(scheduler.GetWakeCount() == 0);
+
+		// A deadline that has passed already is not slept on either
+		scheduler.StartTimer(0, 0ms, EventB);
+		CHIPSET_CHECK(scheduler.Wait(EventB) == EventB);
+		CHIPSET_CHECK(scheduler.GetWakeCount() == 0);
+	}
+
+	void PeriodicTimerWakesOncePerPeriod()
+	{
+		FakeWakeupTimer timer;
+		Scheduler scheduler(timer);
+
+		scheduler.StartTimer(0, 100ms, EventA, true);
+		uint32_t fired = 0;
+		std::chrono::milliseconds worstLatency{0};
+		while (scheduler.Now() < 10s)
+		{
+			CHIPSET_CHECK(scheduler.Wait(EventA) == EventA);
+			fired++;
+			worstLatency = std::max(worstLatency, scheduler.Now() - std::chrono::milliseconds(fired * 100));
+		}
+		CHIPSET_CHECK(fired == 100);
+		CHIPSET_CHECK(scheduler.GetWakeCount() == 100);
+		CHIPSET_CHECK(worstLatency == 0ms);
+	}
+
+	void OnlyTheNearestDeadlineIsArmed()
+	{
+		FakeWakeupTimer timer;
+		Scheduler scheduler(timer);
+
+		// 70 plus 30 expiries in 2.1 s, 10 of them at the same time
+		scheduler.StartTimer(0, 30ms, EventA, true);
+		scheduler.StartTimer(1, 70ms, EventB, true);
+		uint32_t firedA = 0;
+		uint32_t firedB = 0;
+		while (scheduler.Now() < 2100ms)
+		{
+			EventMask events = scheduler.Wait(EventA | EventB);
+			firedA += (events & EventA) ? 1 : 0;
+			firedB += (events & EventB) ? 1 : 0;
+		}
+		CHIPSET_CHECK(firedA == 70);
+		CHIPSET_CHECK(firedB == 30);
+		CHIPSET_CHECK(scheduler.GetWakeCount() == 90);
+	}
+
+	void InterruptEventIsReturnedAtOnce()
+	{
+		FakeWakeupTimer timer;
+		Scheduler scheduler(timer);
+
+		scheduler.StartTimer(0, 100ms, EventB, true);
+		timer.ScheduleInterrupt(250ms, [&scheduler]()
+		{	scheduler.Post(EventA);});
+
+		CHIPSET_CHECK(scheduler.Wait(EventA) == EventA);
+		CHIPSET_CHECK(scheduler.Now() == 250ms);
+		// Woken by the timer at 100 and 200 ms, then by the interrupt
+		CHIPSET_CHECK(scheduler.GetWakeCount() == 3);
+		// The timer events were not asked for and are still pending
+		CHIPSET_CHECK(scheduler.Poll(EventB) == EventB);
+	}
+
+	void WaitForTimesOutWithoutLeftovers()
+	{
+		FakeWakeupTimer timer;
+		Scheduler scheduler(timer);
+
+		CHIPSET_CHECK(scheduler.WaitFor(EventA, 50ms) == Event::None);
+		CHIPSET_CHECK(scheduler.Now() == 50ms);
+		CHIPSET_CHECK(scheduler.GetWakeCount() == 1);
+
+		timer.ScheduleInterrupt(70ms, [&scheduler]()
+		{	scheduler.Post(EventA);});
+		CHIPSET_CHECK(scheduler.WaitFor(EventA, 50ms) == EventA);
+		CHIPSET_CHECK(scheduler.Now() == 70ms);
+
+		// The stopped timeout must not wake the core at 100 ms
+		timer.ScheduleInterrupt(500ms, [&scheduler]()
+		{	scheduler.Post(EventB);});
+		uint32_t wakes = scheduler.GetWakeCount();
+		CHIPSET_CHECK(scheduler.Wait(EventB) == EventB);
+		CHIPSET_CHECK(scheduler.Now() == 500ms);
+		CHIPSET_CHECK(scheduler.GetWakeCount() == wakes + 1);
+
+		scheduler.Sleep(25ms);
+		CHIPSET_CHECK(scheduler.Now() == 525ms);
+	}
+
+	void MissedPeriodsAreSkipped()
+	{
+		FakeWakeupTimer timer;
+		Scheduler scheduler(timer);
+
+		scheduler.StartTimer(0, 10ms, EventA, true);
+		timer.Advance(95ms);
+		CHIPSET_CHECK(scheduler.Poll(EventA) == EventA);
+		CHIPSET_CHECK(scheduler.Poll(EventA) == Event::None);
+
+		// The period stays on its grid instead of restarting at 95 ms
+		CHIPSET_CHECK(scheduler.Wait(EventA) == EventA);
+		CHIPSET_CHECK(scheduler.Now() == 100ms);
+		CHIPSET_CHECK(scheduler.GetWakeCount() == 1);
+
+		scheduler.StopTimer(0);
+		CHIPSET_CHECK(!scheduler.IsTimerActive(0));
+		CHIPSET_CHECK(scheduler.WaitFor(EventA, 1s) == Event::None);
+	}
+}
+
+int main()
+{
+	PendingEventDoesNotSleep();
+	PeriodicTimerWakesOncePerPeriod();
+	OnlyTheNearestDeadlineIsArmed();
+	InterruptEventIsReturnedAtOnce();
+	WaitForTimesOutWithoutLeftovers();
+	MissedPeriodsAreSkipped();
+	return Result();
+}
@@ -0,0 +1,161 @@
+/*
+ * WakeScheduleTest.cpp
+ *
+ * The window arithmetic behind LocalCommand::SetSchedule: repeating windows rolled forward to the
+ * present, windows that were started already skipped, the earlier of overlapping windows chosen,
+ * and the entries that SetSchedule rejects.
+ */
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include "PiSubmarine/Chipset/WakeSchedule.h"
+#include "Check.h"
+
+using namespace PiSubmarine::Chipset;
+using namespace PiSubmarine::Chipset::Tests;
+
+namespace
+{
+	constexpr uint32_t Epoch = 1760000000;
+	constexpr uint32_t Day = 86400;
+	constexpr RtcClock::Duration Grace = std::chrono::seconds(60);
+
+	RtcClock::Duration At(int64_t seconds)
+	{
+		return std::chrono::seconds(seconds);
+	}
+
+	WakeSchedule MakeSchedule(std::initializer_list<WakeEntry> list)
+	{
+		std::array<WakeEntry, WakeSchedule::MaxEntries> entries{};
+		size_t count = 0;
+		for (const WakeEntry &entry : list)
+		{
+			entries[count++] = entry;
+		}
+		WakeSchedule schedule;
+		schedule.Set(entries, count);
+		return schedule;
+	}
+
+	void RepeatingWindowRollsForward()
+	{
+		// Daily at Epoch for ten minutes, programmed a hundred days later
+		WakeSchedule schedule = MakeSchedule({WakeEntry{Epoch, Day, 600}});
+		WakeWindow window;
+
+		CHIPSET_CHECK(schedule.FindNext(At(Epoch + 100LL * Day + 3600), window));
+		CHIPSET_CHECK(window.Start == At(Epoch + 101LL * Day));
+		CHIPSET_CHECK(window.End == At(Epoch + 101LL * Day + 600));
+
+		// Inside a window it is the one due now, at its end the next one
+		CHIPSET_CHECK(schedule.FindNext(At(Epoch + 5LL * Day + 599), window));
+		CHIPSET_CHECK(window.Start == At(Epoch + 5LL * Day));
+		CHIPSET_CHECK(schedule.FindNext(At(Epoch + 5LL * Day + 600), window));
+		CHIPSET_CHECK(window.Start == At(Epoch + 6LL * Day));
+
+		// Before the first start
+		CHIPSET_CHECK(schedule.FindNext(At(Epoch - 10), window));
+		CHIPSET_CHECK(window.Start == At(Epoch));
+	}
+
+	void StartedWindowIsSkipped()
+	{
+		WakeSchedule schedule = MakeSchedule({WakeEntry{Epoch, 3600, 600}});
+		WakeWindow window;
+
+		CHIPSET_CHECK(schedule.FindNext(At(Epoch + 10), window));
+		CHIPSET_CHECK(window.Start == At(Epoch));
+		schedule.MarkStarted(window);
+
+		// Still inside the window, but a Pi that shut down early is not booted for it again
+		CHIPSET_CHECK(schedule.FindNext(At(Epoch + 20), window));
+		CHIPSET_CHECK(window.Start == At(Epoch + 3600));
+
+		// Reprogramming the same table keeps the mark
+		std::array<WakeEntry, WakeSchedule::MaxEntries> entries{};
+		entries[0] = WakeEntry{Epoch, 3600, 600};
+		schedule.Set(entries, 1);
+		CHIPSET_CHECK(schedule.FindNext(At(Epoch + 30), window));
+		CHIPSET_CHECK(window.Start == At(Epoch + 3600));
+	}
+
+	void SingleWindow()
+	{
+		WakeSchedule schedule = MakeSchedule({WakeEntry{Epoch + 100, 0, 0}});
+		WakeWindow window;
+
+		CHIPSET_CHECK(schedule.FindNext(At(Epoch), window));
+		CHIPSET_CHECK(window.Start == At(Epoch + 100));
+		// No duration: the Pi ends it with the Shutdown command
+		CHIPSET_CHECK(window.End == At(0));
+
+		// Due for StartSlack after its start, then gone
+		CHIPSET_CHECK(schedule.FindNext(At(Epoch + 159), window));
+		CHIPSET_CHECK(!schedule.FindNext(At(Epoch + 160), window));
+
+		schedule.MarkStarted(WakeWindow{At(Epoch + 100), At(0)});
+		CHIPSET_CHECK(!schedule.FindNext(At(Epoch + 110), window));
+	}
+
+	void EarlierOfOverlappingWindowsWins()
+	{
+		WakeSchedule schedule = MakeSchedule({WakeEntry{Epoch + 300, 3600, 600}, WakeEntry{Epoch + 200, 0, 0}, WakeEntry{Epoch + 250, 3600, 60}});
+		WakeWindow window;
+
+		CHIPSET_CHECK(schedule.FindNext(At(Epoch), window));
+		CHIPSET_CHECK(window.Start == At(Epoch + 200));
+		schedule.MarkStarted(window);
+
+		CHIPSET_CHECK(schedule.FindNext(At(Epoch + 201), window));
+		CHIPSET_CHECK(window.Start == At(Epoch + 250));
+		CHIPSET_CHECK(window.End == At(Epoch + 310));
+		schedule.MarkStarted(window);
+
+		// Started at 250 s, so the window at 300 s is still ahead
+		CHIPSET_CHECK(schedule.FindNext(At(Epoch + 305), window));
+		CHIPSET_CHECK(window.Start == At(Epoch + 300));
+		schedule.MarkStarted(window);
+
+		CHIPSET_CHECK(schedule.FindNext(At(Epoch + 400), window));
+		CHIPSET_CHECK(window.Start == At(Epoch + 3850));
+
+		schedule.Clear();
+		CHIPSET_CHECK(schedule.IsEmpty());
+		CHIPSET_CHECK(!schedule.FindNext(At(Epoch), window));
+	}
+
+	void InvalidEntriesAreRejected()
+	{
+		RtcClock::Duration now = At(Epoch);
+
+		// Single windows
+		CHIPSET_CHECK(WakeSchedule::IsValid(WakeEntry{Epoch + 3600, 0, 600}, now, Grace));
+		CHIPSET_CHECK(WakeSchedule::IsValid(WakeEntry{Epoch - 10, 0, 600}, now, Grace));
+		CHIPSET_CHECK(!WakeSchedule::IsValid(WakeEntry{Epoch - 600, 0, 600}, now, Grace));
+		CHIPSET_CHECK(!WakeSchedule::IsValid(WakeEntry{Epoch - 60, 0, 0}, now, Grace));
+
+		// Repeating windows may start in the past
+		CHIPSET_CHECK(WakeSchedule::IsValid(WakeEntry{Epoch - 100 * Day, Day, 600}, now, Grace));
+		// Duration and grace time must fit the period
+		CHIPSET_CHECK(WakeSchedule::IsValid(WakeEntry{Epoch, 66, 5}, now, Grace));
+		CHIPSET_CHECK(!WakeSchedule::IsValid(WakeEntry{Epoch, 65, 5}, now, Grace));
+		CHIPSET_CHECK(!WakeSchedule::IsValid(WakeEntry{Epoch, 30, 5}, now, Grace));
+		CHIPSET_CHECK(!WakeSchedule::IsValid(WakeEntry{Epoch, 600, 600}, now, Grace));
+		// Without a duration the Pi ends the window, only the start slack has to fit
+		CHIPSET_CHECK(WakeSchedule::IsValid(WakeEntry{Epoch, 61, 0}, now, Grace));
+		CHIPSET_CHECK(!WakeSchedule::IsValid(WakeEntry{Epoch, 60, 0}, now, Grace));
+	}
+}
+
+int main()
+{
+	RepeatingWindowRollsForward();
+	StartedWindowIsSkipped();
+	SingleWindow();
+	EarlierOfOverlappingWindowsWins();
+	InvalidEntriesAreRejected();
+	return Result();
+}